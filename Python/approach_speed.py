@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""
+Approach speed estimation from SORT tracks
+Turns the frame-to-frame movement of each tracked vehicle into a speed and
+reports the 85th percentile over a sliding window, the speed the lane
+controllers use to size yellow and all red (lane_config.h, kinematic clearance).
+
+The camera is calibrated with a single meters-per-pixel factor measured along
+the approach (e.g. lane markings of known length divided by their length in
+pixels). That is only accurate near the stretch it was measured on, which is
+why a lane without a calibration reports no speed and the board falls back to
+the configured speed limit.
+"""
+
+import time
+from collections import deque
+
+import numpy as np
+
+PERCENTILE = 85
+MIN_SAMPLES = 10
+MIN_MOVING_KPH = 5.0  # Queued and creeping vehicles do not say anything about approach speed
+MAX_KPH = 130.0       # Above this it is a tracking jump, not a vehicle
+
+
+class ApproachSpeedEstimator:
+    def __init__(self, meters_per_pixel, window_s=120.0, min_interval_s=0.2):
+        self.meters_per_pixel = meters_per_pixel
+        self.window_s = window_s
+        self.min_interval_s = min_interval_s
+        self.last_seen = {}       # track_id -> (time, x, y) of the last sample
+        self.samples = deque()    # (time, kph)
+
+    def update(self, tracked_objects, now=None):
+        """tracked_objects as returned by Sort.update(): (bbox, track_id, class_name)"""
+        now = time.time() if now is None else now
+        seen = set()
+        for bbox, track_id, _ in tracked_objects:
+            # Bottom centre of the box: where the vehicle touches the road
+            x, y = (bbox[0] + bbox[2]) / 2.0, bbox[3]
+            seen.add(track_id)
+            last = self.last_seen.get(track_id)
+            if last is None:
+                self.last_seen[track_id] = (now, x, y)
+                continue
+            dt = now - last[0]
+            if dt < self.min_interval_s:
+                continue
+            kph = np.hypot(x - last[1], y - last[2]) * self.meters_per_pixel / dt * 3.6
+            if MIN_MOVING_KPH <= kph <= MAX_KPH:
+                self.samples.append((now, kph))
+            self.last_seen[track_id] = (now, x, y)
+
+        for track_id in [t for t in self.last_seen if t not in seen]:
+            del self.last_seen[track_id]
+        while self.samples and now - self.samples[0][0] > self.window_s:
+            self.samples.popleft()
+
+    def speed_kph(self):
+        """85th percentile approach speed, None until there are enough samples"""
+        if len(self.samples) < MIN_SAMPLES:
+            return None
+        return round(float(np.percentile([kph for _, kph in self.samples], PERCENTILE)), 1)
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""
+Controller benchmark comparison
+Checks a host/controller_bench run (--benchmark_out JSON) against the stored
+baseline and exits with 1 if any benchmark got slower by more than the
+threshold or allocates more per op. --save writes the run as the new baseline.
+
+    ./controller_bench --benchmark_repetitions=5 --benchmark_out=bench.json --benchmark_out_format=json
+    python Python/bench_compare.py bench.json
+    python Python/bench_compare.py bench.json --threshold 5 --save
+"""
+
+import argparse
+import json
+import os
+import sys
+
+DEFAULT_BASELINE = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "host",
+                                                 "controller_bench_baseline.json"))
+
+# Allocation counts are exact, but writeToLog amortizes its segment rotations over the run
+ALLOCATION_SLACK = 0.5
+
+
+def load_run(path):
+    """{name: {"ns": time per op, "allocs": allocations per op}} from Google Benchmark JSON.
+    With --benchmark_repetitions the median of the repetitions is used."""
+    with open(path) as f:
+        data = json.load(f)
+    entries = data.get("benchmarks", [])
+    medians = [e for e in entries if e.get("aggregate_name") == "median"]
+    results = {}
+    for entry in medians or entries:
+        if not medians and entry.get("run_type", "iteration") != "iteration":
+            continue
+        scale = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}[entry.get("time_unit", "ns")]
+        results[entry.get("run_name", entry["name"])] = {
+            "ns": round(entry["real_time"] * scale, 2),
+            "allocs": round(entry.get("allocs/op", 0.0), 2),
+        }
+    return results
+
+
+def compare(baseline, current, threshold):
+    """Print one row per benchmark; returns the names of the regressions"""
+    regressions = []
+    print(f"{'Benchmark':34} {'Baseline ns':>12} {'Now ns':>10} {'Change':>8} {'Allocs':>14}")
+    for name in sorted(set(baseline) | set(current)):
+        if name not in current:
+            print(f"{name:34} {'':>12} {'missing':>10}")
+            continue
+        if name not in baseline:
+            print(f"{name:34} {'new':>12} {current[name]['ns']:10.1f}")
+            continue
+        before, now = baseline[name], current[name]
+        change = (now["ns"] / before["ns"] - 1) * 100 if before["ns"] > 0 else 0.0
+        slower = change > threshold
+        allocates = now["allocs"] > before["allocs"] + ALLOCATION_SLACK
+        flag = "  REGRESSION" if slower or allocates else ""
+        allocs = f"{before['allocs']:g} -> {now['allocs']:g}"
+        print(f"{name:34} {before['ns']:12.1f} {now['ns']:10.1f} {change:+7.1f}% {allocs:>14}{flag}")
+        if flag:
+            regressions.append(name)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare a controller_bench run against the baseline')
+    parser.add_argument('run', help='JSON written by controller_bench --benchmark_out')
+    parser.add_argument('--baseline', default=DEFAULT_BASELINE, help='Baseline file')
+    parser.add_argument('--threshold', type=float, default=15.0,
+                        help='Allowed slowdown in percent (default: 15)')
+    parser.add_argument('--save', action='store_true', help='Store the run as the new baseline')
+    args = parser.parse_args()
+
+    current = load_run(args.run)
+    if args.save:
+        with open(args.baseline, "w") as f:
+            json.dump({"benchmarks": current}, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print(f"Saved {len(current)} benchmarks to {args.baseline}")
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)["benchmarks"]
+    regressions = compare(baseline, current, args.threshold)
+    if regressions:
+        print(f"{len(regressions)} regression(s) above {args.threshold:g}%: {', '.join(regressions)}")
+        return 1
+    print("No regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,428 @@
+#!/usr/bin/env python3
+"""
+TLS to the MQTT broker
+Makes the certificates for a TLS broker, stands one up on this machine and
+measures what a reconnect costs. The sketches built with -DMQTT_TLS offer only
+ECDHE-ECDSA suites on P-256 (tls_session.h), so everything here is ECDSA.
+
+--make-certs writes a CA, a broker certificate for --host and a certificate per
+board into --certs (openssl must be on the PATH), then broker_certs.h with the
+CA and that board's certificate into every sketch folder. Point mosquitto at
+the broker files with the snippet it prints, or run --serve.
+
+--serve is a small QoS 0 broker on --port (retained messages, + and #
+wildcards), enough to run the sketches and the host tools against. It asks
+each client for a certificate signed by the CA.
+
+--check connects --connects times to --broker the way a board reconnects,
+offering the session from the previous connect, and reports the full and the
+resumed handshakes: time, round trips and bytes each way. It exits with 1 if
+the broker never resumes a session.
+
+Usage:
+    python Python/broker_tls.py --make-certs --host broker.local
+    python Python/broker_tls.py --serve
+    python Python/broker_tls.py --check --broker broker.local
+"""
+
+import argparse
+import os
+import socket
+import ssl
+import subprocess
+import sys
+import threading
+import time
+
+import mqtt_topics
+
+SKETCH_DIRS = ["esp32_arduino_ide/esp32_lane1", "esp32_arduino_ide/esp32_lane2",
+               "esp32_arduino_ide/esp32_lane3", "esp32_arduino_ide/esp32_lane4",
+               "esp32_arduino_ide/esp32_intersection"]
+BOARDS = ["lane1", "lane2", "lane3", "lane4", "intersection"]  # In SKETCH_DIRS order
+CIPHERS = "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES128-SHA256"  # CIPHERSUITES in tls_session.h
+CURVE = "prime256v1"
+TLS_PORT = 8883
+
+
+# ---------------------------------------------------------------------------
+# Certificates
+# ---------------------------------------------------------------------------
+
+def openssl(*args):
+    subprocess.run(["openssl", *args], check=True, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+
+
+def make_key(path):
+    openssl("ecparam", "-name", CURVE, "-genkey", "-noout", "-out", path)
+    os.chmod(path, 0o600)
+
+
+def sign(certs, name, subject, days, extensions):
+    key, csr, crt, ext = (os.path.join(certs, name + suffix) for suffix in (".key", ".csr", ".crt", ".ext"))
+    make_key(key)
+    openssl("req", "-new", "-key", key, "-subj", subject, "-out", csr)
+    with open(ext, "w") as f:
+        f.write(extensions)
+    openssl("x509", "-req", "-in", csr, "-CA", os.path.join(certs, "ca.crt"), "-CAkey", os.path.join(certs, "ca.key"),
+            "-CAcreateserial", "-days", str(days), "-sha256", "-extfile", ext, "-out", crt)
+    os.remove(csr)
+    os.remove(ext)
+
+
+def make_certs(certs, host, intersection, days):
+    os.makedirs(certs, exist_ok=True)
+    make_key(os.path.join(certs, "ca.key"))
+    openssl("req", "-new", "-x509", "-key", os.path.join(certs, "ca.key"), "-sha256", "-days", str(days),
+            "-subj", f"/CN=Traffic {intersection} CA", "-out", os.path.join(certs, "ca.crt"))
+    try:
+        socket.inet_aton(host)
+        san = f"IP:{host}"
+    except OSError:
+        san = f"DNS:{host}"
+    sign(certs, "broker", f"/CN={host}", days,
+         f"subjectAltName={san}\nextendedKeyUsage=serverAuth\nkeyUsage=digitalSignature\n")
+    for board in BOARDS:
+        sign(certs, board, f"/CN=traffic\\/{intersection}\\/{board}", days,
+             "extendedKeyUsage=clientAuth\nkeyUsage=digitalSignature\n")
+
+
+def read_pem(certs, name):
+    with open(os.path.join(certs, name)) as f:
+        return f.read().strip()
+
+
+def render_header(certs, host, board, intersection):
+    return f"""// Broker certificates for {board}, generated by Python/broker_tls.py; do not edit.
+// Holds this board's private key: keep it out of version control.
+#ifndef BROKER_CERTS_H
+#define BROKER_CERTS_H
+
+// Must match the name in the broker's certificate
+#define BROKER_TLS_HOST "{host}"
+
+// CA that signed the broker's certificate and this board's
+static const char BROKER_CA_PEM[] = R"PEM(
+{read_pem(certs, "ca.crt")}
+)PEM";
+
+// traffic/{intersection}/{board}, for brokers that ask for a client certificate
+static const char BOARD_CERT_PEM[] = R"PEM(
+{read_pem(certs, board + ".crt")}
+)PEM";
+
+static const char BOARD_KEY_PEM[] = R"PEM(
+{read_pem(certs, board + ".key")}
+)PEM";
+
+#endif // BROKER_CERTS_H
+"""
+
+
+def install(certs, host, intersection, root):
+    paths = []
+    for sketch_dir, board in zip(SKETCH_DIRS, BOARDS):
+        path = os.path.join(root, sketch_dir, "broker_certs.h")
+        with open(path, "w") as f:
+            f.write(render_header(certs, host, board, intersection))
+        paths.append(path)
+    return paths
+
+
+def mosquitto_conf(certs):
+    certs = os.path.abspath(certs)
+    return f"""listener {TLS_PORT}
+cafile {certs}/ca.crt
+certfile {certs}/broker.crt
+keyfile {certs}/broker.key
+require_certificate true
+use_identity_as_username true
+tls_version tlsv1.2
+ciphers {CIPHERS}"""
+
+
+def server_context(certs, require_client_cert=True):
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.minimum_version = ssl.TLSVersion.TLSv1_2
+    context.set_ciphers(CIPHERS)
+    context.set_ecdh_curve(CURVE)
+    context.load_cert_chain(os.path.join(certs, "broker.crt"), os.path.join(certs, "broker.key"))
+    if require_client_cert:
+        context.load_verify_locations(os.path.join(certs, "ca.crt"))
+        context.verify_mode = ssl.CERT_REQUIRED
+    return context
+
+
+def client_context(certs, board):
+    # What tls_session.h offers: TLS 1.2, ECDHE-ECDSA on P-256, the broker checked against the CA
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    context.minimum_version = context.maximum_version = ssl.TLSVersion.TLSv1_2
+    context.set_ciphers(CIPHERS)
+    context.load_verify_locations(os.path.join(certs, "ca.crt"))
+    if board:
+        context.load_cert_chain(os.path.join(certs, board + ".crt"), os.path.join(certs, board + ".key"))
+    return context
+
+
+# ---------------------------------------------------------------------------
+# A small broker for local testing
+# ---------------------------------------------------------------------------
+
+def topic_matches(pattern, topic):
+    pattern_levels, topic_levels = pattern.split("/"), topic.split("/")
+    for i, level in enumerate(pattern_levels):
+        if level == "#":
+            return True
+        if i >= len(topic_levels) or (level != "+" and level != topic_levels[i]):
+            return False
+    return len(pattern_levels) == len(topic_levels)
+
+
+def encode_length(length):
+    out = bytearray()
+    while True:
+        byte, length = length % 128, length // 128
+        out.append(byte | (0x80 if length else 0))
+        if not length:
+            return bytes(out)
+
+
+def encode_publish(topic, payload, retain):
+    topic = topic.encode()
+    body = len(topic).to_bytes(2, "big") + topic + payload
+    return bytes([0x30 | (1 if retain else 0)]) + encode_length(len(body)) + body
+
+
+class Broker:
+    def __init__(self, context, port, verbose):
+        self.context = context
+        self.port = port
+        self.verbose = verbose
+        self.lock = threading.Lock()
+        self.sessions = {}  # socket -> [send lock, subscription filters]
+        self.retained = {}
+
+    def serve(self):
+        listener = socket.create_server(("", self.port), reuse_port=False)
+        print(f"TLS broker on port {self.port}")
+        while True:
+            raw, address = listener.accept()
+            threading.Thread(target=self.handle, args=(raw, address), daemon=True).start()
+
+    def send(self, conn, data):
+        with self.lock:
+            session = self.sessions.get(conn)
+        if session is None:
+            return
+        with session[0]:
+            try:
+                conn.sendall(data)
+            except OSError:
+                pass
+
+    def publish(self, topic, payload, retain):
+        if retain:
+            with self.lock:
+                if payload:
+                    self.retained[topic] = payload
+                else:
+                    self.retained.pop(topic, None)
+        with self.lock:
+            targets = [conn for conn, (_, filters) in self.sessions.items()
+                       if any(topic_matches(f, topic) for f in filters)]
+        packet = encode_publish(topic, payload, False)
+        for conn in targets:
+            self.send(conn, packet)
+
+    def handle(self, raw, address):
+        try:
+            start = time.perf_counter()
+            conn = self.context.wrap_socket(raw, server_side=True)
+            if self.verbose:
+                peer = conn.getpeercert() or {}
+                subject = dict(item[0] for item in peer.get("subject", ()))
+                print(f"{address[0]}: {subject.get('commonName', 'no certificate')}, "
+                      f"{'resumed' if conn.session_reused else 'full'} handshake in "
+                      f"{(time.perf_counter() - start) * 1000:.1f} ms")
+        except (ssl.SSLError, OSError) as e:
+            print(f"{address[0]}: handshake failed: {e}")
+            raw.close()
+            return
+        with self.lock:
+            self.sessions[conn] = [threading.Lock(), []]
+        try:
+            self.run(conn)
+        except (ssl.SSLError, OSError, ValueError):
+            pass
+        finally:
+            with self.lock:
+                self.sessions.pop(conn, None)
+            conn.close()
+
+    def run(self, conn):
+        stream = conn.makefile("rb")
+        while True:
+            header = stream.read(1)
+            if not header:
+                return
+            length, shift = 0, 0
+            while True:
+                byte = stream.read(1)
+                if not byte:
+                    return
+                length |= (byte[0] & 0x7F) << shift
+                shift += 7
+                if not byte[0] & 0x80:
+                    break
+            body = stream.read(length)
+            if len(body) != length:
+                return
+            kind, flags = header[0] >> 4, header[0] & 0x0F
+
+            if kind == 1:  # CONNECT
+                self.send(conn, b"\x20\x02\x00\x00")
+            elif kind == 3:  # PUBLISH
+                topic_length = int.from_bytes(body[:2], "big")
+                topic = body[2:2 + topic_length].decode()
+                offset = 2 + topic_length
+                qos = (flags >> 1) & 3
+                if qos:
+                    packet_id = body[offset:offset + 2]
+                    offset += 2
+                    self.send(conn, b"\x40\x02" + packet_id)  # PUBACK, delivered onward at QoS 0
+                self.publish(topic, body[offset:], bool(flags & 1))
+            elif kind == 8:  # SUBSCRIBE
+                packet_id, offset, granted, added = body[:2], 2, bytearray(), []
+                while offset < len(body):
+                    filter_length = int.from_bytes(body[offset:offset + 2], "big")
+                    added.append(body[offset + 2:offset + 2 + filter_length].decode())
+                    offset += 2 + filter_length + 1
+                    granted.append(0)
+                with self.lock:
+                    self.sessions[conn][1].extend(added)
+                    retained = [(t, p) for t, p in self.retained.items() if any(topic_matches(f, t) for f in added)]
+                self.send(conn, b"\x90" + encode_length(2 + len(granted)) + packet_id + bytes(granted))
+                for topic, payload in retained:
+                    self.send(conn, encode_publish(topic, payload, True))
+            elif kind == 10:  # UNSUBSCRIBE
+                packet_id, offset, removed = body[:2], 2, []
+                while offset < len(body):
+                    filter_length = int.from_bytes(body[offset:offset + 2], "big")
+                    removed.append(body[offset + 2:offset + 2 + filter_length].decode())
+                    offset += 2 + filter_length
+                with self.lock:
+                    filters = self.sessions[conn][1]
+                    filters[:] = [f for f in filters if f not in removed]
+                self.send(conn, b"\xB0\x02" + packet_id)
+            elif kind == 12:  # PINGREQ
+                self.send(conn, b"\xD0\x00")
+            elif kind == 14:  # DISCONNECT
+                return
+
+
+# ---------------------------------------------------------------------------
+# Reconnect measurement
+# ---------------------------------------------------------------------------
+
+def handshake(context, host, port, session):
+    """One connect as a board makes it: TCP, then the TLS handshake pumped by hand
+    so the bytes and round trips can be counted. Returns the finished SSLObject
+    and the handshake's time, round trips and bytes sent and received."""
+    raw = socket.create_connection((host, port), timeout=10)
+    incoming, outgoing = ssl.MemoryBIO(), ssl.MemoryBIO()
+    tls = context.wrap_bio(incoming, outgoing, server_hostname=host, session=session)
+    sent = received = round_trips = 0
+    flight_sent = False  # Sent something since the last read: the next read waits out a round trip
+    start = time.perf_counter()
+    try:
+        while True:
+            try:
+                tls.do_handshake()
+                done = True
+            except ssl.SSLWantReadError:
+                done = False
+            data = outgoing.read()
+            if data:
+                raw.sendall(data)
+                sent += len(data)
+                flight_sent = True
+            if done:
+                break
+            data = raw.recv(16384)
+            if not data:
+                raise ConnectionError("broker closed the connection during the handshake")
+            if flight_sent:
+                round_trips += 1
+                flight_sent = False
+            received += len(data)
+            incoming.write(data)
+        elapsed_ms = (time.perf_counter() - start) * 1000
+    finally:
+        raw.close()
+    return tls, elapsed_ms, round_trips, sent, received
+
+
+def check(certs, host, port, board, connects):
+    context = client_context(certs, board)
+    results = {"full": [], "resumed": []}
+    session = None
+    for i in range(connects):
+        try:
+            tls, elapsed_ms, round_trips, sent, received = handshake(context, host, port, session)
+        except (ssl.SSLError, OSError) as e:
+            print(f"connect {i + 1:2d}: failed: {e}")
+            return False
+        mode = "resumed" if tls.session_reused else "full"
+        results[mode].append((elapsed_ms, round_trips, sent, received))
+        print(f"connect {i + 1:2d}: {mode:7s} {elapsed_ms:6.1f} ms, {round_trips} round trip(s), "
+              f"{sent} B out, {received} B in, {tls.cipher()[0]}")
+        session = tls.session
+
+    for mode, rows in results.items():
+        if rows:
+            n = len(rows)
+            print(f"{mode:7s}: {n} connects, average {sum(r[0] for r in rows) / n:.1f} ms, "
+                  f"{sum(r[1] for r in rows) / n:.1f} round trip(s), "
+                  f"{sum(r[2] for r in rows) / n:.0f} B out, {sum(r[3] for r in rows) / n:.0f} B in")
+    if not results["resumed"]:
+        print("The broker never resumed a session: every reconnect pays a full handshake")
+        return False
+    return True
+
+
+def main():
+    repo_root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description="Certificates, a local broker and reconnect timing for MQTT over TLS")
+    mode = parser.add_mutually_exclusive_group(required=True)
+    mode.add_argument("--make-certs", action="store_true", help="Make the CA, broker and board certificates")
+    mode.add_argument("--serve", action="store_true", help="Run a local TLS broker")
+    mode.add_argument("--check", action="store_true", help="Measure full and resumed handshakes against --broker")
+    parser.add_argument("--certs", default=os.path.join(repo_root, "certs"), help="Certificate directory")
+    parser.add_argument("--host", default="localhost", help="Broker name for its certificate (--make-certs)")
+    parser.add_argument("--days", type=int, default=825, help="Certificate lifetime")
+    parser.add_argument("--intersection", default=mqtt_topics.DEFAULT_INTERSECTION)
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=TLS_PORT)
+    parser.add_argument("--board", default="lane1", choices=BOARDS + ["none"],
+                        help="Client certificate for --check")
+    parser.add_argument("--connects", type=int, default=10)
+    parser.add_argument("--no-client-cert", action="store_true", help="Let --serve accept clients without a certificate")
+    parser.add_argument("--verbose", action="store_true", help="Print each handshake --serve sees")
+    parser.add_argument("--root", default=repo_root, help="Repository root")
+    args = parser.parse_args()
+
+    if args.make_certs:
+        make_certs(args.certs, args.host, args.intersection, args.days)
+        for path in install(args.certs, args.host, args.intersection, args.root):
+            print(f"Wrote {os.path.relpath(path, args.root)}")
+        print(f"Certificates in {args.certs}; for mosquitto:\n")
+        print(mosquitto_conf(args.certs))
+    elif args.serve:
+        Broker(server_context(args.certs, not args.no_client_cert), args.port, args.verbose).serve()
+    else:
+        board = None if args.board == "none" else args.board
+        sys.exit(0 if check(args.certs, args.broker, args.port, board, args.connects) else 1)
+
+
+if __name__ == "__main__":
+    main()
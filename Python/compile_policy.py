@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+"""
+Policy compiler for the lane controllers
+Turns a green-time policy table (CSV) into lane_policy.h, a constexpr table with
+a header-only evaluator, and writes it into every ESP32 sketch folder. The
+firmware includes lane_policy.h and reports the policy name, version and
+checksum at boot, so a new policy ships by recompiling, without code edits.
+
+Policy CSV format:
+    # name: fuzzy-default
+    # version: 1
+    jam_sibuk,count,green_seconds,next_lane
+    0,0,10.0,0
+    ...
+Rows are per vehicle-count bin, for normal hours (jam_sibuk 0) and rush hours
+(jam_sibuk 1). Counts above the last bin use the last bin. next_lane 0 keeps
+the normal 1 -> 2 -> 3 -> 4 order.
+
+Usage:
+    python Python/compile_policy.py policies/fuzzy_default.csv
+    python Python/compile_policy.py --fuzzy --save-csv policies/fuzzy_default.csv
+"""
+
+import argparse
+import os
+import struct
+import zlib
+
+MAX_BINS = 64  # keeps the constexpr checksum within the compiler's recursion limit
+SKETCH_DIRS = ["esp32_arduino_ide/esp32_lane1", "esp32_arduino_ide/esp32_lane2",
+               "esp32_arduino_ide/esp32_lane3", "esp32_arduino_ide/esp32_lane4",
+               "esp32_arduino_ide/esp32_intersection"]
+
+
+class Policy:
+    def __init__(self, name, version, green, next_lane=None):
+        """green[jam_sibuk][count] in seconds, next_lane[jam_sibuk][count] (0 = normal order)"""
+        self.name = name
+        self.version = int(version)
+        self.green = [list(map(float, green[0])), list(map(float, green[1]))]
+        bins = len(self.green[0])
+        self.next_lane = next_lane or [[0] * bins, [0] * bins]
+        if len(self.green[1]) != bins or not 1 <= bins <= MAX_BINS:
+            raise ValueError(f"policy needs the same number of bins (1..{MAX_BINS}) for both hour types")
+        if not 0 <= self.version <= 0xFFFF:
+            raise ValueError("version must fit in 16 bits")
+
+    @property
+    def bins(self):
+        return len(self.green[0])
+
+    def green_ds(self, rush, count):
+        """Green time in tenths of a second as stored in the firmware"""
+        return max(0, min(0xFFFF, int(round(self.green[rush][count] * 10))))
+
+    def checksum(self):
+        """CRC-32 over the same bytes lane_policy::checksum() hashes on the board"""
+        data = struct.pack("<HB", self.version, self.bins)
+        for rush in (0, 1):
+            for count in range(self.bins):
+                data += struct.pack("<HB", self.green_ds(rush, count), self.next_lane[rush][count])
+        return zlib.crc32(data) & 0xFFFFFFFF
+
+
+def fuzzy_policy(max_count=10, breakpoints=(3, 5, 10), normal=(10, 20, 40), rush=(15, 30, 60)):
+    """Tabulate the fuzzy controller the sketches used (sedikit/sedang/padat, centroid)"""
+    low, mid, high = breakpoints
+
+    def sedikit(x):
+        return 1.0 if x <= low else ((mid - x) / (mid - low) if x < mid else 0.0)
+
+    def sedang(x):
+        if x <= low or x >= high:
+            return 0.0
+        return (x - low) / (mid - low) if x <= mid else (high - x) / (high - mid)
+
+    def padat(x):
+        return 0.0 if x <= mid else ((x - mid) / (high - mid) if x < high else 1.0)
+
+    def defuzzify(x, durations, fallback):
+        weights = (sedikit(x), sedang(x), padat(x))
+        total = sum(weights)
+        return fallback if total == 0 else sum(w * d for w, d in zip(weights, durations)) / total
+
+    green = [[defuzzify(c, normal, 20.0) for c in range(max_count + 1)],
+             [defuzzify(c, rush, 30.0) for c in range(max_count + 1)]]
+    return Policy("fuzzy-default", 1, green)
+
+
+def read_policy_csv(path):
+    name, version = os.path.splitext(os.path.basename(path))[0], 1
+    rows = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            if line.startswith("#"):
+                key, _, value = line[1:].partition(":")
+                if key.strip() == "name":
+                    name = value.strip()
+                elif key.strip() == "version":
+                    version = int(value)
+                continue
+            fields = line.split(",")
+            if fields[0] == "jam_sibuk":
+                continue
+            rush, count = int(fields[0]), int(fields[1])
+            next_lane = int(fields[3]) if len(fields) > 3 and fields[3] else 0
+            rows[(rush, count)] = (float(fields[2]), next_lane)
+
+    bins = max(count for _, count in rows) + 1
+    missing = [(r, c) for r in (0, 1) for c in range(bins) if (r, c) not in rows]
+    if missing:
+        raise ValueError(f"{path}: missing rows for (jam_sibuk, count) {missing[:5]}")
+    green = [[rows[(r, c)][0] for c in range(bins)] for r in (0, 1)]
+    next_lane = [[rows[(r, c)][1] for c in range(bins)] for r in (0, 1)]
+    return Policy(name, version, green, next_lane)
+
+
+def write_policy_csv(policy, path):
+    os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+    with open(path, "w") as f:
+        f.write(f"# name: {policy.name}\n# version: {policy.version}\n")
+        f.write("jam_sibuk,count,green_seconds,next_lane\n")
+        for rush in (0, 1):
+            for count in range(policy.bins):
+                f.write(f"{rush},{count},{policy.green[rush][count]:g},{policy.next_lane[rush][count]}\n")
+
+
+def render_header(policy, source):
+    def table(values):
+        return ",\n".join("    {" + ", ".join(str(v) for v in row) + "}" for row in values)
+
+    green = [[policy.green_ds(r, c) for c in range(policy.bins)] for r in (0, 1)]
+    return f"""// Generated by Python/compile_policy.py from {source} - do not edit.
+// Green time (and optionally the next lane) per reported vehicle count, for
+// normal hours and jam sibuk. Evaluation is one table lookup.
+#ifndef LANE_POLICY_H
+#define LANE_POLICY_H
+
+#include <stdint.h>
+
+namespace lane_policy
+{{
+constexpr const char *NAME = "{policy.name}";
+constexpr uint16_t VERSION = {policy.version};
+constexpr int COUNT_BINS = {policy.bins};
+
+// Tenths of a second, [jamSibuk][count]
+constexpr uint16_t GREEN_DS[2][COUNT_BINS] = {{
+{table(green)}
+}};
+
+// Lane to serve next, 0 = normal 1 -> 2 -> 3 -> 4 order
+constexpr uint8_t NEXT_LANE[2][COUNT_BINS] = {{
+{table(policy.next_lane)}
+}};
+
+// CRC-32 of version, bin count and table, computed by the compiler so the
+// value reported at boot identifies exactly the table that was flashed
+constexpr uint32_t crc32Bits(uint32_t crc, int bits)
+{{
+    return bits == 0 ? crc : crc32Bits((crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1, bits - 1);
+}}
+
+constexpr uint32_t crc32Byte(uint32_t crc, uint8_t value)
+{{
+    return crc32Bits(crc ^ value, 8);
+}}
+
+constexpr uint8_t tableByte(int i)
+{{
+    return i % 3 == 2 ? NEXT_LANE[i / 3 / COUNT_BINS][i / 3 % COUNT_BINS]
+                      : (uint8_t)(GREEN_DS[i / 3 / COUNT_BINS][i / 3 % COUNT_BINS] >> (8 * (i % 3)));
+}}
+
+constexpr uint32_t crc32Table(uint32_t crc, int i)
+{{
+    return i == 2 * COUNT_BINS * 3 ? crc : crc32Table(crc32Byte(crc, tableByte(i)), i + 1);
+}}
+
+constexpr uint32_t checksum()
+{{
+    return ~crc32Table(crc32Byte(crc32Byte(crc32Byte(0xFFFFFFFFu, VERSION & 0xFF), VERSION >> 8), COUNT_BINS), 0);
+}}
+
+constexpr uint32_t CHECKSUM = 0x{policy.checksum():08X}u;
+static_assert(checksum() == CHECKSUM, "lane_policy.h was edited by hand, regenerate it with compile_policy.py");
+
+inline int countBin(float kendaraan)
+{{
+    if (kendaraan <= 0)
+        return 0;
+    int bin = (int)(kendaraan + 0.5f);
+    return bin < COUNT_BINS ? bin : COUNT_BINS - 1;
+}}
+
+// Green time in seconds, replaces defuzzify()
+inline float greenSeconds(float kendaraan, bool jamSibuk)
+{{
+    return GREEN_DS[jamSibuk ? 1 : 0][countBin(kendaraan)] / 10.0f;
+}}
+
+// Lane that should be served after `lane`
+inline int nextLane(float kendaraan, bool jamSibuk, int lane)
+{{
+    uint8_t next = NEXT_LANE[jamSibuk ? 1 : 0][countBin(kendaraan)];
+    return next == 0 ? (lane % 4) + 1 : next;
+}}
+}} // namespace lane_policy
+
+#endif // LANE_POLICY_H
+"""
+
+
+def install(policy, source, root):
+    header = render_header(policy, source)
+    paths = []
+    for sketch_dir in SKETCH_DIRS:
+        path = os.path.join(root, sketch_dir, "lane_policy.h")
+        with open(path, "w") as f:
+            f.write(header)
+        paths.append(path)
+    return paths
+
+
+def main():
+    repo_root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description="Compile a policy table into lane_policy.h for the ESP32 sketches")
+    parser.add_argument("policy", nargs="?", help="Policy CSV")
+    parser.add_argument("--fuzzy", action="store_true", help="Tabulate the original fuzzy controller instead")
+    parser.add_argument("--save-csv", help="Also write the policy as CSV")
+    parser.add_argument("--root", default=repo_root, help="Repository root")
+    args = parser.parse_args()
+
+    if args.fuzzy:
+        policy, source = fuzzy_policy(), "the fuzzy rules (--fuzzy)"
+    elif args.policy:
+        policy, source = read_policy_csv(args.policy), os.path.relpath(args.policy, args.root)
+    else:
+        parser.error("give a policy CSV or --fuzzy")
+
+    if args.save_csv:
+        write_policy_csv(policy, args.save_csv)
+        source = os.path.relpath(args.save_csv, args.root)
+    for path in install(policy, source, args.root):
+        print(f"Wrote {os.path.relpath(path, args.root)}")
+    print(f"Policy {policy.name} v{policy.version}, {policy.bins} bins, checksum {policy.checksum():08x}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""
+Short-term arrival forecast per lane
+The coordinator's copy of demand_forecast.h, with the same model and defaults.
+
+While a lane is red nothing leaves it, so the growth of its vehicle count
+between two detector updates is the arrival rate. Each such observation
+updates a Holt-Winters model in O(1): level and trend of the deseasonalised
+rate plus a multiplicative profile of 96 quarter-hour factors. The predicted
+rate is published as arrival_rate_vpm with the lane's counts, and controllers
+with forecast greens enabled (lane_config.py --forecast) size each green for
+the vehicles waiting plus those expected to arrive during it.
+"""
+
+import time
+
+SLOTS = 96             # Quarter hours of the day
+MIN_INTERVAL_S = 2.0   # Shorter gaps between updates are too noisy
+MAX_INTERVAL_S = 120.0
+
+
+def slot_of(timestamp=None):
+    local = time.localtime(time.time() if timestamp is None else timestamp)
+    return (local.tm_hour * 60 + local.tm_min) // 15 % SLOTS
+
+
+class DemandForecast:
+    def __init__(self, alpha=0.3, beta=0.05, gamma=0.1):
+        self.alpha = alpha
+        self.beta = beta
+        self.gamma = gamma
+        self.level = 0.0     # Deseasonalised arrivals per second
+        self.trend = 0.0     # Change of level per second
+        self.season = [1.0] * SLOTS
+        self.observations = 0
+        self.last = None     # (time, count) the current red interval is measured from
+
+    def observe_red(self, count, now=None, slot=None):
+        """Vehicle count seen at `now` while the lane is red"""
+        now = time.time() if now is None else now
+        slot = slot_of(now) if slot is None else slot
+        if self.last is not None:
+            seconds = now - self.last[0]
+            if seconds < MIN_INTERVAL_S:
+                return  # Keep the older reference point and wait for a longer gap
+            if seconds <= MAX_INTERVAL_S:
+                self._update(max(0.0, count - self.last[1]) / seconds, slot, seconds)
+        self.last = (now, count)
+
+    def break_interval(self):
+        """The lane got green: the next red interval starts from a new reference count"""
+        self.last = None
+
+    def ready(self):
+        return self.observations >= 3
+
+    def rate_per_second(self, slot, ahead_s=0.0):
+        return max(0.0, (self.level + self.trend * ahead_s) * self.season[slot % SLOTS])
+
+    def arrivals_over(self, seconds, slot=None):
+        """Vehicles expected to arrive during the next `seconds`"""
+        slot = slot_of() if slot is None else slot
+        return self.rate_per_second(slot, seconds / 2) * seconds if self.ready() else 0.0
+
+    def rate_per_minute(self, slot=None):
+        """Forecast for arrival_rate_vpm, None until the model has seen a few red intervals"""
+        slot = slot_of() if slot is None else slot
+        return round(self.rate_per_second(slot) * 60, 2) if self.ready() else None
+
+    def _update(self, rate, slot, seconds):
+        """`rate` was measured over the `seconds` since the previous observation"""
+        slot %= SLOTS
+        if self.observations == 0:
+            self.level = rate
+        else:
+            previous = self.level
+            factor = max(self.season[slot], 0.05)
+            self.level = self.alpha * (rate / factor) + (1 - self.alpha) * (self.level + self.trend * seconds)
+            self.trend = self.beta * (self.level - previous) / seconds + (1 - self.beta) * self.trend
+            if self.level > 0.01:
+                self.season[slot] = self.gamma * (rate / self.level) + (1 - self.gamma) * self.season[slot]
+        self.level = max(self.level, 0.0)
+        self.observations += 1
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""
+Stop line crossings per green from SORT tracks
+Counts the tracked vehicles that cross a lane's stop line while its head is
+green and reports each green once it ends, the measurement the controllers
+turn into a saturation flow (saturation_flow.h, with the same rules as
+GreenDischarge there).
+
+The stop line is a segment in image pixels, from one kerb to the other. A track
+crosses it when the bottom centre of its box moves from one side of the line to
+the other within the segment, in the direction of travel; every track counts
+once. The first STARTUP_VEHICLES headways of a green include the start-up loss
+and a gap over MAX_SATURATED_HEADWAY_S means the queue is gone, so only the
+headways in between are reported as saturated.
+"""
+
+import time
+
+STARTUP_VEHICLES = 4           # saturation_flow.h
+MAX_SATURATED_HEADWAY_S = 4.0
+
+
+def parse_stop_line(text):
+    """x1,y1,x2,y2 in pixels; the direction of travel is learnt from the crossings"""
+    values = [float(v) for v in text.split(",")]
+    if len(values) != 4:
+        raise ValueError(f"stop line needs x1,y1,x2,y2, got {text!r}")
+    return tuple(values)
+
+
+class GreenDischarge:
+    """Saturated headways of one green, fed the crossings in time order"""
+
+    def __init__(self):
+        self.crossings = 0
+        self.headways = 0
+        self.saturated_s = 0.0
+        self.ended = False
+        self.last_s = 0.0
+
+    def cross(self, seconds):
+        self.crossings += 1
+        if self.crossings > STARTUP_VEHICLES and not self.ended:
+            headway = seconds - self.last_s
+            if headway > MAX_SATURATED_HEADWAY_S:
+                self.ended = True
+            else:
+                self.headways += 1
+                self.saturated_s += headway
+        self.last_s = seconds
+
+
+class DischargeCounter:
+    def __init__(self, stop_line):
+        self.x1, self.y1, self.x2, self.y2 = stop_line
+        self.last_side = {}      # track_id -> side of the line the vehicle was last seen on
+        self.counted = set()     # Tracks that already crossed
+        self.changes = {2: 0, -2: 0}  # Crossings seen per side change; the majority is the direction of travel
+        self.green = None        # GreenDischarge while the head is green
+        self.green_start = 0.0
+
+    def side(self, x, y):
+        cross = (self.x2 - self.x1) * (y - self.y1) - (self.y2 - self.y1) * (x - self.x1)
+        return 1 if cross > 0 else -1
+
+    def within_segment(self, x, y):
+        dx, dy = self.x2 - self.x1, self.y2 - self.y1
+        length2 = dx * dx + dy * dy
+        if length2 == 0:
+            return False
+        t = ((x - self.x1) * dx + (y - self.y1) * dy) / length2
+        return 0.0 <= t <= 1.0
+
+    def update(self, tracked_objects, green, now=None):
+        """tracked_objects as returned by Sort.update(): (bbox, track_id, class_name).
+        Returns the report of a green that just ended, otherwise None."""
+        now = time.time() if now is None else now
+        report = None
+        if green and self.green is None:
+            self.green, self.green_start = GreenDischarge(), now
+        elif not green and self.green is not None:
+            report = {
+                "crossings": self.green.crossings,
+                "headways": self.green.headways,
+                "saturated_s": round(self.green.saturated_s, 2),
+                "green_s": round(now - self.green_start, 1),
+            }
+            self.green = None
+
+        seen = set()
+        for bbox, track_id, _ in tracked_objects:
+            # Bottom centre of the box: where the vehicle touches the road
+            x, y = (bbox[0] + bbox[2]) / 2.0, bbox[3]
+            seen.add(track_id)
+            side = self.side(x, y)
+            last = self.last_side.get(track_id)
+            self.last_side[track_id] = side
+            if last is None or last == side or track_id in self.counted or not self.within_segment(x, y):
+                continue
+            change = side - last
+            self.changes[change] += 1
+            if self.changes[change] < self.changes[-change]:
+                continue  # Against the traffic: a vehicle backing up or a track swap
+            self.counted.add(track_id)
+            if self.green is not None:
+                self.green.cross(now - self.green_start)
+
+        for track_id in [t for t in self.last_side if t not in seen]:
+            del self.last_side[track_id]
+        self.counted &= seen
+        return report
@@ -0,0 +1,503 @@
+#!/usr/bin/env python3
+"""
+Staged frame pipeline with backpressure
+Python bindings (ctypes) for host/frame_pipeline.h: stages run on their own
+worker threads and pass items through bounded lock-free queues, each with an
+overflow policy (BLOCK for backpressure, DROP_OLDEST for latest-wins frames,
+DROP_NEWEST). Every stage counts its items and drops and measures its queue
+occupancy, queue wait and service time; report() marks the bottleneck stage.
+
+Without the library the same pipeline runs on Python threads and queues, with
+the same policies and metrics.
+
+Build the library first (from the repository root):
+    g++ -std=c++17 -O2 -pthread -shared -fPIC host/frame_pipeline_capi.cpp -o Python/libframe_pipeline.so
+
+Usage:
+    python3 Python/frame_pipeline.py --bench
+    python3 Python/frame_pipeline.py --bench --infer-ms 80 --infer-workers 2
+    python3 Python/frame_pipeline.py --bench --python
+"""
+
+import argparse
+import atexit
+import collections
+import ctypes
+import itertools
+import os
+import threading
+import time
+import traceback
+import weakref
+
+LIBRARY_NAME = "libframe_pipeline.so"
+
+BLOCK = 0        # Producer waits for room: backpressure
+DROP_OLDEST = 1  # Latest wins: the stalest queued item is discarded
+DROP_NEWEST = 2  # The new item is discarded
+
+# Per-stage metrics, in the order of fp_stats() in host/frame_pipeline_capi.cpp
+STAT_FIELDS = ("workers", "capacity", "queued", "in", "out", "dropped", "filtered", "errors",
+               "mean_occupancy", "max_occupancy", "utilization", "blocked_s",
+               "wait_p50_ms", "wait_p99_ms", "service_mean_ms", "service_p50_ms", "service_p99_ms",
+               "throughput")
+
+STAGE_FN = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_uint64, ctypes.POINTER(ctypes.c_uint64))
+RELEASE_FN = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_uint64)
+
+
+def load_library(path=None):
+    """Load libframe_pipeline.so from path, $FRAME_PIPELINE_LIB or next to this file"""
+    candidates = [path, os.environ.get("FRAME_PIPELINE_LIB"),
+                  os.path.join(os.path.dirname(os.path.abspath(__file__)), LIBRARY_NAME)]
+    for candidate in candidates:
+        if candidate and os.path.exists(candidate):
+            lib = ctypes.CDLL(candidate)
+            break
+    else:
+        raise OSError(f"{LIBRARY_NAME} not found, build it with the command in {__file__}")
+
+    lib.fp_stats_size.restype = ctypes.c_int
+    lib.fp_create.restype = ctypes.c_void_p
+    lib.fp_create.argtypes = [RELEASE_FN, ctypes.c_void_p]
+    lib.fp_destroy.argtypes = [ctypes.c_void_p]
+    lib.fp_add_source.restype = ctypes.c_int
+    lib.fp_add_source.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int, STAGE_FN, ctypes.c_void_p]
+    lib.fp_add_stage.restype = ctypes.c_int
+    lib.fp_add_stage.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_int,
+                                 ctypes.c_int, STAGE_FN, ctypes.c_void_p]
+    lib.fp_submit.restype = ctypes.c_int
+    lib.fp_submit.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_uint64]
+    lib.fp_start.argtypes = [ctypes.c_void_p]
+    lib.fp_stop.argtypes = [ctypes.c_void_p]
+    lib.fp_clear.restype = ctypes.c_int
+    lib.fp_clear.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.fp_stage_count.restype = ctypes.c_int
+    lib.fp_stage_count.argtypes = [ctypes.c_void_p]
+    lib.fp_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_double)]
+    if lib.fp_stats_size() != len(STAT_FIELDS):
+        raise OSError(f"{LIBRARY_NAME} is from another version, rebuild it")
+    return lib
+
+
+def run_stage(name, fn, item, source):
+    """Call a stage function; returns (status, output) as the C interface expects"""
+    try:
+        output = fn() if source else fn(item)
+    except Exception:
+        print(f"[pipeline] ❌ {name} stage error")
+        traceback.print_exc()
+        return -1, None
+    return (0, None) if output is None else (1, output)
+
+
+class NativeBackend:
+    """Stages on native threads; Python objects travel as tokens into self.items"""
+
+    def __init__(self, lib):
+        self.lib = lib
+        self.items = {}
+        self.tokens = itertools.count(1)
+        self.callbacks = []  # ctypes callbacks must outlive the pipeline
+        self.release = RELEASE_FN(lambda ctx, token: self.items.pop(token, None))
+        self.handle = lib.fp_create(self.release, None)
+
+    def store(self, item):
+        token = next(self.tokens)
+        self.items[token] = item
+        return token
+
+    def callback(self, name, fn, source):
+        def call(ctx, token, out):
+            status, output = run_stage(name, fn, None if source else self.items.pop(token, None), source)
+            if status > 0:
+                out[0] = self.store(output)
+            return status
+        callback = STAGE_FN(call)
+        self.callbacks.append(callback)
+        return callback
+
+    def add_source(self, name, fn, workers):
+        return self.lib.fp_add_source(self.handle, name.encode(), workers, self.callback(name, fn, True), None)
+
+    def add_stage(self, name, fn, upstream, workers, capacity, overflow):
+        return self.lib.fp_add_stage(self.handle, name.encode(), -1 if upstream is None else upstream,
+                                     workers, capacity, overflow, self.callback(name, fn, False), None)
+
+    def submit(self, stage, item):
+        return self.lib.fp_submit(self.handle, stage, self.store(item)) == 1
+
+    def start(self):
+        self.lib.fp_start(self.handle)
+
+    def stop(self):
+        self.lib.fp_stop(self.handle)
+
+    def clear(self, stage):
+        return self.lib.fp_clear(self.handle, stage)
+
+    def stats(self):
+        count = self.lib.fp_stage_count(self.handle)
+        values = (ctypes.c_double * (count * len(STAT_FIELDS)))()
+        self.lib.fp_stats(self.handle, values)
+        n = len(STAT_FIELDS)
+        return [tuple(values[s * n:(s + 1) * n]) for s in range(count)]
+
+    def close(self):
+        if self.handle:
+            self.lib.fp_destroy(self.handle)
+            self.handle = None
+
+
+class LatencyHistogram:
+    """Microseconds in four buckets per power of two, as in frame_pipeline.h"""
+
+    BUCKETS = 160
+
+    def __init__(self):
+        self.counts = [0] * self.BUCKETS
+        self.samples = 0
+        self.total_ns = 0
+
+    def record(self, ns):
+        us = ns // 1000
+        if us < 4:
+            bucket = us
+        else:
+            octave = us.bit_length() - 1
+            bucket = min(4 * (octave - 1) + ((us >> (octave - 2)) & 3), self.BUCKETS - 1)
+        self.counts[bucket] += 1
+        self.samples += 1
+        self.total_ns += ns
+
+    def mean_ms(self):
+        return self.total_ns / 1e6 / self.samples if self.samples else 0.0
+
+    def quantile_ms(self, q):
+        if not self.samples:
+            return 0.0
+        rank, seen = int(q * (self.samples - 1)) + 1, 0
+        for bucket, count in enumerate(self.counts):
+            seen += count
+            if seen >= rank:
+                break
+        if bucket < 4:
+            return (bucket + 1) / 1000.0
+        octave, sub = bucket // 4 + 1, bucket % 4
+        return ((4 + sub + 1) << (octave - 2)) / 1000.0
+
+
+class PythonStage:
+    def __init__(self, name, fn, workers, capacity, overflow, source):
+        self.name, self.fn, self.source = name, fn, source
+        self.workers, self.capacity, self.overflow = max(workers, 1), capacity, overflow
+        self.downstream = None
+        self.queue = collections.deque()
+        self.lock = threading.Lock()
+        self.not_empty = threading.Condition(self.lock)
+        self.not_full = threading.Condition(self.lock)
+        self.counts = dict.fromkeys(("in", "out", "dropped", "filtered", "errors"), 0)
+        self.busy_ns = self.blocked_ns = 0
+        self.occupancy_sum = self.occupancy_samples = self.occupancy_max = 0
+        self.wait, self.service = LatencyHistogram(), LatencyHistogram()
+
+
+class PythonBackend:
+    """The same pipeline on Python threads, for machines without the library"""
+
+    def __init__(self):
+        self.stages = []
+        self.threads = []
+        self.stopping = False
+        self.start_ns = self.stop_ns = 0
+
+    def add(self, stage, upstream):
+        if upstream is not None:
+            self.stages[upstream].downstream = len(self.stages)
+        self.stages.append(stage)
+        return len(self.stages) - 1
+
+    def add_source(self, name, fn, workers):
+        return self.add(PythonStage(name, fn, workers, 0, BLOCK, True), None)
+
+    def add_stage(self, name, fn, upstream, workers, capacity, overflow):
+        return self.add(PythonStage(name, fn, workers, max(capacity, 1), overflow, False), upstream)
+
+    def push(self, stage, item):
+        with stage.lock:
+            if len(stage.queue) >= stage.capacity:
+                if stage.overflow == DROP_OLDEST:
+                    stage.queue.popleft()
+                    stage.counts["dropped"] += 1
+                elif stage.overflow == DROP_NEWEST:
+                    stage.counts["dropped"] += 1
+                    return False
+                else:
+                    since = time.perf_counter_ns()
+                    while len(stage.queue) >= stage.capacity and not self.stopping:
+                        stage.not_full.wait(0.1)
+                    stage.blocked_ns += time.perf_counter_ns() - since
+                    if self.stopping:
+                        stage.counts["dropped"] += 1
+                        return False
+            stage.queue.append((item, time.perf_counter_ns()))
+            depth = len(stage.queue)
+            stage.counts["in"] += 1
+            stage.occupancy_sum += depth
+            stage.occupancy_samples += 1
+            stage.occupancy_max = max(stage.occupancy_max, depth)
+            stage.not_empty.notify()
+        return True
+
+    def submit(self, stage, item):
+        return self.push(self.stages[stage], item)
+
+    def work(self, stage):
+        while not self.stopping:
+            item = None
+            if not stage.source:
+                with stage.lock:
+                    while not stage.queue and not self.stopping:
+                        stage.not_empty.wait(0.1)
+                    if self.stopping:
+                        return
+                    item, enqueued_ns = stage.queue.popleft()
+                    stage.not_full.notify()
+                    stage.wait.record(time.perf_counter_ns() - enqueued_ns)
+
+            begin = time.perf_counter_ns()
+            status, output = run_stage(stage.name, stage.fn, item, stage.source)
+            elapsed = time.perf_counter_ns() - begin
+            with stage.lock:
+                if not stage.source or status != 0:
+                    stage.service.record(elapsed)
+                    stage.busy_ns += elapsed
+                if status > 0:
+                    stage.counts["out"] += 1
+                    if stage.source:
+                        stage.counts["in"] += 1
+                elif status < 0:
+                    stage.counts["errors"] += 1
+                elif not stage.source and stage.downstream is None:
+                    stage.counts["out"] += 1  # A sink consumed it
+                elif not stage.source:
+                    stage.counts["filtered"] += 1
+            if status > 0 and stage.downstream is not None:
+                self.push(self.stages[stage.downstream], output)
+            elif status == 0 and stage.source:
+                time.sleep(0.001)  # Nothing to decode yet
+
+    def start(self):
+        self.stopping = False
+        self.start_ns = time.perf_counter_ns()
+        for stage in self.stages:
+            for _ in range(stage.workers):
+                thread = threading.Thread(target=self.work, args=(stage,), daemon=True)
+                thread.start()
+                self.threads.append(thread)
+
+    def stop(self):
+        self.stopping = True
+        for stage in self.stages:
+            with stage.lock:
+                stage.not_empty.notify_all()
+                stage.not_full.notify_all()
+        for thread in self.threads:
+            if thread is not threading.current_thread():
+                thread.join()
+        self.threads = []
+        self.stop_ns = time.perf_counter_ns()
+        for stage in range(len(self.stages)):
+            self.clear(stage)
+
+    def clear(self, stage):
+        stage = self.stages[stage]
+        with stage.lock:
+            cleared = len(stage.queue)
+            stage.queue.clear()
+            stage.not_full.notify_all()
+        return cleared
+
+    def stats(self):
+        elapsed_ns = (self.stop_ns if self.stop_ns > self.start_ns else time.perf_counter_ns()) - self.start_ns
+        rows = []
+        for s in self.stages:
+            with s.lock:
+                c = s.counts
+                rows.append((s.workers, s.capacity, len(s.queue), c["in"], c["out"], c["dropped"],
+                             c["filtered"], c["errors"],
+                             s.occupancy_sum / s.occupancy_samples if s.occupancy_samples else 0.0,
+                             s.occupancy_max,
+                             s.busy_ns / (s.workers * elapsed_ns) if elapsed_ns > 0 else 0.0,
+                             s.blocked_ns / 1e9,
+                             s.wait.quantile_ms(0.5), s.wait.quantile_ms(0.99),
+                             s.service.mean_ms(), s.service.quantile_ms(0.5), s.service.quantile_ms(0.99),
+                             c["out"] / (elapsed_ns / 1e9) if elapsed_ns > 0 else 0.0))
+        return rows
+
+    def close(self):
+        pass
+
+
+_running = weakref.WeakSet()
+
+
+@atexit.register
+def _stop_running():
+    # Native workers must not call into an interpreter that is shutting down
+    for pipeline in list(_running):
+        pipeline.stop()
+
+
+class Pipeline:
+    """
+    source(name, fn)  fn() -> item or None (nothing yet), called in a loop
+    stage(name, fn, after=stage)  fn(item) -> item for the next stage or None
+    stage(name, fn)   without `after` the stage is fed by submit(stage, item)
+    A stage nothing is added after is a sink: what it returns is discarded and
+    every item it finishes counts as out.
+    """
+
+    def __init__(self, name="pipeline", native=True, library=None):
+        self.name = name
+        self.names = []
+        self.backend = None
+        self.started = False
+        if native:
+            try:
+                self.backend = NativeBackend(load_library(library))
+            except OSError as e:
+                print(f"[{name}] ⚠️  {e}; running the pipeline on Python threads")
+        if self.backend is None:
+            self.backend = PythonBackend()
+        self.native = isinstance(self.backend, NativeBackend)
+
+    def source(self, name, fn, workers=1):
+        self.names.append(name)
+        return self.backend.add_source(name, fn, workers)
+
+    def stage(self, name, fn, after=None, workers=1, capacity=4, overflow=BLOCK):
+        self.names.append(name)
+        return self.backend.add_stage(name, fn, after, workers, capacity, overflow)
+
+    def submit(self, stage, item):
+        """Queue an item under the stage's overflow policy; False if it was discarded"""
+        return self.backend.submit(stage, item)
+
+    def clear(self, stage):
+        """Discard the queued items of a stage; returns how many"""
+        return self.backend.clear(stage)
+
+    def start(self):
+        if not self.started:
+            self.started = True
+            _running.add(self)
+            self.backend.start()
+
+    def stop(self):
+        if self.started:
+            self.started = False
+            _running.discard(self)
+            self.backend.stop()
+
+    def stats(self):
+        """One dict per stage: name, STAT_FIELDS and whether it is the bottleneck"""
+        stats = [dict(zip(STAT_FIELDS, row), name=name) for name, row in zip(self.names, self.backend.stats())]
+        # A source is paced by its input (a camera), so only queued stages can be the bottleneck
+        queued = [s for s in stats if s["capacity"] > 0]
+        busiest = max(queued, key=lambda s: s["utilization"], default=None)
+        for s in stats:
+            s["bottleneck"] = s is busiest and s["utilization"] > 0
+        return stats
+
+    def report(self):
+        lines = [f"{'stage':<12} {'wk':>3} {'queue':>7} {'in':>8} {'out':>8} {'drop':>7} {'occ':>6} "
+                 f"{'busy':>6} {'fps':>7} {'wait p50':>9} {'svc p50':>9} {'svc p99':>9} {'blocked':>8}"]
+        for s in self.stats():
+            queue = f"{int(s['queued'])}/{int(s['capacity'])}" if s["capacity"] else "-"
+            lines.append(f"{s['name']:<12} {int(s['workers']):>3} {queue:>7} {int(s['in']):>8} {int(s['out']):>8} "
+                         f"{int(s['dropped']):>7} {s['mean_occupancy']:>6.2f} {100 * s['utilization']:>5.0f}% "
+                         f"{s['throughput']:>7.1f} {s['wait_p50_ms']:>7.2f}ms {s['service_p50_ms']:>7.2f}ms "
+                         f"{s['service_p99_ms']:>7.2f}ms {s['blocked_s']:>7.2f}s"
+                         + ("  <- bottleneck" if s["bottleneck"] else ""))
+        return "\n".join(lines)
+
+    def close(self):
+        self.stop()
+        self.backend.close()
+
+
+def bench(args):
+    """decode -> preprocess -> infer -> track -> publish with sleeps standing in for
+    the camera, the GPU and the broker, which all release the GIL like the real ones"""
+    pipeline = Pipeline("bench", native=not args.python)
+    frame_interval = 1.0 / args.fps
+    next_frame = [time.perf_counter()]
+    sequence = itertools.count()
+    latencies = LatencyHistogram()
+    last_tracked = [-1]
+
+    def decode():
+        delay = next_frame[0] - time.perf_counter()
+        if delay > 0:
+            time.sleep(delay)
+        next_frame[0] = max(next_frame[0] + frame_interval, time.perf_counter() - frame_interval)
+        return {"seq": next(sequence), "t": time.perf_counter_ns()}
+
+    def work(ms):
+        def fn(item):
+            time.sleep(ms / 1000.0)
+            return item
+        return fn
+
+    def track(item):
+        if item["seq"] < last_tracked[0]:
+            return None  # Overtaken by a later frame from another infer worker
+        last_tracked[0] = item["seq"]
+        time.sleep(args.track_ms / 1000.0)
+        return item
+
+    def publish(item):
+        time.sleep(args.publish_ms / 1000.0)
+        latencies.record(time.perf_counter_ns() - item["t"])
+
+    frames = DROP_OLDEST if not args.block else BLOCK
+    decode_stage = pipeline.source("decode", decode)
+    pre = pipeline.stage("preprocess", work(args.preprocess_ms), after=decode_stage, capacity=1, overflow=frames)
+    infer = pipeline.stage("infer", work(args.infer_ms), after=pre, workers=args.infer_workers,
+                           capacity=1, overflow=frames)
+    track_stage = pipeline.stage("track", track, after=infer, capacity=4)
+    pipeline.stage("publish", publish, after=track_stage, capacity=16)
+
+    pipeline.start()
+    time.sleep(args.seconds)
+    pipeline.stop()
+    print(f"{'native' if pipeline.native else 'Python'} pipeline, {args.fps:g} fps camera, "
+          f"{'blocking' if args.block else 'latest-wins'} frame queues, {args.seconds:g} s")
+    print(pipeline.report())
+    print(f"decode to publish: p50 {latencies.quantile_ms(0.5):.1f} ms, p99 {latencies.quantile_ms(0.99):.1f} ms, "
+          f"{latencies.samples} frames published")
+    pipeline.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Staged frame pipeline benchmark")
+    parser.add_argument("--bench", action="store_true", help="Run the synthetic detector pipeline")
+    parser.add_argument("--seconds", type=float, default=5.0)
+    parser.add_argument("--fps", type=float, default=25.0, help="Camera frame rate (default: 25)")
+    parser.add_argument("--preprocess-ms", type=float, default=4.0)
+    parser.add_argument("--infer-ms", type=float, default=60.0)
+    parser.add_argument("--infer-workers", type=int, default=1)
+    parser.add_argument("--track-ms", type=float, default=3.0)
+    parser.add_argument("--publish-ms", type=float, default=1.0)
+    parser.add_argument("--block", action="store_true", help="Blocking frame queues instead of latest-wins")
+    parser.add_argument("--python", action="store_true", help="Use the Python threads even if the library exists")
+    args = parser.parse_args()
+    if not args.bench:
+        parser.print_help()
+        return
+    bench(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""
+Retained snapshot of one intersection's signal state
+The coordinator's copy of intersection_snapshot.h, with the same message.
+
+The single-board controller, or lane 1 with lane boards, publishes one
+versioned message per change on traffic/<intersection>/snapshot with the
+retain flag: which sections are in their light sequence, the stage of that
+group and the wall-clock time it ends, the group served next, and every
+lane's green time and demand. A detector that starts or reconnects
+mid-cycle gets it from the broker straight away and is in step after that
+one message, instead of inferring the state from countdown_sync,
+green_status and next_lane_ready over the following seconds.
+
+    {"v":118,"t":1760771234000,"active":5,"next":2,"stage":"green",
+     "end":1760771246000,"green":[12,0,12,0],"q":[4,1,5,0]}
+"""
+
+import json
+import time
+
+LANES = 4
+STAGES = ("idle", "starting", "green", "clearing")
+
+# A lower version published this much later than the current snapshot comes
+# from a writer that restarted before it saw the retained message
+RESTART_GRACE_MS = 10000
+
+
+def now_ms():
+    return int(time.time() * 1000)
+
+
+class Snapshot:
+    def __init__(self, version=0, published_ms=0, active=0, next_section=1, stage="idle",
+                 stage_end_ms=0, green=None, demand=None):
+        self.version = version
+        self.published_ms = published_ms
+        self.active = active              # Bit s-1 set while section s is in its light sequence
+        self.next_section = next_section  # Lead section of the group served next
+        self.stage = stage                # Stage of the active group, one of STAGES
+        self.stage_end_ms = stage_end_ms  # Wall clock at which that stage ends, 0 when idle
+        self.green = list(green) if green else [0] * LANES
+        self.demand = list(demand) if demand else [0] * LANES
+
+    def is_active(self, section):
+        return 1 <= section <= LANES and bool(self.active >> (section - 1) & 1)
+
+    def lead(self):
+        """First section of the running group, or the next group's lead between groups"""
+        for section in range(1, LANES + 1):
+            if self.is_active(section):
+                return section
+        return self.next_section
+
+    def remaining_s(self, at_ms=None):
+        """Seconds left in the current stage, 0 when it has ended or the intersection is idle"""
+        at_ms = now_ms() if at_ms is None else at_ms
+        return max(0.0, (self.stage_end_ms - at_ms) / 1000.0) if self.stage_end_ms else 0.0
+
+    def is_current(self, at_ms=None):
+        """False once the stage should have ended long ago, i.e. its writer has gone away"""
+        at_ms = now_ms() if at_ms is None else at_ms
+        return self.stage == "idle" or self.stage_end_ms + RESTART_GRACE_MS > at_ms
+
+    def supersedes(self, current):
+        """Whether this snapshot replaces `current` (None for no snapshot yet)"""
+        if current is None or self.version > current.version:
+            return True
+        return self.published_ms > current.published_ms + RESTART_GRACE_MS
+
+    def encode(self):
+        return json.dumps({
+            "v": self.version, "t": self.published_ms, "active": self.active, "next": self.next_section,
+            "stage": self.stage, "end": self.stage_end_ms, "green": self.green, "q": self.demand,
+        }, separators=(",", ":"))
+
+
+def parse(payload):
+    """Snapshot from a message payload (str or bytes), None unless every field is valid"""
+    try:
+        data = json.loads(payload)
+        snapshot = Snapshot(
+            version=int(data["v"]),
+            published_ms=int(data["t"]),
+            active=int(data["active"]) & ((1 << LANES) - 1),
+            next_section=int(data["next"]),
+            stage=data["stage"],
+            stage_end_ms=int(data["end"]),
+            green=[int(g) for g in data["green"]],
+            demand=[int(q) for q in data["q"]],
+        )
+    except (ValueError, KeyError, TypeError):
+        return None
+    if (snapshot.stage not in STAGES or not 1 <= snapshot.next_section <= LANES
+            or len(snapshot.green) != LANES or len(snapshot.demand) != LANES):
+        return None
+    return snapshot
@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+"""
+Runtime config blobs for the lane controllers
+Builds the binary config that lane_config.h parses (header, body, CRC-32) and
+optionally publishes it retained on traffic/<intersection>/config. Every board
+of that intersection validates the blob, switches to it between two light
+sequences and saves it in NVS, then reports staged/applied/rejected on
+traffic/<intersection>/config_status.
+
+The layout must match lane_config.h; SCHEMA is hashed into every blob so a
+board built for a different layout rejects it instead of misreading it.
+
+Usage:
+    python Python/lane_config.py --version 2 --rush 7-9 --rush 16-19 --publish
+    python Python/lane_config.py --version 5 --plan weekday:06:30-09:30 --plan saturday:10:00-14:00=50 \
+        --holiday 2025-03-31 --holiday 2025-04-01 --publish
+    python Python/lane_config.py --version 3 --policy policies/learned.csv --out config.bin
+    python Python/lane_config.py --version 4 --kinematic --speed-kph 40,30,40,30 --pre-yellow-ms 0 --publish
+    python Python/lane_config.py --version 6 --saturation --forecast --publish
+"""
+
+import argparse
+import datetime
+import struct
+import zlib
+
+from compile_policy import read_policy_csv
+import mqtt_topics
+
+MAGIC = 0x4746434C  # "LCFG"
+SCHEMA = ("lane_config/4;u16 allRedMs;u16 yellowMs;u16 minGreenDs;u16 maxGreenDs;"
+          "u8 greenBins;u8 clearance;u8 conflicts[4];u16 preYellowMs;u8 speedKph[4];u8 widthM[4];"
+          "u8 planCount;u8 transitionMin;u8 holidayCount;u8 reserved;"
+          "{u8 dayType;u8 rushPct;u16 startMin;u16 endMin} plans[16];u16 holidays[24];u16 greenDs[2][32]")
+MAX_BINS = 32
+MAX_PLANS = 16
+MAX_HOLIDAYS = 24
+BODY_FORMAT = ("<HHHHBB4BH4B4BBBBB" + "BBHH" * MAX_PLANS + "H" * MAX_HOLIDAYS
+               + "H" * (2 * MAX_BINS))
+# plan_schedule.h DayType
+DAY_TYPES = ("weekday", "saturday", "sunday", "holiday")
+HOLIDAY_EPOCH = datetime.date(2000, 1, 1)
+# (day type, start minute, end minute, rush %): jam sibuk on weekdays 07:00-10:00 and 17:00-20:00
+DEFAULT_PLANS = ((0, 7 * 60, 10 * 60, 100), (0, 17 * 60, 20 * 60, 100))
+CLEARANCE_FIXED = 0
+CLEARANCE_KINEMATIC = 1
+FLAG_FORECAST = 0x0001    # Header flag: size greens for forecast arrivals too
+FLAG_SATURATION = 0x0002  # Header flag: size greens from the measured saturation flow
+# Sections that may share green; every other pair of approaches conflicts
+DEFAULT_COMPATIBLE = ((1, 3), (2, 4))
+CONFIG_LEAF = "config"  # traffic/<intersection>/config
+
+
+def fnv1a(text):
+    value = 2166136261
+    for byte in text.encode():
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+SCHEMA_HASH = fnv1a(SCHEMA)
+
+
+def parse_window(text):
+    """Weekday jam sibuk hours START-END, inclusive like the old isJamSibuk() windows"""
+    start, _, end = text.partition("-")
+    start, end = int(start), int(end or start)
+    if not 0 <= start <= end <= 23:
+        raise argparse.ArgumentTypeError(f"rush window {text!r} must be START-END within 0-23")
+    return 0, start * 60, (end + 1) * 60, 100
+
+
+def parse_minute(text):
+    hours, _, minutes = text.partition(":")
+    return int(hours) * 60 + int(minutes or 0)
+
+
+def parse_plan(text):
+    """DAYTYPE:HH:MM-HH:MM[=PCT], e.g. weekday:07:00-10:00 or saturday:10:00-14:00=50
+
+    The end must come after the start; a window past midnight is two plans,
+    e.g. weekday:22:00-24:00 and weekday:00:00-02:00.
+    """
+    try:
+        day, _, rest = text.partition(":")
+        span, _, pct = rest.partition("=")
+        start, _, end = span.partition("-")
+        plan = (DAY_TYPES.index(day.lower()), parse_minute(start), parse_minute(end), int(pct or 100))
+    except ValueError:
+        plan = None
+    if plan is None or not 0 <= plan[1] < plan[2] <= 24 * 60 or not 0 <= plan[3] <= 100:
+        raise argparse.ArgumentTypeError(f"plan {text!r} must be DAYTYPE:HH:MM-HH:MM[=PCT] with the end after "
+                                         "the start (split windows past midnight), "
+                                         f"DAYTYPE one of {', '.join(DAY_TYPES)}")
+    return plan
+
+
+def parse_date(text):
+    try:
+        return datetime.date.fromisoformat(text.strip())
+    except ValueError:
+        raise argparse.ArgumentTypeError(f"holiday {text!r} must be YYYY-MM-DD")
+
+
+def read_holidays(path):
+    """One YYYY-MM-DD per line; # starts a comment"""
+    with open(path) as f:
+        return [parse_date(line.split("#")[0]) for line in f if line.split("#")[0].strip()]
+
+
+def parse_pair(text):
+    first, _, second = text.partition("+")
+    pair = (int(first), int(second or 0))
+    if not all(1 <= section <= 4 for section in pair) or pair[0] == pair[1]:
+        raise argparse.ArgumentTypeError(f"compatible pair {text!r} must be two different sections, e.g. 1+3")
+    return pair
+
+
+def conflict_masks(compatible):
+    """Conflict bitmask per section: every other section except the compatible ones"""
+    masks = [0x0F & ~(1 << section) for section in range(4)]
+    for a, b in compatible:
+        masks[a - 1] &= ~(1 << (b - 1))
+        masks[b - 1] &= ~(1 << (a - 1))
+    return masks
+
+
+def parse_per_section(text):
+    values = [int(v) for v in text.split(",")]
+    if len(values) == 1:
+        values *= 4
+    if len(values) != 4 or not all(1 <= v <= 255 for v in values):
+        raise argparse.ArgumentTypeError(f"{text!r} must be one value or four comma separated values in 1-255")
+    return values
+
+
+def build_blob(version, plans=DEFAULT_PLANS, all_red_ms=1000, yellow_ms=3000,
+               min_green=5.0, max_green=120.0, policy=None, compatible=DEFAULT_COMPATIBLE,
+               kinematic=False, pre_yellow_ms=3000, speed_kph=(40,) * 4, width_m=(12,) * 4,
+               forecast=False, holidays=(), transition_min=10, saturation=False):
+    """Config blob as lane_config::parse() expects it; policy None keeps lane_policy.h.
+    kinematic computes each section's yellow and all red from speed_kph and width_m
+    instead of using all_red_ms and yellow_ms. forecast sizes each green for the
+    vehicles forecast to arrive during it as well (demand_forecast.h). saturation sizes
+    greens as queue / saturation flow once the board has measured it (saturation_flow.h).
+    plans are (day type, start minute, end minute, rush %) intervals and holidays
+    dates that run the holiday plans (plan_schedule.h)."""
+    plans = sorted(plans)
+    if len(plans) > MAX_PLANS:
+        raise ValueError(f"at most {MAX_PLANS} plans")
+    for previous, plan in zip(plans, plans[1:]):
+        if plan[0] == previous[0] and plan[1] < previous[2]:
+            raise ValueError(f"{DAY_TYPES[plan[0]]} plans overlap around minute {plan[1]}")
+    days = sorted({(date - HOLIDAY_EPOCH).days for date in holidays})
+    if len(days) > MAX_HOLIDAYS:
+        raise ValueError(f"at most {MAX_HOLIDAYS} holidays")
+    if days and not 0 <= days[0] <= days[-1] <= 0xFFFF:
+        raise ValueError("holidays must be on or after 2000-01-01")
+    plan_fields = []
+    for day_type, start, end, pct in list(plans) + [(0, 0, 0, 0)] * (MAX_PLANS - len(plans)):
+        plan_fields += [day_type, pct, start, end]
+
+    bins, green = 0, [0] * (2 * MAX_BINS)
+    if policy is not None:
+        bins = min(policy.bins, MAX_BINS)
+        for r in (0, 1):
+            for count in range(bins):
+                green[r * MAX_BINS + count] = policy.green_ds(r, count)
+
+    body = struct.pack(BODY_FORMAT,
+                       all_red_ms, yellow_ms, int(round(min_green * 10)), int(round(max_green * 10)),
+                       bins, CLEARANCE_KINEMATIC if kinematic else CLEARANCE_FIXED,
+                       *conflict_masks(compatible), pre_yellow_ms, *speed_kph, *width_m,
+                       len(plans), transition_min, len(days), 0, *plan_fields,
+                       *days, *[0] * (MAX_HOLIDAYS - len(days)), *green)
+    header = struct.pack("<IIIHH", MAGIC, SCHEMA_HASH, version, len(body),
+                         (FLAG_FORECAST if forecast else 0) | (FLAG_SATURATION if saturation else 0))
+    return header + body + struct.pack("<I", zlib.crc32(header + body) & 0xFFFFFFFF)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build and publish a lane controller config blob")
+    parser.add_argument("--version", type=int, required=True, help="Config revision, must increase")
+    parser.add_argument("--rush", type=parse_window, action="append",
+                        help="Weekday jam sibuk hours START-END (inclusive), shorthand for --plan")
+    parser.add_argument("--plan", type=parse_plan, action="append",
+                        help="DAYTYPE:HH:MM-HH:MM[=PCT] (weekday, saturday, sunday, holiday), rush %% "
+                             "100 by default; repeat up to 16 times (default weekday 07-10 and 17-20)")
+    parser.add_argument("--holiday", type=parse_date, action="append", default=[],
+                        help="YYYY-MM-DD that runs the holiday plans, repeatable")
+    parser.add_argument("--holidays", help="File with one YYYY-MM-DD per line")
+    parser.add_argument("--transition-min", type=int, default=10,
+                        help="Minutes over which green times move to a new plan")
+    parser.add_argument("--all-red-ms", type=int, default=1000)
+    parser.add_argument("--yellow-ms", type=int, default=3000)
+    parser.add_argument("--pre-yellow-ms", type=int, default=3000, help="Yellow before green, 0 to go red to green")
+    parser.add_argument("--kinematic", action="store_true",
+                        help="Yellow and all red per section from speed limit and crossing width")
+    parser.add_argument("--speed-kph", type=parse_per_section, default=[40] * 4,
+                        help="Approach speed limit, one value or four (sections 1-4)")
+    parser.add_argument("--width-m", type=parse_per_section, default=[12] * 4,
+                        help="Stop line to far side of the conflict area, one value or four")
+    parser.add_argument("--forecast", action="store_true",
+                        help="Size greens for waiting vehicles plus the arrivals forecast during the green")
+    parser.add_argument("--saturation", action="store_true",
+                        help="Size greens from each lane's measured saturation flow instead of the policy table")
+    parser.add_argument("--min-green", type=float, default=5.0, help="Seconds")
+    parser.add_argument("--max-green", type=float, default=120.0, help="Seconds")
+    parser.add_argument("--policy", help="Policy CSV whose green times replace lane_policy.h")
+    parser.add_argument("--compatible", type=parse_pair, action="append",
+                        help="Sections that may be green together, e.g. 1+3 (default 1+3 and 2+4)")
+    parser.add_argument("--sequential", action="store_true", help="No shared greens, one section at a time")
+    parser.add_argument("--out", help="Write the blob to a file")
+    parser.add_argument("--publish", action="store_true", help="Publish it retained on traffic/<intersection>/config")
+    parser.add_argument("--intersection", default=mqtt_topics.DEFAULT_INTERSECTION,
+                        help=f"Intersection to configure (default: {mqtt_topics.DEFAULT_INTERSECTION})")
+    parser.add_argument("--broker", default="broker.emqx.io")
+    parser.add_argument("--port", type=int, default=1883)
+    args = parser.parse_args()
+
+    policy = read_policy_csv(args.policy) if args.policy else None
+    compatible = [] if args.sequential else (args.compatible or DEFAULT_COMPATIBLE)
+    plans = (args.rush or []) + (args.plan or []) or DEFAULT_PLANS
+    holidays = args.holiday + (read_holidays(args.holidays) if args.holidays else [])
+    blob = build_blob(args.version, plans, args.all_red_ms, args.yellow_ms,
+                      args.min_green, args.max_green, policy, compatible,
+                      args.kinematic, args.pre_yellow_ms, args.speed_kph, args.width_m,
+                      args.forecast, holidays, args.transition_min, args.saturation)
+    print(f"Config v{args.version}: {len(blob)} bytes, schema {SCHEMA_HASH:08x}, "
+          f"crc {struct.unpack('<I', blob[-4:])[0]:08x}")
+
+    if args.out:
+        with open(args.out, "wb") as f:
+            f.write(blob)
+        print(f"Wrote {args.out}")
+    if args.publish:
+        import paho.mqtt.client as mqtt
+
+        try:
+            client = mqtt.Client(callback_api_version=mqtt.CallbackAPIVersion.VERSION2)
+        except AttributeError:
+            client = mqtt.Client()  # paho-mqtt 1.x
+        client.connect(args.broker, args.port, 60)
+        client.loop_start()
+        topic = mqtt_topics.site(args.intersection, CONFIG_LEAF)
+        client.publish(topic, blob, qos=1, retain=True).wait_for_publish()
+        client.loop_stop()
+        client.disconnect()
+        print(f"Published to {topic} on {args.broker}")
+
+
+if __name__ == "__main__":
+    main()
@@ -14,6 +14,7 @@ import serial.tools.list_ports
 from typing import List, Dict, Optional
 import threading
 import queue
+import json
 
 class ESPLogReader:
     def __init__(self):
@@ -219,6 +220,53 @@ class ESPLogReader:
         except Exception as e:
             print(f"Error filtering logs: {e}")
 
+    def fetch_log_range(self, broker, intersection, lane, start=None, end=None, stats=False, timeout=30):
+        """
+        Fetch a time range ("YYYY-mm-dd HH:MM:SS") of one board's segmented log over MQTT
+        (handleLogCommand in esp_logger.h). The board answers on log_data with raw text
+        chunks and a closing {"end": ...} record; the lines are appended to self.log_file.
+        """
+        import paho.mqtt.client as mqtt
+        import mqtt_topics
+
+        request_topic = mqtt_topics.lane(intersection, lane, "log_request")
+        data_topic = mqtt_topics.lane(intersection, lane, "log_data")
+        done = threading.Event()
+        received = {"bytes": 0, "chunks": 0}
+
+        def on_message(client, userdata, message):
+            payload = message.payload.decode('utf-8', errors='replace')
+            if payload.startswith("{"):
+                print(payload)  # Closing record, stats or error
+                done.set()
+                return
+            received["bytes"] += len(message.payload)
+            received["chunks"] += 1
+            with open(self.log_file, 'a', encoding='utf-8') as f:
+                f.write(payload)
+
+        client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+        client.on_message = on_message
+        client.connect(broker, 1883)
+        client.subscribe(data_topic, qos=1)
+        client.loop_start()
+        time.sleep(0.5)  # Let the subscription settle before asking
+
+        command = {"cmd": "stats"} if stats else {"cmd": "range"}
+        if start:
+            command["from"] = start
+        if end:
+            command["to"] = end
+        started = time.time()
+        client.publish(request_topic, json.dumps(command), qos=1)
+        if not done.wait(timeout):
+            print(f"No complete answer from lane {lane} within {timeout} s")
+        client.loop_stop()
+        client.disconnect()
+        if not stats:
+            print(f"Fetched {received['bytes']} bytes in {received['chunks']} chunks "
+                  f"in {time.time() - started:.1f} s into {self.log_file}")
+
 def main():
     parser = argparse.ArgumentParser(description='ESP32 Traffic Light Log Reader')
     parser.add_argument('-m', '--monitor', action='store_true',
@@ -233,12 +281,25 @@ def main():
                        help='Filter logs by type (INFO, ERROR, MQTT, SYSTEM, etc.)')
     parser.add_argument('-p', '--ports', nargs='+',
                        help='Specify serial ports manually (e.g., /dev/ttyUSB0 /dev/ttyUSB1)')
+    parser.add_argument('--fetch', nargs='*', metavar='TIME',
+                       help='Fetch the log of --lane over MQTT, optionally from/to "YYYY-mm-dd HH:MM:SS"')
+    parser.add_argument('--log-stats', action='store_true',
+                       help='Ask the board of --lane for its log statistics over MQTT')
+    parser.add_argument('--broker', default='broker.emqx.io', help='MQTT broker for --fetch')
+    parser.add_argument('--intersection', default='1', help='Intersection id for --fetch')
     
     args = parser.parse_args()
     
     log_reader = ESPLogReader()
     
-    if args.monitor:
+    if args.fetch is not None or args.log_stats:
+        # Range of a board's log over MQTT
+        if not args.lane:
+            parser.error("--fetch and --log-stats need --lane")
+        bounds = (args.fetch or []) + [None, None]
+        log_reader.fetch_log_range(args.broker, args.intersection, args.lane, bounds[0], bounds[1],
+                                   stats=args.log_stats)
+    elif args.monitor:
         # Real-time monitoring
         log_reader.start_monitoring(args.ports)
     elif args.filter or args.lane or args.type:
@@ -0,0 +1,48 @@
+"""
+MQTT topic names, namespaced by intersection.
+
+Same layout as esp32_arduino_ide/*/mqtt_topics.h: site-wide messages use
+traffic/<intersection>/<leaf> and per-approach messages
+traffic/<intersection>/<lane>/<leaf>. Subscribe with site_wildcard() or
+lane_wildcard() so a coordinator only receives its own intersection's
+traffic, however many sites share the broker.
+"""
+
+DEFAULT_INTERSECTION = "1"
+
+# Per-approach leaves; everything else is site-wide
+LANE_LEAVES = ("vehicle_count", "duration", "countdown_sync", "cycle_stats", "log_request", "log_data",
+               "watchdog", "loop_stats", "ota", "ota_status", "tls", "discharge")
+
+
+def site(intersection, leaf):
+    """traffic/<intersection>/<leaf>"""
+    return f"traffic/{intersection}/{leaf}"
+
+
+def lane(intersection, lane_id, leaf):
+    """traffic/<intersection>/<lane>/<leaf>"""
+    return f"traffic/{intersection}/{lane_id}/{leaf}"
+
+
+def lane_wildcard(intersection, leaf):
+    """Filter matching `leaf` on every lane of one intersection"""
+    return f"traffic/{intersection}/+/{leaf}"
+
+
+def site_wildcard(intersection):
+    """Filter matching everything one intersection publishes"""
+    return f"traffic/{intersection}/#"
+
+
+def parse(topic):
+    """
+    Split a topic into (intersection, lane, leaf). lane is None for site-wide
+    topics; returns None for topics outside the traffic/ tree.
+    """
+    parts = topic.split("/")
+    if len(parts) < 3 or parts[0] != "traffic":
+        return None
+    if len(parts) >= 4 and parts[2].isdigit():
+        return parts[1], int(parts[2]), "/".join(parts[3:])
+    return parts[1], None, "/".join(parts[2:])
@@ -10,7 +10,6 @@ import time
 import numpy as np
 from ultralytics import YOLO
 import threading
-import queue
 from collections import defaultdict
 from datetime import datetime
 import paho.mqtt.client as mqtt
@@ -22,6 +21,13 @@ import os
 import sys
 import mysql.connector
 
+from approach_speed import ApproachSpeedEstimator
+from demand_forecast import DemandForecast
+from discharge_counter import DischargeCounter, parse_stop_line
+from frame_pipeline import Pipeline, DROP_OLDEST
+import intersection_snapshot
+import mqtt_topics
+
 # Define model path manually - change this if needed
 DEFAULT_MODEL_PATH = "Python/YOLOv11_trained_weights/train1.pt"
 
@@ -104,7 +110,9 @@ class SharedState:
 shared_state = SharedState()
 
 class LaneProcessor:
-    def __init__(self, rtsp_url, model_path, lane_id=1, confidence=0.25):
+    def __init__(self, rtsp_url, model_path, lane_id=1, confidence=0.25, meters_per_pixel=None,
+                 stream_interval=0, intersection=mqtt_topics.DEFAULT_INTERSECTION, stop_line=None,
+                 infer_workers=1, infer_size=0, pipeline_report=0):
         """
         Initialize lane processor for vehicle detection and counting
         
@@ -112,13 +120,22 @@ class LaneProcessor:
         :param model_path: Path to YOLO model  
         :param lane_id: Lane identifier (1-4)
         :param confidence: Detection confidence threshold
+        :param meters_per_pixel: Camera calibration along the approach; enables approach speed reporting
+        :param stream_interval: Also publish this lane's own count every N seconds (0 = off)
+        :param intersection: Intersection id, the namespace of every MQTT topic (traffic/<intersection>/...)
+        :param stop_line: (x1, y1, x2, y2) stop line in pixels; enables discharge reports for the saturation flow
+        :param infer_workers: Threads running the detector, each with its own model after the first
+        :param infer_size: Shrink frames to this many pixels on their longer side before detection (0 = off)
+        :param pipeline_report: Print the pipeline's per-stage metrics every N seconds (0 = only at exit)
         """
         self.rtsp_url = rtsp_url
         self.lane_id = lane_id
+        self.intersection = intersection
         self.confidence = confidence
         self.is_running = False
         
         # Load YOLO model (shared across lanes)
+        self.model_path = model_path
         try:
             self.model = YOLO(model_path)
             print(f"[Lane {self.lane_id}] ✅ YOLO model loaded: {model_path}")
@@ -127,6 +144,7 @@ class LaneProcessor:
             print(f"[Lane {self.lane_id}] Attempting to load default model from {DEFAULT_MODEL_PATH}")
             try:
                 self.model = YOLO(DEFAULT_MODEL_PATH)
+                self.model_path = DEFAULT_MODEL_PATH
                 print(f"[Lane {self.lane_id}] ✅ YOLO model loaded from default path: {DEFAULT_MODEL_PATH}")
             except Exception as e2:
                 print(f"[Lane {self.lane_id}] ❌ Failed to load default model: {e2}")
@@ -144,10 +162,51 @@ class LaneProcessor:
             self.tracker = Sort(max_age=20, min_hits=1, iou_threshold=0.4)
         else:
             self.tracker = None
-            
-        # Threading for performance
-        self.frame_queue = queue.Queue(maxsize=32)
-        self.result_queue = queue.Queue(maxsize=16)
+
+        # Approach speeds for the controller's clearance times (needs tracks and a calibration)
+        if self.tracker and meters_per_pixel:
+            self.speed_estimator = ApproachSpeedEstimator(meters_per_pixel)
+        else:
+            self.speed_estimator = None
+
+        # Stop line crossings of each green, from which the controller learns the saturation flow
+        if self.tracker and stop_line:
+            self.discharge_counter = DischargeCounter(stop_line)
+        else:
+            self.discharge_counter = None
+
+        # Streamed counts let the controllers decide the next phase during the current one
+        self.stream_interval = stream_interval
+        self.last_stream_time = 0
+
+        # Arrival forecast from the count growing while this lane's head is red
+        self.forecast = DemandForecast()
+        self.esp_green = False
+
+        # Latest intersection snapshot applied (intersection_snapshot.py)
+        self.snapshot = None
+            
+        # Staged pipeline: decode -> preprocess -> infer -> track -> publish (start_pipeline)
+        self.pipeline = None
+        self.infer_workers = max(1, infer_workers)
+        self.infer_size = infer_size
+        self.pipeline_report = pipeline_report
+        self.last_report_time = 0
+        self.frame_seq = 0
+        self.last_tracked_seq = -1
+        self.pending_sends = []  # DB and MQTT sends for the publish stage
+        self.worker_models = {}  # Infer worker thread id -> its model
+        self.model_lock = threading.Lock()
+
+        # Latest result for the display thread
+        self.display_lock = threading.Lock()
+        self.display_result = None
+
+        # Lane cycle state of the track stage
+        self.data_sent_in_current_period = False
+        self.data_send_initiated = False
+        self.in_startup_delay = True
+        self.first_cycle_after_startup = False
         
         # Performance tracking
         self.frame_count = 0
@@ -275,35 +334,97 @@ class LaneProcessor:
         if rc == 0:
             print(f"[Lane {self.lane_id}] ✅ Connected to MQTT broker")
             
-            # Subscribe to duration updates
-            self.mqtt_client.subscribe("traffic/duration")
-            self.mqtt_client.subscribe("traffic/duration/#")
-            self.mqtt_client.subscribe("traffic/vehicle_count")  # User's ESP sends duration in vehicle_count topic
-            self.mqtt_client.subscribe(f"traffic/command/{self.lane_id}")
-            self.mqtt_client.subscribe("traffic/command/all")
+            # Subscribe to duration updates; wildcards stay within this intersection
+            self.mqtt_client.subscribe(mqtt_topics.lane_wildcard(self.intersection, "duration"))
+            self.mqtt_client.subscribe(mqtt_topics.lane_wildcard(self.intersection, "vehicle_count"))  # User's ESP sends duration in vehicle_count topic
+            self.mqtt_client.subscribe(self.site_topic(f"command/{self.lane_id}"))
+            self.mqtt_client.subscribe(self.site_topic("command/all"))
             
             # Subscribe to sync topics
-            self.mqtt_client.subscribe("traffic/sync")
-            self.mqtt_client.subscribe("traffic/sync/#")
-            self.mqtt_client.subscribe(f"traffic/sync/{self.lane_id}")
+            self.mqtt_client.subscribe(self.site_topic("sync"))
+            self.mqtt_client.subscribe(self.site_topic("sync/#"))
             
             # NEW: Subscribe to countdown sync topic for ESP synchronization
-            self.mqtt_client.subscribe("traffic/countdown_sync")
+            self.mqtt_client.subscribe(mqtt_topics.lane_wildcard(self.intersection, "countdown_sync"))
             print(f"[Lane {self.lane_id}] 🔄 Subscribed to countdown sync topic")
             
             # Subscribe to ESP green status to handle lane switching
-            self.mqtt_client.subscribe("traffic/green_status")
-            self.mqtt_client.subscribe("traffic/next_lane_ready")
+            self.mqtt_client.subscribe(self.site_topic("green_status"))
+            self.mqtt_client.subscribe(self.site_topic("next_lane_ready"))
             print(f"[Lane {self.lane_id}] 🚦 Subscribed to ESP green status and lane switching topics")
             
+            # The retained snapshot puts a lane that joins mid-cycle in step at once
+            self.mqtt_client.subscribe(self.site_topic("snapshot"))
+            
             # Publish connection status
-            self.mqtt_client.publish(f"traffic/status/{self.lane_id}", "online", qos=1, retain=True)
+            self.mqtt_client.publish(self.site_topic(f"status/{self.lane_id}"), "online", qos=1, retain=True)
             
             # Sync lane status
             self.sync_lane_status()
         else:
             print(f"[Lane {self.lane_id}] ❌ MQTT connection failed: {rc}")
     
+    def site_topic(self, leaf):
+        """traffic/<intersection>/<leaf> of this lane's intersection"""
+        return mqtt_topics.site(self.intersection, leaf)
+    
+    def apply_snapshot(self, snapshot):
+        """
+        Take the intersection state from a snapshot: the active lane, the countdown and this
+        lane's timing follow from one message, so no sync offset has to be learnt
+        """
+        if not snapshot.supersedes(self.snapshot):
+            return
+        self.snapshot = snapshot
+        if not snapshot.is_current():
+            return  # Its writer went away mid-stage, wait for the live messages
+
+        current_time = time.time()
+        with shared_state.lock:
+            lead = snapshot.lead()
+            remaining = snapshot.remaining_s()
+            if shared_state.active_lane != lead:
+                shared_state.active_lane = lead
+                shared_state.last_switch_time = current_time
+            for lane_id in range(1, 5):
+                if lane_id in shared_state.lane_states:
+                    shared_state.lane_states[lane_id]['active'] = lane_id == lead
+                    if snapshot.green[lane_id - 1] > 0:
+                        shared_state.lane_states[lane_id]['duration_threshold'] = (
+                            snapshot.green[lane_id - 1] + self.green_to_red_transition + self.red_to_green_transition)
+            shared_state.current_countdown = int(remaining + 0.5)
+            shared_state.countdown_start_time = current_time
+            shared_state.countdown_active = snapshot.stage == "green"
+            shared_state.sync_established = True
+            shared_state.sync_offset = 0
+            shared_state.force_sync_next_cycle = False
+
+        # This lane's own timing, so that duration_remaining ends when its head turns red
+        if snapshot.green[self.lane_id - 1] > 0:
+            self.esp_green_duration = snapshot.green[self.lane_id - 1]
+            self.duration_threshold = (self.esp_green_duration + self.green_to_red_transition
+                                       + self.red_to_green_transition)
+        in_sequence = snapshot.is_active(self.lane_id)
+        self.esp_green = in_sequence and snapshot.stage == "green"
+        if in_sequence:
+            if snapshot.stage == "starting":
+                target_remaining = remaining + self.esp_green_duration + self.green_to_red_transition
+            elif snapshot.stage == "green":
+                target_remaining = remaining + self.green_to_red_transition
+            else:
+                target_remaining = remaining
+            start_time = current_time - max(0.0, self.duration_threshold - target_remaining)
+            with shared_state.lock:
+                shared_state.lane_states[self.lane_id]['last_send_time'] = start_time
+            self.is_active = True
+            self.last_mqtt_send_time = start_time
+            self.duration_remaining = target_remaining
+        else:
+            self.is_active = snapshot.stage == "idle" and snapshot.next_section == self.lane_id
+
+        print(f"[Lane {self.lane_id}] 📸 Snapshot v{snapshot.version}: lane {snapshot.lead()} {snapshot.stage}, "
+              f"{remaining:.1f}s left, next {snapshot.next_section}")
+
     def on_mqtt_disconnect(self, client, userdata, rc, *args):
         """MQTT disconnection callback"""
         print(f"[Lane {self.lane_id}] ⚠️  MQTT disconnected: {rc}")
@@ -317,8 +438,14 @@ class LaneProcessor:
             
             print(f"[Lane {self.lane_id}] 📩 MQTT Message: {topic}: {payload}")
             
+            # Only this intersection's topics are subscribed; dispatch on the leaf
+            parsed = mqtt_topics.parse(topic)
+            if parsed is None or parsed[0] != self.intersection:
+                return
+            leaf = parsed[2]
+            
             # NEW: Handle countdown sync messages from ESP
-            if topic == "traffic/countdown_sync":
+            if leaf == "countdown_sync":
                 try:
                     data = json.loads(payload.replace("'", "\""))
                     if ("lane_id" in data and "remaining_seconds" in data and 
@@ -392,8 +519,14 @@ class LaneProcessor:
                 except json.JSONDecodeError as e:
                     print(f"[Lane {self.lane_id}] ❌ Error parsing countdown sync JSON: {e}")
             
+            # Versioned state of the whole intersection, retained by the broker
+            elif leaf == "snapshot":
+                snapshot = intersection_snapshot.parse(payload)
+                if snapshot is not None:
+                    self.apply_snapshot(snapshot)
+            
             # Handle ESP green status messages for lane switching
-            elif topic == "traffic/green_status":
+            elif leaf == "green_status":
                 try:
                     data = json.loads(payload.replace("'", "\""))
                     if "section" in data and "status" in data:
@@ -401,6 +534,11 @@ class LaneProcessor:
                         esp_status = data["status"]
                         
                         print(f"[Lane {self.lane_id}] 🚦 ESP Section {esp_section} status: {esp_status}")
+
+                        if esp_section == self.lane_id:
+                            self.esp_green = esp_status == "green"
+                            if self.esp_green:
+                                self.forecast.break_interval()
                         
                         # When ESP goes to RED, trigger lane switching in Python
                         if esp_status == "red" and esp_section == self.lane_id:
@@ -457,7 +595,7 @@ class LaneProcessor:
                                             "timestamp": current_time,
                                             "source": "python_esp_red_trigger"
                                         }
-                                        self.mqtt_client.publish("traffic/green_permission", 
+                                        self.mqtt_client.publish(self.site_topic("green_permission"), 
                                                                json.dumps(green_permission_data), qos=1)
                                         print(f"[LANE SWITCH] Published green permission for Lane {next_lane_id}")
                                 elif self.is_active:
@@ -508,7 +646,7 @@ class LaneProcessor:
                     print(f"[Lane {self.lane_id}] ❌ Error parsing green status JSON: {e}")
             
             # Handle next lane ready messages from ESP
-            elif topic == "traffic/next_lane_ready":
+            elif leaf == "next_lane_ready":
                 try:
                     data = json.loads(payload.replace("'", "\""))
                     if "next_expected_section" in data and "from_lane" in data:
@@ -550,7 +688,7 @@ class LaneProcessor:
                     print(f"[Lane {self.lane_id}] ❌ Error parsing next lane ready JSON: {e}")
             
             # Process traffic duration messages
-            elif topic == "traffic/duration" or topic == "traffic/vehicle_count":
+            elif leaf == "duration" or leaf == "vehicle_count":
                 # Deserialize JSON payload
                 try:
                     data = json.loads(payload.replace("'", "\""))
@@ -613,7 +751,7 @@ class LaneProcessor:
                     print(f"[Lane {self.lane_id}] ❌ Error parsing duration JSON: {e}")
             
             # Handle sync commands
-            elif message.topic == "traffic/sync" or message.topic.startswith("traffic/sync/"):
+            elif leaf == "sync" or leaf.startswith("sync/"):
                 try:
                     data = json.loads(payload)
                     command = data.get("command")
@@ -651,7 +789,7 @@ class LaneProcessor:
                     print(f"[Lane {self.lane_id}] Sync JSON decode error: {e}")
             
             # Handle command messages (following nod.py pattern)
-            elif message.topic == f"traffic/command/{self.lane_id}" or message.topic == "traffic/command/all":
+            elif leaf == f"command/{self.lane_id}" or leaf == "command/all":
                 try:
                     data = json.loads(payload)
                     command = data.get("command")
@@ -697,7 +835,7 @@ class LaneProcessor:
                                 print(f"[Lane {self.lane_id}] 🔄 Forced sync - starting fresh cycle with RED>GREEN transition")
                     
                     # Acknowledge command
-                    self.mqtt_client.publish(f"traffic/command_ack/{self.lane_id}", 
+                    self.mqtt_client.publish(self.site_topic(f"command_ack/{self.lane_id}"), 
                                            json.dumps({
                                                "received": command,
                                                "timestamp": datetime.now().strftime('%Y-%m-%d %H:%M:%S')
@@ -748,7 +886,7 @@ class LaneProcessor:
             message = json.dumps(sync_data)
             
             # Publish countdown sync
-            result = self.mqtt_client.publish("traffic/countdown_sync", message, qos=1)
+            result = self.mqtt_client.publish(mqtt_topics.lane(self.intersection, self.lane_id, "countdown_sync"), message, qos=1)
             
             if result[0] == 0:
                 print(f"[Lane {self.lane_id}] 📡 Published countdown sync: {remaining_seconds}s remaining")
@@ -812,7 +950,7 @@ class LaneProcessor:
                                 "timestamp": current_time,
                                 "source": "python_timeout_protection"
                             }
-                            self.mqtt_client.publish("traffic/green_permission", 
+                            self.mqtt_client.publish(self.site_topic("green_permission"), 
                                                    json.dumps(green_permission_data), qos=1)
                             print(f"[TIMEOUT SWITCH] Published green permission for Lane {next_lane_id}")
                 
@@ -839,7 +977,7 @@ class LaneProcessor:
             # Publish current status
             status = "active" if self.is_active else "standby"
             if hasattr(self, 'mqtt_client') and self.mqtt_client:
-                self.mqtt_client.publish(f"traffic/lane_status/{self.lane_id}", 
+                self.mqtt_client.publish(self.site_topic(f"lane_status/{self.lane_id}"), 
                                         json.dumps({
                                             "status": status,
                                             "lane_id": self.lane_id,
@@ -1075,550 +1213,582 @@ class LaneProcessor:
         print(f"[Lane {self.lane_id}] ❌ Failed to connect after {retry_attempts} attempts")
         return None
     
-    def fetch_frames(self):
-        """Fetch frames from RTSP stream in separate thread"""
-        while self.is_running:
-            try:
-                if self.cap and self.cap.isOpened():
-                    ret, frame = self.cap.read()
-                    if ret and frame is not None:
-                        # Add frame to queue (drop old frames if queue is full)
-                        if not self.frame_queue.full():
-                            self.frame_queue.put(frame)
+    def decode_frame(self):
+        """decode stage: the next frame of the RTSP stream, or None while there is none"""
+        try:
+            if self.cap and self.cap.isOpened():
+                ret, frame = self.cap.read()
+                if ret and frame is not None:
+                    self.frame_seq += 1
+                    return {'seq': self.frame_seq, 'frame': frame}
+                # Reconnect if stream fails
+                print(f"[Lane {self.lane_id}] ⚠️  Stream lost, reconnecting...")
+                self.cap.release()
+                self.cap = self.connect_to_stream(retry_attempts=2)
+            else:
+                time.sleep(0.1)
+        except Exception as e:
+            print(f"[Lane {self.lane_id}] ❌ Frame fetch error: {e}")
+            time.sleep(0.5)
+        return None
+
+    def preprocess_frame(self, item):
+        """preprocess stage: decides whether the frame is detected and shrinks it for the model"""
+        with shared_state.lock:
+            item['detect'] = shared_state.system_started
+        frame = item['frame']
+        height, width = frame.shape[:2]
+        if item['detect'] and self.infer_size and max(height, width) > self.infer_size:
+            item['scale'] = self.infer_size / max(height, width)
+            item['input'] = cv2.resize(frame, (round(width * item['scale']), round(height * item['scale'])),
+                                       interpolation=cv2.INTER_AREA)
+        else:
+            item['scale'], item['input'] = 1.0, frame
+        return item
+
+    def detector(self):
+        """The calling infer worker's model: YOLO prediction is not thread-safe, so every worker after the first loads its own.
+        Keyed by thread id, as native workers get a fresh threading.local() on every call into Python."""
+        worker = threading.get_ident()
+        model = self.worker_models.get(worker)
+        if model is None:
+            with self.model_lock:
+                model = self.model if not self.worker_models else YOLO(self.model_path)
+                self.worker_models[worker] = model
+        return model
+
+    def infer_frame(self, item):
+        """infer stage: YOLO detections with confidence >= 0.60, in frame pixels"""
+        image = item.pop('input')
+        item['results'], item['names'], item['detections'] = None, {}, []
+        if not item['detect']:
+            return item  # Startup delay: the frame is only shown
+
+        results = self.detector()(image, conf=self.confidence, verbose=False)
+        item['results'] = results[0]
+        try:
+            if results[0] is not None and hasattr(results[0], 'boxes') and results[0].boxes is not None:
+                boxes = results[0].boxes.xyxy.cpu().numpy() if hasattr(results[0].boxes, 'xyxy') else None
+                scores = results[0].boxes.conf.cpu().numpy() if hasattr(results[0].boxes, 'conf') else None
+                classes = results[0].boxes.cls.cpu().numpy() if hasattr(results[0].boxes, 'cls') else None
+
+                if boxes is not None and scores is not None and classes is not None:
+                    item['names'] = results[0].names
+                    for box, score, cls in zip(boxes, scores, classes):
+                        # Only process detections with confidence >= 0.60
+                        if score >= 0.60 and results[0].names[int(cls)].lower() in self.vehicle_classes:
+                            box = box / item['scale']
+                            item['detections'].append([box[0], box[1], box[2], box[3], score, int(cls)])
+        except Exception as e:
+            print(f"[Lane {self.lane_id}] Detection error: {e}")
+        return item
+
+    def track_frame(self, item):
+        """track stage: lane timing, tracking, counting and the sends they trigger; returns the display result"""
+        if item['seq'] < self.last_tracked_seq:
+            return None  # Overtaken by a later frame from another infer worker
+        self.last_tracked_seq = item['seq']
+        current_time = time.time()
+        frame, detections, names = item['frame'], item['detections'], item['names']
+
+        self.update_startup(current_time)
+
+        # Handle lane activation logic (following nod.py pattern) - ONLY AFTER STARTUP
+        with shared_state.lock:
+            system_started = shared_state.system_started
+
+        if system_started:  # Only run normal lane logic after startup delay
+            self.update_lane_timing(current_time)
+        else:
+            # During startup delay, keep lanes in standby mode
+            self.is_active = False
+            self.duration_remaining = self.duration_threshold
+
+        # Check if we're in startup delay
+        with shared_state.lock:
+            self.in_startup_delay = not shared_state.system_started
+
+        tracked_objects = []
+        if self.in_startup_delay or not item['detect']:
+            # During startup delay, skip detection but still show frames
+            h, w = frame.shape[:2]
+            cv2.putText(frame, "DETECTION PAUSED - STARTUP DELAY",
+                       (w//2 - 200, 30), cv2.FONT_HERSHEY_SIMPLEX,
+                       0.8, (0, 0, 255), 2)
+        else:
+            tracked_objects = self.count_vehicles(detections, names)
+
+        # Regular timed data sending (last 5 seconds) - ONLY AFTER STARTUP
+        with shared_state.lock:
+            system_started = shared_state.system_started
+        self.send_lane_data(current_time, system_started)
+        self.sync_countdown(current_time, system_started)
+
+        # Create frame_vehicles for display - include ALL detected vehicles
+        frame_vehicles = []
+        if len(tracked_objects) > 0:
+            # Use tracked objects when available
+            for bbox, track_id, class_name in tracked_objects:
+                x1, y1, x2, y2 = bbox
+                frame_vehicles.append((class_name, (x1, y1, x2, y2, track_id)))
+        else:
+            # Fallback for direct detections - include ALL detections
+            for i, det in enumerate(detections):
+                class_name = names[int(det[5])].lower()
+                if class_name in self.vehicle_classes:
+                    x1, y1, x2, y2 = det[0], det[1], det[2], det[3]
+                    score = det[4]  # Include confidence score
+                    frame_vehicles.append((class_name, (x1, y1, x2, y2, i)))
+
+        # Update frame counter and FPS
+        self.frame_count += 1
+        self.fps_counter += 1
+
+        # Calculate FPS
+        if current_time - self.last_fps_time >= 1.0:
+            self.fps = self.fps_counter
+            self.fps_counter = 0
+            self.last_fps_time = current_time
+
+        # Garbage collection
+        if current_time - self.last_gc_time >= self.gc_interval:
+            gc.collect()
+            self.last_gc_time = current_time
+
+        for send in self.pending_sends:
+            self.pipeline.submit(self.publish_stage, send)
+        self.pending_sends = []
+
+        return {
+            'frame': frame,
+            'results': item['results'],
+            'tracked': tracked_objects,
+            'detections': len(detections),
+            'vehicles': frame_vehicles
+        }
+
+    def update_startup(self, current_time):
+        """Startup delay (following nod.py pattern): Lane 1 sends its own data at 18 s and becomes active at the end"""
+        with shared_state.lock:
+            if not shared_state.system_started:
+                elapsed_startup = current_time - shared_state.startup_time
+
+                # Check if we should send startup data (2 seconds before end = at 18 seconds)
+                if (elapsed_startup >= 18 and not shared_state.startup_data_sent and 
+                    self.lane_id == 1):
+                    print(f"[Lane 1] 🚀 Sending startup data at 18s (2s before delay ends)")
+                    shared_state.startup_data_sent = True
+
+                    # Send Lane 1's own data during startup (publish stage, DB first)
+                    self.queue_send(self.log_traffic_data_startup)
+                    self.queue_send(self.publish_vehicle_count_startup)
+
+                if elapsed_startup >= shared_state.startup_delay:
+                    shared_state.system_started = True
+                    self.in_startup_delay = False
+                    print(f"[SYSTEM] 🚀 Startup delay complete - Lane 1 becoming active")
+
+                    # Mark that this is the first cycle after startup
+                    if self.lane_id == 1:
+                        self.first_cycle_after_startup = True
+                        print(f"[Lane 1] First cycle after startup - normal operation begins")
+
+                    # Ensure Lane 1 is properly set as active
+                    shared_state.active_lane = 1
+                    for lane_id in range(1, 5):
+                        is_active = (lane_id == 1)
+                        if lane_id in shared_state.lane_states:
+                            shared_state.lane_states[lane_id]['active'] = is_active
+                            if is_active:
+                                shared_state.lane_states[lane_id]['last_send_time'] = current_time
+                else:
+                    # Still in startup delay
+                    self.in_startup_delay = True
+                    remaining_startup = shared_state.startup_delay - elapsed_startup
+                    if self.lane_id == 1:  # Only show countdown from Lane 1
+                        print(f"[SYSTEM] 🕐 Startup delay: {remaining_startup:.1f}s remaining")
+
+                    # Don't skip frame processing during startup delay
+                    # Instead, we'll show the frames but skip detection
+
+    def update_lane_timing(self, current_time):
+        """Activation, phase timing and switching of this lane once the system has started"""
+        with shared_state.lock:
+            # Check if this lane just became active
+            if self.is_active == False and shared_state.active_lane == self.lane_id:
+                print(f"[CRITICAL] Lane {self.lane_id} detected it just became active")
+                self.is_active = True
+                self.last_mqtt_send_time = current_time  # Start fresh cycle
+                self.became_active_time = current_time
+                self.sent_data_after_delay = False
+                self.duration_remaining = self.duration_threshold  # Start with full duration
+
+                # Update in shared state
+                shared_state.lane_states[self.lane_id]['last_send_time'] = current_time
+                shared_state.lane_states[self.lane_id]['active'] = True
+
+                # Reset data sending flags
+                self.data_sent_in_current_period = False
+                self.data_send_initiated = False
+                if self.lane_id in shared_state.data_sending_status:
+                    shared_state.data_sending_status[self.lane_id]['sending'] = False
+                    shared_state.data_sending_status[self.lane_id]['completed'] = False
+
+                print(f"[Lane {self.lane_id}] ✅ FRESH CYCLE START: RED>GREEN(4s) -> GREEN -> GREEN>RED(4s)")
+
+            # Handle lane timing and switching for active lane
+            if self.is_active:
+                elapsed_time = int(current_time - self.last_mqtt_send_time)
+                previous_remaining = self.duration_remaining
+                self.duration_remaining = max(0, self.duration_threshold - elapsed_time)
+
+                # Log phase transitions for clarity
+                red_to_green = self.red_to_green_transition  # Use instance variable (3s)
+                green_to_red = self.green_to_red_transition   # Use instance variable (3s)
+                esp_duration = self.esp_green_duration        # Use actual ESP duration
+
+                # Red-to-Green transition ending
+                if (previous_remaining > (esp_duration + green_to_red) and 
+                    self.duration_remaining <= (esp_duration + green_to_red) and 
+                    self.duration_remaining > green_to_red):
+                    print(f"[Lane {self.lane_id}] 🟢 RED>GREEN COMPLETE - ENTERING GREEN PHASE ({esp_duration}s)")
+
+                # Green phase ending
+                elif (previous_remaining > green_to_red and 
+                      self.duration_remaining <= green_to_red and 
+                      self.duration_remaining > 0):
+                    print(f"[Lane {self.lane_id}] 🟡 GREEN PHASE ENDED ({esp_duration}s) - ENTERING GREEN>RED TRANSITION ({green_to_red}s)")
+
+                # Check if this lane has completed sending data when duration is up
+                if elapsed_time >= self.duration_threshold:
+                    # Check if we have completed sending data
+                    data_sending_complete = True
+                    if self.lane_id in shared_state.data_sending_status:
+                        if shared_state.data_sending_status[self.lane_id]['sending'] == True:
+                            data_sending_complete = False
+                            shared_state.switching_blocked = True
+                            print(f"[Lane {self.lane_id}] Blocking lane switch - still sending data")
+                        elif not self.data_sent_in_current_period and not self.data_send_initiated:
+                            print(f"[Lane {self.lane_id}] Duration elapsed but data not sent yet - forcing send")
+                            self.queue_send(self.log_traffic_data)
+                            self.queue_send(self.publish_vehicle_count)
+                            self.data_send_initiated = True
+                            shared_state.data_sending_status[self.lane_id]['sending'] = True
+                            shared_state.switching_blocked = True
+                            data_sending_complete = False
                         else:
-                            # Drop oldest frame and add new one
-                            try:
-                                self.frame_queue.get_nowait()
-                                self.frame_queue.put(frame)
-                            except:
-                                pass
-                    else:
-                        # Reconnect if stream fails
-                        print(f"[Lane {self.lane_id}] ⚠️  Stream lost, reconnecting...")
-                        self.cap.release()
-                        self.cap = self.connect_to_stream(retry_attempts=2)
-                        if not self.cap:
-                            break
+                            data_sending_complete = True
+                            shared_state.switching_blocked = False
+
+                    # Only switch if data sending is complete
+                    if data_sending_complete and not shared_state.switching_blocked:
+                        # Determine next lane in sequence (1→2→3→4→1)
+                        next_lane_id = (self.lane_id % 4) + 1
+
+                        print(f"[Lane {self.lane_id}] Duration elapsed, switching to Lane {next_lane_id}")
+                        shared_state.active_lane = next_lane_id
+                        shared_state.last_switch_time = current_time
+                        self.is_active = False
+
+                        # Update all lane states
+                        for lane_id in range(1, 5):
+                            is_next = (lane_id == next_lane_id)
+                            if lane_id in shared_state.lane_states:
+                                shared_state.lane_states[lane_id]['active'] = is_next
+                                if is_next:
+                                    # CRITICAL FIX: Set new lane timer to START of cycle (RED>GREEN phase)
+                                    shared_state.lane_states[lane_id]['last_send_time'] = current_time
+                                    print(f"[CRITICAL] Lane {lane_id} starts fresh cycle: RED>GREEN(4s) -> GREEN -> GREEN>RED(4s)")
+                                    if lane_id in shared_state.data_sending_status:
+                                        shared_state.data_sending_status[lane_id]['sending'] = False
+                                        shared_state.data_sending_status[lane_id]['completed'] = False
+
+                        # Reset our tracking variables
+                        self.last_mqtt_send_time = current_time
+                        self.data_sent_in_current_period = False
+                        self.data_send_initiated = False
+                        self.first_cycle_after_startup = False  # Ensure normal behavior for subsequent cycles
+                        self.clear_queues()
+
+                # If we're approaching the end of our duration, prepare next lane data
+                if self.duration_remaining <= 4 and shared_state.next_lane_trigger_time is None:
+                    next_lane_id = (self.lane_id % 4) + 1
+                    shared_state.next_lane_trigger_time = current_time
+                    print(f"[Lane {self.lane_id}] Preparing Lane {next_lane_id} data - GREEN>RED phase: {self.duration_remaining}s remaining")
+
+                    # Ensure next lane has timer set
+                    if next_lane_id in shared_state.lane_states:
+                        shared_state.lane_states[next_lane_id]['last_send_time'] = current_time
+
+            # Update lane status from shared state
+            self.is_active = (shared_state.active_lane == self.lane_id)
+            if self.lane_id in shared_state.lane_states:
+                shared_state.lane_states[self.lane_id]['active'] = self.is_active
+
+    def count_vehicles(self, detections, names):
+        """Tracks the detections, updates the counts and this lane's shared data; returns the tracked objects"""
+        # Update tracking if available
+        tracked_objects = []
+        class_names = []
+        if self.tracker and len(detections) > 0:
+            # Extract class names for tracker
+            for det in detections:
+                class_name = names[int(det[5])].lower()
+                class_names.append(class_name)
+
+            tracked_objects = self.tracker.update(np.array(detections), class_names)
+            if self.speed_estimator:
+                self.speed_estimator.update(tracked_objects)
+
+        if self.discharge_counter:
+            report = self.discharge_counter.update(tracked_objects, self.esp_green)
+            if report is not None:
+                self.publish_discharge(report)
+
+        # Count vehicles based on tracking results OR direct detections
+        current_vehicle_counts = defaultdict(int)
+        if len(tracked_objects) > 0:
+            # Use tracking results
+            for bbox, track_id, class_name in tracked_objects:
+                if class_name in self.vehicle_classes:
+                    current_vehicle_counts[class_name] += 1
+        else:
+            # Fallback to direct detection counting (without SORT)
+            if len(detections) > 0:
+                for det in detections:
+                    class_name = names[int(det[5])].lower()
+                    if class_name in self.vehicle_classes:
+                        current_vehicle_counts[class_name] += 1
+
+        # Update vehicle counts
+        self.vehicle_counts = dict(current_vehicle_counts)
+        self.total_vehicles = sum(current_vehicle_counts.values())
+
+        # Store our data in shared state for other lanes to access
+        with shared_state.lock:
+            lane_data = {
+                "road_section_id": self.lane_id,
+                "total_vehicles": self.total_vehicles,
+                "vehicle_counts": dict(current_vehicle_counts),
+                "timestamp": datetime.now().strftime('%Y-%m-%d %H:%M:%S')
+            }
+            speed = self.speed_estimator.speed_kph() if self.speed_estimator else None
+            if speed is not None:
+                lane_data["approach_speed_kph"] = speed
+            if not self.esp_green:
+                self.forecast.observe_red(self.total_vehicles)
+            rate = self.forecast.rate_per_minute()
+            if rate is not None:
+                lane_data["arrival_rate_vpm"] = rate
+            shared_state.lane_data[self.lane_id] = lane_data
+
+        if self.stream_interval > 0 and time.time() - self.last_stream_time >= self.stream_interval:
+            self.stream_own_count(lane_data)
+        return tracked_objects
+
+    def send_lane_data(self, current_time, system_started):
+        """Send data at start of green-to-red transition (4 seconds remaining)"""
+        if (system_started and self.is_active and self.duration_remaining <= 4 and 
+            not self.waiting_for_mqtt_response and not self.data_send_initiated):
+
+            # Check if we're not in switching process
+            switching_in_progress = False
+            with shared_state.lock:
+                switching_in_progress = (current_time - shared_state.last_switch_time < 1.0)
+
+            if not switching_in_progress:
+                # Determine which phase we're in for clearer messaging
+                red_to_green = self.red_to_green_transition
+                green_to_red = self.green_to_red_transition
+                esp_duration = self.esp_green_duration
+
+                if self.duration_remaining > (esp_duration + green_to_red):
+                    red_green_remaining = self.duration_remaining - (esp_duration + green_to_red)
+                    print(f"[Lane {self.lane_id}] 📡 Sending data - RED>GREEN: {red_green_remaining}s")
+                elif self.duration_remaining > green_to_red:
+                    green_remaining = self.duration_remaining - green_to_red
+                    print(f"[Lane {self.lane_id}] 📡 Sending data - GREEN: {green_remaining}s")
                 else:
-                    time.sleep(0.1)
-            except Exception as e:
-                print(f"[Lane {self.lane_id}] ❌ Frame fetch error: {e}")
-                time.sleep(0.5)
-    
-    def process_frames(self):
-        """Process frames with sophisticated timing logic from nod.py"""
-        # Track data sending status for this lane
-        data_sent_in_current_period = False
-        data_send_initiated = False
-        
-        # Flag to indicate if we're in startup delay
-        in_startup_delay = True
-        
-        # Track if this is the very first cycle after startup
-        first_cycle_after_startup = False
-        
-        while self.is_running:
-            try:
-                current_time = time.time()
-                
-                                    # Check if system is still in startup delay (following nod.py pattern)
+                    print(f"[Lane {self.lane_id}] 📡 Sending data - GREEN>RED PHASE: {self.duration_remaining}s remaining")
+
+                # Mark data sending as in progress
                 with shared_state.lock:
-                    if not shared_state.system_started:
-                        elapsed_startup = current_time - shared_state.startup_time
-                        
-                        # Check if we should send startup data (2 seconds before end = at 18 seconds)
-                        if (elapsed_startup >= 18 and not shared_state.startup_data_sent and 
-                            self.lane_id == 1):
-                            print(f"[Lane 1] 🚀 Sending startup data at 18s (2s before delay ends)")
-                            shared_state.startup_data_sent = True
-                            
-                            # Send Lane 1's own data during startup
-                            threading.Timer(0.1, lambda: self.log_traffic_data_startup()).start()
-                            threading.Timer(0.3, lambda: self.publish_vehicle_count_startup()).start()
-                        
-                        if elapsed_startup >= shared_state.startup_delay:
-                            shared_state.system_started = True
-                            in_startup_delay = False
-                            print(f"[SYSTEM] 🚀 Startup delay complete - Lane 1 becoming active")
-                            
-                            # Mark that this is the first cycle after startup
-                            if self.lane_id == 1:
-                                first_cycle_after_startup = True
-                                print(f"[Lane 1] First cycle after startup - normal operation begins")
-                            
-                            # Ensure Lane 1 is properly set as active
-                            shared_state.active_lane = 1
-                            for lane_id in range(1, 5):
-                                is_active = (lane_id == 1)
-                                if lane_id in shared_state.lane_states:
-                                    shared_state.lane_states[lane_id]['active'] = is_active
-                                    if is_active:
-                                        shared_state.lane_states[lane_id]['last_send_time'] = current_time
-                        else:
-                            # Still in startup delay
-                            in_startup_delay = True
-                            remaining_startup = shared_state.startup_delay - elapsed_startup
-                            if self.lane_id == 1:  # Only show countdown from Lane 1
-                                print(f"[SYSTEM] 🕐 Startup delay: {remaining_startup:.1f}s remaining")
-                            
-                            # Don't skip frame processing during startup delay
-                            # Instead, we'll show the frames but skip detection
-                
-                if not self.frame_queue.empty():
-                    frame = self.frame_queue.get()
-                    
-                    # Handle lane activation logic (following nod.py pattern) - ONLY AFTER STARTUP
-                    with shared_state.lock:
-                        system_started = shared_state.system_started
-                    
-                    if system_started:  # Only run normal lane logic after startup delay
+                    if self.lane_id in shared_state.data_sending_status:
+                        shared_state.data_sending_status[self.lane_id]['sending'] = True
+                        shared_state.data_sending_status[self.lane_id]['completed'] = False
+
+                # Send data on the publish stage so the detection keeps running (DB first, then MQTT)
+                self.queue_send(self.log_traffic_data)
+                self.queue_send(self.publish_vehicle_count)
+
+                # Update tracking variables
+                self.waiting_for_mqtt_response = True
+                self.data_send_initiated = True
+                print(f"[Lane {self.lane_id}] Data send initiated (DB + MQTT), waiting for response")
+
+    def sync_countdown(self, current_time, system_started):
+        """Publish countdown sync every 2 seconds during active phase"""
+        if (system_started and self.is_active and 
+            int(current_time) % 2 == 0 and  # Every 2 seconds
+            int(current_time) != getattr(self, 'last_sync_publish_time', 0)):  # Avoid duplicate sends
+
+            self.last_sync_publish_time = int(current_time)
+
+            # Check if we're still the active lane before publishing sync
+            with shared_state.lock:
+                still_active = (shared_state.active_lane == self.lane_id)
+
+            # CRITICAL FIX: Stop publishing countdown sync if cycle is complete (duration_remaining <= 0)
+            # ENHANCED FIX: Also check if countdown is still active and ESP hasn't gone RED yet
+            with shared_state.lock:
+                countdown_should_continue = (still_active and 
+                                           self.duration_remaining > 0 and 
+                                           shared_state.countdown_active)
+
+            if countdown_should_continue:
+                # Additional check: Only one lane should publish countdown sync at a time
+                other_lanes_publishing = False
+                with shared_state.lock:
+                    for other_lane_id in range(1, 5):
+                        if (other_lane_id != self.lane_id and 
+                            other_lane_id in shared_state.data_sending_status and
+                            hasattr(shared_state, 'last_countdown_publisher') and
+                            shared_state.last_countdown_publisher == other_lane_id and
+                            time.time() - getattr(shared_state, 'last_countdown_time', 0) < 3):
+                            other_lanes_publishing = True
+                            break
+
+                if not other_lanes_publishing and shared_state.countdown_active:
+                    # Only publish countdown sync if ESP has started the green phase
+                    # Determine current phase for sync message
+                    red_to_green = self.red_to_green_transition
+                    green_to_red = self.green_to_red_transition
+                    esp_duration = self.esp_green_duration
+
+                    if self.duration_remaining > (esp_duration + green_to_red):
+                        current_phase = "red_to_green"
+                        # Don't publish countdown sync during red-to-green phase
+                        print(f"[Lane {self.lane_id}] ⏸️ In red-to-green phase - waiting for ESP green signal")
+                    elif self.duration_remaining > green_to_red:
+                        current_phase = "green"
+                        # Mark this lane as the countdown publisher
                         with shared_state.lock:
-                            # Check if this lane just became active
-                            if self.is_active == False and shared_state.active_lane == self.lane_id:
-                                print(f"[CRITICAL] Lane {self.lane_id} detected it just became active")
-                                self.is_active = True
-                                self.last_mqtt_send_time = current_time  # Start fresh cycle
-                                self.became_active_time = current_time
-                                self.sent_data_after_delay = False
-                                self.duration_remaining = self.duration_threshold  # Start with full duration
-                                
-                                # Update in shared state
-                                shared_state.lane_states[self.lane_id]['last_send_time'] = current_time
-                                shared_state.lane_states[self.lane_id]['active'] = True
-                                
-                                # Reset data sending flags
-                                data_sent_in_current_period = False
-                                data_send_initiated = False
-                                if self.lane_id in shared_state.data_sending_status:
-                                    shared_state.data_sending_status[self.lane_id]['sending'] = False
-                                    shared_state.data_sending_status[self.lane_id]['completed'] = False
-                                
-                                print(f"[Lane {self.lane_id}] ✅ FRESH CYCLE START: RED>GREEN(4s) -> GREEN -> GREEN>RED(4s)")
-                            
-                            # Handle lane timing and switching for active lane
-                            if self.is_active:
-                                elapsed_time = int(current_time - self.last_mqtt_send_time)
-                                previous_remaining = self.duration_remaining
-                                self.duration_remaining = max(0, self.duration_threshold - elapsed_time)
-                                
-                                # Log phase transitions for clarity
-                                red_to_green = self.red_to_green_transition  # Use instance variable (3s)
-                                green_to_red = self.green_to_red_transition   # Use instance variable (3s)
-                                esp_duration = self.esp_green_duration        # Use actual ESP duration
-                                
-                                # Red-to-Green transition ending
-                                if (previous_remaining > (esp_duration + green_to_red) and 
-                                    self.duration_remaining <= (esp_duration + green_to_red) and 
-                                    self.duration_remaining > green_to_red):
-                                    print(f"[Lane {self.lane_id}] 🟢 RED>GREEN COMPLETE - ENTERING GREEN PHASE ({esp_duration}s)")
-                                
-                                # Green phase ending
-                                elif (previous_remaining > green_to_red and 
-                                      self.duration_remaining <= green_to_red and 
-                                      self.duration_remaining > 0):
-                                    print(f"[Lane {self.lane_id}] 🟡 GREEN PHASE ENDED ({esp_duration}s) - ENTERING GREEN>RED TRANSITION ({green_to_red}s)")
-                                
-                                # Check if this lane has completed sending data when duration is up
-                                if elapsed_time >= self.duration_threshold:
-                                    # Check if we have completed sending data
-                                    data_sending_complete = True
-                                    if self.lane_id in shared_state.data_sending_status:
-                                        if shared_state.data_sending_status[self.lane_id]['sending'] == True:
-                                            data_sending_complete = False
-                                            shared_state.switching_blocked = True
-                                            print(f"[Lane {self.lane_id}] Blocking lane switch - still sending data")
-                                        elif not data_sent_in_current_period and not data_send_initiated:
-                                            print(f"[Lane {self.lane_id}] Duration elapsed but data not sent yet - forcing send")
-                                            threading.Timer(0.1, self.log_traffic_data).start()
-                                            threading.Timer(0.3, self.publish_vehicle_count).start()
-                                            data_send_initiated = True
-                                            shared_state.data_sending_status[self.lane_id]['sending'] = True
-                                            shared_state.switching_blocked = True
-                                            data_sending_complete = False
-                                        else:
-                                            data_sending_complete = True
-                                            shared_state.switching_blocked = False
-                                    
-                                    # Only switch if data sending is complete
-                                    if data_sending_complete and not shared_state.switching_blocked:
-                                        # Determine next lane in sequence (1→2→3→4→1)
-                                        next_lane_id = (self.lane_id % 4) + 1
-                                        
-                                        print(f"[Lane {self.lane_id}] Duration elapsed, switching to Lane {next_lane_id}")
-                                        shared_state.active_lane = next_lane_id
-                                        shared_state.last_switch_time = current_time
-                                        self.is_active = False
-                                        
-                                        # Update all lane states
-                                        for lane_id in range(1, 5):
-                                            is_next = (lane_id == next_lane_id)
-                                            if lane_id in shared_state.lane_states:
-                                                shared_state.lane_states[lane_id]['active'] = is_next
-                                                if is_next:
-                                                    # CRITICAL FIX: Set new lane timer to START of cycle (RED>GREEN phase)
-                                                    shared_state.lane_states[lane_id]['last_send_time'] = current_time
-                                                    print(f"[CRITICAL] Lane {lane_id} starts fresh cycle: RED>GREEN(4s) -> GREEN -> GREEN>RED(4s)")
-                                                    if lane_id in shared_state.data_sending_status:
-                                                        shared_state.data_sending_status[lane_id]['sending'] = False
-                                                        shared_state.data_sending_status[lane_id]['completed'] = False
-                                        
-                                        # Reset our tracking variables
-                                        self.last_mqtt_send_time = current_time
-                                        data_sent_in_current_period = False
-                                        data_send_initiated = False
-                                        first_cycle_after_startup = False  # Ensure normal behavior for subsequent cycles
-                                        self.clear_queues()
-                                
-                                # If we're approaching the end of our duration, prepare next lane data
-                                if self.duration_remaining <= 4 and shared_state.next_lane_trigger_time is None:
-                                    next_lane_id = (self.lane_id % 4) + 1
-                                    shared_state.next_lane_trigger_time = current_time
-                                    print(f"[Lane {self.lane_id}] Preparing Lane {next_lane_id} data - GREEN>RED phase: {self.duration_remaining}s remaining")
-                                    
-                                    # Ensure next lane has timer set
-                                    if next_lane_id in shared_state.lane_states:
-                                        shared_state.lane_states[next_lane_id]['last_send_time'] = current_time
-                            
-                            # Update lane status from shared state
-                            self.is_active = (shared_state.active_lane == self.lane_id)
-                            if self.lane_id in shared_state.lane_states:
-                                shared_state.lane_states[self.lane_id]['active'] = self.is_active
-                    else:
-                        # During startup delay, keep lanes in standby mode
-                        self.is_active = False
-                        self.duration_remaining = self.duration_threshold
-                    
-                    # Check if we're in startup delay
-                    with shared_state.lock:
-                        in_startup_delay = not shared_state.system_started
-                        just_started = shared_state.system_started and (current_time - shared_state.startup_time < 2.0)
-                    
-                    if in_startup_delay:
-                        # During startup delay, skip detection but still show frames
-                        # Create empty results for display
-                        current_vehicle_counts = defaultdict(int)
-                        detections = []
-                        tracked_objects = []
-                        
-                        # Create a dummy results object for display with proper methods
-                        class DummyBoxes:
-                            def __init__(self):
-                                self.xyxy = None
-                                self.conf = None
-                                self.cls = None
-                            
-                            def cpu(self):
-                                # Return empty tensor that can be converted to numpy
-                                import numpy as np
-                                return np.array([])
-                                
-                        class DummyResults:
-                            def __init__(self):
-                                self.boxes = None  # Set to None to avoid processing during startup
-                                self.names = {0: 'mobil', 1: 'motor', 2: 'truck', 3: 'bus'}
-                        
-                        dummy_result = DummyResults()
-                        results = [dummy_result]
-                        
-                        # Add "DETECTION PAUSED" text to the frame
-                        h, w = frame.shape[:2]
-                        cv2.putText(frame, "DETECTION PAUSED - STARTUP DELAY", 
-                                   (w//2 - 200, 30), cv2.FONT_HERSHEY_SIMPLEX, 
-                                   0.8, (0, 0, 255), 2)
+                            shared_state.last_countdown_publisher = self.lane_id
+                            shared_state.last_countdown_time = current_time
+
+                        # Publish countdown sync to help ESP monitor Python's timing
+                        self.publish_countdown_sync(self.duration_remaining, current_phase)
                     else:
-                        # Normal operation after startup delay
-                        # Run YOLO detection
-                        results = self.model(frame, conf=self.confidence, verbose=False)
-                        
-                        # Process detections for tracking
-                        detections = []
-                        try:
-                            if results[0] is not None and hasattr(results[0], 'boxes') and results[0].boxes is not None:
-                                boxes = results[0].boxes.xyxy.cpu().numpy() if hasattr(results[0].boxes, 'xyxy') else None
-                                scores = results[0].boxes.conf.cpu().numpy() if hasattr(results[0].boxes, 'conf') else None
-                                classes = results[0].boxes.cls.cpu().numpy() if hasattr(results[0].boxes, 'cls') else None
-                                
-                                if boxes is not None and scores is not None and classes is not None:
-                                    # Reset vehicle counts for processing
-                                    current_vehicle_counts = defaultdict(int)
-                                    
-                                    for i, (box, score, cls) in enumerate(zip(boxes, scores, classes)):
-                                        # Only process detections with confidence >= 0.60
-                                        if score >= 0.60:
-                                            class_name = results[0].names[int(cls)].lower()
-                                            if class_name in self.vehicle_classes:
-                                                # Count this vehicle
-                                                current_vehicle_counts[class_name] += 1
-                                                # Add to detections
-                                                detections.append([box[0], box[1], box[2], box[3], score, int(cls)])
-                                    
-                                    # Update vehicle counts
-                                    self.vehicle_counts = dict(current_vehicle_counts)
-                                    self.total_vehicles = sum(current_vehicle_counts.values())
-                        except Exception as e:
-                            # Silently handle errors during detection processing
-                            if not in_startup_delay:  # Only print errors if not in startup delay
-                                print(f"[Lane {self.lane_id}] Detection error: {e}")
-                        
-                        # Update tracking if available
-                        tracked_objects = []
-                        class_names = []
-                        if self.tracker and len(detections) > 0:
-                            # Extract class names for tracker
-                            for det in detections:
-                                class_name = results[0].names[int(det[5])].lower()
-                                class_names.append(class_name)
-                            
-                            tracked_objects = self.tracker.update(np.array(detections), class_names)
-                        
-                        # Count vehicles based on tracking results OR direct detections
-                        current_vehicle_counts = defaultdict(int)
-                        if len(tracked_objects) > 0:
-                            # Use tracking results
-                            for bbox, track_id, class_name in tracked_objects:
-                                if class_name in self.vehicle_classes:
-                                    current_vehicle_counts[class_name] += 1
-                        else:
-                            # Fallback to direct detection counting (without SORT)
-                            if len(detections) > 0:
-                                for det in detections:
-                                    class_name = results[0].names[int(det[5])].lower()
-                                    if class_name in self.vehicle_classes:
-                                        current_vehicle_counts[class_name] += 1
-                        
-                        # Update vehicle counts
-                        self.vehicle_counts = dict(current_vehicle_counts)
-                        self.total_vehicles = sum(current_vehicle_counts.values())
-                        
-                        # Store our data in shared state for other lanes to access
+                        current_phase = "green_to_red"
+                        # Mark this lane as the countdown publisher
                         with shared_state.lock:
-                            lane_data = {
-                                "road_section_id": self.lane_id,
-                                "total_vehicles": self.total_vehicles,
-                                "vehicle_counts": dict(current_vehicle_counts),
-                                "timestamp": datetime.now().strftime('%Y-%m-%d %H:%M:%S')
-                            }
-                            shared_state.lane_data[self.lane_id] = lane_data
-                    
-                    # Regular timed data sending (last 5 seconds) - ONLY AFTER STARTUP
+                            shared_state.last_countdown_publisher = self.lane_id
+                            shared_state.last_countdown_time = current_time
+
+                        # Publish countdown sync to help ESP monitor Python's timing
+                        self.publish_countdown_sync(self.duration_remaining, current_phase)
+                else:
+                    print(f"[Lane {self.lane_id}] ⏸️ Skipping countdown sync - another lane is publishing")
+            else:
+                # Log why countdown sync stopped
+                if not still_active:
+                    print(f"[Lane {self.lane_id}] 🛑 Stopped countdown sync - no longer active lane")
+                elif self.duration_remaining <= 0:
+                    print(f"[Lane {self.lane_id}] 🛑 Stopped countdown sync - cycle complete (duration: {self.duration_remaining}s)")
+
+                    # CRITICAL FIX: Force immediate lane switch ONLY when cycle is complete (duration_remaining <= 0)
                     with shared_state.lock:
-                        system_started = shared_state.system_started
-                    
-                    # Send data at start of green-to-red transition (4 seconds remaining)
-                    if (system_started and self.is_active and self.duration_remaining <= 4 and 
-                        not self.waiting_for_mqtt_response and not data_send_initiated):
-                        
-                        # Check if we're not in switching process
-                        switching_in_progress = False
-                        with shared_state.lock:
-                            switching_in_progress = (current_time - shared_state.last_switch_time < 1.0)
-                        
-                        if not switching_in_progress:
-                            # Determine which phase we're in for clearer messaging
-                            red_to_green = self.red_to_green_transition
-                            green_to_red = self.green_to_red_transition
-                            esp_duration = self.esp_green_duration
-                            
-                            if self.duration_remaining > (esp_duration + green_to_red):
-                                red_green_remaining = self.duration_remaining - (esp_duration + green_to_red)
-                                print(f"[Lane {self.lane_id}] 📡 Sending data - RED>GREEN: {red_green_remaining}s")
-                            elif self.duration_remaining > green_to_red:
-                                green_remaining = self.duration_remaining - green_to_red
-                                print(f"[Lane {self.lane_id}] 📡 Sending data - GREEN: {green_remaining}s")
-                            else:
-                                print(f"[Lane {self.lane_id}] 📡 Sending data - GREEN>RED PHASE: {self.duration_remaining}s remaining")
-                            
-                            # Mark data sending as in progress
-                            with shared_state.lock:
-                                if self.lane_id in shared_state.data_sending_status:
-                                    shared_state.data_sending_status[self.lane_id]['sending'] = True
-                                    shared_state.data_sending_status[self.lane_id]['completed'] = False
-                            
-                            # Send data using threading to prevent blocking
-                            threading.Timer(0.1, self.log_traffic_data).start()
-                            threading.Timer(0.3, self.publish_vehicle_count).start()
-                            
-                            # Update tracking variables
-                            self.waiting_for_mqtt_response = True
-                            data_send_initiated = True
-                            print(f"[Lane {self.lane_id}] Data send initiated (DB + MQTT), waiting for response")
-                    
-                    # NEW: Publish countdown sync every 2 seconds during active phase
-                    if (system_started and self.is_active and 
-                        int(current_time) % 2 == 0 and  # Every 2 seconds
-                        int(current_time) != getattr(self, 'last_sync_publish_time', 0)):  # Avoid duplicate sends
-                        
-                        self.last_sync_publish_time = int(current_time)
-                        
-                        # Check if we're still the active lane before publishing sync
-                        with shared_state.lock:
-                            still_active = (shared_state.active_lane == self.lane_id)
-                        
-                        # CRITICAL FIX: Stop publishing countdown sync if cycle is complete (duration_remaining <= 0)
-                        # ENHANCED FIX: Also check if countdown is still active and ESP hasn't gone RED yet
-                        with shared_state.lock:
-                            countdown_should_continue = (still_active and 
-                                                       self.duration_remaining > 0 and 
-                                                       shared_state.countdown_active)
-                        
-                        if countdown_should_continue:
-                            # Additional check: Only one lane should publish countdown sync at a time
-                            other_lanes_publishing = False
-                            with shared_state.lock:
-                                for other_lane_id in range(1, 5):
-                                    if (other_lane_id != self.lane_id and 
-                                        other_lane_id in shared_state.data_sending_status and
-                                        hasattr(shared_state, 'last_countdown_publisher') and
-                                        shared_state.last_countdown_publisher == other_lane_id and
-                                        time.time() - getattr(shared_state, 'last_countdown_time', 0) < 3):
-                                        other_lanes_publishing = True
-                                        break
-                            
-                            if not other_lanes_publishing and shared_state.countdown_active:
-                                # Only publish countdown sync if ESP has started the green phase
-                                # Determine current phase for sync message
-                                red_to_green = self.red_to_green_transition
-                                green_to_red = self.green_to_red_transition
-                                esp_duration = self.esp_green_duration
-                                
-                                if self.duration_remaining > (esp_duration + green_to_red):
-                                    current_phase = "red_to_green"
-                                    # Don't publish countdown sync during red-to-green phase
-                                    print(f"[Lane {self.lane_id}] ⏸️ In red-to-green phase - waiting for ESP green signal")
-                                elif self.duration_remaining > green_to_red:
-                                    current_phase = "green"
-                                    # Mark this lane as the countdown publisher
-                                    with shared_state.lock:
-                                        shared_state.last_countdown_publisher = self.lane_id
-                                        shared_state.last_countdown_time = current_time
-                                    
-                                    # Publish countdown sync to help ESP monitor Python's timing
-                                    self.publish_countdown_sync(self.duration_remaining, current_phase)
-                                else:
-                                    current_phase = "green_to_red"
-                                    # Mark this lane as the countdown publisher
-                                    with shared_state.lock:
-                                        shared_state.last_countdown_publisher = self.lane_id
-                                        shared_state.last_countdown_time = current_time
-                                    
-                                    # Publish countdown sync to help ESP monitor Python's timing
-                                    self.publish_countdown_sync(self.duration_remaining, current_phase)
-                            else:
-                                print(f"[Lane {self.lane_id}] ⏸️ Skipping countdown sync - another lane is publishing")
-                        else:
-                            # Log why countdown sync stopped
-                            if not still_active:
-                                print(f"[Lane {self.lane_id}] 🛑 Stopped countdown sync - no longer active lane")
-                            elif self.duration_remaining <= 0:
-                                print(f"[Lane {self.lane_id}] 🛑 Stopped countdown sync - cycle complete (duration: {self.duration_remaining}s)")
-                                
-                                # CRITICAL FIX: Force immediate lane switch ONLY when cycle is complete (duration_remaining <= 0)
-                                with shared_state.lock:
-                                    if shared_state.active_lane == self.lane_id and self.is_active:
-                                        next_lane_id = (self.lane_id % 4) + 1
-                                        print(f"[Lane {self.lane_id}] 🔄 FORCE SWITCH: Cycle complete - switching to Lane {next_lane_id}")
-                                        
-                                        shared_state.active_lane = next_lane_id
-                                        shared_state.last_switch_time = current_time
-                                        self.is_active = False
-                                        
-                                        # Update all lane states
-                                        for lane_id in range(1, 5):
-                                            is_next = (lane_id == next_lane_id)
-                                            if lane_id in shared_state.lane_states:
-                                                shared_state.lane_states[lane_id]['active'] = is_next
-                                                if is_next:
-                                                    shared_state.lane_states[lane_id]['last_send_time'] = current_time
-                                                    print(f"[FORCE SWITCH] Lane {lane_id} starts fresh cycle")
-                                                    if lane_id in shared_state.data_sending_status:
-                                                        shared_state.data_sending_status[lane_id]['sending'] = False
-                                                        shared_state.data_sending_status[lane_id]['completed'] = False
-                                        
-                                        # Clear sync data for completed lane
-                                        shared_state.countdown_active = False
-                                        shared_state.sync_established = False
-                                        
-                                        print(f"[FORCE SWITCH] Completed: {self.lane_id} -> {next_lane_id}")
-                                         
-                                         # Publish green permission for the next lane
-                                        if self.mqtt_client:
-                                             green_permission_data = {
-                                                 "section": next_lane_id,
-                                                 "permission": "granted",
-                                                 "timestamp": current_time,
-                                                 "source": "python_force_switch"
-                                             }
-                                             self.mqtt_client.publish("traffic/green_permission", 
-                                                                    json.dumps(green_permission_data), qos=1)
-                                             print(f"[FORCE SWITCH] Published green permission for Lane {next_lane_id}")
-                            else:
-                                print(f"[Lane {self.lane_id}] 🛑 Stopped countdown sync - unknown reason")
-                    
-                    # Add result to queue for display
-                    if not self.result_queue.full():
-                        # Create frame_vehicles for display - include ALL detected vehicles
-                        frame_vehicles = []
-                        if len(tracked_objects) > 0:
-                            # Use tracked objects when available
-                            for bbox, track_id, class_name in tracked_objects:
-                                x1, y1, x2, y2 = bbox
-                                frame_vehicles.append((class_name, (x1, y1, x2, y2, track_id)))
-                        else:
-                            # Fallback for direct detections - include ALL detections
-                            for i, det in enumerate(detections):
-                                class_name = results[0].names[int(det[5])].lower()
-                                if class_name in self.vehicle_classes:
-                                    x1, y1, x2, y2 = det[0], det[1], det[2], det[3]
-                                    score = det[4]  # Include confidence score
-                                    frame_vehicles.append((class_name, (x1, y1, x2, y2, i)))
-                        
-                        self.result_queue.put({
-                            'frame': frame,
-                            'results': results[0],
-                            'tracked': tracked_objects,
-                            'detections': len(detections),
-                            'vehicles': frame_vehicles
-                        })
-                    
-                    # Update frame counter and FPS
-                    self.frame_count += 1
-                    self.fps_counter += 1
-                    
-                    # Calculate FPS
-                    if current_time - self.last_fps_time >= 1.0:
-                        self.fps = self.fps_counter
-                        self.fps_counter = 0
-                        self.last_fps_time = current_time
-                    
-                    # Garbage collection
-                    if current_time - self.last_gc_time >= self.gc_interval:
-                        gc.collect()
-                        self.last_gc_time = current_time
-                        
+                        if shared_state.active_lane == self.lane_id and self.is_active:
+                            next_lane_id = (self.lane_id % 4) + 1
+                            print(f"[Lane {self.lane_id}] 🔄 FORCE SWITCH: Cycle complete - switching to Lane {next_lane_id}")
+
+                            shared_state.active_lane = next_lane_id
+                            shared_state.last_switch_time = current_time
+                            self.is_active = False
+
+                            # Update all lane states
+                            for lane_id in range(1, 5):
+                                is_next = (lane_id == next_lane_id)
+                                if lane_id in shared_state.lane_states:
+                                    shared_state.lane_states[lane_id]['active'] = is_next
+                                    if is_next:
+                                        shared_state.lane_states[lane_id]['last_send_time'] = current_time
+                                        print(f"[FORCE SWITCH] Lane {lane_id} starts fresh cycle")
+                                        if lane_id in shared_state.data_sending_status:
+                                            shared_state.data_sending_status[lane_id]['sending'] = False
+                                            shared_state.data_sending_status[lane_id]['completed'] = False
+
+                            # Clear sync data for completed lane
+                            shared_state.countdown_active = False
+                            shared_state.sync_established = False
+
+                            print(f"[FORCE SWITCH] Completed: {self.lane_id} -> {next_lane_id}")
+
+                             # Publish green permission for the next lane
+                            if self.mqtt_client:
+                                 green_permission_data = {
+                                     "section": next_lane_id,
+                                     "permission": "granted",
+                                     "timestamp": current_time,
+                                     "source": "python_force_switch"
+                                 }
+                                 self.mqtt_client.publish(self.site_topic("green_permission"), 
+                                                        json.dumps(green_permission_data), qos=1)
+                                 print(f"[FORCE SWITCH] Published green permission for Lane {next_lane_id}")
                 else:
-                    time.sleep(0.01)  # Small delay if no frames
-                    
-            except Exception as e:
-                print(f"[Lane {self.lane_id}] ❌ Processing error: {e}")
-                import traceback
-                traceback.print_exc()
-                time.sleep(0.1)
-    
+                    print(f"[Lane {self.lane_id}] 🛑 Stopped countdown sync - unknown reason")
+
+    def publish_item(self, item):
+        """publish stage: the DB and MQTT sends from queue_send(), and results for the display"""
+        if callable(item):
+            item()
+            return
+        # Latest wins: the display only ever shows the newest result
+        with self.display_lock:
+            self.display_result = item
+
+    def queue_send(self, send):
+        """Run a DB or MQTT send on the publish stage, in the order queued. The track stage
+        hands them over once it holds no lock, as the publish stage may be full."""
+        self.pending_sends.append(send)
+
+    def start_pipeline(self):
+        """
+        decode -> preprocess -> infer -> track -> publish, each stage on its own threads
+        (frame_pipeline.py). Frames up to the detector are latest-wins: one that would wait
+        behind a busy model is replaced by a newer one instead of delaying every later frame.
+        Track and publish block instead, so detected frames are tracked in order and no DB or
+        MQTT send is lost; a slow broker then holds back the tracker rather than piling up.
+        """
+        self.pipeline = Pipeline(f"Lane {self.lane_id}")
+        decode = self.pipeline.source("decode", self.decode_frame)
+        self.preprocess_stage = self.pipeline.stage("preprocess", self.preprocess_frame, after=decode,
+                                                    capacity=1, overflow=DROP_OLDEST)
+        self.infer_stage = self.pipeline.stage("infer", self.infer_frame, after=self.preprocess_stage,
+                                               workers=self.infer_workers, capacity=1, overflow=DROP_OLDEST)
+        track = self.pipeline.stage("track", self.track_frame, after=self.infer_stage, capacity=4)
+        self.publish_stage = self.pipeline.stage("publish", self.publish_item, after=track, capacity=32)
+        self.pipeline.start()
+        self.last_report_time = time.time()
+        print(f"[Lane {self.lane_id}] 🧵 Pipeline started ({'native' if self.pipeline.native else 'Python'} queues, "
+              f"{self.infer_workers} infer worker(s))")
+
+    def report_pipeline(self, force=False):
+        """Print the per-stage occupancy and latencies every pipeline_report seconds"""
+        if not self.pipeline or (not force and (self.pipeline_report <= 0 or
+                                                time.time() - self.last_report_time < self.pipeline_report)):
+            return
+        self.last_report_time = time.time()
+        print(f"[Lane {self.lane_id}] 📈 Pipeline stages:\n{self.pipeline.report()}")
+
     def clear_queues(self):
-        """Clear frame and result queues to prevent backlog during lane switching"""
+        """Drop the frames still waiting for detection and the undisplayed result during lane switching"""
         try:
-            while not self.frame_queue.empty():
-                try:
-                    self.frame_queue.get_nowait()
-                except:
-                    break
-                    
-            while not self.result_queue.empty():
-                try:
-                    self.result_queue.get_nowait()
-                except:
-                    break
-                    
+            if self.pipeline:
+                self.pipeline.clear(self.preprocess_stage)
+                self.pipeline.clear(self.infer_stage)
+            with self.display_lock:
+                self.display_result = None
             print(f"[Lane {self.lane_id}] Cleared queues during lane switch")
         except Exception as e:
             print(f"[Lane {self.lane_id}] Error clearing queues: {e}")
@@ -1644,7 +1814,7 @@ class LaneProcessor:
             
             # Publish to MQTT
             try:
-                topic = "traffic/vehicle_count"
+                topic = mqtt_topics.lane(self.intersection, 1, "vehicle_count")
                 result = self.mqtt_client.publish(topic, message, qos=1, retain=True)
                 
                 # Check publish status
@@ -1664,6 +1834,26 @@ class LaneProcessor:
         except Exception as e:
             print(f"[Lane {self.lane_id}] Error in startup MQTT publishing: {e}")
     
+    def stream_own_count(self, lane_data):
+        """Publish this lane's latest count outside the transition-time handover"""
+        self.last_stream_time = time.time()
+        if not self.mqtt_client:
+            return
+        try:
+            self.mqtt_client.publish(mqtt_topics.lane(self.intersection, self.lane_id, "vehicle_count"), json.dumps(lane_data), qos=0)
+        except Exception as e:
+            print(f"[Lane {self.lane_id}] Error streaming count: {e}")
+
+    def publish_discharge(self, report):
+        """Publish the stop line crossings of the green that just ended"""
+        if not self.mqtt_client:
+            return
+        report = dict(report, road_section_id=self.lane_id, timestamp=datetime.now().strftime('%Y-%m-%d %H:%M:%S'))
+        try:
+            self.mqtt_client.publish(mqtt_topics.lane(self.intersection, self.lane_id, "discharge"), json.dumps(report), qos=0)
+        except Exception as e:
+            print(f"[Lane {self.lane_id}] Error publishing discharge: {e}")
+
     def publish_vehicle_count(self):
         """Publish vehicle count data to MQTT following nod.py sequential pattern"""
         try:
@@ -1757,10 +1947,9 @@ class LaneProcessor:
             
             message = json.dumps(target_data)
             
-            # Publish to a single topic for simplicity
+            # Publish on the target lane's topic
             try:
-                # General topic only
-                topic = "traffic/vehicle_count"
+                topic = mqtt_topics.lane(self.intersection, target_lane_id, "vehicle_count")
                 result = self.mqtt_client.publish(topic, message, qos=1, retain=True)
                 
                 # Check publish status
@@ -1851,8 +2040,9 @@ class LaneProcessor:
         
         while self.is_running:
             try:
-                if not self.result_queue.empty():
-                    result_data = self.result_queue.get(timeout=1)
+                with self.display_lock:
+                    result_data, self.display_result = self.display_result, None
+                if result_data is not None:
                     
                     frame = result_data['frame']
                     results = result_data['results']
@@ -1875,8 +2065,8 @@ class LaneProcessor:
                             'bus': (0, 255, 255)       # Yellow for buses
                         }
                         
-                        # Get original frame dimensions for scaling
-                        original_height, original_width = frame.shape[:2]
+                        # Get the detector's input dimensions for scaling (smaller than the frame with --infer-size)
+                        original_height, original_width = getattr(results, 'orig_shape', None) or frame.shape[:2]
                         scale_x = self.window_width / original_width
                         scale_y = self.window_height / original_height
                         
@@ -2243,19 +2433,16 @@ class LaneProcessor:
         
         self.is_running = True
         
-        # Start processing threads
-        fetch_thread = threading.Thread(target=self.fetch_frames, daemon=True)
-        process_thread = threading.Thread(target=self.process_frames, daemon=True)
+        # Start the pipeline stages and the display thread
+        self.start_pipeline()
         display_thread = threading.Thread(target=self.display_results, daemon=True)
-        
-        fetch_thread.start()
-        process_thread.start()
         display_thread.start()
         
         try:
             # Wait for threads
             while self.is_running:
                 time.sleep(0.1)
+                self.report_pipeline()
                 
         except KeyboardInterrupt:
             print(f"[Lane {self.lane_id}] ⚠️  Interrupted by user")
@@ -2267,11 +2454,16 @@ class LaneProcessor:
         print(f"[Lane {self.lane_id}] 🧹 Cleaning up...")
         self.is_running = False
         
+        if self.pipeline:
+            self.pipeline.stop()
+            self.report_pipeline(force=True)
+            self.pipeline.close()
+        
         if self.cap:
             self.cap.release()
         
         if self.mqtt_client:
-            self.mqtt_client.publish(f"traffic/status/{self.lane_id}", "offline", qos=1, retain=True)
+            self.mqtt_client.publish(self.site_topic(f"status/{self.lane_id}"), "offline", qos=1, retain=True)
             self.mqtt_client.loop_stop()
             self.mqtt_client.disconnect()
         
@@ -2308,6 +2500,21 @@ def main():
                        help=f'Screen width in pixels (default: {SCREEN_WIDTH})')
     parser.add_argument('--screen-height', type=int, default=SCREEN_HEIGHT, 
                        help=f'Screen height in pixels (default: {SCREEN_HEIGHT})')
+    parser.add_argument('--stream-counts', type=float, default=0, metavar='SECONDS',
+                       help='Also publish each lane\'s own count every SECONDS so the next phase is decided ahead (default: off)')
+    parser.add_argument('--meters-per-pixel', type=float, nargs=4, default=None,
+                       help='Camera calibration per lane; reports 85th percentile approach speeds for clearance times')
+    parser.add_argument('--stop-lines', type=parse_stop_line, nargs=4, default=None, metavar='X1,Y1,X2,Y2',
+                       help='Stop line per lane in pixels; reports crossings per green for the saturation flow')
+    parser.add_argument('--infer-workers', type=int, default=1,
+                       help='Detector threads per lane, each with its own model (default: 1)')
+    parser.add_argument('--infer-size', type=int, default=0, metavar='PIXELS',
+                       help='Shrink frames to PIXELS on the longer side before detection, in the preprocess stage (default: off)')
+    parser.add_argument('--pipeline-report', type=float, default=0, metavar='SECONDS',
+                       help='Print each lane\'s per-stage occupancy and latencies every SECONDS (default: only at exit)')
+    parser.add_argument('--intersection', type=str, default=mqtt_topics.DEFAULT_INTERSECTION,
+                       help='Intersection id; all MQTT topics live under traffic/<intersection>/ '
+                            f'(default: {mqtt_topics.DEFAULT_INTERSECTION}, must match the boards\' INTERSECTION_ID)')
     
     args = parser.parse_args()
     
@@ -2397,7 +2604,14 @@ def main():
             rtsp_url=stream_url,
             model_path=args.model,
             lane_id=lane_id,
-            confidence=args.conf
+            confidence=args.conf,
+            meters_per_pixel=args.meters_per_pixel[lane_id - 1] if args.meters_per_pixel else None,
+            stream_interval=args.stream_counts,
+            intersection=args.intersection,
+            stop_line=args.stop_lines[lane_id - 1] if args.stop_lines else None,
+            infer_workers=args.infer_workers,
+            infer_size=args.infer_size,
+            pipeline_report=args.pipeline_report
         )
         processors.append(processor)
         print(f"✅ Created processor for Lane {lane_id}: {stream_url}")
@@ -2415,7 +2629,7 @@ def main():
     print("  - Press 1, 2, 3, 4 to focus display on specific lane")
     print("  - Press Q to quit")
     print("  - System follows nod.py timing logic")
-    print("  - MQTT topic 'traffic/duration' controls timing")
+    print(f"  - MQTT topics 'traffic/{args.intersection}/<lane>/duration' control timing")
     print("  - STARTUP: Lane 1 sends OWN data at 18s (2s before 20s delay ends)")
     print("  - NORMAL: Each lane sends NEXT lane's data at green>red transition")
     print("  - Each lane active for 28s total (4s red>green + ESP + 4s green>red)")
@@ -0,0 +1,327 @@
+#!/usr/bin/env python3
+"""
+Delta firmware updates for the controllers
+Builds the patches that ota_update.h applies and streams them to one board
+over MQTT. A patch rebuilds the new .bin in the board's spare app slot from
+the image it is running: COPY runs of the old image (at any offset, so code
+that moved still matches), REUSE runs of the new image itself, FILL runs of
+one byte and literal ADD bytes for the rest. Without --base the patch is the
+full image, compressed with REUSE and FILL only.
+
+The transfer goes to traffic/<intersection>/<lane>/ota (traffic/<intersection>/ota
+with --single-board) in 1 KB chunks, with a window of chunks in flight. The
+board acknowledges what it has decoded on ota_status, which moves the window
+on, and asks for a resend after a gap. Once the image is complete it switches
+slots at its next phase boundary, restarts and keeps the new image if it runs
+for a minute; otherwise the previous one comes back. --rollback switches back
+to the previous image without a transfer.
+
+Usage:
+    python Python/ota_update.py --base v6/esp32_lane2.ino.bin --target v7/esp32_lane2.ino.bin \
+        --version 7 --out lane2_v7.patch
+    python Python/ota_update.py --base v6/esp32_lane2.ino.bin --target v7/esp32_lane2.ino.bin \
+        --version 7 --lane 2 --push --follow
+    python Python/ota_update.py --patch lane2_v7.patch --lane 2 --push
+    python Python/ota_update.py --lane 2 --rollback
+"""
+
+import argparse
+import json
+import struct
+import threading
+import time
+import zlib
+
+import mqtt_topics
+
+MAGIC = 0x41544F4C  # "LOTA"
+FORMAT = 1
+HEADER_FORMAT = "<IHHIIIIIII"  # PatchHeader in ota_update.h
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+WINDOW = 4096  # REUSE reach, ota_update::WINDOW
+MAX_CHUNK = 1024
+BUFFER = 16384  # Chunks queued on the board, ota_update::BUFFER: the most the window may hold
+OP_COPY, OP_REUSE, OP_ADD, OP_FILL = range(4)
+
+KEY = 8          # Bytes that must match before a run is worth looking at
+MIN_RUN = 8      # Shortest COPY or REUSE at a new offset
+MIN_NEXT = 4     # Shortest COPY that continues the previous one's alignment
+MIN_FILL = 16
+
+
+def leb128(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return value * 2 if value >= 0 else -value * 2 - 1
+
+
+def tag(op, length):
+    if length < 64:
+        return bytes([op << 6 | length])
+    return bytes([op << 6]) + leb128(length)
+
+
+def match_length(source, start, target, position):
+    """Length of the common run of source[start:] and target[position:]"""
+    length = 0
+    limit = min(len(source) - start, len(target) - position)
+    while length + 64 <= limit and source[start + length:start + length + 64] == \
+            target[position + length:position + length + 64]:
+        length += 64
+    while length < limit and source[start + length] == target[position + length]:
+        length += 1
+    return length
+
+
+def build_operations(base, target):
+    """Greedy COPY/REUSE/FILL/ADD stream that turns base into target"""
+    index = {}
+    for i in range(len(base) - KEY + 1):
+        index.setdefault(base[i:i + KEY], i)
+
+    ops = bytearray()
+    literal = bytearray()
+    recent = {}  # KEY bytes of the new image -> last position
+    copy_end = 0
+    shift = None  # Base offset minus target position of the last COPY
+    position = 0
+
+    def flush_literal():
+        if literal:
+            ops.extend(tag(OP_ADD, len(literal)))
+            ops.extend(literal)
+            literal.clear()
+
+    while position < len(target):
+        key = target[position:position + KEY]
+        best_op, best_length, best_arg = None, 0, 0
+
+        if shift is not None and 0 <= position + shift < len(base):
+            length = match_length(base, position + shift, target, position)
+            if length >= MIN_NEXT:
+                best_op, best_length, best_arg = OP_COPY, length, position + shift
+        offset = index.get(key)
+        if offset is not None:
+            length = match_length(base, offset, target, position)
+            if length >= MIN_RUN and length > best_length:
+                best_op, best_length, best_arg = OP_COPY, length, offset
+        previous = recent.get(key)
+        if previous is not None and position - previous <= WINDOW:
+            length = match_length(target, previous, target, position)
+            if length >= MIN_RUN and length > best_length:
+                best_op, best_length, best_arg = OP_REUSE, length, position - previous
+        run = 1
+        while position + run < len(target) and target[position + run] == target[position] and run < 1 << 20:
+            run += 1
+        if run >= MIN_FILL and run > best_length:
+            best_op, best_length, best_arg = OP_FILL, run, target[position]
+
+        if best_op is None:
+            literal.append(target[position])
+            recent[key] = position
+            position += 1
+            continue
+
+        flush_literal()
+        ops.extend(tag(best_op, best_length))
+        if best_op == OP_COPY:
+            ops.extend(leb128(zigzag(best_arg - copy_end)))
+            copy_end = best_arg + best_length
+            shift = best_arg - position
+        elif best_op == OP_REUSE:
+            ops.extend(leb128(best_arg))
+        else:
+            ops.append(best_arg)
+        for p in range(position, min(position + best_length, len(target) - KEY + 1)):
+            recent[target[p:p + KEY]] = p
+        position += best_length
+    flush_literal()
+    return bytes(ops)
+
+
+def build_patch(base, target, version):
+    """PatchHeader + operations; base b"" gives a full image"""
+    ops = build_operations(base, target)
+    fields = (MAGIC, FORMAT, 0, version, len(base), zlib.crc32(base), len(target), zlib.crc32(target), len(ops))
+    header = struct.pack(HEADER_FORMAT[:-1], *fields)
+    return header + struct.pack("<I", zlib.crc32(header)) + ops
+
+
+def describe_patch(patch):
+    magic, fmt, _, version, base_size, base_crc, target_size, target_crc, ops_size, _ = \
+        struct.unpack(HEADER_FORMAT, patch[:HEADER_SIZE])
+    if magic != MAGIC or fmt != FORMAT or ops_size != len(patch) - HEADER_SIZE:
+        raise ValueError("not a format 1 firmware patch")
+    kind = f"against {base_size} bytes (crc {base_crc:08x})" if base_size else "full image"
+    return (f"Firmware v{version}: {target_size} bytes (crc {target_crc:08x}), patch {ops_size} bytes "
+            f"({100.0 * ops_size / max(1, target_size):.1f} %), {kind}")
+
+
+class OtaSender:
+    """Streams one patch to one board and follows its ota_status reports"""
+
+    def __init__(self, client, intersection, lane, window_chunks=BUFFER // MAX_CHUNK, timeout=30.0):
+        if lane:
+            self.topic = mqtt_topics.lane(intersection, lane, "ota")
+            self.status_topic = mqtt_topics.lane(intersection, lane, "ota_status")
+        else:
+            self.topic = mqtt_topics.site(intersection, "ota")
+            self.status_topic = mqtt_topics.site(intersection, "ota_status")
+        self.client = client
+        self.window = window_chunks * MAX_CHUNK
+        self.timeout = timeout
+        self.reports = []
+        self.event = threading.Condition()
+        client.message_callback_add(self.status_topic, self.on_status)
+        client.subscribe(self.status_topic, qos=1)
+
+    def on_status(self, client, userdata, message):
+        try:
+            report = json.loads(message.payload)
+        except ValueError:
+            return
+        with self.event:
+            self.reports.append(report)
+            self.event.notify()
+
+    def next_report(self, timeout):
+        with self.event:
+            if not self.reports:
+                self.event.wait(timeout)
+            return self.reports.pop(0) if self.reports else None
+
+    def push(self, patch):
+        """True once the board reports the image ready"""
+        ops = patch[HEADER_SIZE:]
+        started = time.time()
+        self.client.publish(self.topic, b"B" + patch[:HEADER_SIZE], qos=1)
+        sent = acked = 0
+        resends = 0
+        while True:
+            while sent < len(ops) and min(sent + MAX_CHUNK, len(ops)) - acked <= self.window:
+                chunk = ops[sent:sent + MAX_CHUNK]
+                self.client.publish(self.topic, b"D" + struct.pack("<I", sent) + chunk, qos=0)
+                sent += len(chunk)
+            report = self.next_report(self.timeout)
+            if report is None:
+                sent = acked  # Nothing heard: go back to the last acknowledged offset
+                resends += 1
+                continue
+            state = report.get("state")
+            if state == "receiving":
+                # Decoded up to here: the window slides on
+                acked = max(acked, report.get("next", acked))
+                print(f"  {acked}/{len(ops)} bytes", end="\r")
+            elif state == "resend":
+                # Gap after "next": send again from there, still within the window
+                sent = report.get("next", acked)
+                resends += 1
+            elif state == "ready":
+                elapsed = time.time() - started
+                print(f"Ready after {elapsed:.1f} s ({len(patch) / max(elapsed, 1e-3) / 1024:.1f} KB/s, "
+                      f"{resends} resends); the board switches at its next phase boundary")
+                return True
+            elif state == "rejected":
+                print(f"Rejected: {report.get('reason')}")
+                return False
+
+    def follow(self, timeout, until=("confirmed", "rolled_back", "rejected")):
+        """Print reports until the new image is confirmed or rolled back"""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            report = self.next_report(deadline - time.time())
+            if report is None:
+                break
+            print(f"  {report.get('state')}: running v{report.get('running')}"
+                  f"{' on trial' if report.get('trial') else ''}")
+            if report.get("state") in until:
+                return report.get("state") == until[0]
+        print("No confirmation before the timeout")
+        return False
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build and send delta firmware patches")
+    parser.add_argument("--base", help="Image the board runs now (.bin); without it the patch is the full image")
+    parser.add_argument("--target", help="New image (.bin)")
+    parser.add_argument("--version", type=int, default=0, help="Build number of the new image")
+    parser.add_argument("--patch", help="Send a patch built earlier instead of --base/--target")
+    parser.add_argument("--out", help="Write the patch to a file")
+    parser.add_argument("--link-kbps", type=float, default=16.0,
+                        help="Link rate for the transfer time estimate, KB/s (default: 16)")
+    parser.add_argument("--push", action="store_true", help="Send the patch to the board")
+    parser.add_argument("--rollback", action="store_true", help="Switch the board back to its previous image")
+    parser.add_argument("--follow", action="store_true", help="After the transfer, wait for confirmation")
+    parser.add_argument("--lane", type=int, choices=[1, 2, 3, 4], help="Lane board to update")
+    parser.add_argument("--single-board", action="store_true", help="Update the single-board controller")
+    parser.add_argument("--intersection", default=mqtt_topics.DEFAULT_INTERSECTION,
+                        help=f"Intersection of the board (default: {mqtt_topics.DEFAULT_INTERSECTION})")
+    parser.add_argument("--broker", default="broker.emqx.io")
+    parser.add_argument("--port", type=int, default=1883)
+    args = parser.parse_args()
+
+    patch = None
+    if args.patch:
+        patch = read(args.patch)
+    elif args.target:
+        target = read(args.target)
+        base = read(args.base) if args.base else b""
+        started = time.time()
+        patch = build_patch(base, target, args.version)
+        full = len(target) / 1024 / args.link_kbps
+        print(f"Built in {time.time() - started:.1f} s; at {args.link_kbps:g} KB/s the transfer takes "
+              f"{len(patch) / 1024 / args.link_kbps:.1f} s instead of {full:.1f} s for the image")
+    if patch is not None:
+        print(describe_patch(patch))
+    if args.out and patch is not None:
+        with open(args.out, "wb") as f:
+            f.write(patch)
+        print(f"Wrote {args.out}")
+
+    if not (args.push or args.rollback):
+        return
+    if not args.lane and not args.single_board:
+        parser.error("--push and --rollback need --lane or --single-board")
+    if args.push and patch is None:
+        parser.error("--push needs --target or --patch")
+
+    import paho.mqtt.client as mqtt
+
+    try:
+        client = mqtt.Client(callback_api_version=mqtt.CallbackAPIVersion.VERSION2)
+    except AttributeError:
+        client = mqtt.Client()  # paho-mqtt 1.x
+    client.connect(args.broker, args.port, 60)
+    client.loop_start()
+    sender = OtaSender(client, args.intersection, None if args.single_board else args.lane)
+    time.sleep(0.5)  # Let the subscription settle before sending
+    ok = True
+    if args.rollback:
+        client.publish(sender.topic, b"R", qos=1)
+        ok = sender.follow(600, until=("running", "rejected"))
+    else:
+        ok = sender.push(patch)
+        if ok and args.follow:
+            ok = sender.follow(600)
+    client.loop_stop()
+    client.disconnect()
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+Checks for demand_forecast.py (and, by extension, the sketches' demand_forecast.h)
+Run with `python3 test_demand_forecast.py` or pytest.
+"""
+
+import sys
+
+from demand_forecast import DemandForecast
+
+SLOT = 32  # 08:00, any fixed slot will do
+
+
+def feed_ramp(forecast, start_rate, slope, intervals, until_s):
+    """Feed red-interval counts of a linear ramp of arrivals per second.
+
+    Reports come at irregular `intervals` (cycled), as they do from the
+    detector; returns the time of the last report.
+    """
+    now = 0.0
+    count = 0.0
+    forecast.observe_red(count, now, SLOT)
+    step = 0
+    while now < until_s:
+        seconds = intervals[step % len(intervals)]
+        step += 1
+        # Arrivals over the interval: the integral of start_rate + slope * t
+        count += start_rate * seconds + slope * (now + seconds / 2) * seconds
+        now += seconds
+        forecast.observe_red(count, now, SLOT)
+    return now
+
+
+def test_linear_ramp_rate():
+    """A rising approach is forecast at its true rate, whatever the report spacing"""
+    start_rate, slope = 0.1, 0.0005  # 6 veh/min, rising 1.8 veh/min every minute
+    for intervals in ([5.0], [30.0], [4.0, 60.0, 15.0]):
+        forecast = DemandForecast()
+        now = feed_ramp(forecast, start_rate, slope, intervals, 1800)
+        assert forecast.ready()
+        for ahead in (0.0, 30.0, 120.0):
+            expected = start_rate + slope * (now + ahead)
+            got = forecast.rate_per_second(SLOT, ahead)
+            assert abs(got - expected) < 0.05 * expected, (intervals, ahead, got, expected)
+
+
+def test_linear_ramp_arrivals():
+    """arrivals_over() integrates the ramp over the green"""
+    start_rate, slope = 0.3, -0.0001  # Falling approach
+    forecast = DemandForecast()
+    now = feed_ramp(forecast, start_rate, slope, [10.0, 45.0], 1200)
+    green = 40.0
+    expected = (start_rate + slope * (now + green / 2)) * green
+    got = forecast.arrivals_over(green, SLOT)
+    assert abs(got - expected) < 0.05 * expected, (got, expected)
+
+
+def main():
+    failed = 0
+    for name, test in sorted(globals().items()):
+        if name.startswith("test_") and callable(test):
+            try:
+                test()
+                print(f"✅ {name}")
+            except AssertionError as e:
+                failed += 1
+                print(f"❌ {name}: {e}")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
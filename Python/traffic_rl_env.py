@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""
+Vectorized intersection environment for learning signal policies
+Python bindings (ctypes) for host/rl_env.h: N intersections are stepped in one
+batch call, each step being one green-time decision of the lane controllers
+under the conflict groups and clearance of a lane_config.h config
+
+Build the library first (from the repository root):
+    g++ -std=c++17 -O3 -march=native -pthread -shared -fPIC -Ihost/shim \
+        host/rl_env_capi.cpp -o Python/librl_env.so
+"""
+
+import argparse
+import ctypes
+import os
+import time
+
+import numpy as np
+
+LIBRARY_NAME = "librl_env.so"
+
+
+def load_library(path=None):
+    """Load librl_env.so from path, $TRAFFIC_RL_LIB or next to this file"""
+    candidates = [path, os.environ.get("TRAFFIC_RL_LIB"),
+                  os.path.join(os.path.dirname(os.path.abspath(__file__)), LIBRARY_NAME)]
+    for candidate in candidates:
+        if candidate and os.path.exists(candidate):
+            lib = ctypes.CDLL(candidate)
+            break
+    else:
+        raise OSError(f"{LIBRARY_NAME} not found, build it with the command in {__file__}")
+
+    float_p = np.ctypeslib.ndpointer(dtype=np.float32, flags="C_CONTIGUOUS")
+    int_p = np.ctypeslib.ndpointer(dtype=np.int32, flags="C_CONTIGUOUS")
+    byte_p = np.ctypeslib.ndpointer(dtype=np.uint8, flags="C_CONTIGUOUS")
+
+    lib.rl_env_obs_dim.restype = ctypes.c_int
+    lib.rl_env_num_actions.restype = ctypes.c_int
+    lib.rl_env_green_options.argtypes = [float_p]
+    lib.rl_env_create.restype = ctypes.c_void_p
+    lib.rl_env_create.argtypes = [ctypes.c_int, ctypes.c_uint32, ctypes.c_int, ctypes.c_int,
+                                  ctypes.c_float, ctypes.c_float, ctypes.c_float, ctypes.c_int,
+                                  ctypes.c_char_p, ctypes.c_size_t]
+    lib.rl_env_destroy.argtypes = [ctypes.c_void_p]
+    lib.rl_env_threads.restype = ctypes.c_int
+    lib.rl_env_threads.argtypes = [ctypes.c_void_p]
+    lib.rl_env_reset.argtypes = [ctypes.c_void_p, float_p]
+    lib.rl_env_step.argtypes = [ctypes.c_void_p, int_p, float_p, float_p, byte_p, float_p]
+    lib.rl_env_baseline_actions.argtypes = [ctypes.c_void_p, float_p, int_p]
+    return lib
+
+
+class VecTrafficEnv:
+    """
+    Gym-style vector environment
+
+    reset() -> obs                               (num_envs, obs_dim) float32
+    step(actions) -> obs, rewards, dones, infos  actions: (num_envs,) ints
+
+    Sections are served in barrier groups of the config's conflict matrix
+    ({1, 3} then {2, 4} by default), with its clearance times; config is a
+    blob from lane_config.py (bytes or a path to its --out file), or None
+    for the firmware defaults.
+
+    obs[:, 0:4] halting vehicles per approach, starting at the section deciding now
+    obs[:, 4]   1.0 during the config's rush hours, obs[:, 5] hour / 23
+    Action a gives that section green_options[a] seconds of green.
+    Reward is minus the vehicle-minutes of delay during the step, and
+    infos["seconds"] the simulated time it took; both are 0 except on the
+    last decision of a group, when the whole group runs.
+    """
+
+    def __init__(self, num_envs=256, seed=1, microscopic=False, threads=0,
+                 episode_seconds=3600.0, min_rate=50.0, max_rate=350.0, hour=-1, config=None, library=None):
+        if isinstance(config, str):
+            with open(config, "rb") as f:
+                config = f.read()
+        self.lib = load_library(library)
+        self.num_envs = num_envs
+        self.obs_dim = self.lib.rl_env_obs_dim()
+        self.num_actions = self.lib.rl_env_num_actions()
+        self.green_options = np.zeros(self.num_actions, dtype=np.float32)
+        self.lib.rl_env_green_options(self.green_options)
+
+        self.observation_shape = (self.obs_dim,)
+        self.action_count = self.num_actions
+
+        self.handle = self.lib.rl_env_create(num_envs, seed, int(microscopic), threads,
+                                             episode_seconds, min_rate, max_rate, hour,
+                                             config, len(config) if config else 0)
+        if not self.handle:
+            raise ValueError("config blob does not parse, check it with lane_config.py")
+        self.threads = self.lib.rl_env_threads(self.handle)
+
+        self.obs = np.zeros((num_envs, self.obs_dim), dtype=np.float32)
+        self.rewards = np.zeros(num_envs, dtype=np.float32)
+        self.dones = np.zeros(num_envs, dtype=np.uint8)
+        self.seconds = np.zeros(num_envs, dtype=np.float32)
+        self.actions = np.zeros(num_envs, dtype=np.int32)
+
+    def reset(self):
+        self.lib.rl_env_reset(self.handle, self.obs)
+        return self.obs.copy()
+
+    def step(self, actions):
+        self.actions[:] = actions
+        self.lib.rl_env_step(self.handle, self.actions, self.obs, self.rewards, self.dones, self.seconds)
+        return self.obs.copy(), self.rewards.copy(), self.dones.astype(bool), {"seconds": self.seconds.copy()}
+
+    def baseline_actions(self, obs=None):
+        """Actions the boards would take: the config's green time for obs[:, 0]"""
+        obs = self.obs if obs is None else np.ascontiguousarray(obs, dtype=np.float32)
+        actions = np.zeros(self.num_envs, dtype=np.int32)
+        self.lib.rl_env_baseline_actions(self.handle, obs, actions)
+        return actions
+
+    def close(self):
+        if self.handle:
+            self.lib.rl_env_destroy(self.handle)
+            self.handle = None
+
+    def __del__(self):
+        self.close()
+
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the vectorized intersection environment")
+    parser.add_argument("--envs", type=int, default=1024, help="Intersections per batch")
+    parser.add_argument("--steps", type=int, default=200, help="Batch steps to run")
+    parser.add_argument("--threads", type=int, default=0, help="Worker threads (0 = all cores)")
+    parser.add_argument("--micro", action="store_true", help="Use the vehicle-level simulator")
+    parser.add_argument("--policy", choices=["random", "baseline"], default="random")
+    parser.add_argument("--config", help="Config blob from lane_config.py --out (default: firmware defaults)")
+    args = parser.parse_args()
+
+    env = VecTrafficEnv(num_envs=args.envs, threads=args.threads, microscopic=args.micro, config=args.config)
+    rng = np.random.default_rng(0)
+    obs = env.reset()
+    total_reward = 0.0
+
+    start = time.perf_counter()
+    for _ in range(args.steps):
+        if args.policy == "baseline":
+            actions = env.baseline_actions(obs)
+        else:
+            actions = rng.integers(0, env.num_actions, size=env.num_envs, dtype=np.int32)
+        obs, rewards, dones, _ = env.step(actions)
+        total_reward += float(rewards.sum())
+    elapsed = time.perf_counter() - start
+
+    env_steps = args.envs * args.steps
+    print(f"{env_steps} env-steps in {elapsed:.3f} s on {env.threads} thread(s): "
+          f"{env_steps / elapsed:,.0f} env-steps/s")
+    print(f"Mean reward per step ({args.policy}): {total_reward / env_steps:.2f} vehicle-minutes")
+    env.close()
+
+
+if __name__ == "__main__":
+    main()
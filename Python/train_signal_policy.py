@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""
+Train a green-time policy for the lane controllers on the vectorized environment
+The policy is a table over the state the ESP32 actually has (its own vehicle
+count and whether it is jam sibuk), searched with the cross-entropy method,
+compared against the policy the sketches run now and saved as a policy CSV for
+compile_policy.py
+"""
+
+import argparse
+import os
+import time
+
+import numpy as np
+
+from compile_policy import Policy, install, write_policy_csv
+from traffic_rl_env import VecTrafficEnv
+
+
+def state_index(obs, max_count):
+    counts = np.clip(np.rint(obs[:, 0]), 0, max_count).astype(np.int64)
+    rush = (obs[:, 4] > 0.5).astype(np.int64)
+    return rush * (max_count + 1) + counts
+
+
+def run(env, choose, steps):
+    """
+    Roll every intersection forward `steps` decisions
+    Returns delay per intersection in vehicle-minutes per simulated hour, so
+    that policies with short and long greens are compared over equal time
+    """
+    obs = env.reset()
+    delay = np.zeros(env.num_envs)
+    seconds = np.zeros(env.num_envs)
+    for _ in range(steps):
+        actions = choose(obs)
+        obs, rewards, _, infos = env.step(actions)
+        delay -= rewards
+        seconds += infos["seconds"]
+    return delay / seconds * 3600.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Learn a green-time table for the lane controllers")
+    parser.add_argument("--envs", type=int, default=1024, help="Intersections per batch")
+    parser.add_argument("--candidates", type=int, default=64, help="Tables evaluated per iteration")
+    parser.add_argument("--iterations", type=int, default=40)
+    parser.add_argument("--steps", type=int, default=100, help="Decisions per evaluation")
+    parser.add_argument("--elite", type=float, default=0.2, help="Fraction of candidates kept")
+    parser.add_argument("--max-count", type=int, default=30, help="Last vehicle-count bin")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--micro", action="store_true", help="Evaluate on the vehicle-level simulator")
+    parser.add_argument("--config", help="Config blob the boards run (lane_config.py --out), default: firmware defaults")
+    parser.add_argument("--name", default="learned", help="Policy name reported at boot")
+    parser.add_argument("--version", type=int, default=1, help="Policy version reported at boot")
+    parser.add_argument("--output", default="policies/learned.csv", help="Policy CSV to write")
+    parser.add_argument("--install", action="store_true", help="Also compile it into the sketches")
+    args = parser.parse_args()
+
+    env = VecTrafficEnv(num_envs=args.envs, seed=args.seed, config=args.config)
+    rng = np.random.default_rng(args.seed)
+    states = 2 * (args.max_count + 1)
+    probs = np.full((states, env.num_actions), 1.0 / env.num_actions)
+    owner = np.arange(args.envs) % args.candidates  # candidate table used by each intersection
+    elites = max(1, int(args.candidates * args.elite))
+
+    start = time.perf_counter()
+    for iteration in range(args.iterations):
+        # Sample one action per state for every candidate table
+        cumulative = probs.cumsum(axis=1)
+        draws = rng.random((args.candidates, states, 1))
+        tables = (draws > cumulative[None, :, :]).sum(axis=2).clip(0, env.num_actions - 1)
+
+        delay = run(env, lambda o: tables[owner, state_index(o, args.max_count)].astype(np.int32), args.steps)
+        score = np.bincount(owner, weights=delay, minlength=args.candidates) / np.bincount(owner)
+        best = tables[np.argsort(score)[:elites]]
+
+        frequency = np.zeros_like(probs)
+        for table in best:
+            frequency[np.arange(states), table] += 1.0 / elites
+        probs = 0.7 * probs + 0.3 * frequency
+        if iteration % 10 == 0 or iteration == args.iterations - 1:
+            print(f"  iteration {iteration:3d}: best {score.min():.0f}, mean {score.mean():.0f} vehicle-min/h")
+    elapsed = time.perf_counter() - start
+    env_steps = args.iterations * args.steps * args.envs
+    print(f"Trained on {env_steps:,} env-steps in {elapsed:.1f} s")
+
+    best_actions = probs.argmax(axis=1)
+    green = env.green_options[best_actions].reshape(2, args.max_count + 1)
+    env.close()
+
+    eval_env = VecTrafficEnv(num_envs=256, seed=args.seed + 100, microscopic=args.micro, config=args.config)
+    steps = 30 if args.micro else args.steps
+    learned = run(eval_env, lambda o: best_actions[state_index(o, args.max_count)].astype(np.int32), steps).mean()
+    baseline = run(eval_env, eval_env.baseline_actions, steps).mean()
+    print(f"Delay: learned {learned:.0f}, current firmware {baseline:.0f} vehicle-minutes per intersection-hour")
+    for rush, label in ((0, "normal"), (1, "jam sibuk")):
+        print(f"  {label:9s} green (s) by count: " + " ".join(f"{g:.0f}" for g in green[rush]))
+    eval_env.close()
+
+    policy = Policy(args.name, args.version, green)
+    write_policy_csv(policy, args.output)
+    print(f"Policy written to {args.output} (checksum {policy.checksum():08x})")
+    if args.install:
+        for path in install(policy, args.output, os.path.dirname(os.path.dirname(os.path.abspath(__file__)))):
+            print(f"Wrote {path}")
+
+
+if __name__ == "__main__":
+    main()
@@ -67,8 +67,8 @@ void setup()
 // Membership function for busy hour (jam sibuk)
 bool isJamSibuk(int jam)
 {
-    // Define busy hours: 7-9 AM and 4-7 PM (rush hours)
-    bool sibuk = ((jam >= 7 && jam <= 9) || (jam >= 16 && jam <= 19));
+    // Define busy hours: 7-9 AM and 5-7 PM (rush hours), the controllers' default weekday plan
+    bool sibuk = ((jam >= 7 && jam <= 9) || (jam >= 17 && jam <= 19));
 
     if (sibuk)
     {
@@ -0,0 +1,114 @@
+// Where the time of each signal cycle goes, per section.
+// This file is identical in every sketch folder; change all of them together.
+//
+// Every millisecond is charged to exactly one category: the sketch calls
+// enter() whenever its section changes what it is doing, and the time since
+// the previous call goes to the category that was running until then.
+//   EFFECTIVE_GREEN    green with vehicles on the approach
+//   CLEARANCE          leading all red, pre-yellow, yellow, clearance all red
+//   COORDINATION_WAIT  vehicles waiting for the section's turn, a green
+//                      permission or the barrier
+//   IDLE               nothing to serve, including green on an empty approach
+// A cycle ends when the section's light sequence ends; closeCycle() keeps the
+// finished cycle for telemetry and starts the next one.
+#ifndef CYCLE_ACCOUNTING_H
+#define CYCLE_ACCOUNTING_H
+
+#include <stdint.h>
+
+namespace cycle_accounting
+{
+enum Category
+{
+    EFFECTIVE_GREEN,
+    CLEARANCE,
+    COORDINATION_WAIT,
+    IDLE,
+    CATEGORIES
+};
+
+class CycleAccounting
+{
+public:
+    CycleAccounting() : current(IDLE), since(0), started(false), cycles(0)
+    {
+        for (int c = 0; c < CATEGORIES; c++)
+        {
+            runningMs[c] = 0;
+            lastMs[c] = 0;
+            totalMs[c] = 0;
+        }
+    }
+
+    // Charge the time since the last call to the running category, then switch.
+    // A mark before the previous one (a back-dated stage change) charges nothing.
+    void enter(Category category, uint32_t nowMs)
+    {
+        if (!started || (int32_t)(nowMs - since) > 0) // Wraps correctly across millis() overflow
+        {
+            if (started)
+            {
+                uint32_t elapsed = nowMs - since;
+                runningMs[current] += elapsed;
+                totalMs[current] += elapsed;
+            }
+            since = nowMs;
+        }
+        started = true;
+        current = category;
+    }
+
+    // End the cycle at nowMs; the running category carries on into the next one
+    void closeCycle(uint32_t nowMs)
+    {
+        enter(current, nowMs);
+        for (int c = 0; c < CATEGORIES; c++)
+        {
+            lastMs[c] = runningMs[c];
+            runningMs[c] = 0;
+        }
+        cycles++;
+    }
+
+    Category category() const
+    {
+        return current;
+    }
+
+    uint32_t cycleCount() const
+    {
+        return cycles;
+    }
+
+    // Milliseconds of the last closed cycle
+    uint32_t lastCycleMs(Category category) const
+    {
+        return lastMs[category];
+    }
+
+    uint32_t lastCycleLengthMs() const
+    {
+        uint32_t length = 0;
+        for (int c = 0; c < CATEGORIES; c++)
+            length += lastMs[c];
+        return length;
+    }
+
+    // Since boot, in whole seconds
+    uint32_t totalSeconds(Category category) const
+    {
+        return (uint32_t)(totalMs[category] / 1000);
+    }
+
+private:
+    Category current;
+    uint32_t since;
+    bool started;
+    uint32_t cycles;
+    uint32_t runningMs[CATEGORIES];
+    uint32_t lastMs[CATEGORIES];
+    uint64_t totalMs[CATEGORIES];
+};
+} // namespace cycle_accounting
+
+#endif // CYCLE_ACCOUNTING_H
@@ -0,0 +1,118 @@
+// Short-term arrival forecast for one approach.
+// This file is identical in every sketch folder; change all of them together.
+// Python/demand_forecast.py is the same model for the coordinator.
+//
+// While an approach is red nothing leaves it, so the growth of its vehicle
+// count between two reports is the arrival rate. Each such observation
+// updates a Holt-Winters model in O(1): a level and trend of the
+// deseasonalised rate, and a multiplicative time-of-day profile of SLOTS
+// quarter-hour factors. Green times can then be sized for the vehicles
+// already waiting plus those predicted to arrive during the green, instead of
+// lagging one cycle behind.
+#ifndef DEMAND_FORECAST_H
+#define DEMAND_FORECAST_H
+
+#include <stdint.h>
+
+namespace demand_forecast
+{
+constexpr int SLOTS = 96;             // Quarter hours of the day
+constexpr float MIN_INTERVAL_S = 2.0f; // Shorter gaps between reports are too noisy
+constexpr float MAX_INTERVAL_S = 120.0f;
+
+inline int slotOf(int hour, int minute)
+{
+    return (hour * 60 + minute) / 15 % SLOTS;
+}
+
+class DemandForecast
+{
+public:
+    explicit DemandForecast(float alpha = 0.3f, float beta = 0.05f, float gamma = 0.1f)
+        : alpha(alpha), beta(beta), gamma(gamma), level(0), trend(0), observations(0), hasLast(false),
+          lastCount(0), lastMs(0)
+    {
+        for (int i = 0; i < SLOTS; i++)
+            season[i] = 1.0f;
+    }
+
+    // Vehicle count reported at nowMs while the approach is red, in time-of-day slot
+    void observeRed(float count, uint32_t nowMs, int slot)
+    {
+        if (hasLast)
+        {
+            float seconds = (nowMs - lastMs) / 1000.0f;
+            if (seconds >= MIN_INTERVAL_S && seconds <= MAX_INTERVAL_S)
+            {
+                float rate = count > lastCount ? (count - lastCount) / seconds : 0.0f;
+                update(rate, slot, seconds);
+            }
+            else if (seconds < MIN_INTERVAL_S)
+            {
+                return; // Keep the older reference point and wait for a longer gap
+            }
+        }
+        hasLast = true;
+        lastCount = count;
+        lastMs = nowMs;
+    }
+
+    // The approach got green: the next red interval starts from a new reference count
+    void breakInterval()
+    {
+        hasLast = false;
+    }
+
+    bool ready() const
+    {
+        return observations >= 3;
+    }
+
+    // Arrivals per second expected aheadSeconds from now
+    float ratePerSecond(int slot, float aheadSeconds = 0) const
+    {
+        float rate = (level + trend * aheadSeconds) * season[slot % SLOTS];
+        return rate > 0 ? rate : 0;
+    }
+
+    // Vehicles expected to arrive during the next `seconds`
+    float arrivalsOver(float seconds, int slot) const
+    {
+        return ready() ? ratePerSecond(slot, seconds / 2) * seconds : 0;
+    }
+
+private:
+    // rate was measured over the `seconds` since the previous observation
+    void update(float rate, int slot, float seconds)
+    {
+        slot %= SLOTS;
+        if (observations == 0)
+        {
+            level = rate;
+        }
+        else
+        {
+            float previous = level;
+            float factor = season[slot] > 0.05f ? season[slot] : 0.05f;
+            level = alpha * (rate / factor) + (1 - alpha) * (level + trend * seconds);
+            trend = beta * (level - previous) / seconds + (1 - beta) * trend;
+            if (level > 0.01f)
+                season[slot] = gamma * (rate / level) + (1 - gamma) * season[slot];
+        }
+        if (level < 0)
+            level = 0;
+        observations++;
+    }
+
+    float alpha, beta, gamma;
+    float level;        // Deseasonalised arrivals per second
+    float trend;        // Change of level per second
+    float season[SLOTS];
+    uint32_t observations;
+    bool hasLast;
+    float lastCount;
+    uint32_t lastMs;
+};
+} // namespace demand_forecast
+
+#endif // DEMAND_FORECAST_H
@@ -0,0 +1,1251 @@
+#include <WiFi.h> // For ESP32 (use ESP8266WiFi.h for ESP8266)
+#include <PubSubClient.h>
+#include <ArduinoJson.h> // Add JSON library for parsing
+#include <time.h>        // Include time library for NTP
+#include "lane_policy.h" // Green time policy table (generated by Python/compile_policy.py)
+#include "lane_config.h" // Runtime parameters, saved in NVS and updated over traffic/config
+#include "phase_engine.h" // Conflict matrix and barrier groups for shared greens
+#include "cycle_accounting.h" // Per-cycle time accounting for traffic/cycle_stats
+#include "mqtt_topics.h" // traffic/<intersection>/... topic names
+#include "demand_forecast.h" // Arrival forecast for sizing green times
+#include "saturation_flow.h" // Measured saturation flow for sizing green times
+#include "intersection_snapshot.h" // Retained state for boards and detectors joining mid-cycle
+#include "loop_watchdog.h" // Deadline of the loop, flashing red fallback and latency histograms
+#include "ota_update.h" // Delta firmware updates into the other app slot, with rollback
+#ifdef MQTT_TLS
+#include "tls_session.h" // TLS to the broker, resuming the session kept in RTC memory
+#include "broker_certs.h" // Broker CA and this board's certificate (generated by Python/broker_tls.py)
+#endif
+#include <esp_task_wdt.h>
+
+// Single-board intersection controller.
+// One ESP32 drives the signal heads of all four road sections from its own
+// GPIOs and runs the phase engine in-process, so handing green from one group
+// to the next needs no green_request/green_permission/green_status round trip.
+// MQTT is only used for vehicle counts in and telemetry out; the messages it
+// publishes have the same format as the lane boards', so the Python side and
+// dashboards work unchanged. Flash this sketch OR the four esp32_laneN
+// sketches, not both. Lane boards are optional here: the signal_heads topic
+// carries every head's state for boards used as remote I/O.
+
+// WiFi settings
+const char *ssid = "PSS";         // Replace with your WiFi SSID
+const char *password = "S3rpong!"; // Replace with your WiFi password
+
+// MQTT settings
+#ifdef MQTT_TLS
+const char *mqtt_broker = BROKER_TLS_HOST; // The name in the broker's certificate
+const int mqtt_port = 8883;
+#else
+const char *mqtt_broker = "broker.emqx.io";
+const int mqtt_port = 1883;
+#endif
+const char *mqtt_topic = MQTT_SITE_TOPIC("+/vehicle_count");    // Every section of this intersection
+const char *mqtt_discharge_topic = MQTT_SITE_TOPIC("+/discharge"); // Stop line crossings of each green, from the detector
+const char *mqtt_client_id = "esp32_traffic_controller_intersection";
+const char *mqtt_green_status_topic = MQTT_SITE_TOPIC("green_status"); // Published for telemetry only
+const char *mqtt_reset_topic = MQTT_SITE_TOPIC("reset");
+const char *mqtt_config_topic = MQTT_SITE_TOPIC("config");             // Binary config blobs (see lane_config.h)
+const char *mqtt_config_status_topic = MQTT_SITE_TOPIC("config_status");
+const char *mqtt_signal_heads_topic = MQTT_SITE_TOPIC("signal_heads"); // All head states, retained
+const char *mqtt_state_topic = MQTT_SITE_TOPIC("state");               // Compact state for the area controller
+const char *mqtt_snapshot_topic = MQTT_SITE_TOPIC("snapshot");         // Versioned signal state, retained
+const char *mqtt_watchdog_topic = MQTT_SITE_TOPIC("watchdog");         // Stalls that made the heads flash red
+const char *mqtt_loop_stats_topic = MQTT_SITE_TOPIC("loop_stats");     // Max and p99 time per loop region
+const char *mqtt_ota_topic = MQTT_SITE_TOPIC("ota");                   // Firmware patch transfer (see ota_update.h)
+const char *mqtt_ota_status_topic = MQTT_SITE_TOPIC("ota_status");     // Transfer progress, switches and rollbacks
+const char *mqtt_tls_topic = MQTT_SITE_TOPIC("tls");                   // Handshake time and resumption after each connect
+// Per section, built with mqtt_topics::laneTopic(): duration, countdown_sync and
+// cycle_stats (where each section's cycle time went)
+
+// NTP Server Settings
+const char *ntpServer = "pool.ntp.org";
+const long gmtOffset_sec = 25200; // GMT+7 timezone offset in seconds (7*3600)
+const int daylightOffset_sec = 0; // No DST offset
+
+// Traffic Light Pin Definitions, {red, yellow, green} per road section.
+// Section 1 keeps the lane boards' pins; the others use free output-capable GPIOs.
+const int SECTIONS = 4;
+const int HEAD_PINS[SECTIONS][3] = {
+    {19, 18, 5},  // Section 1: GPIO19, GPIO18, GPIO5
+    {23, 22, 21}, // Section 2: GPIO23, GPIO22, GPIO21
+    {25, 26, 27}, // Section 3: GPIO25, GPIO26, GPIO27
+    {32, 33, 13}, // Section 4: GPIO32, GPIO33, GPIO13
+};
+
+const unsigned long DATA_TIMEOUT_MS = 120000; // Counts older than 2 minutes count as no data
+
+#ifdef MQTT_TLS
+// The session outlives esp_restart() and watchdog resets in RTC memory, so reconnects resume it
+RTC_NOINIT_ATTR tls_session::CachedSession tlsSession;
+tls_session::TlsClient espClient(tlsSession);
+#else
+WiFiClient espClient;
+#endif
+PubSubClient mqtt_client(espClient);
+
+// Define light state for each signal head
+struct TrafficLight
+{
+    bool red;
+    bool yellow;
+    bool green;
+};
+
+TrafficLight heads[SECTIONS];
+
+// Where a section is in its light sequence: all red, yellow, green, yellow, clearance red
+enum HeadStage
+{
+    STAGE_RED,
+    STAGE_ALL_RED,
+    STAGE_PRE_YELLOW,
+    STAGE_GREEN,
+    STAGE_YELLOW,
+    STAGE_CLEARANCE // Red, still holding the conflict area until traffic from yellow has crossed
+};
+
+struct SectionState
+{
+    float vehicleCount;
+    float approachSpeedKph; // 85th percentile from the tracker, 0 until one is reported
+    float arrivalRateVpm;   // Coordinator's arrival forecast per minute, -1 until one is reported
+    String timestamp;
+    unsigned long dataReceivedTime;
+    bool hasData;
+    HeadStage stage;
+    unsigned long stageEnd; // millis() at which the current stage ends
+    float duration;         // Green time of the running sequence
+    int lastCountdown;      // Last remaining-seconds value published
+};
+
+SectionState sections[SECTIONS];
+
+// Every millisecond of each section's cycle, charged to green, clearance, waiting or idle.
+// Kept outside SectionState so traffic/reset does not clear the counters.
+cycle_accounting::CycleAccounting cycleTime[SECTIONS];
+
+// Arrivals learnt from each count growing while its section is red, also kept across resets
+demand_forecast::DemandForecast arrivalForecast[SECTIONS];
+
+// Saturation flow of each section from the detector's discharge reports, kept across resets too
+saturation_flow::SaturationFlow saturationFlow[SECTIONS];
+
+// The watchdog task flashes every head red while the loop is overdue; headsMux serializes it
+// with setHead()
+loop_watchdog::LoopWatchdog loopWatchdog;
+portMUX_TYPE headsMux = portMUX_INITIALIZER_UNLOCKED;
+loop_watchdog::Violation pendingViolation; // Held until MQTT is connected to report it
+bool violationPending = false;
+
+// Firmware updates; the writer task decodes them into the other app slot, holding otaMutex
+ota_update::OtaUpdater otaUpdater;
+SemaphoreHandle_t otaMutex;
+bool otaChunkTaken = false; // The message poll_mqtt() just took was a firmware chunk
+
+// Controller parameters, double buffered so updates only take effect between groups
+lane_config::ConfigStore configStore;
+
+// Sections in their light sequence; compatible sections share green
+phase_engine::PhaseEngine phases;
+int nextExpectedSection = 1; // Lead section of the group served next
+int servingLead = 0;         // Lead section of the group being served, 0 between groups
+
+// The next group and its green times, decided again on every pass while the current group
+// runs, so the barrier only has to apply them
+int stagedLead = 1;
+float stagedGreen[SECTIONS];
+unsigned long groupEndedAt = 0; // When the last section of the served group finished its clearance
+
+// Last snapshot published (or, straight after boot, the retained one left by the previous run)
+intersection_snapshot::Snapshot snapshot;
+
+// Function declarations
+void watchdog_task(void *);
+void ota_task(void *);
+void poll_mqtt();
+void check_loop_watchdog();
+void setHead(int section, bool red, bool yellow, bool green);
+void publish_countdown_sync(int section, int remaining_seconds, String phase = "green");
+String getCurrentTimestamp();
+void resetAllData();
+void handle_config_message(const uint8_t *payload, unsigned int length);
+void publish_config_status(uint32_t version, const char *status, const char *reason);
+void handle_ota_message(const uint8_t *payload, unsigned int length);
+void publish_ota_status(ota_update::Report report);
+void report_ota();
+void service_ota();
+void publish_cycle_stats(int section);
+void publish_area_state();
+void publish_snapshot(unsigned long now);
+int forecastSlot();
+
+// MQTT message callback
+void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
+{
+    // Config blobs are binary, handle them before the payload is printed as text
+    if (strcmp(topic, mqtt_config_topic) == 0)
+    {
+        handle_config_message(payload, length);
+        return;
+    }
+    if (strcmp(topic, mqtt_ota_topic) == 0)
+    {
+        otaChunkTaken = true;
+        handle_ota_message(payload, length);
+        return;
+    }
+
+    String message;
+    for (int i = 0; i < length; i++)
+    {
+        message += (char)payload[i];
+    }
+
+    // Our own retained snapshot from before a reboot: keep its version count and sequence position
+    if (strcmp(topic, mqtt_snapshot_topic) == 0)
+    {
+        intersection_snapshot::Snapshot received;
+        if (intersection_snapshot::decode(payload, length, received) &&
+            intersection_snapshot::supersedes(received, snapshot))
+        {
+            snapshot.version = received.version;
+            if (servingLead == 0 && !phases.anyActive())
+            {
+                nextExpectedSection = phases.leadOf(received.next);
+                Serial.print("Intersection - Resuming the sequence at section ");
+                Serial.println(nextExpectedSection);
+            }
+        }
+        return;
+    }
+
+    if (mqtt_topics::laneOf(topic, "vehicle_count") > 0)
+    {
+        message.replace("'", "\"");
+        DynamicJsonDocument doc(1024);
+        DeserializationError error = deserializeJson(doc, message);
+        if (error)
+        {
+            Serial.print("deserializeJson() failed: ");
+            Serial.println(error.c_str());
+            return;
+        }
+
+        int road_section_id = doc["road_section_id"];
+        if (road_section_id < 1 || road_section_id > SECTIONS)
+        {
+            return;
+        }
+
+        int total_vehicles = 0;
+        if (doc.containsKey("total_vehicles"))
+        {
+            total_vehicles = doc["total_vehicles"];
+        }
+        else if (doc.containsKey("vehicle_counts"))
+        {
+            JsonObject vehicle_counts = doc["vehicle_counts"];
+            for (JsonPair kv : vehicle_counts)
+            {
+                total_vehicles += kv.value().as<int>();
+            }
+        }
+
+        SectionState &section = sections[road_section_id - 1];
+        section.vehicleCount = total_vehicles;
+        if (doc.containsKey("approach_speed_kph"))
+        {
+            section.approachSpeedKph = doc["approach_speed_kph"].as<float>();
+        }
+        if (doc.containsKey("arrival_rate_vpm"))
+        {
+            section.arrivalRateVpm = doc["arrival_rate_vpm"].as<float>();
+        }
+        if (section.stage == STAGE_RED)
+        {
+            arrivalForecast[road_section_id - 1].observeRed(total_vehicles, millis(), forecastSlot());
+        }
+        section.timestamp = doc.containsKey("timestamp") ? doc["timestamp"].as<String>() : getCurrentTimestamp();
+        section.dataReceivedTime = millis();
+        section.hasData = true;
+
+        Serial.print("Section ");
+        Serial.print(road_section_id);
+        Serial.print(" - Total Vehicles: ");
+        Serial.println(total_vehicles);
+    }
+    else if (mqtt_topics::laneOf(topic, "discharge") > 0)
+    {
+        // One report per green from the detector's stop line counter
+        int section = mqtt_topics::laneOf(topic, "discharge");
+        DynamicJsonDocument doc(256);
+        if (section <= SECTIONS && !deserializeJson(doc, message) && doc.containsKey("headways") &&
+            doc.containsKey("saturated_s"))
+        {
+            saturationFlow[section - 1].observe(doc["headways"].as<unsigned long>(), doc["saturated_s"].as<float>());
+        }
+    }
+    else if (strcmp(topic, mqtt_reset_topic) == 0)
+    {
+        String resetCommand = message;
+        resetCommand.trim();
+        resetCommand.toLowerCase();
+
+        if (resetCommand == "true" || resetCommand == "1" || resetCommand == "reset")
+        {
+            Serial.println("Intersection - RESET command received!");
+            resetAllData();
+        }
+        else
+        {
+            Serial.print("Intersection - Invalid reset command: ");
+            Serial.println(resetCommand);
+        }
+    }
+}
+
+void setup_wifi()
+{
+    unsigned long start = micros();
+    loopWatchdog.enter(loop_watchdog::WIFI);
+    delay(10);
+    Serial.println();
+    Serial.print("Connecting to ");
+    Serial.println(ssid);
+
+    WiFi.begin(ssid, password);
+
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        esp_task_wdt_reset(); // Waiting, not hung; the heads flash red meanwhile
+        delay(500);
+        Serial.print(".");
+    }
+
+    Serial.println("");
+    Serial.println("WiFi connected");
+    Serial.println("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Configure time
+    configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
+    Serial.println("Time configured");
+    loopWatchdog.leave(loop_watchdog::WIFI, micros() - start);
+}
+
+void connect_mqtt()
+{
+    unsigned long start = micros();
+    loopWatchdog.enter(loop_watchdog::MQTT_CONNECT);
+    while (!mqtt_client.connected())
+    {
+        Serial.print("Attempting MQTT connection...");
+        if (mqtt_client.connect(mqtt_client_id))
+        {
+            Serial.println("connected");
+#ifdef MQTT_TLS
+            char tlsReport[tls_session::MAX_REPORT];
+            if (tls_session::encodeReport(tlsReport, 0, espClient.handshakes()) > 0)
+            {
+                Serial.print("TLS: ");
+                Serial.println(tlsReport);
+                mqtt_client.publish(mqtt_tls_topic, tlsReport);
+            }
+#endif
+            Serial.println("Subscribing to topics:");
+
+            if (mqtt_client.subscribe(mqtt_topic)) {
+                Serial.println("  ✓ " + String(mqtt_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_topic));
+            }
+
+            if (mqtt_client.subscribe(mqtt_discharge_topic)) {
+                Serial.println("  ✓ " + String(mqtt_discharge_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_discharge_topic));
+            }
+
+            if (mqtt_client.subscribe(mqtt_reset_topic)) {
+                Serial.println("  ✓ " + String(mqtt_reset_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_reset_topic));
+            }
+
+            if (mqtt_client.subscribe(mqtt_config_topic)) {
+                Serial.println("  ✓ " + String(mqtt_config_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_config_topic));
+            }
+
+            if (mqtt_client.subscribe(mqtt_ota_topic)) {
+                Serial.println("  ✓ " + String(mqtt_ota_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_ota_topic));
+            }
+
+            if (mqtt_client.subscribe(mqtt_snapshot_topic)) {
+                Serial.println("  ✓ " + String(mqtt_snapshot_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_snapshot_topic));
+            }
+
+            Serial.println("Intersection controller ready to receive MQTT messages!");
+        }
+        else
+        {
+            Serial.print("failed, rc=");
+            Serial.print(mqtt_client.state());
+#ifdef MQTT_TLS
+            Serial.print(", TLS: ");
+            Serial.print(espClient.lastError());
+#endif
+            Serial.println(" try again in 5 seconds");
+            esp_task_wdt_reset(); // Retrying is progress; a failed attempt still trips the loop deadline
+            delay(5000);
+        }
+    }
+    loopWatchdog.leave(loop_watchdog::MQTT_CONNECT, micros() - start);
+}
+
+// Arduino core hook: keep a new image on trial instead of marking it valid at boot;
+// service_ota() confirms it once it has proven itself
+bool verifyRollbackLater()
+{
+    return true;
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    Serial.println("ESP32 Traffic Light Controller - Single-board intersection");
+
+    // Identify the green time policy that was flashed
+    char policyChecksum[9];
+    snprintf(policyChecksum, sizeof(policyChecksum), "%08lx", (unsigned long)lane_policy::CHECKSUM);
+    Serial.println("Policy: " + String(lane_policy::NAME) + " v" + String(lane_policy::VERSION) + " (crc " + String(policyChecksum) + ")");
+
+    // Load the parameters saved by the last config update
+    bool configLoaded = configStore.begin();
+    phases.setConflicts(configStore.current().body.conflicts);
+    if (configLoaded)
+    {
+        Serial.println("Config: v" + String(configStore.current().version) + " loaded from NVS");
+    }
+    else
+    {
+        Serial.println("Config: none saved, using defaults");
+    }
+
+    // Which firmware runs, and whether it is a new image on trial
+    otaUpdater.begin(millis());
+    Serial.println("Firmware: v" + String(otaUpdater.runningVersion()) + (otaUpdater.onTrial() ? " on trial" : ""));
+
+    // Initialize traffic light pins, every head starts red
+    for (int i = 0; i < SECTIONS; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            pinMode(HEAD_PINS[i][k], OUTPUT);
+        }
+        sections[i] = SectionState{0, 0, -1, "", 0, false, STAGE_RED, 0, 0, 0};
+        setHead(i + 1, true, false, false);
+    }
+
+    // Watch the loop from here on, so a hang in setup_wifi() already flashes the heads red
+    loopWatchdog.begin(millis());
+    esp_task_wdt_init(loop_watchdog::TASK_WDT_TIMEOUT_S, true);
+    esp_task_wdt_add(NULL);
+    xTaskCreatePinnedToCore(watchdog_task, "loop_watchdog", 2048, NULL, 2, NULL, 0);
+    otaMutex = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(ota_task, "ota_writer", 4096, NULL, 1, NULL, 0);
+
+    setup_wifi();
+#ifdef MQTT_TLS
+    if (!espClient.setCertificates(BROKER_CA_PEM, BOARD_CERT_PEM, BOARD_KEY_PEM))
+    {
+        Serial.print("TLS: certificates not loaded, ");
+        Serial.println(espClient.lastError());
+    }
+#endif
+    mqtt_client.setServer(mqtt_broker, mqtt_port);
+    mqtt_client.setCallback(mqtt_callback);
+    mqtt_client.setBufferSize(1280); // Config blobs and 1 KB firmware chunks are larger than the 256-byte default
+
+    Serial.println("Setup completed for the intersection");
+}
+
+// Whether a weekday hour runs the jam sibuk plan; the loop uses the full schedule (rushWeight)
+bool isJamSibuk(int jam)
+{
+    return configStore.current().isRushHour(jam);
+}
+
+// Quarter hour of the day for the forecast's time-of-day profile
+int forecastSlot()
+{
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo, 0))
+    {
+        return 0;
+    }
+    return demand_forecast::slotOf(timeinfo.tm_hour, timeinfo.tm_min);
+}
+
+// Vehicles expected to join a section's queue during a green of greenSeconds, 0 unless the
+// config enables forecast greens. The coordinator's forecast wins over the local one.
+float expectedArrivals(int section, float greenSeconds)
+{
+    if (!configStore.current().forecastGreens())
+    {
+        return 0;
+    }
+    if (sections[section - 1].arrivalRateVpm >= 0)
+    {
+        return sections[section - 1].arrivalRateVpm / 60.0f * greenSeconds;
+    }
+    return arrivalForecast[section - 1].arrivalsOver(greenSeconds, forecastSlot());
+}
+
+// Green time for `vehicles` waiting in a section: queue over its measured saturation flow
+// once the config enables it and enough greens were measured, otherwise the policy table
+float greenSecondsFor(int section, float vehicles, float rushWeight)
+{
+    const lane_config::LaneConfig &config = configStore.current();
+    const saturation_flow::SaturationFlow &flow = saturationFlow[section - 1];
+    if (config.saturationGreens() && flow.ready())
+    {
+        return config.clampGreen(flow.greenSeconds(vehicles));
+    }
+    return config.blendedGreenSeconds(vehicles, rushWeight);
+}
+
+// Wall-clock milliseconds for the snapshot. NTP time only has whole seconds, so the fraction
+// is counted with millis() from the pass that saw the second change.
+uint64_t wallClockMs()
+{
+    static time_t lastSecond = 0;
+    static unsigned long secondSeenAt = 0;
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo, 0))
+    {
+        return 0;
+    }
+    time_t second = mktime(&timeinfo);
+    unsigned long now = millis();
+    if (second != lastSecond)
+    {
+        lastSecond = second;
+        secondSeenAt = now;
+    }
+    unsigned long fraction = now - secondSeenAt;
+    return (uint64_t)second * 1000 + (fraction < 1000 ? fraction : 999);
+}
+
+String getCurrentTimestamp()
+{
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo))
+    {
+        return "1970-01-01 00:00:00"; // Fallback if time not available
+    }
+
+    char timeStr[20];
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &timeinfo);
+    return String(timeStr);
+}
+
+void setHead(int section, bool red, bool yellow, bool green)
+{
+    // While the watchdog task flashes red the stages run on, but do not reach the heads
+    portENTER_CRITICAL(&headsMux);
+    if (!loopWatchdog.fallbackActive())
+    {
+        const int *pins = HEAD_PINS[section - 1];
+        digitalWrite(pins[0], red ? HIGH : LOW);
+        digitalWrite(pins[1], yellow ? HIGH : LOW);
+        digitalWrite(pins[2], green ? HIGH : LOW);
+
+        heads[section - 1].red = red;
+        heads[section - 1].yellow = yellow;
+        heads[section - 1].green = green;
+    }
+    portEXIT_CRITICAL(&headsMux);
+}
+
+void allRed()
+{
+    for (int section = 1; section <= SECTIONS; section++)
+    {
+        setHead(section, true, false, false);
+    }
+}
+
+// Watchdog task: flash every head red while the signal task misses its deadline
+void watchdog_task(void *)
+{
+    while (true)
+    {
+        portENTER_CRITICAL(&headsMux);
+        if (loopWatchdog.trip(millis()))
+        {
+            bool on = loopWatchdog.flashOn(millis());
+            for (int i = 0; i < SECTIONS; i++)
+            {
+                digitalWrite(HEAD_PINS[i][0], on ? HIGH : LOW);
+                digitalWrite(HEAD_PINS[i][1], LOW);
+                digitalWrite(HEAD_PINS[i][2], LOW);
+                heads[i].red = on;
+                heads[i].yellow = false;
+                heads[i].green = false;
+            }
+        }
+        portEXIT_CRITICAL(&headsMux);
+        vTaskDelay(pdMS_TO_TICKS(loop_watchdog::CHECK_MS));
+    }
+}
+
+// Writer task: decodes queued firmware chunks, one flash sector per step, so the signal task
+// waits out at most one sector erase when it needs the updater
+void ota_task(void *)
+{
+    while (true)
+    {
+        xSemaphoreTake(otaMutex, portMAX_DELAY);
+        bool more = otaUpdater.work();
+        xSemaphoreGive(otaMutex);
+        vTaskDelay(pdMS_TO_TICKS(more ? 1 : 100));
+    }
+}
+
+// mqtt_client.loop() for the signal task; every poll is a check-in with the loop watchdog
+void poll_mqtt()
+{
+    loopWatchdog.checkIn(millis());
+    esp_task_wdt_reset();
+    unsigned long start = micros();
+    loopWatchdog.enter(loop_watchdog::MQTT_POLL);
+    // Firmware chunks don't use up the poll, so a transfer can't hold back the control
+    // messages queued behind it; the sender's window bounds how many there are
+    do
+    {
+        otaChunkTaken = false;
+        mqtt_client.loop();
+    } while (otaChunkTaken);
+    loopWatchdog.leave(loop_watchdog::MQTT_POLL, micros() - start);
+    report_ota();
+}
+
+// Called between groups, when every head is meant to be red: ends a fallback and reports it,
+// and publishes the loop statistics when they are due
+void check_loop_watchdog()
+{
+    loop_watchdog::Violation violation;
+    portENTER_CRITICAL(&headsMux);
+    bool recovered = loopWatchdog.recover(millis(), violation);
+    portEXIT_CRITICAL(&headsMux);
+    if (recovered)
+    {
+        allRed();
+        pendingViolation = violation;
+        violationPending = true;
+        Serial.print("Intersection - WATCHDOG: loop stalled ");
+        Serial.print(violation.stalledMs);
+        Serial.print(" ms in ");
+        Serial.print(loop_watchdog::regionName(violation.region));
+        Serial.print(", heads flashed red for ");
+        Serial.print(violation.fallbackMs);
+        Serial.println(" ms");
+    }
+
+    char message[loop_watchdog::MAX_REPORT];
+    if (violationPending && mqtt_client.connected() &&
+        loop_watchdog::encodeViolation(message, 0, pendingViolation, loopWatchdog.totalViolations()) > 0)
+    {
+        violationPending = !mqtt_client.publish(mqtt_watchdog_topic, message);
+    }
+    if (loopWatchdog.statsDue(millis()) && loopWatchdog.report(message, 0, millis()) > 0)
+    {
+        mqtt_client.publish(mqtt_loop_stats_topic, message);
+    }
+}
+
+// Head states as one character per section (G, y or r), e.g. "GrGr"
+String headString()
+{
+    String state;
+    for (int i = 0; i < SECTIONS; i++)
+    {
+        state += heads[i].green ? "G" : (heads[i].yellow ? "y" : "r");
+    }
+    return state;
+}
+
+void publish_signal_heads()
+{
+    DynamicJsonDocument doc(256);
+    doc["heads"] = headString();
+    doc["timestamp"] = getCurrentTimestamp();
+
+    String message;
+    serializeJson(doc, message);
+    mqtt_client.publish(mqtt_signal_heads_topic, message.c_str(), true);
+}
+
+void resetAllData()
+{
+    Serial.println("Intersection - RESET: Clearing all data and states");
+
+    for (int i = 0; i < SECTIONS; i++)
+    {
+        sections[i] = SectionState{0, 0, -1, "", 0, false, STAGE_RED, 0, 0, 0};
+    }
+    phases.clear();
+    nextExpectedSection = 1; // Reset to starting sequence
+    servingLead = 0;
+
+    allRed();
+    publish_signal_heads();
+    Serial.println("Intersection - RESET completed");
+}
+
+void publish_green_status(int section, String status)
+{
+    DynamicJsonDocument doc(256);
+    doc["section"] = section;
+    doc["status"] = status;
+    doc["timestamp"] = getCurrentTimestamp();
+
+    String message;
+    serializeJson(doc, message);
+    mqtt_client.publish(mqtt_green_status_topic, message.c_str());
+}
+
+void publish_countdown_sync(int section, int remaining_seconds, String phase)
+{
+    DynamicJsonDocument doc(512);
+    doc["lane_id"] = section;
+    doc["remaining_seconds"] = remaining_seconds;
+    doc["phase"] = phase;
+    doc["timestamp"] = millis() / 1000;
+    doc["source"] = "esp";
+
+    String message;
+    serializeJson(doc, message);
+    char topic[mqtt_topics::MAX_TOPIC];
+    mqtt_client.publish(mqtt_topics::laneTopic(topic, section, "countdown_sync"), message.c_str());
+}
+
+void publish_duration(int section, float duration)
+{
+    DynamicJsonDocument doc(512);
+    doc["road_section_id"] = section;
+    doc["total_vehicles"] = (int)sections[section - 1].vehicleCount;
+    doc["duration"] = duration;
+    doc["lost_time_ms"] = configStore.current().lostMsFor(section, sections[section - 1].approachSpeedKph);
+    if (saturationFlow[section - 1].ready())
+    {
+        doc["saturation_flow_vph"] = (int)(saturationFlow[section - 1].perHour() + 0.5f);
+    }
+    doc["timestamp"] = sections[section - 1].timestamp;
+
+    String message;
+    serializeJson(doc, message);
+    char topic[mqtt_topics::MAX_TOPIC];
+    mqtt_client.publish(mqtt_topics::laneTopic(topic, section, "duration"), message.c_str());
+}
+
+void publish_config_status(uint32_t version, const char *status, const char *reason)
+{
+    DynamicJsonDocument doc(256);
+    doc["lane_id"] = 0; // The whole intersection
+    doc["version"] = version;
+    doc["status"] = status;
+    doc["reason"] = reason;
+    doc["timestamp"] = getCurrentTimestamp();
+
+    String message;
+    serializeJson(doc, message);
+    mqtt_client.publish(mqtt_config_status_topic, message.c_str());
+}
+
+void publish_ota_status(ota_update::Report report)
+{
+    DynamicJsonDocument doc(320);
+    doc["lane_id"] = 0; // The whole intersection
+    doc["state"] = ota_update::reportName(report);
+    doc["running"] = otaUpdater.runningVersion();
+    doc["version"] = otaUpdater.incomingVersion();
+    doc["next"] = otaUpdater.nextOffset();
+    doc["size"] = otaUpdater.patchSize();
+    doc["trial"] = otaUpdater.onTrial();
+    doc["reason"] = report == ota_update::REPORT_REJECTED ? ota_update::describe(otaUpdater.lastResult()) : "";
+    doc["timestamp"] = getCurrentTimestamp();
+
+    String message;
+    serializeJson(doc, message);
+    mqtt_client.publish(mqtt_ota_status_topic, message.c_str());
+}
+
+void handle_ota_message(const uint8_t *payload, unsigned int length)
+{
+    xSemaphoreTake(otaMutex, portMAX_DELAY);
+    otaUpdater.handle(payload, length);
+    xSemaphoreGive(otaMutex);
+}
+
+// Publish what the last chunks or the writer task have to say
+void report_ota()
+{
+    xSemaphoreTake(otaMutex, portMAX_DELAY);
+    ota_update::Report report = otaUpdater.takeReport();
+    xSemaphoreGive(otaMutex);
+    if (report == ota_update::REPORT_NONE)
+    {
+        return;
+    }
+    // Progress goes to the sender only
+    if (report != ota_update::REPORT_RECEIVING && report != ota_update::REPORT_RESEND)
+    {
+        Serial.print("Intersection - Firmware v");
+        Serial.print(otaUpdater.incomingVersion());
+        Serial.print(" ");
+        Serial.print(ota_update::reportName(report));
+        if (report == ota_update::REPORT_REJECTED)
+        {
+            Serial.print(": ");
+            Serial.print(ota_update::describe(otaUpdater.lastResult()));
+        }
+        Serial.println();
+    }
+    publish_ota_status(report);
+}
+
+// Boot report, trial of a new image and the switch to a finished update
+void service_ota()
+{
+    if (mqtt_client.connected())
+    {
+        ota_update::Report boot = otaUpdater.takeBootReport();
+        if (boot != ota_update::REPORT_NONE)
+        {
+            publish_ota_status(boot);
+        }
+    }
+
+    if (otaUpdater.onTrial())
+    {
+        // Kept once it has run a while and is connected with the loop on time; a hang
+        // before that resets the board through the task watchdog, and the bootloader rolls back
+        if (mqtt_client.connected() && !loopWatchdog.fallbackActive() && otaUpdater.trialPassed(millis()))
+        {
+            otaUpdater.confirm();
+            publish_ota_status(ota_update::REPORT_CONFIRMED);
+            Serial.print("Intersection - Firmware v");
+            Serial.print(otaUpdater.runningVersion());
+            Serial.println(" confirmed");
+        }
+        else if (otaUpdater.trialExpired(millis()))
+        {
+            Serial.print("Intersection - Firmware v");
+            Serial.print(otaUpdater.runningVersion());
+            Serial.println(" not confirmed, rolling back");
+            otaUpdater.rollBackNow(); // Restarts
+        }
+    }
+
+    // A finished update (or a rollback) takes over here, with every head red; the restart
+    // darkens them for about a second
+    if (otaUpdater.switchDue())
+    {
+        Serial.print("Intersection - Firmware v");
+        Serial.print(otaUpdater.incomingVersion());
+        Serial.println(" switching, restarting");
+        if (otaUpdater.switchBoot() == ota_update::OTA_OK)
+        {
+            publish_ota_status(ota_update::REPORT_APPLYING);
+            mqtt_client.disconnect();
+            esp_restart();
+        }
+        publish_ota_status(ota_update::REPORT_REJECTED);
+    }
+}
+
+// Queues and arrival rates of all sections in one message per group, for host/area_controller
+void publish_area_state()
+{
+    unsigned long now = millis();
+    DynamicJsonDocument doc(256);
+    doc["lead"] = servingLead;
+    JsonArray queues = doc.createNestedArray("q");
+    JsonArray rates = doc.createNestedArray("vpm");
+    for (int section = 1; section <= SECTIONS; section++)
+    {
+        const SectionState &state = sections[section - 1];
+        bool fresh = state.hasData && now - state.dataReceivedTime <= DATA_TIMEOUT_MS;
+        queues.add(fresh ? (int)state.vehicleCount : 0);
+        const demand_forecast::DemandForecast &forecast = arrivalForecast[section - 1];
+        rates.add(forecast.ready() ? forecast.ratePerSecond(forecastSlot()) * 60.0f : state.arrivalRateVpm);
+    }
+
+    String message;
+    serializeJson(doc, message);
+    mqtt_client.publish(mqtt_state_topic, message.c_str());
+}
+
+// Where the served group is in its sequence and when that stage ends, from its lead section
+intersection_snapshot::Stage groupStage(unsigned long now, unsigned long &endsAt)
+{
+    endsAt = now;
+    if (servingLead == 0 || !phases.anyActive())
+    {
+        return intersection_snapshot::IDLE;
+    }
+    const SectionState &lead = sections[servingLead - 1];
+    const lane_config::LaneConfig &config = configStore.current();
+    endsAt = lead.stageEnd;
+    switch (lead.stage)
+    {
+    case STAGE_ALL_RED:
+        endsAt += config.body.preYellowMs;
+        return intersection_snapshot::STARTING;
+    case STAGE_PRE_YELLOW:
+        return intersection_snapshot::STARTING;
+    case STAGE_GREEN:
+        return intersection_snapshot::GREEN;
+    case STAGE_YELLOW:
+        endsAt += config.allRedMsFor(servingLead, lead.approachSpeedKph);
+        return intersection_snapshot::CLEARING;
+    case STAGE_CLEARANCE:
+        return intersection_snapshot::CLEARING;
+    default:
+        // The lead has finished while a longer section of its group clears
+        endsAt = now;
+        return intersection_snapshot::CLEARING;
+    }
+}
+
+// Versioned state of the whole intersection, retained, whenever the group, its stage or the
+// next group changes
+void publish_snapshot(unsigned long now)
+{
+    unsigned long endsAt;
+    intersection_snapshot::Stage stage = groupStage(now, endsAt);
+    uint8_t next = servingLead != 0 ? stagedLead : nextExpectedSection;
+    if (snapshot.active == phases.activeMask() && snapshot.stage == stage && snapshot.next == next)
+    {
+        return; // Also holds at boot, so the retained snapshot arrives before anything is published
+    }
+
+    uint64_t wallNow = wallClockMs();
+    if (wallNow == 0)
+    {
+        return; // No NTP time yet, joiners could not use the stage end
+    }
+    snapshot.version++;
+    snapshot.publishedMs = wallNow;
+    snapshot.active = phases.activeMask();
+    snapshot.next = next;
+    snapshot.stage = stage;
+    snapshot.stageEndMs = stage == intersection_snapshot::IDLE ? 0 : wallNow + (long)(endsAt - now);
+    for (int section = 1; section <= SECTIONS; section++)
+    {
+        const SectionState &state = sections[section - 1];
+        bool fresh = state.hasData && now - state.dataReceivedTime <= DATA_TIMEOUT_MS;
+        snapshot.green[section - 1] = (uint16_t)(int)state.duration;
+        snapshot.demand[section - 1] = fresh ? (uint16_t)state.vehicleCount : 0;
+    }
+
+    char message[intersection_snapshot::MAX_MESSAGE];
+    if (intersection_snapshot::encode(snapshot, message) > 0)
+    {
+        mqtt_client.publish(mqtt_snapshot_topic, message, true);
+    }
+}
+
+// One compact record per section cycle: milliseconds of the cycle and seconds since boot,
+// each as [effective green, clearance, coordination wait, idle]
+void publish_cycle_stats(int section)
+{
+    const cycle_accounting::CycleAccounting &accounting = cycleTime[section - 1];
+    DynamicJsonDocument doc(384);
+    doc["lane_id"] = section;
+    doc["cycle"] = accounting.cycleCount();
+    doc["cycle_ms"] = accounting.lastCycleLengthMs();
+    JsonArray cycleMs = doc.createNestedArray("ms");
+    JsonArray totalSeconds = doc.createNestedArray("total_s");
+    for (int c = 0; c < cycle_accounting::CATEGORIES; c++)
+    {
+        cycleMs.add(accounting.lastCycleMs((cycle_accounting::Category)c));
+        totalSeconds.add(accounting.totalSeconds((cycle_accounting::Category)c));
+    }
+
+    String message;
+    serializeJson(doc, message);
+    char topic[mqtt_topics::MAX_TOPIC];
+    mqtt_client.publish(mqtt_topics::laneTopic(topic, section, "cycle_stats"), message.c_str());
+}
+
+void handle_config_message(const uint8_t *payload, unsigned int length)
+{
+    lane_config::ParseResult result = configStore.stage(payload, length);
+    uint32_t version = 0;
+    if (length >= sizeof(lane_config::ConfigHeader))
+    {
+        memcpy(&version, payload + offsetof(lane_config::ConfigHeader, version), sizeof(version));
+    }
+
+    Serial.print("Intersection - Config v");
+    Serial.print(version);
+    if (result == lane_config::CONFIG_OK)
+    {
+        Serial.println(" saved, applying at the next phase boundary");
+        publish_config_status(version, "staged", "");
+    }
+    else if (result == lane_config::CONFIG_STALE)
+    {
+        // Retained configs are received again on every reconnect
+        Serial.println(" already running");
+    }
+    else
+    {
+        Serial.print(" rejected: ");
+        Serial.println(lane_config::describe(result));
+        publish_config_status(version, "rejected", lane_config::describe(result));
+    }
+}
+
+// Next group and green times from the latest counts: the group after the one being served,
+// or the expected one between groups
+void stageNextGroup(float rushWeight, unsigned long now)
+{
+    bool jamSibuk = rushWeight >= 0.5f;
+    if (servingLead != 0)
+    {
+        int proposed = lane_policy::nextLane(sections[servingLead - 1].vehicleCount, jamSibuk, servingLead);
+        stagedLead = phases.nextLead(servingLead, proposed);
+    }
+    else
+    {
+        stagedLead = nextExpectedSection;
+    }
+
+    for (int section = 1; section <= SECTIONS; section++)
+    {
+        const SectionState &state = sections[section - 1];
+        bool fresh = state.hasData && now - state.dataReceivedTime <= DATA_TIMEOUT_MS;
+        float vehicles = fresh ? state.vehicleCount : 0;
+        stagedGreen[section - 1] = greenSecondsFor(section, vehicles, rushWeight);
+        float arriving = fresh ? expectedArrivals(section, stagedGreen[section - 1]) : 0;
+        if (arriving > 0)
+        {
+            // Size the green for the vehicles that will be there by the time it runs
+            stagedGreen[section - 1] = greenSecondsFor(section, vehicles + arriving, rushWeight);
+        }
+    }
+}
+
+// Begin the light sequence of one section at `now`: all red, yellow, green, yellow, all red
+void startSection(int section, float duration, unsigned long now)
+{
+    SectionState &state = sections[section - 1];
+    bool fresh = state.hasData && now - state.dataReceivedTime <= DATA_TIMEOUT_MS;
+    float vehicles = fresh ? state.vehicleCount : 0;
+
+    state.duration = duration;
+    state.stage = STAGE_ALL_RED;
+    state.stageEnd = now + configStore.current().leadRedMs();
+    phases.setActive(section, true);
+    setHead(section, true, false, false);
+    cycleTime[section - 1].enter(cycle_accounting::CLEARANCE, now);
+
+    Serial.print("Section ");
+    Serial.print(section);
+    Serial.print(" - Vehicles: ");
+    Serial.print(vehicles);
+    Serial.print(", green for ");
+    Serial.print(state.duration);
+    Serial.println(" seconds");
+    publish_duration(section, state.duration);
+}
+
+// Move a section through its sequence; stages that ended while the loop was busy are caught up
+void advanceSection(int section, unsigned long now)
+{
+    SectionState &state = sections[section - 1];
+    const lane_config::LaneConfig &config = configStore.current();
+
+    cycle_accounting::CycleAccounting &accounting = cycleTime[section - 1];
+
+    while (state.stage != STAGE_RED && (long)(now - state.stageEnd) >= 0)
+    {
+        unsigned long at = state.stageEnd; // When the stage really ended, even if the loop was late
+        switch (state.stage)
+        {
+        case STAGE_ALL_RED:
+            setHead(section, false, true, false);
+            state.stage = STAGE_PRE_YELLOW;
+            state.stageEnd += config.body.preYellowMs;
+            break;
+        case STAGE_PRE_YELLOW:
+            setHead(section, false, false, true);
+            publish_green_status(section, "green");
+            arrivalForecast[section - 1].breakInterval(); // The queue discharges from here on
+            accounting.enter(state.vehicleCount > 0 ? cycle_accounting::EFFECTIVE_GREEN : cycle_accounting::IDLE, at);
+            state.stage = STAGE_GREEN;
+            state.stageEnd += (unsigned long)(int)state.duration * 1000UL; // Whole seconds, like countdownTimer()
+            state.lastCountdown = 0;
+            break;
+        case STAGE_GREEN:
+            setHead(section, false, true, false);
+            accounting.enter(cycle_accounting::CLEARANCE, at);
+            state.stage = STAGE_YELLOW;
+            state.stageEnd += config.yellowMsFor(section, state.approachSpeedKph);
+            break;
+        case STAGE_YELLOW:
+            setHead(section, true, false, false);
+            state.stage = STAGE_CLEARANCE;
+            state.stageEnd += config.allRedMsFor(section, state.approachSpeedKph);
+            break;
+        case STAGE_CLEARANCE:
+            publish_green_status(section, "red");
+            phases.setActive(section, false);
+            state.stage = STAGE_RED;
+            if ((long)(at - groupEndedAt) > 0)
+            {
+                groupEndedAt = at;
+            }
+            accounting.closeCycle(at);
+            publish_cycle_stats(section);
+            Serial.print("Section ");
+            Serial.print(section);
+            Serial.println(" - Traffic light cycle completed");
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Red between sequences: reported vehicles are waiting for their group's turn
+    if (state.stage == STAGE_RED)
+    {
+        bool fresh = state.hasData && now - state.dataReceivedTime <= DATA_TIMEOUT_MS;
+        accounting.enter(fresh ? cycle_accounting::COORDINATION_WAIT : cycle_accounting::IDLE, now);
+    }
+
+    // Countdown every 2 seconds, or every second for the last 3 seconds
+    if (state.stage == STAGE_GREEN)
+    {
+        int remaining = (int)((state.stageEnd - now + 999) / 1000);
+        if (remaining != state.lastCountdown && (remaining % 2 == 0 || remaining <= 3))
+        {
+            publish_countdown_sync(section, remaining, "green");
+        }
+        state.lastCountdown = remaining;
+    }
+}
+
+bool anyFreshData(unsigned long now)
+{
+    for (int i = 0; i < SECTIONS; i++)
+    {
+        if (sections[i].hasData && now - sections[i].dataReceivedTime <= DATA_TIMEOUT_MS)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void loop()
+{
+    if (!mqtt_client.connected())
+    {
+        connect_mqtt();
+    }
+    poll_mqtt();
+
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo))
+    {
+        Serial.println("Failed to obtain time");
+        delay(1000);
+        return;
+    }
+    // Day type, holidays and smooth changes between plans all come from the config's schedule
+    float rushWeight = configStore.current().rushWeight(timeinfo);
+
+    String before = headString();
+    unsigned long now = millis();
+    for (int section = 1; section <= SECTIONS; section++)
+    {
+        advanceSection(section, now);
+    }
+    stageNextGroup(rushWeight, now);
+
+    // Barrier: the next group starts once every section of the current one is red
+    if (!phases.anyActive())
+    {
+        check_loop_watchdog();
+        service_ota();
+
+        // Straight after a group, the next one starts at the moment its clearance ended,
+        // not at the pass that noticed it
+        unsigned long start = now;
+        if (servingLead != 0)
+        {
+            nextExpectedSection = stagedLead;
+            servingLead = 0;
+            start = groupEndedAt;
+        }
+
+        // No light sequence is running here, so this is where a staged config takes over
+        if (configStore.applyPending())
+        {
+            phases.setConflicts(configStore.current().body.conflicts);
+            nextExpectedSection = phases.leadOf(nextExpectedSection);
+            Serial.print("Intersection - Config v");
+            Serial.print(configStore.current().version);
+            Serial.println(" applied");
+            publish_config_status(configStore.current().version, "applied", "");
+            stageNextGroup(rushWeight, now);
+        }
+
+        // Keep every head red until the detector has reported something
+        if (anyFreshData(now))
+        {
+            servingLead = nextExpectedSection;
+            Serial.print("Intersection - Serving group of section ");
+            Serial.println(servingLead);
+            for (int section = 1; section <= SECTIONS; section++)
+            {
+                if (phases.sameGroup(section, servingLead))
+                {
+                    startSection(section, stagedGreen[section - 1], start);
+                    advanceSection(section, now);
+                }
+            }
+            publish_area_state();
+        }
+    }
+
+    if (headString() != before)
+    {
+        publish_signal_heads();
+    }
+    publish_snapshot(millis());
+
+    // Sleep at most 100 ms, and only until the next stage change, so lights switch on time
+    unsigned long sleepMs = 100;
+    now = millis();
+    for (int i = 0; i < SECTIONS; i++)
+    {
+        long untilEnd = (long)(sections[i].stageEnd - now);
+        if (sections[i].stage != STAGE_RED && untilEnd >= 0 && (unsigned long)untilEnd < sleepMs)
+        {
+            sleepMs = untilEnd;
+        }
+    }
+    delay(sleepMs);
+}
@@ -0,0 +1,186 @@
+// Retained snapshot of one intersection's signal state, on traffic/<intersection>/snapshot.
+// This file is identical in every sketch folder; change all of them together.
+// Python/intersection_snapshot.py reads and writes the same message.
+//
+// A board or detector that connects mid-cycle receives the retained snapshot
+// as soon as it subscribes, and from that one message knows which sections
+// hold green, when their stage ends, which group is served next and the
+// demand on every approach. Without it a joiner has to piece this together
+// from countdown_sync, green_status and next_lane_ready over the following
+// seconds. The single-board controller writes the snapshot; with lane boards,
+// lane 1 writes it from the handover messages it already receives.
+//
+// Times are wall-clock milliseconds since the Unix epoch (NTP), so a joiner
+// can tell how much of a stage is left however long the message was retained.
+//   {"v":118,"t":1760771234000,"active":5,"next":2,"stage":"green",
+//    "end":1760771246000,"green":[12,0,12,0],"q":[4,1,5,0]}
+#ifndef INTERSECTION_SNAPSHOT_H
+#define INTERSECTION_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace intersection_snapshot
+{
+constexpr int LANES = 4;
+constexpr size_t MAX_MESSAGE = 192;
+
+// A lower version published this much later than the current snapshot comes from a writer
+// that restarted before the broker handed it the retained message; it wins anyway
+constexpr uint64_t RESTART_GRACE_MS = 10000;
+
+// How long a section that just connected waits for the retained snapshot before it starts a
+// sequence of its own; none arrives when nothing has been published yet
+constexpr uint32_t JOIN_WAIT_MS = 2000;
+
+enum Stage : uint8_t
+{
+    IDLE,     // Every head red between groups
+    STARTING, // Lead all red and pre-yellow before the green
+    GREEN,
+    CLEARING, // Yellow and clearance red
+};
+
+inline const char *stageName(Stage stage)
+{
+    static const char *const NAMES[] = {"idle", "starting", "green", "clearing"};
+    return stage <= CLEARING ? NAMES[stage] : NAMES[IDLE];
+}
+
+struct Snapshot
+{
+    uint32_t version = 0;        // Incremented by the writer on every change
+    uint64_t publishedMs = 0;    // Wall clock when it was published
+    uint8_t active = 0;          // Bit s-1 set while section s is in its light sequence
+    uint8_t next = 1;            // Lead section of the group served next
+    Stage stage = IDLE;          // Stage of the active group
+    uint64_t stageEndMs = 0;     // Wall clock at which that stage ends, 0 when idle
+    uint16_t green[LANES] = {};  // Green seconds of each section's latest sequence
+    uint16_t demand[LANES] = {}; // Vehicles reported on each approach
+
+    bool isActive(int section) const
+    {
+        return section >= 1 && section <= LANES && (active >> (section - 1)) & 1;
+    }
+
+    // Milliseconds left in the current stage at wall clock nowMs, 0 when it has ended or is unknown
+    uint32_t remainingMs(uint64_t nowMs) const
+    {
+        return stageEndMs > nowMs ? (uint32_t)(stageEndMs - nowMs) : 0;
+    }
+};
+
+// Whether a received snapshot replaces the one a board already holds
+inline bool supersedes(const Snapshot &candidate, const Snapshot &current)
+{
+    if (candidate.version > current.version)
+    {
+        return true;
+    }
+    return candidate.publishedMs > current.publishedMs + RESTART_GRACE_MS;
+}
+
+// Compact JSON for the retained message; returns its length, 0 if it did not fit
+inline size_t encode(const Snapshot &snapshot, char (&out)[MAX_MESSAGE])
+{
+    int length = snprintf(out, sizeof(out),
+                          "{\"v\":%lu,\"t\":%llu,\"active\":%u,\"next\":%u,\"stage\":\"%s\",\"end\":%llu,"
+                          "\"green\":[%u,%u,%u,%u],\"q\":[%u,%u,%u,%u]}",
+                          (unsigned long)snapshot.version, (unsigned long long)snapshot.publishedMs,
+                          (unsigned)snapshot.active, (unsigned)snapshot.next, stageName(snapshot.stage),
+                          (unsigned long long)snapshot.stageEndMs, (unsigned)snapshot.green[0],
+                          (unsigned)snapshot.green[1], (unsigned)snapshot.green[2], (unsigned)snapshot.green[3],
+                          (unsigned)snapshot.demand[0], (unsigned)snapshot.demand[1], (unsigned)snapshot.demand[2],
+                          (unsigned)snapshot.demand[3]);
+    return length > 0 && (size_t)length < sizeof(out) ? (size_t)length : 0;
+}
+
+// Text after "key": in a NUL-terminated message, nullptr if the key is missing
+inline const char *valueOf(const char *message, const char *key)
+{
+    char pattern[16];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *found = strstr(message, pattern);
+    return found ? found + strlen(pattern) : nullptr;
+}
+
+// Up to `count` numbers of a JSON array value into out; false unless all of them were there
+inline bool readArray(const char *value, uint16_t *out, int count)
+{
+    if (!value || *value != '[')
+    {
+        return false;
+    }
+    const char *p = value + 1;
+    for (int i = 0; i < count; i++)
+    {
+        char *end;
+        unsigned long number = strtoul(p, &end, 10);
+        if (end == p)
+        {
+            return false;
+        }
+        out[i] = number > 0xFFFF ? 0xFFFF : (uint16_t)number;
+        p = end;
+        while (*p == ' ' || *p == ',')
+            p++;
+    }
+    return true;
+}
+
+// Parse a snapshot message; false (and `out` untouched) unless every field is present
+inline bool decode(const uint8_t *payload, size_t length, Snapshot &out)
+{
+    char message[MAX_MESSAGE];
+    if (length == 0 || length >= sizeof(message))
+    {
+        return false;
+    }
+    memcpy(message, payload, length);
+    message[length] = '\0';
+
+    const char *version = valueOf(message, "v");
+    const char *published = valueOf(message, "t");
+    const char *active = valueOf(message, "active");
+    const char *next = valueOf(message, "next");
+    const char *stage = valueOf(message, "stage");
+    const char *end = valueOf(message, "end");
+    if (!version || !published || !active || !next || !stage || !end)
+    {
+        return false;
+    }
+
+    Snapshot parsed;
+    parsed.version = (uint32_t)strtoul(version, nullptr, 10);
+    parsed.publishedMs = strtoull(published, nullptr, 10);
+    parsed.active = (uint8_t)(strtoul(active, nullptr, 10) & ((1u << LANES) - 1));
+    parsed.next = (uint8_t)strtoul(next, nullptr, 10);
+    parsed.stageEndMs = strtoull(end, nullptr, 10);
+    if (parsed.next < 1 || parsed.next > LANES || *stage != '"')
+    {
+        return false;
+    }
+    bool known = false;
+    for (int s = IDLE; s <= CLEARING; s++)
+    {
+        const char *name = stageName((Stage)s);
+        size_t nameLength = strlen(name);
+        if (strncmp(stage + 1, name, nameLength) == 0 && stage[1 + nameLength] == '"')
+        {
+            parsed.stage = (Stage)s;
+            known = true;
+        }
+    }
+    if (!known || !readArray(valueOf(message, "green"), parsed.green, LANES) ||
+        !readArray(valueOf(message, "q"), parsed.demand, LANES))
+    {
+        return false;
+    }
+    out = parsed;
+    return true;
+}
+} // namespace intersection_snapshot
+
+#endif // INTERSECTION_SNAPSHOT_H
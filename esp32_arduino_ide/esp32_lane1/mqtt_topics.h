@@ -0,0 +1,57 @@
+// MQTT topic layout, namespaced by intersection.
+// This file is identical in every sketch folder; change all of them together.
+// Python/mqtt_topics.py builds the same names for the coordinator.
+//
+// Every topic sits under traffic/<intersection>/. Messages about the whole
+// site (green handover, reset, config, signal heads) use
+// traffic/<intersection>/<leaf>; messages about one approach (counts,
+// durations, countdowns, cycle stats) use traffic/<intersection>/<lane>/<leaf>.
+// A board subscribes to its own site only, and a lane board to its own lane's
+// counts, so the messages each board receives stay the same however many
+// intersections share the broker.
+//
+// INTERSECTION_ID is a string literal, set per site at build time, e.g.
+//   -DINTERSECTION_ID=\"42\"
+#ifndef MQTT_TOPICS_H
+#define MQTT_TOPICS_H
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef INTERSECTION_ID
+#define INTERSECTION_ID "1"
+#endif
+
+// Compile-time topic names; `lane` is a number literal
+#define MQTT_SITE_TOPIC(leaf) "traffic/" INTERSECTION_ID "/" leaf
+#define MQTT_LANE_TOPIC(lane, leaf) "traffic/" INTERSECTION_ID "/" #lane "/" leaf
+
+namespace mqtt_topics
+{
+constexpr size_t MAX_TOPIC = 64;
+
+// traffic/<intersection>/<lane>/<leaf> for a lane only known at run time
+inline const char *laneTopic(char (&out)[MAX_TOPIC], int lane, const char *leaf)
+{
+    snprintf(out, sizeof(out), "%s%d/%s", MQTT_SITE_TOPIC(""), lane, leaf);
+    return out;
+}
+
+// Lane of a traffic/<intersection>/<lane>/<leaf> topic of this site, 0 for any other topic
+inline int laneOf(const char *topic, const char *leaf)
+{
+    const char *prefix = MQTT_SITE_TOPIC("");
+    size_t prefixLength = strlen(prefix);
+    if (strncmp(topic, prefix, prefixLength) != 0)
+        return 0;
+    const char *p = topic + prefixLength;
+    int lane = 0;
+    while (*p >= '0' && *p <= '9' && lane < 1000)
+        lane = lane * 10 + (*p++ - '0');
+    if (lane == 0 || *p != '/')
+        return 0;
+    return strcmp(p + 1, leaf) == 0 ? lane : 0;
+}
+} // namespace mqtt_topics
+
+#endif // MQTT_TOPICS_H
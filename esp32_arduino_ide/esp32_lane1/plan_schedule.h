@@ -0,0 +1,155 @@
+// Time-of-day plan schedule, replacing the fixed jam sibuk hours.
+// This file is identical in every sketch folder; change all of them together.
+//
+// The config (lane_config.h) carries up to MAX_PLANS intervals of
+// (day type, start, end) -> rush percentage, plus a calendar of holidays.
+// 0 % runs the normal green times, 100 % the jam sibuk ones, anything in
+// between a blend of the two. Intervals are sorted by day type and start and
+// may not overlap, so the plan for a moment is one binary search, and the day
+// type is another one in the holiday list. Minutes no interval covers run the
+// normal plan. For transitionMin minutes after every boundary the percentage
+// moves linearly from the old plan to the new one, so green times do not jump.
+// An interval never wraps past midnight: valid() rejects end <= start, and a
+// window such as 22:00-02:00 is two entries, 22:00-24:00 and 00:00-02:00.
+#ifndef PLAN_SCHEDULE_H
+#define PLAN_SCHEDULE_H
+
+#include <stdint.h>
+#include <time.h>
+
+namespace plan_schedule
+{
+enum DayType : uint8_t
+{
+    WEEKDAY, // Monday to Friday
+    SATURDAY,
+    SUNDAY,
+    HOLIDAY, // Any date in the holiday list, whatever weekday it falls on
+    DAY_TYPES
+};
+
+constexpr int MAX_PLANS = 16;
+constexpr int MAX_HOLIDAYS = 24;
+constexpr uint16_t MINUTES_PER_DAY = 1440;
+
+struct PlanEntry
+{
+    uint8_t dayType;   // DayType
+    uint8_t rushPct;   // 0 = normal green times, 100 = jam sibuk
+    uint16_t startMin; // Minute of the day, inclusive
+    uint16_t endMin;   // Exclusive, after startMin and up to MINUTES_PER_DAY
+};
+
+// Days since 2000-01-01 of a civil date, the holiday list's format
+inline uint16_t dayNumber(int year, int month, int day)
+{
+    // Howard Hinnant's days_from_civil, shifted to the 2000 epoch
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = (long)era * 146097 + doe - 730425; // 730425 = days from 0000-03-01 to 2000-01-01
+    return days < 0 ? 0 : (days > 0xFFFF ? 0xFFFF : (uint16_t)days);
+}
+
+// holidays: sorted ascending day numbers
+inline DayType dayTypeOf(const struct tm &now, const uint16_t *holidays, int holidayCount)
+{
+    uint16_t today = dayNumber(now.tm_year + 1900, now.tm_mon + 1, now.tm_mday);
+    int lo = 0, hi = holidayCount;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (holidays[mid] < today)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < holidayCount && holidays[lo] == today)
+        return HOLIDAY;
+    if (now.tm_wday == 6)
+        return SATURDAY;
+    return now.tm_wday == 0 ? SUNDAY : WEEKDAY;
+}
+
+inline uint32_t sortKey(uint8_t dayType, uint16_t minute)
+{
+    return (uint32_t)dayType * MINUTES_PER_DAY + minute;
+}
+
+// Intervals well formed, sorted and disjoint within each day type
+inline bool valid(const PlanEntry *plans, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const PlanEntry &plan = plans[i];
+        if (plan.dayType >= DAY_TYPES || plan.rushPct > 100 || plan.startMin >= plan.endMin ||
+            plan.endMin > MINUTES_PER_DAY)
+            return false;
+        if (i > 0)
+        {
+            const PlanEntry &previous = plans[i - 1];
+            if (plan.dayType < previous.dayType || (plan.dayType == previous.dayType && plan.startMin < previous.endMin))
+                return false;
+        }
+    }
+    return true;
+}
+
+inline bool validHolidays(const uint16_t *holidays, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        if (holidays[i] <= holidays[i - 1])
+            return false;
+    }
+    return true;
+}
+
+// Rush weight (0..1) at `minute` (fractional) of a day of type dayType
+inline float rushWeight(const PlanEntry *plans, int count, uint8_t transitionMin, DayType dayType, float minute)
+{
+    // Last interval of this day type starting at or before `minute`
+    uint32_t key = sortKey(dayType, (uint16_t)minute);
+    int lo = 0, hi = count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (sortKey(plans[mid].dayType, plans[mid].startMin) <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int index = lo - 1;
+
+    // Plan now, plan before the last boundary and when that boundary was
+    float current = 0, previous = 0, boundary = 0;
+    if (index >= 0 && plans[index].dayType == dayType)
+    {
+        const PlanEntry &plan = plans[index];
+        if (minute < plan.endMin)
+        {
+            current = plan.rushPct;
+            boundary = plan.startMin;
+            bool adjacent = index > 0 && plans[index - 1].dayType == dayType && plans[index - 1].endMin == plan.startMin;
+            previous = adjacent ? plans[index - 1].rushPct : 0;
+            if (plan.startMin == 0)
+                previous = current; // No blending across midnight
+        }
+        else
+        {
+            previous = plan.rushPct; // In the gap after it, back to normal
+            boundary = plan.endMin;
+        }
+    }
+
+    float weight = current;
+    float since = minute - boundary;
+    if (transitionMin > 0 && since < transitionMin)
+        weight = previous + (current - previous) * since / transitionMin;
+    return weight / 100.0f;
+}
+} // namespace plan_schedule
+
+#endif // PLAN_SCHEDULE_H
@@ -0,0 +1,444 @@
+// TLS to the MQTT broker that resumes its session after a reconnect or restart.
+// This file is identical in every sketch folder; change all of them together.
+// Built only with -DMQTT_TLS; it needs mbedTLS 2.28 (arduino-esp32 2.x).
+//
+// A full TLS 1.2 handshake costs the ESP32 an ECDHE key exchange and an ECDSA
+// verification of the broker's certificate, a second or more of CPU, plus the
+// certificates on the wire. After the first one the client keeps the session
+// (its ID and the broker's session ticket) in RTC memory, which survives
+// esp_restart() and watchdog resets. Every later connect offers it, and a broker
+// that still knows it skips both: one round trip and symmetric crypto only. A
+// session the broker no longer accepts ends in a full handshake, whose session
+// is kept instead; a failed handshake drops the cached one.
+//
+// Only ECDHE-ECDSA suites on P-256 are offered, so the broker needs an ECDSA
+// certificate (Python/broker_tls.py makes one, with a certificate per board
+// for client authentication). The client measures every handshake; the sketch
+// publishes encodeReport() on traffic/<intersection>/<lane>/tls after each connect.
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <Client.h>
+#include <WiFi.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/error.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+namespace tls_session
+{
+constexpr uint32_t MAGIC = 0x534C5453u;              // "STLS"
+constexpr size_t MAX_SESSION = 1536;                 // Saved session: ticket and the broker's certificate
+constexpr uint32_t HANDSHAKE_TIMEOUT_MS = 10000;
+constexpr uint32_t TCP_TIMEOUT_MS = 5000;
+constexpr size_t MAX_REPORT = 256;
+
+const int CIPHERSUITES[] = {MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+                            MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256, 0};
+const mbedtls_ecp_group_id CURVES[] = {MBEDTLS_ECP_DP_SECP256R1, MBEDTLS_ECP_DP_NONE};
+
+// FNV-1a, to tell a cached session from RTC garbage after power-on and whose broker it is
+inline uint32_t fnv1a(uint32_t hash, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+inline uint32_t serverId(const char *host, uint16_t port)
+{
+    uint32_t hash = fnv1a(2166136261u, (const uint8_t *)host, strlen(host));
+    return fnv1a(hash, (const uint8_t *)&port, sizeof(port));
+}
+
+// Lives in RTC_NOINIT_ATTR memory, so it has no initializers; valid() checks it before use
+struct CachedSession
+{
+    uint32_t magic;
+    uint32_t server; // serverId() of the broker it belongs to
+    uint32_t length;
+    uint32_t check;  // fnv1a() over server, length and data
+    uint8_t data[MAX_SESSION];
+
+    uint32_t checksum() const
+    {
+        uint32_t hash = fnv1a(2166136261u, (const uint8_t *)&server, sizeof(server));
+        hash = fnv1a(hash, (const uint8_t *)&length, sizeof(length));
+        return fnv1a(hash, data, length <= MAX_SESSION ? length : 0);
+    }
+
+    bool valid(uint32_t forServer) const
+    {
+        return magic == MAGIC && server == forServer && length > 0 && length <= MAX_SESSION && check == checksum();
+    }
+
+    void clear()
+    {
+        magic = 0;
+        length = 0;
+    }
+};
+
+struct HandshakeStats
+{
+    uint32_t full = 0;
+    uint32_t resumed = 0;
+    uint32_t failed = 0;
+    uint32_t fullMsTotal = 0;
+    uint32_t resumedMsTotal = 0;
+    uint32_t lastMs = 0;      // Handshake of the latest connection
+    uint32_t lastTcpMs = 0;   // TCP connect before it
+    bool lastResumed = false;
+    bool lastOffered = false; // Whether a cached session was offered
+};
+
+// {"lane_id":1,"mode":"resumed","handshake_ms":84,"tcp_ms":9,"offered":true,"full":1,"resumed":6,...}
+inline size_t encodeReport(char (&out)[MAX_REPORT], int laneId, const HandshakeStats &stats)
+{
+    int length = snprintf(out, sizeof(out),
+                          "{\"lane_id\":%d,\"mode\":\"%s\",\"handshake_ms\":%lu,\"tcp_ms\":%lu,\"offered\":%s,"
+                          "\"full\":%lu,\"resumed\":%lu,\"failed\":%lu,\"full_avg_ms\":%lu,\"resumed_avg_ms\":%lu}",
+                          laneId, stats.lastResumed ? "resumed" : "full", (unsigned long)stats.lastMs,
+                          (unsigned long)stats.lastTcpMs, stats.lastOffered ? "true" : "false",
+                          (unsigned long)stats.full, (unsigned long)stats.resumed, (unsigned long)stats.failed,
+                          (unsigned long)(stats.full > 0 ? stats.fullMsTotal / stats.full : 0),
+                          (unsigned long)(stats.resumed > 0 ? stats.resumedMsTotal / stats.resumed : 0));
+    return length > 0 && (size_t)length < sizeof(out) ? (size_t)length : 0;
+}
+
+// Client for PubSubClient: TLS over a WiFiClient, with the session cached in `cache`
+class TlsClient : public Client
+{
+public:
+    explicit TlsClient(CachedSession &cache) : cache(cache)
+    {
+        mbedtls_ssl_init(&ssl);
+        mbedtls_ssl_config_init(&conf);
+        mbedtls_x509_crt_init(&caChain);
+        mbedtls_x509_crt_init(&ownCert);
+        mbedtls_pk_init(&ownKey);
+        mbedtls_entropy_init(&entropy);
+        mbedtls_ctr_drbg_init(&drbg);
+    }
+
+    // PEM strings; certPem and keyPem may be NULL when the broker does not ask for a client certificate
+    bool setCertificates(const char *caPem, const char *certPem, const char *keyPem)
+    {
+        configured = false;
+        int ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, (const unsigned char *)"tls_session", 11);
+        if (ret == 0)
+            ret = mbedtls_x509_crt_parse(&caChain, (const unsigned char *)caPem, strlen(caPem) + 1);
+        if (ret == 0)
+            ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                              MBEDTLS_SSL_PRESET_DEFAULT);
+        if (ret == 0 && certPem != NULL && keyPem != NULL)
+        {
+            ret = mbedtls_x509_crt_parse(&ownCert, (const unsigned char *)certPem, strlen(certPem) + 1);
+            if (ret == 0)
+                ret = mbedtls_pk_parse_key(&ownKey, (const unsigned char *)keyPem, strlen(keyPem) + 1, NULL, 0);
+            if (ret == 0)
+                ret = mbedtls_ssl_conf_own_cert(&conf, &ownCert, &ownKey);
+        }
+        if (ret != 0)
+        {
+            lastResult = ret;
+            return false;
+        }
+
+        mbedtls_ssl_conf_min_version(&conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+        mbedtls_ssl_conf_max_version(&conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+        mbedtls_ssl_conf_ciphersuites(&conf, CIPHERSUITES);
+        mbedtls_ssl_conf_curves(&conf, CURVES);
+        mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_ca_chain(&conf, &caChain, NULL);
+        mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+        mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+        configured = true;
+        return true;
+    }
+
+    int connect(IPAddress ip, uint16_t port) override
+    {
+        return connect(ip.toString().c_str(), port);
+    }
+
+    int connect(const char *host, uint16_t port) override
+    {
+        stop();
+        if (!configured)
+            return 0;
+
+        uint32_t start = millis();
+        if (!tcp.connect(host, port, TCP_TIMEOUT_MS))
+            return 0;
+        stats.lastTcpMs = millis() - start;
+
+        start = millis();
+        uint32_t server = serverId(host, port);
+        int ret = mbedtls_ssl_setup(&ssl, &conf);
+        if (ret == 0)
+            ret = mbedtls_ssl_set_hostname(&ssl, host);
+        if (ret != 0)
+            return fail(ret);
+        mbedtls_ssl_set_bio(&ssl, &tcp, sendTcp, receiveTcp, NULL);
+        stats.lastOffered = offerCached(server);
+
+        // Stepped, to see whether the broker sends its certificate: a resumed handshake goes
+        // from ServerHello straight to ChangeCipherSpec
+        bool certificateSent = false;
+        while (ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER)
+        {
+            ret = mbedtls_ssl_handshake_step(&ssl);
+            certificateSent = certificateSent || ssl.state == MBEDTLS_SSL_SERVER_CERTIFICATE;
+            if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+            {
+                if (millis() - start > HANDSHAKE_TIMEOUT_MS)
+                    return fail(MBEDTLS_ERR_SSL_TIMEOUT);
+                delay(1);
+                continue;
+            }
+            if (ret != 0)
+            {
+                if (stats.lastOffered)
+                    cache.clear(); // Maybe the session is what the broker refused; start over
+                return fail(ret);
+            }
+        }
+
+        stats.lastMs = millis() - start;
+        stats.lastResumed = stats.lastOffered && !certificateSent;
+        if (stats.lastResumed)
+        {
+            stats.resumed++;
+            stats.resumedMsTotal += stats.lastMs;
+        }
+        else
+        {
+            stats.full++;
+            stats.fullMsTotal += stats.lastMs;
+        }
+        keepSession(server); // After a resumption too: the broker may have issued a new ticket
+        handshakeDone = true;
+        lastResult = 0;
+        return 1;
+    }
+
+    size_t write(uint8_t b) override
+    {
+        return write(&b, 1);
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (!handshakeDone)
+            return 0;
+        size_t written = 0;
+        uint32_t start = millis();
+        while (written < size)
+        {
+            int ret = mbedtls_ssl_write(&ssl, buffer + written, size - written);
+            if (ret > 0)
+            {
+                written += ret;
+            }
+            else if ((ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) &&
+                     millis() - start < HANDSHAKE_TIMEOUT_MS)
+            {
+                delay(1);
+            }
+            else
+            {
+                lastResult = ret;
+                stop();
+                break;
+            }
+        }
+        return written;
+    }
+
+    int available() override
+    {
+        if (!handshakeDone)
+            return 0;
+        if (peeked >= 0)
+            return 1 + (int)mbedtls_ssl_get_bytes_avail(&ssl);
+        // A zero-length read takes in the next record without consuming it
+        int ret = mbedtls_ssl_read(&ssl, NULL, 0);
+        if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            lastResult = ret;
+            stop();
+            return 0;
+        }
+        return (int)mbedtls_ssl_get_bytes_avail(&ssl);
+    }
+
+    int read() override
+    {
+        uint8_t b;
+        return read(&b, 1) == 1 ? b : -1;
+    }
+
+    int read(uint8_t *buffer, size_t size) override
+    {
+        if (!handshakeDone || size == 0)
+            return -1;
+        size_t offset = 0;
+        if (peeked >= 0)
+        {
+            buffer[offset++] = (uint8_t)peeked;
+            peeked = -1;
+            if (offset == size)
+                return 1;
+        }
+        int ret = mbedtls_ssl_read(&ssl, buffer + offset, size - offset);
+        if (ret > 0)
+            return (int)offset + ret;
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            lastResult = ret;
+            stop();
+        }
+        return offset > 0 ? (int)offset : -1;
+    }
+
+    int peek() override
+    {
+        if (peeked < 0 && available() > 0)
+        {
+            uint8_t b;
+            if (mbedtls_ssl_read(&ssl, &b, 1) == 1)
+                peeked = b;
+        }
+        return peeked;
+    }
+
+    void flush() override
+    {
+    }
+
+    void stop() override
+    {
+        if (handshakeDone)
+        {
+            mbedtls_ssl_close_notify(&ssl);
+        }
+        tcp.stop();
+        handshakeDone = false;
+        peeked = -1;
+        mbedtls_ssl_free(&ssl);
+        mbedtls_ssl_init(&ssl);
+    }
+
+    uint8_t connected() override
+    {
+        return handshakeDone && (tcp.connected() || peeked >= 0 || mbedtls_ssl_get_bytes_avail(&ssl) > 0);
+    }
+
+    operator bool() override
+    {
+        return connected();
+    }
+
+    const HandshakeStats &handshakes() const
+    {
+        return stats;
+    }
+
+    // mbedTLS error of the latest failure, e.g. for "failed, rc=..." on Serial
+    const char *lastError()
+    {
+        if (lastResult == 0)
+            return "none";
+        mbedtls_strerror(lastResult, errorText, sizeof(errorText));
+        return errorText;
+    }
+
+private:
+    static int sendTcp(void *context, const unsigned char *buffer, size_t length)
+    {
+        WiFiClient *client = (WiFiClient *)context;
+        if (!client->connected())
+            return MBEDTLS_ERR_NET_CONN_RESET;
+        int written = client->write(buffer, length);
+        return written > 0 ? written : MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+
+    static int receiveTcp(void *context, unsigned char *buffer, size_t length)
+    {
+        WiFiClient *client = (WiFiClient *)context;
+        int waiting = client->available();
+        if (waiting <= 0)
+            return client->connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+        int received = client->read(buffer, length < (size_t)waiting ? length : (size_t)waiting);
+        return received > 0 ? received : MBEDTLS_ERR_SSL_WANT_READ;
+    }
+
+    bool offerCached(uint32_t server)
+    {
+        if (!cache.valid(server))
+            return false;
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        bool offered = mbedtls_ssl_session_load(&session, cache.data, cache.length) == 0 &&
+                       mbedtls_ssl_set_session(&ssl, &session) == 0;
+        mbedtls_ssl_session_free(&session);
+        if (!offered)
+            cache.clear(); // Saved by another mbedTLS build
+        return offered;
+    }
+
+    void keepSession(uint32_t server)
+    {
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        size_t length = 0;
+        if (mbedtls_ssl_get_session(&ssl, &session) == 0 &&
+            mbedtls_ssl_session_save(&session, cache.data, sizeof(cache.data), &length) == 0)
+        {
+            cache.server = server;
+            cache.length = (uint32_t)length;
+            cache.check = cache.checksum();
+            cache.magic = MAGIC;
+        }
+        else
+        {
+            cache.clear(); // Too large for the cache; the next connect is a full handshake
+        }
+        mbedtls_ssl_session_free(&session);
+    }
+
+    int fail(int ret)
+    {
+        lastResult = ret;
+        stats.failed++;
+        stop();
+        return 0;
+    }
+
+    CachedSession &cache;
+    WiFiClient tcp;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt caChain;
+    mbedtls_x509_crt ownCert;
+    mbedtls_pk_context ownKey;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    bool configured = false;
+    bool handshakeDone = false;
+    int peeked = -1;
+    int lastResult = 0;
+    char errorText[96];
+    HandshakeStats stats;
+};
+} // namespace tls_session
+
+#endif // TLS_SESSION_H
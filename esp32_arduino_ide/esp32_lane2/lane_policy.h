@@ -0,0 +1,80 @@
+// Generated by Python/compile_policy.py from policies/fuzzy_default.csv - do not edit.
+// Green time (and optionally the next lane) per reported vehicle count, for
+// normal hours and jam sibuk. Evaluation is one table lookup.
+#ifndef LANE_POLICY_H
+#define LANE_POLICY_H
+
+#include <stdint.h>
+
+namespace lane_policy
+{
+constexpr const char *NAME = "fuzzy-default";
+constexpr uint16_t VERSION = 1;
+constexpr int COUNT_BINS = 11;
+
+// Tenths of a second, [jamSibuk][count]
+constexpr uint16_t GREEN_DS[2][COUNT_BINS] = {
+    {100, 100, 100, 100, 150, 200, 240, 280, 320, 360, 400},
+    {150, 150, 150, 150, 225, 300, 360, 420, 480, 540, 600}
+};
+
+// Lane to serve next, 0 = normal 1 -> 2 -> 3 -> 4 order
+constexpr uint8_t NEXT_LANE[2][COUNT_BINS] = {
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+};
+
+// CRC-32 of version, bin count and table, computed by the compiler so the
+// value reported at boot identifies exactly the table that was flashed
+constexpr uint32_t crc32Bits(uint32_t crc, int bits)
+{
+    return bits == 0 ? crc : crc32Bits((crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1, bits - 1);
+}
+
+constexpr uint32_t crc32Byte(uint32_t crc, uint8_t value)
+{
+    return crc32Bits(crc ^ value, 8);
+}
+
+constexpr uint8_t tableByte(int i)
+{
+    return i % 3 == 2 ? NEXT_LANE[i / 3 / COUNT_BINS][i / 3 % COUNT_BINS]
+                      : (uint8_t)(GREEN_DS[i / 3 / COUNT_BINS][i / 3 % COUNT_BINS] >> (8 * (i % 3)));
+}
+
+constexpr uint32_t crc32Table(uint32_t crc, int i)
+{
+    return i == 2 * COUNT_BINS * 3 ? crc : crc32Table(crc32Byte(crc, tableByte(i)), i + 1);
+}
+
+constexpr uint32_t checksum()
+{
+    return ~crc32Table(crc32Byte(crc32Byte(crc32Byte(0xFFFFFFFFu, VERSION & 0xFF), VERSION >> 8), COUNT_BINS), 0);
+}
+
+constexpr uint32_t CHECKSUM = 0xF50DA4D6u;
+static_assert(checksum() == CHECKSUM, "lane_policy.h was edited by hand, regenerate it with compile_policy.py");
+
+inline int countBin(float kendaraan)
+{
+    if (kendaraan <= 0)
+        return 0;
+    int bin = (int)(kendaraan + 0.5f);
+    return bin < COUNT_BINS ? bin : COUNT_BINS - 1;
+}
+
+// Green time in seconds, replaces defuzzify()
+inline float greenSeconds(float kendaraan, bool jamSibuk)
+{
+    return GREEN_DS[jamSibuk ? 1 : 0][countBin(kendaraan)] / 10.0f;
+}
+
+// Lane that should be served after `lane`
+inline int nextLane(float kendaraan, bool jamSibuk, int lane)
+{
+    uint8_t next = NEXT_LANE[jamSibuk ? 1 : 0][countBin(kendaraan)];
+    return next == 0 ? (lane % 4) + 1 : next;
+}
+} // namespace lane_policy
+
+#endif // LANE_POLICY_H
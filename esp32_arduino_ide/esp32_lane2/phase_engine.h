@@ -0,0 +1,155 @@
+// Ring-and-barrier phase engine for the four road sections of one intersection.
+// This file is identical in every sketch folder; change all four together.
+//
+// Each section is one phase. The conflict matrix (lane_config.h) says which
+// sections may not be green together. Sections are grouped, in section order,
+// into barrier groups of mutually compatible phases: with the default matrix
+// that is {1, 3} and {2, 4}. Every phase of the group whose turn it is runs
+// its own green (each board is its own ring), and the next group only starts
+// once no conflicting phase is active any more (the barrier). With a matrix in
+// which every section conflicts with every other one, the groups are single
+// sections and the controller runs the original 1 -> 2 -> 3 -> 4 sequence.
+//
+// The engine tracks the set of active phases (green or clearing yellow) from
+// green_status messages, replacing the single currentGreenSection.
+#ifndef PHASE_ENGINE_H
+#define PHASE_ENGINE_H
+
+#include <stdint.h>
+
+namespace phase_engine
+{
+constexpr int SECTIONS = 4;
+
+inline uint8_t bit(int section)
+{
+    return (uint8_t)(1u << (section - 1));
+}
+
+class PhaseEngine
+{
+public:
+    PhaseEngine() : active(0)
+    {
+        const uint8_t allConflict[SECTIONS] = {0x0F, 0x0F, 0x0F, 0x0F};
+        setConflicts(allConflict);
+    }
+
+    // matrix[s - 1] has bit (t - 1) set when sections s and t conflict.
+    // A conflict in either direction counts; the diagonal is ignored.
+    void setConflicts(const uint8_t matrix[SECTIONS])
+    {
+        for (int s = 1; s <= SECTIONS; s++)
+        {
+            conflictMask[s - 1] = 0;
+            for (int t = 1; t <= SECTIONS; t++)
+            {
+                if (t != s && ((matrix[s - 1] & bit(t)) || (matrix[t - 1] & bit(s))))
+                    conflictMask[s - 1] |= bit(t);
+            }
+        }
+
+        // Greedy barrier groups: a section joins the first group it is compatible with
+        for (int s = 1; s <= SECTIONS; s++)
+            lead[s - 1] = 0;
+        for (int s = 1; s <= SECTIONS; s++)
+        {
+            if (lead[s - 1] != 0)
+                continue;
+            lead[s - 1] = s;
+            uint8_t members = bit(s);
+            for (int t = s + 1; t <= SECTIONS; t++)
+            {
+                if (lead[t - 1] == 0 && (conflictMask[t - 1] & members) == 0)
+                {
+                    lead[t - 1] = s;
+                    members |= bit(t);
+                }
+            }
+        }
+    }
+
+    bool conflicts(int a, int b) const
+    {
+        return (conflictMask[a - 1] & bit(b)) != 0;
+    }
+
+    // Lowest section of the barrier group `section` belongs to
+    int leadOf(int section) const
+    {
+        return section >= 1 && section <= SECTIONS ? lead[section - 1] : 1;
+    }
+
+    bool sameGroup(int a, int b) const
+    {
+        return leadOf(a) == leadOf(b);
+    }
+
+    bool conflictsWithActive(int section) const
+    {
+        return (active & conflictMask[section - 1]) != 0;
+    }
+
+    // Lowest active section that conflicts with `section`, 0 if none
+    int firstConflicting(int section) const
+    {
+        for (int s = 1; s <= SECTIONS; s++)
+        {
+            if ((active & conflictMask[section - 1] & bit(s)) != 0)
+                return s;
+        }
+        return 0;
+    }
+
+    // `section` may go green: its group has the turn and nothing conflicting is active
+    bool mayStart(int section, int expectedSection) const
+    {
+        return sameGroup(section, expectedSection) && !conflictsWithActive(section);
+    }
+
+    // Lead of the group after the one `section` is in. proposed is the lane
+    // the policy wants next; if it is in the same group, the following
+    // section in 1 -> 2 -> 3 -> 4 order is used.
+    int nextLead(int section, int proposed) const
+    {
+        for (int i = 0; i < SECTIONS && sameGroup(proposed, section); i++)
+            proposed = (proposed % SECTIONS) + 1;
+        return leadOf(proposed);
+    }
+
+    void setActive(int section, bool isActive)
+    {
+        if (isActive)
+            active |= bit(section);
+        else
+            active &= (uint8_t)~bit(section);
+    }
+
+    bool isActive(int section) const
+    {
+        return (active & bit(section)) != 0;
+    }
+
+    bool anyActive() const
+    {
+        return active != 0;
+    }
+
+    uint8_t activeMask() const
+    {
+        return active;
+    }
+
+    void clear()
+    {
+        active = 0;
+    }
+
+private:
+    uint8_t conflictMask[SECTIONS];
+    uint8_t lead[SECTIONS];
+    uint8_t active;
+};
+} // namespace phase_engine
+
+#endif // PHASE_ENGINE_H
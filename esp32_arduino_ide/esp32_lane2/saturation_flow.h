@@ -0,0 +1,135 @@
+// Measured discharge of one approach and the green time it implies.
+// This file is identical in every sketch folder; change all of them together.
+// Python/discharge_counter.py counts the crossings with the same rules.
+//
+// The detector counts vehicles crossing the stop line during each green and
+// publishes one report per green on traffic/<intersection>/<lane>/discharge.
+// The first STARTUP_VEHICLES headways include the start-up loss, and a gap
+// longer than MAX_SATURATED_HEADWAY_S means the standing queue is gone, so only
+// the headways in between measure the saturation flow. SaturationFlow keeps the
+// ratio of exponentially forgotten sums of those headways and their seconds, so
+// long greens weigh more than short ones and the estimate follows a site as it
+// changes. With the config's FLAG_SATURATION a green is then sized as
+//   start-up lost time + queue / saturation flow + margin
+// instead of read from the policy table.
+#ifndef SATURATION_FLOW_H
+#define SATURATION_FLOW_H
+
+#include <stdint.h>
+
+namespace saturation_flow
+{
+constexpr int STARTUP_VEHICLES = 4;             // Crossings before the queue discharges at its saturation rate
+constexpr float MAX_SATURATED_HEADWAY_S = 4.0f; // A longer gap ends the saturated part of the green
+constexpr int MIN_HEADWAYS = 3;                 // Fewer saturated headways in a green say nothing
+constexpr float MIN_FLOW_VPH = 600.0f;          // Outside this range it is a counting error
+constexpr float MAX_FLOW_VPH = 3600.0f;
+constexpr float STARTUP_LOST_S = 2.0f; // Green lost while the first vehicles react and accelerate
+constexpr float MARGIN_S = 2.0f;       // Slack for counting errors and vehicles joining the queue late
+constexpr int MIN_GREENS = 3;          // Measured greens before the estimate sizes greens
+
+// Saturated headways of one green, fed the stop line crossings in time order
+class GreenDischarge
+{
+public:
+    GreenDischarge()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        crossings = 0;
+        headways = 0;
+        saturatedS = 0;
+        ended = false;
+        lastS = 0;
+    }
+
+    // A vehicle crossed the stop line `seconds` after the green started
+    void cross(float seconds)
+    {
+        crossings++;
+        if (crossings > STARTUP_VEHICLES && !ended)
+        {
+            float headway = seconds - lastS;
+            if (headway > MAX_SATURATED_HEADWAY_S)
+            {
+                ended = true;
+            }
+            else
+            {
+                headways++;
+                saturatedS += headway;
+            }
+        }
+        lastS = seconds;
+    }
+
+    uint32_t crossings; // All crossings during the green
+    uint32_t headways;  // Saturated headways
+    float saturatedS;   // Their total length
+
+private:
+    bool ended;
+    float lastS;
+};
+
+class SaturationFlow
+{
+public:
+    explicit SaturationFlow(float forgetting = 0.9f)
+        : forgetting(forgetting), headways(0), seconds(0), greens(0)
+    {
+    }
+
+    // One green's report; returns false if it was too short or implausible to use
+    bool observe(uint32_t greenHeadways, float saturatedS)
+    {
+        if (greenHeadways < MIN_HEADWAYS || saturatedS <= 0)
+            return false;
+        float vph = greenHeadways / saturatedS * 3600.0f;
+        if (vph < MIN_FLOW_VPH || vph > MAX_FLOW_VPH)
+            return false;
+        headways = forgetting * headways + greenHeadways;
+        seconds = forgetting * seconds + saturatedS;
+        greens++;
+        return true;
+    }
+
+    bool ready() const
+    {
+        return greens >= MIN_GREENS;
+    }
+
+    // Vehicles per second of green while a queue discharges
+    float perSecond() const
+    {
+        return seconds > 0 ? headways / seconds : 0;
+    }
+
+    float perHour() const
+    {
+        return perSecond() * 3600.0f;
+    }
+
+    // Green that discharges `queue` vehicles; only meaningful once ready()
+    float greenSeconds(float queue) const
+    {
+        return STARTUP_LOST_S + (queue > 0 ? queue / perSecond() : 0) + MARGIN_S;
+    }
+
+    uint32_t measuredGreens() const
+    {
+        return greens;
+    }
+
+private:
+    float forgetting;
+    float headways; // Forgotten sums over the measured greens
+    float seconds;
+    uint32_t greens;
+};
+} // namespace saturation_flow
+
+#endif // SATURATION_FLOW_H
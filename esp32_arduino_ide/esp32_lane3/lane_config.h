@@ -0,0 +1,400 @@
+// Runtime controller parameters, loaded from NVS and updatable over MQTT.
+// This file is identical in every sketch folder; change all four together.
+//
+// A config blob is a fixed binary layout (little endian, as the ESP32 stores it):
+//   ConfigHeader (16 bytes) | ConfigBody (300 bytes) | CRC-32 of header + body
+// The header carries SCHEMA_HASH, a hash of the body layout below. Blobs built
+// for another layout are rejected instead of being read with the wrong offsets.
+// Python/lane_config.py builds blobs from the same schema string.
+//
+// Updates are double buffered: a new blob is validated and copied into the
+// inactive slot when it arrives, and the active slot only changes when the
+// sketch calls applyPending() between two light sequences. Only then is the
+// blob written to NVS, so a reboot before the switch comes back on the config
+// that was running.
+#ifndef LANE_CONFIG_H
+#define LANE_CONFIG_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <Preferences.h>
+#include "plan_schedule.h"
+
+namespace lane_config
+{
+constexpr uint32_t MAGIC = 0x4746434Cu; // "LCFG"
+constexpr const char *SCHEMA =
+    "lane_config/4;u16 allRedMs;u16 yellowMs;u16 minGreenDs;u16 maxGreenDs;"
+    "u8 greenBins;u8 clearance;u8 conflicts[4];u16 preYellowMs;u8 speedKph[4];u8 widthM[4];"
+    "u8 planCount;u8 transitionMin;u8 holidayCount;u8 reserved;"
+    "{u8 dayType;u8 rushPct;u16 startMin;u16 endMin} plans[16];u16 holidays[24];u16 greenDs[2][32]";
+constexpr int MAX_BINS = 32;
+
+// ConfigBody::clearance
+constexpr uint8_t CLEARANCE_FIXED = 0;     // allRedMs before green, yellowMs after it
+constexpr uint8_t CLEARANCE_KINEMATIC = 1; // Yellow and all red from approach speed and crossing width
+
+// Kinematic clearance (ITE change interval):
+//   yellow  = t + v / (2a + 2Gg)   all red = (W + L) / v
+// on level ground (G = 0) with the usual design values below.
+constexpr float PERCEPTION_S = 1.0f;  // t, driver perception-reaction time
+constexpr float DECEL_MPS2 = 3.0f;    // a, comfortable deceleration
+constexpr float VEHICLE_M = 6.0f;     // L, design vehicle length
+constexpr uint16_t MIN_YELLOW_MS = 3000;
+constexpr uint16_t MAX_YELLOW_MS = 6000;
+constexpr uint16_t MAX_ALL_RED_MS = 5000;
+
+// ConfigHeader::flags
+constexpr uint16_t FLAG_FORECAST = 0x0001;   // Size greens for the arrivals forecast during them (demand_forecast.h)
+constexpr uint16_t FLAG_SATURATION = 0x0002; // Size greens from the measured saturation flow (saturation_flow.h)
+constexpr uint16_t KNOWN_FLAGS = FLAG_FORECAST | FLAG_SATURATION;
+
+// FNV-1a, evaluated by the compiler
+constexpr uint32_t fnv1a(const char *s, uint32_t hash = 2166136261u)
+{
+    return *s == 0 ? hash : fnv1a(s + 1, (hash ^ (uint8_t)*s) * 16777619u);
+}
+
+constexpr uint32_t SCHEMA_HASH = fnv1a(SCHEMA);
+
+struct ConfigHeader
+{
+    uint32_t magic;
+    uint32_t schemaHash;
+    uint32_t version;    // Config revision, only increases
+    uint16_t bodyLength;
+    uint16_t flags;      // FLAG_* bits
+};
+
+struct ConfigBody
+{
+    uint16_t allRedMs;    // CLEARANCE_FIXED: all red before the lane's pre-yellow
+    uint16_t yellowMs;    // CLEARANCE_FIXED: yellow after green
+    uint16_t minGreenDs;  // Green time limits in tenths of a second
+    uint16_t maxGreenDs;
+    uint8_t greenBins;    // 0 = green times from lane_policy.h
+    uint8_t clearance;    // CLEARANCE_FIXED or CLEARANCE_KINEMATIC
+    uint8_t conflicts[4]; // Per section, bit (s - 1) set = may not be green together with section s
+    uint16_t preYellowMs; // Yellow before green, 0 = straight from red to green
+    uint8_t speedKph[4];  // Per section, posted speed limit of the approach
+    uint8_t widthM[4];    // Per section, stop line to the far side of the conflict area
+    uint8_t planCount;    // Used entries of plans (plan_schedule.h)
+    uint8_t transitionMin; // Minutes over which the rush weight moves to a new plan
+    uint8_t holidayCount; // Used entries of holidays
+    uint8_t reserved;
+    plan_schedule::PlanEntry plans[plan_schedule::MAX_PLANS]; // Sorted by day type, then start; none wraps past midnight
+    uint16_t holidays[plan_schedule::MAX_HOLIDAYS];           // Days since 2000-01-01, ascending
+    uint16_t greenDs[2][MAX_BINS]; // [jamSibuk][count] when greenBins > 0
+};
+
+static_assert(sizeof(ConfigHeader) == 16, "ConfigHeader layout changed, update SCHEMA");
+static_assert(sizeof(ConfigBody) == 300, "ConfigBody layout changed, update SCHEMA");
+
+constexpr size_t BLOB_SIZE = sizeof(ConfigHeader) + sizeof(ConfigBody) + 4;
+
+inline uint32_t crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+    return ~crc;
+}
+
+// Compiled-in values, the same the sketches used before configs existed
+inline ConfigBody defaults()
+{
+    ConfigBody body;
+    memset(&body, 0, sizeof(body));
+    // Jam sibuk on weekdays 07:00-10:00 and 17:00-20:00, eased in and out over 10 minutes
+    body.planCount = 2;
+    body.plans[0] = plan_schedule::PlanEntry{plan_schedule::WEEKDAY, 100, 7 * 60, 10 * 60};
+    body.plans[1] = plan_schedule::PlanEntry{plan_schedule::WEEKDAY, 100, 17 * 60, 20 * 60};
+    body.transitionMin = 10;
+    body.allRedMs = 1000;
+    body.yellowMs = 3000;
+    body.preYellowMs = 3000;
+    body.minGreenDs = 50;
+    body.maxGreenDs = 1200;
+    // Opposing approaches (1 and 3, 2 and 4) may share green, crossing ones may not
+    body.conflicts[0] = 0x0A;
+    body.conflicts[1] = 0x05;
+    body.conflicts[2] = 0x0A;
+    body.conflicts[3] = 0x05;
+    body.clearance = CLEARANCE_FIXED;
+    for (int i = 0; i < 4; i++)
+    {
+        body.speedKph[i] = 40;
+        body.widthM[i] = 12;
+    }
+    return body;
+}
+
+struct LaneConfig
+{
+    uint32_t version;
+    uint16_t flags;
+    ConfigBody body;
+
+    bool forecastGreens() const
+    {
+        return (flags & FLAG_FORECAST) != 0;
+    }
+
+    bool saturationGreens() const
+    {
+        return (flags & FLAG_SATURATION) != 0;
+    }
+
+    // Rush weight of the plan schedule at `now`: 0 = normal green times, 1 = jam sibuk
+    float rushWeight(const struct tm &now) const
+    {
+        plan_schedule::DayType dayType = plan_schedule::dayTypeOf(now, body.holidays, body.holidayCount);
+        float minute = now.tm_hour * 60 + now.tm_min + now.tm_sec / 60.0f;
+        return plan_schedule::rushWeight(body.plans, body.planCount, body.transitionMin, dayType, minute);
+    }
+
+    // The middle of `hour` on a weekday runs mostly jam sibuk (host tools without a date)
+    bool isRushHour(int hour) const
+    {
+        return plan_schedule::rushWeight(body.plans, body.planCount, body.transitionMin, plan_schedule::WEEKDAY,
+                                         hour * 60 + 30.0f) >= 0.5f;
+    }
+
+    float greenSeconds(float kendaraan, bool jamSibuk) const
+    {
+        float seconds;
+        if (body.greenBins > 0)
+        {
+            int bin = kendaraan <= 0 ? 0 : (int)(kendaraan + 0.5f);
+            if (bin >= body.greenBins)
+                bin = body.greenBins - 1;
+            seconds = body.greenDs[jamSibuk ? 1 : 0][bin] / 10.0f;
+        }
+        else
+        {
+            seconds = lane_policy::greenSeconds(kendaraan, jamSibuk);
+        }
+        return clampGreen(seconds);
+    }
+
+    // Green time within the config's minimum and maximum green
+    float clampGreen(float seconds) const
+    {
+        if (seconds < body.minGreenDs / 10.0f)
+            seconds = body.minGreenDs / 10.0f;
+        if (seconds > body.maxGreenDs / 10.0f)
+            seconds = body.maxGreenDs / 10.0f;
+        return seconds;
+    }
+
+    // Green times of the normal and jam sibuk tables, mixed by the schedule's rush weight
+    float blendedGreenSeconds(float kendaraan, float rushWeight) const
+    {
+        if (rushWeight <= 0.0f)
+            return greenSeconds(kendaraan, false);
+        if (rushWeight >= 1.0f)
+            return greenSeconds(kendaraan, true);
+        return (1.0f - rushWeight) * greenSeconds(kendaraan, false) + rushWeight * greenSeconds(kendaraan, true);
+    }
+
+    // Approach speed used for clearance: the measured 85th percentile speed
+    // when the tracker reports one, otherwise the posted limit
+    float clearanceSpeedMps(int section, float measuredKph) const
+    {
+        float kph = measuredKph >= 5.0f && measuredKph <= 130.0f ? measuredKph : body.speedKph[section - 1];
+        return kph / 3.6f;
+    }
+
+    // All red at the start of a lane's turn, before its pre-yellow
+    uint32_t leadRedMs() const
+    {
+        return body.clearance == CLEARANCE_KINEMATIC ? 0 : body.allRedMs;
+    }
+
+    // Yellow that ends section's green
+    uint32_t yellowMsFor(int section, float measuredKph = 0) const
+    {
+        if (body.clearance != CLEARANCE_KINEMATIC)
+            return body.yellowMs;
+        float v = clearanceSpeedMps(section, measuredKph);
+        uint32_t ms = (uint32_t)ceilf((PERCEPTION_S + v / (2.0f * DECEL_MPS2)) * 10.0f) * 100;
+        return ms < MIN_YELLOW_MS ? MIN_YELLOW_MS : (ms > MAX_YELLOW_MS ? MAX_YELLOW_MS : ms);
+    }
+
+    // All red after section's yellow, until a vehicle that entered on the last
+    // instant of yellow has cleared the conflict area
+    uint32_t allRedMsFor(int section, float measuredKph = 0) const
+    {
+        if (body.clearance != CLEARANCE_KINEMATIC)
+            return 0;
+        float v = clearanceSpeedMps(section, measuredKph);
+        uint32_t ms = (uint32_t)ceilf((body.widthM[section - 1] + VEHICLE_M) / v * 10.0f) * 100;
+        return ms > MAX_ALL_RED_MS ? MAX_ALL_RED_MS : ms;
+    }
+
+    // Time of section's turn in which no approach can use the green: the
+    // leading all red and pre-yellow plus the yellow and all red that clear it
+    uint32_t lostMsFor(int section, float measuredKph = 0) const
+    {
+        return leadRedMs() + body.preYellowMs + yellowMsFor(section, measuredKph) + allRedMsFor(section, measuredKph);
+    }
+};
+
+enum ParseResult
+{
+    CONFIG_OK,
+    CONFIG_BAD_SIZE,
+    CONFIG_BAD_MAGIC,
+    CONFIG_SCHEMA_MISMATCH,
+    CONFIG_BAD_CRC,
+    CONFIG_BAD_VALUES,
+    CONFIG_STALE
+};
+
+inline const char *describe(ParseResult result)
+{
+    switch (result)
+    {
+    case CONFIG_OK:
+        return "ok";
+    case CONFIG_BAD_SIZE:
+        return "bad size";
+    case CONFIG_BAD_MAGIC:
+        return "not a config blob";
+    case CONFIG_SCHEMA_MISMATCH:
+        return "schema hash mismatch";
+    case CONFIG_BAD_CRC:
+        return "crc mismatch";
+    case CONFIG_BAD_VALUES:
+        return "values out of range";
+    case CONFIG_STALE:
+        return "not newer than the running config";
+    }
+    return "unknown";
+}
+
+// Validate a blob and decode it into out. No allocation, a few microseconds.
+inline ParseResult parse(const uint8_t *data, size_t length, LaneConfig &out)
+{
+    if (length != BLOB_SIZE)
+        return CONFIG_BAD_SIZE;
+
+    ConfigHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != MAGIC)
+        return CONFIG_BAD_MAGIC;
+    if (header.schemaHash != SCHEMA_HASH || header.bodyLength != sizeof(ConfigBody))
+        return CONFIG_SCHEMA_MISMATCH;
+    if ((header.flags & ~KNOWN_FLAGS) != 0)
+        return CONFIG_SCHEMA_MISMATCH;
+
+    uint32_t crc;
+    memcpy(&crc, data + sizeof(header) + sizeof(ConfigBody), sizeof(crc));
+    if (crc != crc32(data, sizeof(header) + sizeof(ConfigBody)))
+        return CONFIG_BAD_CRC;
+
+    ConfigBody body;
+    memcpy(&body, data + sizeof(header), sizeof(body));
+    if (body.greenBins > MAX_BINS || body.minGreenDs > body.maxGreenDs || body.yellowMs == 0)
+        return CONFIG_BAD_VALUES;
+    if (body.clearance > CLEARANCE_KINEMATIC)
+        return CONFIG_BAD_VALUES;
+    if (body.planCount > plan_schedule::MAX_PLANS || body.holidayCount > plan_schedule::MAX_HOLIDAYS)
+        return CONFIG_BAD_VALUES;
+    if (!plan_schedule::valid(body.plans, body.planCount) ||
+        !plan_schedule::validHolidays(body.holidays, body.holidayCount))
+        return CONFIG_BAD_VALUES;
+    for (int i = 0; i < 4; i++)
+    {
+        if (body.conflicts[i] > 0x0F)
+            return CONFIG_BAD_VALUES;
+        if (body.clearance == CLEARANCE_KINEMATIC && (body.speedKph[i] < 5 || body.widthM[i] == 0))
+            return CONFIG_BAD_VALUES;
+    }
+
+    out.version = header.version;
+    out.flags = header.flags;
+    out.body = body;
+    return CONFIG_OK;
+}
+
+class ConfigStore
+{
+public:
+    ConfigStore() : active(0), staged(false)
+    {
+        slots[0].version = 0;
+        slots[0].flags = 0;
+        slots[0].body = defaults();
+        slots[1] = slots[0];
+    }
+
+    // Load the last config saved in NVS; keeps the defaults if there is none
+    bool begin()
+    {
+        uint8_t blob[BLOB_SIZE];
+        Preferences prefs;
+        prefs.begin("lane_config", true);
+        size_t length = prefs.getBytes("blob", blob, sizeof(blob));
+        prefs.end();
+        if (length == 0 || parse(blob, length, slots[active]) != CONFIG_OK)
+            return false;
+        slots[1 - active] = slots[active];
+        return true;
+    }
+
+    const LaneConfig &current() const
+    {
+        return slots[active];
+    }
+
+    // Validate an incoming blob and stage it in the inactive slot
+    ParseResult stage(const uint8_t *data, size_t length)
+    {
+        LaneConfig incoming;
+        ParseResult result = parse(data, length, incoming);
+        if (result != CONFIG_OK)
+            return result;
+        uint32_t newest = staged ? slots[1 - active].version : slots[active].version;
+        if (incoming.version <= newest)
+            return CONFIG_STALE;
+
+        memcpy(stagedBlob, data, BLOB_SIZE); // parse() checked length == BLOB_SIZE
+        slots[1 - active] = incoming;
+        staged = true;
+        return CONFIG_OK;
+    }
+
+    bool hasPending() const
+    {
+        return staged;
+    }
+
+    // Switch to the staged config and save it to NVS; call only at a phase boundary
+    bool applyPending()
+    {
+        if (!staged)
+            return false;
+        Preferences prefs;
+        prefs.begin("lane_config", false);
+        prefs.putBytes("blob", stagedBlob, BLOB_SIZE);
+        prefs.end();
+        active = 1 - active;
+        staged = false;
+        return true;
+    }
+
+private:
+    LaneConfig slots[2];
+    uint8_t stagedBlob[BLOB_SIZE]; // Raw blob of the staged slot, saved when it is applied
+    volatile uint8_t active;
+    volatile bool staged;
+};
+} // namespace lane_config
+
+#endif // LANE_CONFIG_H
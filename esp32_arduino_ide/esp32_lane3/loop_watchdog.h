@@ -0,0 +1,291 @@
+// Deadline and latency budget of the signal task (the Arduino loop()).
+// This file is identical in every sketch folder; change all of them together.
+//
+// The sketch checks in at every MQTT poll and before every planned wait of a
+// light sequence, saying how long that wait is. A watchdog task looks every
+// CHECK_MS whether the next check-in is overdue: more than DEADLINE_MS of
+// unplanned time since the last one means the loop is stuck somewhere
+// (connect_mqtt()'s retry delay, setup_wifi(), a long callback) and the heads
+// no longer follow the plan. The watchdog task then takes the heads over and
+// flashes every one of them red, an all-way stop. The fallback ends the next
+// time the sketch has all its heads red by itself; it resumes from all red and
+// publishes the violation. The ESP-IDF task watchdog resets the board if the
+// loop makes no progress at all for TASK_WDT_TIMEOUT_S.
+//
+// Check-in gaps and the time spent in each region go into log-scale
+// histograms, which the sketch publishes as max and p99 every STATS_PERIOD_MS.
+#ifndef LOOP_WATCHDOG_H
+#define LOOP_WATCHDOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace loop_watchdog
+{
+constexpr uint32_t DEADLINE_MS = 2500;        // Unplanned time allowed between check-ins
+constexpr uint32_t CHECK_MS = 250;            // Period of the watchdog task
+constexpr uint32_t FLASH_HALF_MS = 500;       // Flashing red: 500 ms on, 500 ms off
+constexpr uint32_t TASK_WDT_TIMEOUT_S = 30;   // No progress at all for this long resets the board
+constexpr uint32_t STATS_PERIOD_MS = 60000;
+constexpr size_t MAX_REPORT = 384;
+
+enum Region : uint8_t
+{
+    LOOP,         // Unplanned time between check-ins
+    MQTT_POLL,    // mqtt_client.loop(), including the callback
+    MQTT_CONNECT, // connect_mqtt() with its retries
+    WIFI,         // setup_wifi()
+    REGIONS,
+    NO_REGION = REGIONS
+};
+
+inline const char *regionName(Region region)
+{
+    static const char *const NAMES[] = {"loop", "mqtt_poll", "mqtt_connect", "wifi"};
+    return region < REGIONS ? NAMES[region] : NAMES[LOOP];
+}
+
+// Microsecond histogram with four buckets per power of two (at most 19 % wide)
+class Histogram
+{
+public:
+    static constexpr int SUB_BUCKETS = 4;
+    static constexpr int BUCKETS = 32 * SUB_BUCKETS;
+
+    static int bucketOf(uint32_t us)
+    {
+        if (us < 2 * SUB_BUCKETS)
+        {
+            return (int)us;
+        }
+        int octave = 31 - __builtin_clz(us); // 3 or more here
+        return (octave - 1) * SUB_BUCKETS + (int)((us >> (octave - 2)) & (SUB_BUCKETS - 1));
+    }
+
+    // Smallest value that falls into the bucket
+    static uint32_t lowerBound(int bucket)
+    {
+        if (bucket < 2 * SUB_BUCKETS)
+        {
+            return (uint32_t)bucket;
+        }
+        int octave = bucket / SUB_BUCKETS + 1;
+        return (uint32_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (octave - 2);
+    }
+
+    void record(uint32_t us)
+    {
+        counts[bucketOf(us)]++;
+        samples++;
+        maxUs = us > maxUs ? us : maxUs;
+    }
+
+    // Upper end of the bucket that holds the p-th percentile (p in 0..100), capped by the maximum
+    uint32_t percentileUs(float p) const
+    {
+        if (samples == 0)
+        {
+            return 0;
+        }
+        uint32_t rank = (uint32_t)(samples * p / 100.0f + 0.999f);
+        uint32_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++)
+        {
+            seen += counts[b];
+            if (seen >= rank)
+            {
+                uint32_t upper = b + 1 < BUCKETS ? lowerBound(b + 1) - 1 : 0xFFFFFFFFu;
+                return upper < maxUs ? upper : maxUs;
+            }
+        }
+        return maxUs;
+    }
+
+    uint32_t count() const { return samples; }
+    uint32_t max() const { return maxUs; }
+
+    void clear()
+    {
+        memset(counts, 0, sizeof(counts));
+        samples = 0;
+        maxUs = 0;
+    }
+
+private:
+    uint32_t counts[BUCKETS] = {};
+    uint32_t samples = 0;
+    uint32_t maxUs = 0;
+};
+
+// One stall that made the watchdog take the heads over
+struct Violation
+{
+    Region region = NO_REGION; // Region the sketch was in, NO_REGION for plain loop code
+    uint32_t stalledMs = 0;    // From the last check-in before the stall to the first one after it
+    uint32_t fallbackMs = 0;   // How long the heads flashed red
+};
+
+// Shared by the signal task and the watchdog task. The sketch serializes trip(), flashOn()
+// and recover() with the writes to its heads; everything else runs on the signal task.
+class LoopWatchdog
+{
+public:
+    void begin(uint32_t nowMs)
+    {
+        lastCheckInMs = nowMs;
+        deadlineMs = nowMs + DEADLINE_MS;
+        windowStartMs = nowMs;
+    }
+
+    // Sign of life from the signal task; plannedMs is a wait that starts now and is part of the plan
+    void checkIn(uint32_t nowMs, uint32_t plannedMs = 0)
+    {
+        uint32_t gap = nowMs - lastCheckInMs;
+        uint32_t unplanned = gap > lastPlannedMs ? gap - lastPlannedMs : 0;
+        histograms[LOOP].record(unplanned < 0xFFFFFFFFu / 1000 ? unplanned * 1000 : 0xFFFFFFFFu);
+        if (active && stallEndMs == 0)
+        {
+            stallEndMs = nowMs;
+        }
+        lastCheckInMs = nowMs;
+        lastPlannedMs = plannedMs;
+        deadlineMs = nowMs + plannedMs + DEADLINE_MS;
+    }
+
+    void enter(Region region)
+    {
+        openRegion = region;
+    }
+
+    void leave(Region region, uint32_t elapsedUs)
+    {
+        histograms[region].record(elapsedUs);
+        openRegion = NO_REGION;
+    }
+
+    bool overdue(uint32_t nowMs) const
+    {
+        return (int32_t)(nowMs - deadlineMs) > 0;
+    }
+
+    // Watchdog task: take the heads over if the deadline has passed. True while in fallback.
+    bool trip(uint32_t nowMs)
+    {
+        if (!active && overdue(nowMs))
+        {
+            active = true;
+            trippedAtMs = nowMs;
+            stallStartMs = lastCheckInMs;
+            stallEndMs = 0;
+            stallRegion = openRegion;
+            violations++;
+            windowViolations++;
+        }
+        return active;
+    }
+
+    bool fallbackActive() const
+    {
+        return active;
+    }
+
+    // Red phase of the flashing pattern
+    bool flashOn(uint32_t nowMs) const
+    {
+        return ((nowMs - trippedAtMs) / FLASH_HALF_MS) % 2 == 0;
+    }
+
+    // Signal task, with all of its heads red by itself: end the fallback once the loop is
+    // back on time. True (and `out` filled in) when it ended.
+    bool recover(uint32_t nowMs, Violation &out)
+    {
+        if (!active || overdue(nowMs))
+        {
+            return false;
+        }
+        active = false;
+        out.region = stallRegion;
+        out.stalledMs = (stallEndMs != 0 ? stallEndMs : nowMs) - stallStartMs;
+        out.fallbackMs = nowMs - trippedAtMs;
+        windowFallbackMs += out.fallbackMs;
+        return true;
+    }
+
+    bool statsDue(uint32_t nowMs) const
+    {
+        return nowMs - windowStartMs >= STATS_PERIOD_MS;
+    }
+
+    // Compact JSON of the window since the last report, then start a new window; returns its
+    // length, 0 if it did not fit.
+    //   {"lane_id":1,"window_s":60,"violations":0,"fallback_ms":0,
+    //    "regions":{"loop":{"n":2950,"p99_ms":1.02,"max_ms":1.1},...}}
+    size_t report(char (&out)[MAX_REPORT], int laneId, uint32_t nowMs)
+    {
+        int length = snprintf(out, sizeof(out), "{\"lane_id\":%d,\"window_s\":%lu,\"violations\":%lu,\"fallback_ms\":%lu,\"regions\":{",
+                              laneId, (unsigned long)((nowMs - windowStartMs) / 1000), (unsigned long)windowViolations,
+                              (unsigned long)windowFallbackMs);
+        for (int r = 0; r < REGIONS && length > 0 && (size_t)length < sizeof(out); r++)
+        {
+            const Histogram &h = histograms[r];
+            length += snprintf(out + length, sizeof(out) - length, "%s\"%s\":{\"n\":%lu,\"p99_ms\":%.2f,\"max_ms\":%.2f}",
+                               r > 0 ? "," : "", regionName((Region)r), (unsigned long)h.count(),
+                               h.percentileUs(99) / 1000.0, h.max() / 1000.0);
+        }
+        if (length > 0 && (size_t)length < sizeof(out))
+        {
+            length += snprintf(out + length, sizeof(out) - length, "}}");
+        }
+
+        for (int r = 0; r < REGIONS; r++)
+        {
+            histograms[r].clear();
+        }
+        windowStartMs = nowMs;
+        windowViolations = 0;
+        windowFallbackMs = 0;
+        return length > 0 && (size_t)length < sizeof(out) ? (size_t)length : 0;
+    }
+
+    const Histogram &histogram(Region region) const
+    {
+        return histograms[region];
+    }
+
+    uint32_t totalViolations() const
+    {
+        return violations;
+    }
+
+private:
+    Histogram histograms[REGIONS];
+    volatile uint32_t lastCheckInMs = 0;
+    volatile uint32_t deadlineMs = DEADLINE_MS;
+    uint32_t lastPlannedMs = 0;
+    volatile Region openRegion = NO_REGION;
+
+    volatile bool active = false;
+    uint32_t trippedAtMs = 0;
+    uint32_t stallStartMs = 0;
+    uint32_t stallEndMs = 0;
+    Region stallRegion = NO_REGION;
+    uint32_t violations = 0;
+
+    uint32_t windowStartMs = 0;
+    uint32_t windowViolations = 0;
+    uint32_t windowFallbackMs = 0;
+};
+
+// Violation message for the watchdog topic; returns its length, 0 if it did not fit
+//   {"lane_id":1,"region":"mqtt_connect","stalled_ms":10012,"fallback_ms":7750,"total":3}
+inline size_t encodeViolation(char (&out)[MAX_REPORT], int laneId, const Violation &violation, uint32_t total)
+{
+    int length = snprintf(out, sizeof(out), "{\"lane_id\":%d,\"region\":\"%s\",\"stalled_ms\":%lu,\"fallback_ms\":%lu,\"total\":%lu}",
+                          laneId, regionName(violation.region), (unsigned long)violation.stalledMs,
+                          (unsigned long)violation.fallbackMs, (unsigned long)total);
+    return length > 0 && (size_t)length < sizeof(out) ? (size_t)length : 0;
+}
+} // namespace loop_watchdog
+
+#endif // LOOP_WATCHDOG_H
@@ -8,6 +8,21 @@
 #include <PubSubClient.h>
 #include <ArduinoJson.h> // Add JSON library for parsing
 #include <time.h>        // Include time library for NTP
+#include "lane_policy.h" // Green time policy table (generated by Python/compile_policy.py)
+#include "lane_config.h" // Runtime parameters, saved in NVS and updated over traffic/config
+#include "phase_engine.h" // Conflict matrix and barrier groups for shared greens
+#include "cycle_accounting.h" // Per-cycle time accounting for traffic/cycle_stats
+#include "mqtt_topics.h" // traffic/<intersection>/... topic names
+#include "demand_forecast.h" // Arrival forecast for sizing green times
+#include "saturation_flow.h" // Measured saturation flow for sizing green times
+#include "intersection_snapshot.h" // Retained state for boards and detectors joining mid-cycle
+#include "loop_watchdog.h" // Deadline of the loop, flashing red fallback and latency histograms
+#include "ota_update.h" // Delta firmware updates into the other app slot, with rollback
+#ifdef MQTT_TLS
+#include "tls_session.h" // TLS to the broker, resuming the session kept in RTC memory
+#include "broker_certs.h" // Broker CA and this board's certificate (generated by Python/broker_tls.py)
+#endif
+#include <esp_task_wdt.h>
 
 using namespace std;
 
@@ -16,15 +31,32 @@ const char *ssid = "PSS";         // Replace with your WiFi SSID
 const char *password = "S3rpong!"; // Replace with your WiFi password
 
 // MQTT settings
+#ifdef MQTT_TLS
+const char *mqtt_broker = BROKER_TLS_HOST; // The name in the broker's certificate
+const int mqtt_port = 8883;
+#else
 const char *mqtt_broker = "broker.emqx.io";
 const int mqtt_port = 1883;
-const char *mqtt_topic = "traffic/vehicle_count";
-const char *mqtt_duration_topic = "traffic/duration";           // New topic for publishing duration
-const char *mqtt_countdown_sync_topic = "traffic/countdown_sync"; // NEW: Topic for countdown synchronization
+#endif
+const char *mqtt_topic = MQTT_LANE_TOPIC(4, "vehicle_count"); // Only this lane's counts reach the board
+const char *mqtt_duration_topic = MQTT_LANE_TOPIC(4, "duration");           // New topic for publishing duration
+const char *mqtt_countdown_sync_topic = MQTT_LANE_TOPIC(4, "countdown_sync"); // NEW: Topic for countdown synchronization
 const char *mqtt_client_id = "esp32_traffic_controller_lane4";  // Unique client ID for Lane 4
-const char *mqtt_green_status_topic = "traffic/green_status";   // New topic for tracking green status
-const char *mqtt_green_request_topic = "traffic/green_request"; // New topic for requesting green light
-const char *mqtt_reset_topic = "traffic/reset"; // New topic for resetting all data and states
+const char *mqtt_green_status_topic = MQTT_SITE_TOPIC("green_status");   // New topic for tracking green status
+const char *mqtt_green_request_topic = MQTT_SITE_TOPIC("green_request"); // New topic for requesting green light
+const char *mqtt_reset_topic = MQTT_SITE_TOPIC("reset"); // New topic for resetting all data and states
+const char *mqtt_config_topic = MQTT_SITE_TOPIC("config"); // Binary config blobs (see lane_config.h)
+const char *mqtt_config_status_topic = MQTT_SITE_TOPIC("config_status"); // Config accepted/applied/rejected reports
+const char *mqtt_green_permission_topic = MQTT_SITE_TOPIC("green_permission");
+const char *mqtt_next_lane_ready_topic = MQTT_SITE_TOPIC("next_lane_ready");
+const char *mqtt_snapshot_topic = MQTT_SITE_TOPIC("snapshot"); // Versioned intersection state, retained
+const char *mqtt_cycle_stats_topic = MQTT_LANE_TOPIC(4, "cycle_stats"); // Time accounting of each cycle
+const char *mqtt_discharge_topic = MQTT_LANE_TOPIC(4, "discharge"); // Stop line crossings of each green, from the detector
+const char *mqtt_watchdog_topic = MQTT_LANE_TOPIC(4, "watchdog"); // Stalls that made the heads flash red
+const char *mqtt_loop_stats_topic = MQTT_LANE_TOPIC(4, "loop_stats"); // Max and p99 time per loop region
+const char *mqtt_ota_topic = MQTT_LANE_TOPIC(4, "ota"); // Firmware patch transfer (see ota_update.h)
+const char *mqtt_ota_status_topic = MQTT_LANE_TOPIC(4, "ota_status"); // Transfer progress, switches and rollbacks
+const char *mqtt_tls_topic = MQTT_LANE_TOPIC(4, "tls"); // Handshake time and resumption after each connect
 
 // NTP Server Settings
 const char *ntpServer = "pool.ntp.org";
@@ -40,11 +72,21 @@ const int GREEN_PIN = 5;   // GPIO5 (D5)
 const int LANE_ID = 4;
 const int ROAD_SECTION_ID = 4;
 
+#ifdef MQTT_TLS
+// The session outlives esp_restart() and watchdog resets in RTC memory, so reconnects resume it
+RTC_NOINIT_ATTR tls_session::CachedSession tlsSession;
+tls_session::TlsClient espClient(tlsSession);
+#else
 WiFiClient espClient;
+#endif
 PubSubClient mqtt_client(espClient);
 
 // Store vehicle count for this lane
 float vehicleCount = 0;
+// 85th percentile approach speed from the tracker, 0 until one is reported
+float approachSpeedKph = 0;
+// Coordinator's arrival forecast in vehicles per minute, -1 until one is reported
+float arrivalRateVpm = -1;
 
 // Store last received MQTT data
 struct MqttData
@@ -61,9 +103,11 @@ struct MqttData
 MqttData lastReceivedData = {0, 0, "", false, false, false, 0};
 
 // Global variable to track if any section has the green light
-int currentGreenSection = 0; // 0 means no section is green
+// Sections that currently hold green (or its clearing yellow); compatible sections may share green
+phase_engine::PhaseEngine phases;
 bool greenLightRequested = false;
 bool waitingForGreenPermission = false;
+bool permissionReservedAhead = false; // Green request made while the previous group was still clearing
 
 // Circular queue for traffic light ordering
 int nextExpectedSection = 1; // Always start with section 1
@@ -71,6 +115,11 @@ int getNextSection(int current) {
     return (current % 4) + 1; // 1->2->3->4->1
 }
 
+// Latest intersection snapshot seen. After every (re)connect the retained one catches the board up.
+intersection_snapshot::Snapshot snapshot;
+bool joiningFromSnapshot = false;
+unsigned long joinStartMs = 0;
+
 // Define light state for this lane
 struct TrafficLight
 {
@@ -81,44 +130,82 @@ struct TrafficLight
 
 TrafficLight light;
 
-// Function declarations
-void publish_countdown_sync(int remaining_seconds, String phase = "green");
+// Controller parameters, double buffered so updates only take effect between light sequences
+lane_config::ConfigStore configStore;
 
-// Membership Functions for Vehicle Count
-float sedikit(float x)
-{
-    if (x <= 3)
-        return 1.0;
-    else if (x > 3 && x < 5)
-        return (5 - x) / 2.0;
-    else
-        return 0.0;
-}
+// Every millisecond of each cycle, charged to green, clearance, waiting or idle
+cycle_accounting::CycleAccounting cycleTime;
 
-float sedang(float x)
-{
-    if (x <= 3 || x >= 10)
-        return 0.0;
-    else if (x > 3 && x <= 5)
-        return (x - 3) / 2.0;
-    else if (x > 5 && x < 10)
-        return (10 - x) / 5.0;
-    return 0.0;
-}
+// Arrivals learnt from the count growing while this lane is red
+demand_forecast::DemandForecast arrivalForecast;
 
-float padat(float x)
-{
-    if (x <= 5)
-        return 0.0;
-    else if (x > 5 && x < 10)
-        return (x - 5) / 5.0;
-    else
-        return 1.0;
-}
+// Saturation flow learnt from the detector's discharge reports
+saturation_flow::SaturationFlow saturationFlow;
+
+// The watchdog task flashes the head red while the loop is overdue; headsMux serializes it
+// with setTrafficLight()
+loop_watchdog::LoopWatchdog loopWatchdog;
+portMUX_TYPE headsMux = portMUX_INITIALIZER_UNLOCKED;
+loop_watchdog::Violation pendingViolation; // Held until MQTT is connected to report it
+bool violationPending = false;
+
+// Firmware updates; the writer task decodes them into the other app slot, holding otaMutex
+ota_update::OtaUpdater otaUpdater;
+SemaphoreHandle_t otaMutex;
+bool otaChunkTaken = false; // The message poll_mqtt() just took was a firmware chunk
+
+// Function declarations
+void watchdog_task(void *);
+void ota_task(void *);
+void poll_mqtt();
+void sequence_delay(unsigned long ms);
+void check_loop_watchdog();
+void publish_countdown_sync(int remaining_seconds, String phase = "green");
+String getCurrentTimestamp();
+uint64_t wallClockMs();
+void join_from_snapshot(const intersection_snapshot::Snapshot &received);
+void resetAllData();
+void handle_config_message(const uint8_t *payload, unsigned int length);
+void publish_config_status(uint32_t version, const char *status, const char *reason);
+void handle_ota_message(const uint8_t *payload, unsigned int length);
+void publish_ota_status(ota_update::Report report);
+void report_ota();
+void service_ota();
+void publish_cycle_stats();
+int forecastSlot();
 
 // MQTT message callback
 void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
 {
+    // Config blobs are binary, handle them before the payload is printed as text
+    if (strcmp(topic, mqtt_config_topic) == 0)
+    {
+        handle_config_message(payload, length);
+        return;
+    }
+    if (strcmp(topic, mqtt_ota_topic) == 0)
+    {
+        otaChunkTaken = true;
+        handle_ota_message(payload, length);
+        return;
+    }
+
+    if (strcmp(topic, mqtt_snapshot_topic) == 0)
+    {
+        intersection_snapshot::Snapshot received;
+        if (intersection_snapshot::decode(payload, length, received) &&
+            intersection_snapshot::supersedes(received, snapshot))
+        {
+            snapshot = received;
+            if (joiningFromSnapshot)
+            {
+                join_from_snapshot(received);
+            }
+        }
+        joiningFromSnapshot = false; // Only the retained message right after connecting
+        return;
+    }
+
     Serial.print("Message arrived [");
     Serial.print(topic);
     Serial.print("] ");
@@ -272,6 +359,18 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
         
         // Store data for this lane
         vehicleCount = total_vehicles;
+        if (doc.containsKey("approach_speed_kph"))
+        {
+            approachSpeedKph = doc["approach_speed_kph"].as<float>();
+        }
+        if (doc.containsKey("arrival_rate_vpm"))
+        {
+            arrivalRateVpm = doc["arrival_rate_vpm"].as<float>();
+        }
+        if (light.red)
+        {
+            arrivalForecast.observeRed(total_vehicles, millis(), forecastSlot());
+        }
         lastReceivedData.road_section_id = road_section_id;
         lastReceivedData.total_vehicles = total_vehicles;
         
@@ -293,6 +392,15 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
         Serial.print(LANE_ID);
         Serial.println(" data updated!");
     }
+    else if (strcmp(topic, mqtt_discharge_topic) == 0)
+    {
+        // One report per green of this lane from the detector's stop line counter
+        DynamicJsonDocument doc(256);
+        if (!deserializeJson(doc, message) && doc.containsKey("headways") && doc.containsKey("saturated_s"))
+        {
+            saturationFlow.observe(doc["headways"].as<unsigned long>(), doc["saturated_s"].as<float>());
+        }
+    }
     else if (strcmp(topic, mqtt_green_status_topic) == 0)
     {
         // Handle green status updates from other lanes
@@ -306,15 +414,15 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
             
             if (status == "green")
             {
-                currentGreenSection = section;
+                phases.setActive(section, true);
                 Serial.print("Section ");
                 Serial.print(section);
                 Serial.println(" is now GREEN");
             }
-            else if (status == "red" && currentGreenSection == section)
+            else if (status == "red" && phases.isActive(section))
             {
-                currentGreenSection = 0;
-                nextExpectedSection = getNextSection(section);
+                phases.setActive(section, false);
+                nextExpectedSection = phases.nextLead(section, getNextSection(section));
                 Serial.print("Section ");
                 Serial.print(section);
                 Serial.print(" is now RED - Next expected section: ");
@@ -338,13 +446,18 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
                 requesting_time = doc["data_received_time"];
             }
             
-            // If no one has green light and it's the requesting section's turn, grant permission
-            if (currentGreenSection == 0)
+            // A request made ahead is judged as if the clearing group were already red; the
+            // requester still waits for that red (green_status) before it goes green
+            bool ahead = doc.containsKey("ahead") && doc["ahead"].as<bool>();
+
+            // If nothing conflicting is green and it's the requesting section's group's turn, grant permission
+            if (requesting_section != ROAD_SECTION_ID && (ahead || !phases.conflictsWithActive(requesting_section)))
             {
-                bool should_grant = (requesting_section == nextExpectedSection);
+                bool should_grant = phases.sameGroup(requesting_section, nextExpectedSection);
                 
-                // If this ESP also has pending data and it's not our turn, deny
-                if (lastReceivedData.new_data && vehicleCount > 0 && ROAD_SECTION_ID == nextExpectedSection)
+                // If this ESP also has pending data, it's our turn and we can't share green with them, deny
+                if (lastReceivedData.new_data && vehicleCount > 0 && phases.sameGroup(ROAD_SECTION_ID, nextExpectedSection) &&
+                    phases.conflicts(ROAD_SECTION_ID, requesting_section))
                 {
                     should_grant = false;
                     Serial.print("Lane ");
@@ -366,7 +479,7 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
                     
                     String response;
                     serializeJson(responseDoc, response);
-                    mqtt_client.publish("traffic/green_permission", response.c_str());
+                    mqtt_client.publish(mqtt_green_permission_topic, response.c_str());
                     
                     Serial.print("Lane ");
                     Serial.print(LANE_ID);
@@ -376,7 +489,7 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
                     Serial.print(nextExpectedSection);
                     Serial.println(")");
                 }
-                else if (requesting_section != nextExpectedSection)
+                else if (!phases.sameGroup(requesting_section, nextExpectedSection))
                 {
                     Serial.print("Lane ");
                     Serial.print(LANE_ID);
@@ -389,7 +502,7 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
             }
         }
     }
-    else if (strcmp(topic, "traffic/green_permission") == 0)
+    else if (strcmp(topic, mqtt_green_permission_topic) == 0)
     {
         // Handle green light permission responses
         DynamicJsonDocument doc(256);
@@ -432,7 +545,7 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
             Serial.println(resetCommand);
         }
     }
-    else if (strcmp(topic, "traffic/next_lane_ready") == 0)
+    else if (strcmp(topic, mqtt_next_lane_ready_topic) == 0)
     {
         // Handle next lane ready notification
         DynamicJsonDocument doc(256);
@@ -455,10 +568,10 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
             Serial.print(", Our ID: ");
             Serial.print(ROAD_SECTION_ID);
             Serial.print(", Match: ");
-            Serial.println(ROAD_SECTION_ID == nextExpectedSection ? "YES" : "NO");
+            Serial.println(phases.sameGroup(ROAD_SECTION_ID, nextExpectedSection) ? "YES" : "NO");
             
             // If we are the next expected lane, trigger immediate processing regardless of vehicle data
-            if (ROAD_SECTION_ID == nextExpectedSection)
+            if (phases.sameGroup(ROAD_SECTION_ID, nextExpectedSection))
             {
                 Serial.print("Lane ");
                 Serial.print(LANE_ID);
@@ -492,6 +605,8 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
 
 void setup_wifi()
 {
+    unsigned long start = micros();
+    loopWatchdog.enter(loop_watchdog::WIFI);
     delay(10);
     Serial.println();
     Serial.print("Connecting to ");
@@ -501,6 +616,7 @@ void setup_wifi()
 
     while (WiFi.status() != WL_CONNECTED)
     {
+        esp_task_wdt_reset(); // Waiting, not hung; the head flashes red meanwhile
         delay(500);
         Serial.print(".");
     }
@@ -516,7 +632,9 @@ void setup_wifi()
 
     // Wait for time to be set
     struct tm timeinfo;
-    if (!getLocalTime(&timeinfo))
+    bool timeSet = getLocalTime(&timeinfo);
+    loopWatchdog.leave(loop_watchdog::WIFI, micros() - start);
+    if (!timeSet)
     {
         Serial.println("Failed to obtain time");
         return;
@@ -526,12 +644,23 @@ void setup_wifi()
 
 void connect_mqtt()
 {
+    unsigned long start = micros();
+    loopWatchdog.enter(loop_watchdog::MQTT_CONNECT);
     while (!mqtt_client.connected())
     {
         Serial.print("Attempting MQTT connection...");
         if (mqtt_client.connect(mqtt_client_id))
         {
             Serial.println("connected");
+#ifdef MQTT_TLS
+            char tlsReport[tls_session::MAX_REPORT];
+            if (tls_session::encodeReport(tlsReport, LANE_ID, espClient.handshakes()) > 0)
+            {
+                Serial.print("TLS: ");
+                Serial.println(tlsReport);
+                mqtt_client.publish(mqtt_tls_topic, tlsReport);
+            }
+#endif
             Serial.println("Subscribing to topics:");
             
             if (mqtt_client.subscribe(mqtt_topic)) {
@@ -540,6 +669,12 @@ void connect_mqtt()
                 Serial.println("  ✗ Failed: " + String(mqtt_topic));
             }
             
+            if (mqtt_client.subscribe(mqtt_discharge_topic)) {
+                Serial.println("  ✓ " + String(mqtt_discharge_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_discharge_topic));
+            }
+            
             if (mqtt_client.subscribe(mqtt_countdown_sync_topic)) {
                 Serial.println("  ✓ " + String(mqtt_countdown_sync_topic));
             } else {
@@ -558,10 +693,10 @@ void connect_mqtt()
                 Serial.println("  ✗ Failed: " + String(mqtt_green_request_topic));
             }
             
-            if (mqtt_client.subscribe("traffic/green_permission")) {
-                Serial.println("  ✓ traffic/green_permission");
+            if (mqtt_client.subscribe(mqtt_green_permission_topic)) {
+                Serial.println("  ✓ " + String(mqtt_green_permission_topic));
             } else {
-                Serial.println("  ✗ Failed: traffic/green_permission");
+                Serial.println("  ✗ Failed: " + String(mqtt_green_permission_topic));
             }
             
             if (mqtt_client.subscribe(mqtt_reset_topic)) {
@@ -570,10 +705,31 @@ void connect_mqtt()
                 Serial.println("  ✗ Failed: " + String(mqtt_reset_topic));
             }
             
-            if (mqtt_client.subscribe("traffic/next_lane_ready")) {
-                Serial.println("  ✓ traffic/next_lane_ready");
+            if (mqtt_client.subscribe(mqtt_config_topic)) {
+                Serial.println("  ✓ " + String(mqtt_config_topic));
             } else {
-                Serial.println("  ✗ Failed: traffic/next_lane_ready");
+                Serial.println("  ✗ Failed: " + String(mqtt_config_topic));
+            }
+            
+            if (mqtt_client.subscribe(mqtt_ota_topic)) {
+                Serial.println("  ✓ " + String(mqtt_ota_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_ota_topic));
+            }
+            
+            if (mqtt_client.subscribe(mqtt_next_lane_ready_topic)) {
+                Serial.println("  ✓ " + String(mqtt_next_lane_ready_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_next_lane_ready_topic));
+            }
+            
+            // Subscribed last, so the retained snapshot is the newest state when it arrives
+            joiningFromSnapshot = true;
+            joinStartMs = millis();
+            if (mqtt_client.subscribe(mqtt_snapshot_topic)) {
+                Serial.println("  ✓ " + String(mqtt_snapshot_topic));
+            } else {
+                Serial.println("  ✗ Failed: " + String(mqtt_snapshot_topic));
             }
             
             Serial.println("Lane " + String(LANE_ID) + " ready to receive MQTT messages!");
@@ -582,10 +738,16 @@ void connect_mqtt()
         {
             Serial.print("failed, rc=");
             Serial.print(mqtt_client.state());
+#ifdef MQTT_TLS
+            Serial.print(", TLS: ");
+            Serial.print(espClient.lastError());
+#endif
             Serial.println(" try again in 5 seconds");
+            esp_task_wdt_reset(); // Retrying is progress; a failed attempt still trips the loop deadline
             delay(5000);
         }
     }
+    loopWatchdog.leave(loop_watchdog::MQTT_CONNECT, micros() - start);
 }
 
 void testTrafficLights()
@@ -620,11 +782,39 @@ void testTrafficLights()
     Serial.println("Back to Red");
 }
 
+// Arduino core hook: keep a new image on trial instead of marking it valid at boot;
+// service_ota() confirms it once it has proven itself
+bool verifyRollbackLater()
+{
+    return true;
+}
+
 void setup()
 {
     Serial.begin(115200);
     Serial.println("ESP32 Traffic Light Controller - Lane " + String(LANE_ID));
 
+    // Identify the green time policy that was flashed
+    char policyChecksum[9];
+    snprintf(policyChecksum, sizeof(policyChecksum), "%08lx", (unsigned long)lane_policy::CHECKSUM);
+    Serial.println("Policy: " + String(lane_policy::NAME) + " v" + String(lane_policy::VERSION) + " (crc " + String(policyChecksum) + ")");
+
+    // Load the parameters saved by the last config update
+    bool configLoaded = configStore.begin();
+    phases.setConflicts(configStore.current().body.conflicts);
+    if (configLoaded)
+    {
+        Serial.println("Config: v" + String(configStore.current().version) + " loaded from NVS");
+    }
+    else
+    {
+        Serial.println("Config: none saved, using defaults");
+    }
+
+    // Which firmware runs, and whether it is a new image on trial
+    otaUpdater.begin(millis());
+    Serial.println("Firmware: v" + String(otaUpdater.runningVersion()) + (otaUpdater.onTrial() ? " on trial" : ""));
+
     // Initialize traffic light pins
     pinMode(RED_PIN, OUTPUT);
     pinMode(YELLOW_PIN, OUTPUT);
@@ -640,17 +830,101 @@ void setup()
     light.yellow = false;
     light.green = false;
 
+    // Watch the loop from here on, so a hang in setup_wifi() already flashes the head red
+    loopWatchdog.begin(millis());
+    esp_task_wdt_init(loop_watchdog::TASK_WDT_TIMEOUT_S, true);
+    esp_task_wdt_add(NULL);
+    xTaskCreatePinnedToCore(watchdog_task, "loop_watchdog", 2048, NULL, 2, NULL, 0);
+    otaMutex = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(ota_task, "ota_writer", 4096, NULL, 1, NULL, 0);
+
     setup_wifi();
+#ifdef MQTT_TLS
+    if (!espClient.setCertificates(BROKER_CA_PEM, BOARD_CERT_PEM, BOARD_KEY_PEM))
+    {
+        Serial.print("TLS: certificates not loaded, ");
+        Serial.println(espClient.lastError());
+    }
+#endif
     mqtt_client.setServer(mqtt_broker, mqtt_port);
     mqtt_client.setCallback(mqtt_callback);
+    mqtt_client.setBufferSize(1280); // Config blobs and 1 KB firmware chunks are larger than the 256-byte default
 
-    testTrafficLights();
+    // Light test only after power-on; after any other reset traffic is running (an OTA
+    // switch, a watchdog reset) and the test's green would conflict
+    if (esp_reset_reason() == ESP_RST_POWERON)
+    {
+        loopWatchdog.checkIn(millis(), 6000); // The light test
+        check_loop_watchdog();
+        testTrafficLights();
+    }
     Serial.println("Setup completed for Lane " + String(LANE_ID));
 }
 
+// Whether a weekday hour runs the jam sibuk plan; the loop uses the full schedule (rushWeight)
 bool isJamSibuk(int jam)
 {
-    return (jam >= 7 && jam <= 9) || (jam >= 17 && jam <= 19);
+    return configStore.current().isRushHour(jam);
+}
+
+// Quarter hour of the day for the forecast's time-of-day profile
+int forecastSlot()
+{
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo, 0))
+    {
+        return 0;
+    }
+    return demand_forecast::slotOf(timeinfo.tm_hour, timeinfo.tm_min);
+}
+
+// Vehicles expected to join the queue during a green of greenSeconds, 0 unless the
+// config enables forecast greens. The coordinator's forecast wins over the local one.
+float expectedArrivals(float greenSeconds)
+{
+    if (!configStore.current().forecastGreens())
+    {
+        return 0;
+    }
+    if (arrivalRateVpm >= 0)
+    {
+        return arrivalRateVpm / 60.0f * greenSeconds;
+    }
+    return arrivalForecast.arrivalsOver(greenSeconds, forecastSlot());
+}
+
+// Green time for `vehicles` waiting: queue over the measured saturation flow once the
+// config enables it and enough greens were measured, otherwise the policy table
+float greenSecondsFor(float vehicles, float rushWeight)
+{
+    const lane_config::LaneConfig &config = configStore.current();
+    if (config.saturationGreens() && saturationFlow.ready())
+    {
+        return config.clampGreen(saturationFlow.greenSeconds(vehicles));
+    }
+    return config.blendedGreenSeconds(vehicles, rushWeight);
+}
+
+// Wall-clock milliseconds for the snapshot. NTP time only has whole seconds, so the fraction
+// is counted with millis() from the call that saw the second change.
+uint64_t wallClockMs()
+{
+    static time_t lastSecond = 0;
+    static unsigned long secondSeenAt = 0;
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo, 0))
+    {
+        return 0;
+    }
+    time_t second = mktime(&timeinfo);
+    unsigned long now = millis();
+    if (second != lastSecond)
+    {
+        lastSecond = second;
+        secondSeenAt = now;
+    }
+    unsigned long fraction = now - secondSeenAt;
+    return (uint64_t)second * 1000 + (fraction < 1000 ? fraction : 999);
 }
 
 String getCurrentTimestamp()
@@ -668,13 +942,24 @@ String getCurrentTimestamp()
 
 void setTrafficLight(bool red, bool yellow, bool green)
 {
-    digitalWrite(RED_PIN, red ? HIGH : LOW);
-    digitalWrite(YELLOW_PIN, yellow ? HIGH : LOW);
-    digitalWrite(GREEN_PIN, green ? HIGH : LOW);
-    
-    light.red = red;
-    light.yellow = yellow;
-    light.green = green;
+    // While the watchdog task flashes red the sequence runs on, but does not reach the head
+    portENTER_CRITICAL(&headsMux);
+    bool heldByWatchdog = loopWatchdog.fallbackActive();
+    if (!heldByWatchdog)
+    {
+        digitalWrite(RED_PIN, red ? HIGH : LOW);
+        digitalWrite(YELLOW_PIN, yellow ? HIGH : LOW);
+        digitalWrite(GREEN_PIN, green ? HIGH : LOW);
+
+        light.red = red;
+        light.yellow = yellow;
+        light.green = green;
+    }
+    portEXIT_CRITICAL(&headsMux);
+    if (green && !heldByWatchdog)
+    {
+        arrivalForecast.breakInterval(); // The queue discharges, so its growth stops meaning arrivals
+    }
     
     // Removed repetitive light state logging to prevent spam
     // Serial.print("Lane ");
@@ -691,6 +976,102 @@ void allRed()
     setTrafficLight(true, false, false);
 }
 
+// Watchdog task: flash the head red while the signal task misses its deadline
+void watchdog_task(void *)
+{
+    while (true)
+    {
+        portENTER_CRITICAL(&headsMux);
+        if (loopWatchdog.trip(millis()))
+        {
+            bool on = loopWatchdog.flashOn(millis());
+            digitalWrite(RED_PIN, on ? HIGH : LOW);
+            digitalWrite(YELLOW_PIN, LOW);
+            digitalWrite(GREEN_PIN, LOW);
+            light.red = on;
+            light.yellow = false;
+            light.green = false;
+        }
+        portEXIT_CRITICAL(&headsMux);
+        vTaskDelay(pdMS_TO_TICKS(loop_watchdog::CHECK_MS));
+    }
+}
+
+// Writer task: decodes queued firmware chunks, one flash sector per step, so the signal task
+// waits out at most one sector erase when it needs the updater
+void ota_task(void *)
+{
+    while (true)
+    {
+        xSemaphoreTake(otaMutex, portMAX_DELAY);
+        bool more = otaUpdater.work();
+        xSemaphoreGive(otaMutex);
+        vTaskDelay(pdMS_TO_TICKS(more ? 1 : 100));
+    }
+}
+
+// mqtt_client.loop() for the signal task; every poll is a check-in with the loop watchdog
+void poll_mqtt()
+{
+    loopWatchdog.checkIn(millis());
+    esp_task_wdt_reset();
+    unsigned long start = micros();
+    loopWatchdog.enter(loop_watchdog::MQTT_POLL);
+    // Firmware chunks don't use up the poll, so a transfer can't hold back the control
+    // messages queued behind it; the sender's window bounds how many there are
+    do
+    {
+        otaChunkTaken = false;
+        mqtt_client.loop();
+    } while (otaChunkTaken);
+    loopWatchdog.leave(loop_watchdog::MQTT_POLL, micros() - start);
+    report_ota();
+}
+
+// Planned wait of the light sequence, announced so it does not count against the deadline
+void sequence_delay(unsigned long ms)
+{
+    loopWatchdog.checkIn(millis(), ms);
+    esp_task_wdt_reset();
+    delay(ms);
+}
+
+// Called where no light sequence runs, so the head is meant to be red: ends a fallback and
+// reports it, and publishes the loop statistics when they are due
+void check_loop_watchdog()
+{
+    loop_watchdog::Violation violation;
+    portENTER_CRITICAL(&headsMux);
+    bool recovered = loopWatchdog.recover(millis(), violation);
+    portEXIT_CRITICAL(&headsMux);
+    if (recovered)
+    {
+        allRed();
+        pendingViolation = violation;
+        violationPending = true;
+        Serial.print("Lane ");
+        Serial.print(LANE_ID);
+        Serial.print(" - WATCHDOG: loop stalled ");
+        Serial.print(violation.stalledMs);
+        Serial.print(" ms in ");
+        Serial.print(loop_watchdog::regionName(violation.region));
+        Serial.print(", head flashed red for ");
+        Serial.print(violation.fallbackMs);
+        Serial.println(" ms");
+    }
+
+    char message[loop_watchdog::MAX_REPORT];
+    if (violationPending && mqtt_client.connected() &&
+        loop_watchdog::encodeViolation(message, LANE_ID, pendingViolation, loopWatchdog.totalViolations()) > 0)
+    {
+        violationPending = !mqtt_client.publish(mqtt_watchdog_topic, message);
+    }
+    if (loopWatchdog.statsDue(millis()) && loopWatchdog.report(message, LANE_ID, millis()) > 0)
+    {
+        mqtt_client.publish(mqtt_loop_stats_topic, message);
+    }
+}
+
 void resetAllData()
 {
     Serial.print("Lane ");
@@ -710,7 +1091,7 @@ void resetAllData()
     lastReceivedData.data_received_time = 0;
     
     // Reset green light coordination variables
-    currentGreenSection = 0;
+    phases.clear();
     greenLightRequested = false;
     waitingForGreenPermission = false;
     nextExpectedSection = 1; // Reset to starting sequence
@@ -723,38 +1104,6 @@ void resetAllData()
     Serial.println(" - RESET: All data and states cleared successfully");
 }
 
-float defuzzify(float kendaraan, bool jamSibuk)
-{
-    float mu_sedikit = sedikit(kendaraan);
-    float mu_sedang = sedang(kendaraan);
-    float mu_padat = padat(kendaraan);
-
-    float durasi_pendek, durasi_sedang, durasi_lama;
-
-    if (jamSibuk)
-    {
-        durasi_pendek = 15.0;
-        durasi_sedang = 30.0;
-        durasi_lama = 60.0;
-    }
-    else
-    {
-        durasi_pendek = 10.0;
-        durasi_sedang = 20.0;
-        durasi_lama = 40.0;
-    }
-
-    float numerator = (mu_sedikit * durasi_pendek) + (mu_sedang * durasi_sedang) + (mu_padat * durasi_lama);
-    float denominator = mu_sedikit + mu_sedang + mu_padat;
-
-    if (denominator == 0)
-    {
-        return jamSibuk ? 30.0 : 20.0;
-    }
-
-    return numerator / denominator;
-}
-
 void publish_green_status(String status)
 {
     DynamicJsonDocument doc(256);
@@ -772,10 +1121,50 @@ void publish_green_status(String status)
     Serial.println(status);
 }
 
-void request_green_permission()
+// Catch up with the intersection after (re)connecting: which sections are in their sequence and
+// whose turn is next, from one retained message instead of the next few handovers
+void join_from_snapshot(const intersection_snapshot::Snapshot &received)
+{
+    // A stage that should have ended long ago means its writer is gone; only the turn is still good
+    bool current = received.stage == intersection_snapshot::IDLE ||
+                   received.stageEndMs + intersection_snapshot::RESTART_GRACE_MS > wallClockMs();
+    nextExpectedSection = phases.leadOf(received.next);
+    for (int section = 1; section <= intersection_snapshot::LANES; section++)
+    {
+        if (section != ROAD_SECTION_ID)
+        {
+            phases.setActive(section, current && received.isActive(section));
+        }
+    }
+
+    Serial.print("Lane ");
+    Serial.print(LANE_ID);
+    Serial.print(" - Joined from snapshot v");
+    Serial.print(received.version);
+    Serial.print(": active=0x");
+    Serial.print(phases.activeMask(), HEX);
+    Serial.print(", stage ");
+    Serial.print(intersection_snapshot::stageName(received.stage));
+    Serial.print(", next expected section: ");
+    Serial.println(nextExpectedSection);
+
+    // Our own sequence was cut off by the restart; release it so the other boards move on
+    if (received.isActive(ROAD_SECTION_ID) && !phases.isActive(ROAD_SECTION_ID))
+    {
+        publish_green_status("red");
+    }
+}
+
+// ahead: our group has the turn but the previous one is still clearing. The permission is
+// collected now, so the green can follow that group's red without a round trip.
+void request_green_permission(bool ahead = false)
 {
     DynamicJsonDocument doc(256);
     doc["section"] = ROAD_SECTION_ID;
+    if (ahead)
+    {
+        doc["ahead"] = true;
+    }
     doc["timestamp"] = getCurrentTimestamp();
     doc["data_received_time"] = lastReceivedData.data_received_time; // Include timing for priority
     
@@ -785,6 +1174,7 @@ void request_green_permission()
     
     greenLightRequested = true;
     waitingForGreenPermission = true;
+    permissionReservedAhead = ahead;
     
     Serial.print("Lane ");
     Serial.print(LANE_ID);
@@ -838,7 +1228,188 @@ void countdownTimer(int seconds)
         }
         
         delay(1000);
-        mqtt_client.loop(); // Keep MQTT connection alive
+        poll_mqtt(); // Keep MQTT connection alive
+    }
+}
+
+void publish_config_status(uint32_t version, const char *status, const char *reason)
+{
+    DynamicJsonDocument doc(256);
+    doc["lane_id"] = LANE_ID;
+    doc["version"] = version;
+    doc["status"] = status;
+    doc["reason"] = reason;
+    doc["timestamp"] = getCurrentTimestamp();
+
+    String message;
+    serializeJson(doc, message);
+    mqtt_client.publish(mqtt_config_status_topic, message.c_str());
+}
+
+void publish_ota_status(ota_update::Report report)
+{
+    DynamicJsonDocument doc(320);
+    doc["lane_id"] = LANE_ID;
+    doc["state"] = ota_update::reportName(report);
+    doc["running"] = otaUpdater.runningVersion();
+    doc["version"] = otaUpdater.incomingVersion();
+    doc["next"] = otaUpdater.nextOffset();
+    doc["size"] = otaUpdater.patchSize();
+    doc["trial"] = otaUpdater.onTrial();
+    doc["reason"] = report == ota_update::REPORT_REJECTED ? ota_update::describe(otaUpdater.lastResult()) : "";
+    doc["timestamp"] = getCurrentTimestamp();
+
+    String message;
+    serializeJson(doc, message);
+    mqtt_client.publish(mqtt_ota_status_topic, message.c_str());
+}
+
+void handle_ota_message(const uint8_t *payload, unsigned int length)
+{
+    xSemaphoreTake(otaMutex, portMAX_DELAY);
+    otaUpdater.handle(payload, length);
+    xSemaphoreGive(otaMutex);
+}
+
+// Publish what the last chunks or the writer task have to say
+void report_ota()
+{
+    xSemaphoreTake(otaMutex, portMAX_DELAY);
+    ota_update::Report report = otaUpdater.takeReport();
+    xSemaphoreGive(otaMutex);
+    if (report == ota_update::REPORT_NONE)
+    {
+        return;
+    }
+    // Progress goes to the sender only
+    if (report != ota_update::REPORT_RECEIVING && report != ota_update::REPORT_RESEND)
+    {
+        Serial.print("Lane ");
+        Serial.print(LANE_ID);
+        Serial.print(" - Firmware v");
+        Serial.print(otaUpdater.incomingVersion());
+        Serial.print(" ");
+        Serial.print(ota_update::reportName(report));
+        if (report == ota_update::REPORT_REJECTED)
+        {
+            Serial.print(": ");
+            Serial.print(ota_update::describe(otaUpdater.lastResult()));
+        }
+        Serial.println();
+    }
+    publish_ota_status(report);
+}
+
+// Boot report, trial of a new image and the switch to a finished update
+void service_ota()
+{
+    if (mqtt_client.connected())
+    {
+        ota_update::Report boot = otaUpdater.takeBootReport();
+        if (boot != ota_update::REPORT_NONE)
+        {
+            publish_ota_status(boot);
+        }
+    }
+
+    if (otaUpdater.onTrial())
+    {
+        // Kept once it has run a while and is connected with the loop on time; a hang
+        // before that resets the board through the task watchdog, and the bootloader rolls back
+        if (mqtt_client.connected() && !loopWatchdog.fallbackActive() && otaUpdater.trialPassed(millis()))
+        {
+            otaUpdater.confirm();
+            publish_ota_status(ota_update::REPORT_CONFIRMED);
+            Serial.print("Lane ");
+            Serial.print(LANE_ID);
+            Serial.print(" - Firmware v");
+            Serial.print(otaUpdater.runningVersion());
+            Serial.println(" confirmed");
+        }
+        else if (otaUpdater.trialExpired(millis()))
+        {
+            Serial.print("Lane ");
+            Serial.print(LANE_ID);
+            Serial.print(" - Firmware v");
+            Serial.print(otaUpdater.runningVersion());
+            Serial.println(" not confirmed, rolling back");
+            otaUpdater.rollBackNow(); // Restarts
+        }
+    }
+
+    // A finished update (or a rollback) takes over between light sequences while our group
+    // is not next; the restart darkens the head for about a second. The board comes back
+    // knowing only what the retained snapshot says, so it waits until that matches its own view.
+    uint8_t ownBit = 1 << (ROAD_SECTION_ID - 1);
+    bool snapshotCurrent = (snapshot.active | ownBit) == (phases.activeMask() | ownBit) &&
+                           phases.sameGroup(snapshot.next, nextExpectedSection);
+    if (otaUpdater.switchDue() && !waitingForGreenPermission && snapshotCurrent &&
+        !phases.sameGroup(ROAD_SECTION_ID, nextExpectedSection))
+    {
+        Serial.print("Lane ");
+        Serial.print(LANE_ID);
+        Serial.print(" - Firmware v");
+        Serial.print(otaUpdater.incomingVersion());
+        Serial.println(" switching, restarting");
+        if (otaUpdater.switchBoot() == ota_update::OTA_OK)
+        {
+            publish_ota_status(ota_update::REPORT_APPLYING);
+            mqtt_client.disconnect();
+            esp_restart();
+        }
+        publish_ota_status(ota_update::REPORT_REJECTED);
+    }
+}
+
+// One compact record per cycle: milliseconds of the cycle and seconds since boot, each as
+// [effective green, clearance, coordination wait, idle]
+void publish_cycle_stats()
+{
+    DynamicJsonDocument doc(384);
+    doc["lane_id"] = LANE_ID;
+    doc["cycle"] = cycleTime.cycleCount();
+    doc["cycle_ms"] = cycleTime.lastCycleLengthMs();
+    JsonArray cycleMs = doc.createNestedArray("ms");
+    JsonArray totalSeconds = doc.createNestedArray("total_s");
+    for (int c = 0; c < cycle_accounting::CATEGORIES; c++)
+    {
+        cycleMs.add(cycleTime.lastCycleMs((cycle_accounting::Category)c));
+        totalSeconds.add(cycleTime.totalSeconds((cycle_accounting::Category)c));
+    }
+
+    String message;
+    serializeJson(doc, message);
+    mqtt_client.publish(mqtt_cycle_stats_topic, message.c_str());
+}
+
+void handle_config_message(const uint8_t *payload, unsigned int length)
+{
+    lane_config::ParseResult result = configStore.stage(payload, length);
+    uint32_t version = 0;
+    if (length >= sizeof(lane_config::ConfigHeader))
+    {
+        memcpy(&version, payload + offsetof(lane_config::ConfigHeader, version), sizeof(version));
+    }
+
+    Serial.print("Lane ");
+    Serial.print(LANE_ID);
+    Serial.print(" - Config v");
+    Serial.print(version);
+    if (result == lane_config::CONFIG_OK)
+    {
+        Serial.println(" saved, applying at the next phase boundary");
+        publish_config_status(version, "staged", "");
+    }
+    else if (result == lane_config::CONFIG_STALE)
+    {
+        // Retained configs are received again on every reconnect
+        Serial.println(" already running");
+    }
+    else
+    {
+        Serial.print(" rejected: ");
+        Serial.println(lane_config::describe(result));
+        publish_config_status(version, "rejected", lane_config::describe(result));
     }
 }
 
@@ -849,6 +1420,11 @@ void publish_duration(float duration)
     doc["road_section_id"] = lastReceivedData.road_section_id;
     doc["total_vehicles"] = lastReceivedData.total_vehicles;
     doc["duration"] = duration;
+    doc["lost_time_ms"] = configStore.current().lostMsFor(ROAD_SECTION_ID, approachSpeedKph);
+    if (saturationFlow.ready())
+    {
+        doc["saturation_flow_vph"] = (int)(saturationFlow.perHour() + 0.5f);
+    }
     doc["timestamp"] = lastReceivedData.timestamp;
 
     String message;
@@ -894,7 +1470,39 @@ void loop()
     {
         connect_mqtt();
     }
-    mqtt_client.loop();
+    poll_mqtt();
+    check_loop_watchdog();
+
+    // No light sequence is running here, so this is where a staged config takes over
+    if (configStore.applyPending())
+    {
+        phases.setConflicts(configStore.current().body.conflicts);
+        Serial.print("Lane ");
+        Serial.print(LANE_ID);
+        Serial.print(" - Config v");
+        Serial.print(configStore.current().version);
+        Serial.println(" applied");
+        publish_config_status(configStore.current().version, "applied", "");
+    }
+
+    service_ota();
+
+    // No sequence starts before the retained snapshot says where the cycle is; a restart
+    // (an OTA switch) puts this section back in the middle of the other group's turn
+    if (joiningFromSnapshot && millis() - joinStartMs < intersection_snapshot::JOIN_WAIT_MS)
+    {
+        delay(20);
+        return;
+    }
+
+    // A permission granted ahead only holds while our group has the turn
+    if (!phases.sameGroup(ROAD_SECTION_ID, nextExpectedSection))
+    {
+        permissionReservedAhead = false;
+    }
+
+    // Outside a light sequence the section either waits for its turn or has nothing to serve
+    cycleTime.enter(lastReceivedData.new_data ? cycle_accounting::COORDINATION_WAIT : cycle_accounting::IDLE, millis());
 
     // Get current time
     struct tm timeinfo;
@@ -905,8 +1513,9 @@ void loop()
         return;
     }
 
-    int currentHour = timeinfo.tm_hour;
-    bool jamSibuk = isJamSibuk(currentHour);
+    // Day type, holidays and smooth changes between plans all come from the config's schedule
+    float rushWeight = configStore.current().rushWeight(timeinfo);
+    bool jamSibuk = rushWeight >= 0.5f;
 
         // Check if we have new data for our lane
     // Also add timeout to prevent processing old retained messages indefinitely
@@ -929,11 +1538,17 @@ void loop()
         Serial.print(LANE_ID);
         Serial.print(" - Processing new data: vehicles=");
         Serial.print(vehicleCount);
-        Serial.print(", currentGreenSection=");
-        Serial.println(currentGreenSection);
+        Serial.print(", activeSections=0x");
+        Serial.println(phases.activeMask(), HEX);
         
-        // Calculate green light duration using fuzzy logic (always calculate for traffic light control)
-        float duration = defuzzify(vehicleCount, jamSibuk);
+        // Calculate green light duration (always calculate for traffic light control)
+        float duration = greenSecondsFor(vehicleCount, rushWeight);
+        float arriving = expectedArrivals(duration);
+        if (arriving > 0)
+        {
+            // Size the green for the vehicles that will be there by the time it runs
+            duration = greenSecondsFor(vehicleCount + arriving, rushWeight);
+        }
         
         Serial.print("Lane ");
         Serial.print(LANE_ID);
@@ -951,7 +1566,7 @@ void loop()
         
         // Only proceed with traffic light control if we have vehicles, no other section has green light,
         // it's our turn in the sequence, and we haven't already sent a request for this data
-        if (vehicleCount > 0 && currentGreenSection == 0 && ROAD_SECTION_ID == nextExpectedSection && !lastReceivedData.green_request_sent)
+        if (vehicleCount > 0 && phases.mayStart(ROAD_SECTION_ID, nextExpectedSection) && !lastReceivedData.green_request_sent)
             {
                 Serial.print("Lane ");
                 Serial.print(LANE_ID);
@@ -961,17 +1576,21 @@ void loop()
                 Serial.println(ROAD_SECTION_ID);
                 
                 // Immediately claim the green section to prevent race conditions
-                currentGreenSection = ROAD_SECTION_ID;
+                phases.setActive(ROAD_SECTION_ID, true);
                 
-                // Request green light permission
-                request_green_permission();
+                // Request green light permission, unless it was granted while the previous group cleared
+                if (!permissionReservedAhead || waitingForGreenPermission)
+                {
+                    request_green_permission();
+                }
+                permissionReservedAhead = false;
                 lastReceivedData.green_request_sent = true; // Mark that we've sent the request
                 
                 // Wait for permission (timeout after 5 seconds)
                 unsigned long startTime = millis();
                 while (waitingForGreenPermission && (millis() - startTime < 5000))
                 {
-                    mqtt_client.loop();
+                    poll_mqtt();
                     delay(100);
                 }
                 
@@ -982,34 +1601,37 @@ void loop()
                 Serial.println(" - Timeout waiting for permission");
                 waitingForGreenPermission = false;
                 // Release the green section claim on timeout
-                currentGreenSection = 0;
+                phases.setActive(ROAD_SECTION_ID, false);
                 // Don't reset new_data flag on timeout - allow it to try again later
                 return;
             }
             
-            // Double-check that we still hold the green section claim
-            if (currentGreenSection != ROAD_SECTION_ID)
+            // Double-check that no conflicting section went green and our group still has the turn
+            if (phases.conflictsWithActive(ROAD_SECTION_ID) || !phases.sameGroup(ROAD_SECTION_ID, nextExpectedSection))
             {
                 Serial.print("Lane ");
                 Serial.print(LANE_ID);
                 Serial.print(" - Lost green section claim while waiting. Section ");
-                Serial.print(currentGreenSection);
+                Serial.print(phases.firstConflicting(ROAD_SECTION_ID));
                 Serial.println(" is now green.");
+                phases.setActive(ROAD_SECTION_ID, false);
                 // Don't reset new_data flag - allow it to try again when other section finishes
                 return;
             }
 
             // Traffic light sequence
-            // Start with all red (ensure only one green light at a time)
+            cycleTime.enter(cycle_accounting::CLEARANCE, millis());
+            // Start with all red (ensure no conflicting green lights)
             setTrafficLight(true, false, false);
-            delay(1000);
+            sequence_delay(configStore.current().leadRedMs());
             
             // Red to Yellow (prepare for green)
             setTrafficLight(false, true, false);
-            delay(3000); // Yellow preparation phase for 3 seconds
+            sequence_delay(configStore.current().body.preYellowMs); // Yellow preparation phase
 
             // Yellow to Green
             setTrafficLight(false, false, true);
+            cycleTime.enter(vehicleCount > 0 ? cycle_accounting::EFFECTIVE_GREEN : cycle_accounting::IDLE, millis());
             
             // NOW publish green status when light is actually green
             publish_green_status("green");
@@ -1019,11 +1641,12 @@ void loop()
 
             // Green to Yellow (proper transition)
             setTrafficLight(false, true, false);
+            cycleTime.enter(cycle_accounting::CLEARANCE, millis());
             
             // IMPORTANT: When entering yellow state, immediately advance to next lane
             // and notify next lane to publish their duration if they have data waiting
-            int nextLaneInSequence = getNextSection(ROAD_SECTION_ID);
-            nextExpectedSection = nextLaneInSequence;
+            int nextLaneInSequence = lane_policy::nextLane(vehicleCount, jamSibuk, ROAD_SECTION_ID);
+            nextExpectedSection = phases.nextLead(ROAD_SECTION_ID, nextLaneInSequence);
             
             Serial.print("Lane ");
             Serial.print(LANE_ID);
@@ -1038,16 +1661,21 @@ void loop()
             
             String nextLaneMessage;
             serializeJson(nextLaneDoc, nextLaneMessage);
-            mqtt_client.publish("traffic/next_lane_ready", nextLaneMessage.c_str());
+            mqtt_client.publish(mqtt_next_lane_ready_topic, nextLaneMessage.c_str());
             
-            delay(3000); // Yellow phase for 3 seconds
+            sequence_delay(configStore.current().yellowMsFor(ROAD_SECTION_ID, approachSpeedKph)); // Yellow phase
 
             // Yellow to Red
             setTrafficLight(true, false, false);
+            // Hold all red until traffic that entered on yellow has cleared the crossing
+            sequence_delay(configStore.current().allRedMsFor(ROAD_SECTION_ID, approachSpeedKph));
 
             // Publish that green is over and clear current section
             publish_green_status("red");
-            currentGreenSection = 0;
+            phases.setActive(ROAD_SECTION_ID, false);
+            cycleTime.closeCycle(millis());
+            cycleTime.enter(cycle_accounting::IDLE, millis());
+            publish_cycle_stats();
 
             Serial.print("Lane ");
             Serial.print(LANE_ID);
@@ -1058,17 +1686,25 @@ void loop()
             lastReceivedData.duration_published = false;
             lastReceivedData.green_request_sent = false;
         }
-        else if (vehicleCount > 0 && currentGreenSection != 0)
+        else if (vehicleCount > 0 && phases.sameGroup(ROAD_SECTION_ID, nextExpectedSection) && !permissionReservedAhead)
+        {
+            // Our turn, but the previous group is still in yellow or clearance red
+            Serial.print("Lane ");
+            Serial.print(LANE_ID);
+            Serial.println(" - Next in turn, requesting green permission ahead of the red");
+            request_green_permission(true);
+        }
+        else if (vehicleCount > 0 && phases.conflictsWithActive(ROAD_SECTION_ID))
         {
             Serial.print("Lane ");
             Serial.print(LANE_ID);
             Serial.print(" - Waiting... Section ");
-            Serial.print(currentGreenSection);
+            Serial.print(phases.firstConflicting(ROAD_SECTION_ID));
             Serial.println(" currently has green light");
             
             // Don't reset the new_data flag - keep it for when the other section finishes
         }
-        else if (vehicleCount > 0 && ROAD_SECTION_ID != nextExpectedSection)
+        else if (vehicleCount > 0 && !phases.sameGroup(ROAD_SECTION_ID, nextExpectedSection))
         {
             Serial.print("Lane ");
             Serial.print(LANE_ID);
@@ -1079,28 +1715,30 @@ void loop()
             
             // Don't reset the new_data flag - keep it for when it's our turn
         }
-        else if (vehicleCount == 0 && currentGreenSection == 0 && ROAD_SECTION_ID == nextExpectedSection && !lastReceivedData.green_request_sent)
+        else if (vehicleCount == 0 && phases.mayStart(ROAD_SECTION_ID, nextExpectedSection) && !lastReceivedData.green_request_sent)
         {
-            // Process the countdown even when vehicle count is 0, since fuzzy still returns duration
+            // Process the countdown even when vehicle count is 0, since the policy still returns a duration
             Serial.print("Lane ");
             Serial.print(LANE_ID);
             Serial.println(" - No vehicles, but still running traffic light sequence");
             
             // Immediately claim the green section to prevent race conditions
-            currentGreenSection = ROAD_SECTION_ID;
+            phases.setActive(ROAD_SECTION_ID, true);
             lastReceivedData.green_request_sent = true; // Mark that we've processed this data
 
             // Traffic light sequence (same as vehicleCount > 0 case)
-            // Start with all red (ensure only one green light at a time)
+            cycleTime.enter(cycle_accounting::CLEARANCE, millis());
+            // Start with all red (ensure no conflicting green lights)
             setTrafficLight(true, false, false);
-            delay(1000);
+            sequence_delay(configStore.current().leadRedMs());
             
             // Red to Yellow (prepare for green)
             setTrafficLight(false, true, false);
-            delay(3000); // Yellow preparation phase for 3 seconds
+            sequence_delay(configStore.current().body.preYellowMs); // Yellow preparation phase
 
             // Yellow to Green
             setTrafficLight(false, false, true);
+            cycleTime.enter(vehicleCount > 0 ? cycle_accounting::EFFECTIVE_GREEN : cycle_accounting::IDLE, millis());
             
             // NOW publish green status when light is actually green
             publish_green_status("green");
@@ -1110,11 +1748,12 @@ void loop()
 
             // Green to Yellow (proper transition)
             setTrafficLight(false, true, false);
+            cycleTime.enter(cycle_accounting::CLEARANCE, millis());
             
             // IMPORTANT: When entering yellow state, immediately advance to next lane
             // and notify next lane to publish their duration if they have data waiting
-            int nextLaneInSequence = getNextSection(ROAD_SECTION_ID);
-            nextExpectedSection = nextLaneInSequence;
+            int nextLaneInSequence = lane_policy::nextLane(vehicleCount, jamSibuk, ROAD_SECTION_ID);
+            nextExpectedSection = phases.nextLead(ROAD_SECTION_ID, nextLaneInSequence);
             
             Serial.print("Lane ");
             Serial.print(LANE_ID);
@@ -1129,16 +1768,21 @@ void loop()
             
             String nextLaneMessage;
             serializeJson(nextLaneDoc, nextLaneMessage);
-            mqtt_client.publish("traffic/next_lane_ready", nextLaneMessage.c_str());
+            mqtt_client.publish(mqtt_next_lane_ready_topic, nextLaneMessage.c_str());
             
-            delay(3000); // Yellow phase for 3 seconds
+            sequence_delay(configStore.current().yellowMsFor(ROAD_SECTION_ID, approachSpeedKph)); // Yellow phase
 
             // Yellow to Red
             setTrafficLight(true, false, false);
+            // Hold all red until traffic that entered on yellow has cleared the crossing
+            sequence_delay(configStore.current().allRedMsFor(ROAD_SECTION_ID, approachSpeedKph));
 
             // Publish that green is over and clear current section
             publish_green_status("red");
-            currentGreenSection = 0;
+            phases.setActive(ROAD_SECTION_ID, false);
+            cycleTime.closeCycle(millis());
+            cycleTime.enter(cycle_accounting::IDLE, millis());
+            publish_cycle_stats();
 
             Serial.print("Lane ");
             Serial.print(LANE_ID);
@@ -1167,7 +1811,19 @@ void loop()
         allRed();
     }
 
-    delay(1000);
+    // Sleep until the next pass, but wake as soon as our group may start (the previous
+    // group's red arrives) instead of sleeping through the boundary
+    bool couldStart = lastReceivedData.new_data && phases.mayStart(ROAD_SECTION_ID, nextExpectedSection);
+    unsigned long waitStart = millis();
+    while (millis() - waitStart < 1000)
+    {
+        delay(20);
+        poll_mqtt();
+        if (!couldStart && lastReceivedData.new_data && phases.mayStart(ROAD_SECTION_ID, nextExpectedSection))
+        {
+            break;
+        }
+    }
 }
 
 int main()
@@ -0,0 +1,884 @@
+// Firmware updates over MQTT as delta patches against the running image.
+// This file is identical in every sketch folder; change all of them together.
+//
+// The flash has two app slots (ota_0 and ota_1). A patch rebuilds the new image
+// in the slot that is not running, out of four operations:
+//   COPY   n bytes of the running image from an offset (code that stayed, maybe moved)
+//   REUSE  n bytes of the new image from `distance` back, within WINDOW (repeats in new code)
+//   ADD    n literal bytes
+//   FILL   n times one byte (padding)
+// A small change to a ~1 MB image then costs a few KB instead of the whole image.
+// Python/ota_update.py builds patches from the old and the new .bin.
+//
+//   PatchHeader (36 bytes, little endian) | operations
+//   operation: tag = op << 6 | n (n = 1..63), or op << 6 followed by n as LEB128;
+//              COPY adds the zigzag LEB128 offset relative to the end of the last COPY,
+//              REUSE the LEB128 distance, ADD n bytes, FILL one byte
+//
+// The header names the image the patch applies to by its size and CRC-32, so a
+// patch for another build is rejected before anything is written. baseSize 0 is
+// a full image, compressed with REUSE and FILL only.
+//
+// Transfer, on traffic/<intersection>/<lane>/ota (traffic/<intersection>/ota for
+// the single-board controller); every message starts with a type byte:
+//   'B' PatchHeader           start a transfer, replacing an unfinished one
+//   'D' u32 offset | data     operation bytes at that offset, at most MAX_CHUNK
+//   'R'                       switch back to the previous image
+//   'X'                       abort the transfer
+// The callback only queues the chunks; a writer task decodes them into the other
+// slot with esp_ota_write(), one flash sector per step, so the signal task never
+// waits out more than one sector erase and the lights keep running meanwhile. The
+// board reports on ota_status every ACK_BYTES decoded, with the offset the sender
+// may run a window of BUFFER bytes ahead of, and once per gap with the offset to
+// resend from.
+//
+// Once the image is complete and its CRC matches, the sketch calls switchBoot()
+// at a phase boundary and restarts, about a second with its heads dark. The new
+// image boots on trial. It calls confirm() after CONFIRM_MS connected without a
+// loop watchdog stall; a crash or reset before that, or TRIAL_MS without
+// confirming, boots the previous image again (the bootloader's app rollback).
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+
+namespace ota_update
+{
+constexpr uint32_t MAGIC = 0x41544F4Cu; // "LOTA"
+constexpr uint16_t FORMAT = 1;
+constexpr uint32_t WINDOW = 4096;      // How far back REUSE reaches into the new image
+constexpr size_t MAX_CHUNK = 1024;     // Operation bytes per 'D' message
+constexpr size_t BUFFER = 16384;       // Received operation bytes not decoded yet: the sender's window
+constexpr uint32_t ACK_BYTES = 4096;   // Progress report to the sender every this many bytes decoded
+constexpr uint32_t WRITE_STEP = 4096;  // Image bytes per work() call, one flash sector
+constexpr uint32_t CONFIRM_MS = 60000; // A new image is kept after running this long without trouble
+constexpr uint32_t TRIAL_MS = 300000;  // and rolled back if that has not happened after this long
+
+enum Op : uint8_t
+{
+    OP_COPY,
+    OP_REUSE,
+    OP_ADD,
+    OP_FILL
+};
+
+struct PatchHeader
+{
+    uint32_t magic;
+    uint16_t format;
+    uint16_t flags;      // Reserved, 0
+    uint32_t version;    // Firmware build number of the new image
+    uint32_t baseSize;   // Running image the patch applies to, 0 = full image
+    uint32_t baseCrc;
+    uint32_t targetSize; // New image
+    uint32_t targetCrc;
+    uint32_t opsSize;    // Operation bytes after the header
+    uint32_t headerCrc;  // CRC-32 of the fields above
+};
+static_assert(sizeof(PatchHeader) == 36, "PatchHeader layout changed; update Python/ota_update.py");
+
+// zlib's CRC-32, continued over several calls from crc = 0
+inline uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+enum Result : uint8_t
+{
+    OTA_OK,
+    OTA_IGNORED,       // Chunk at another offset than expected (lost, duplicated or resent)
+    OTA_BAD_MESSAGE,
+    OTA_BAD_HEADER,
+    OTA_BASE_MISMATCH, // The patch was built against another image than the running one
+    OTA_TOO_LARGE,
+    OTA_FLASH_ERROR,
+    OTA_BAD_PATCH,
+    OTA_BAD_IMAGE,     // Image complete but its CRC or the bootloader's check failed
+    OTA_NO_PREVIOUS,   // Rollback asked for, but the other slot holds no valid image
+    OTA_NOT_RECEIVING
+};
+
+inline const char *describe(Result result)
+{
+    switch (result)
+    {
+    case OTA_OK:
+        return "ok";
+    case OTA_IGNORED:
+        return "out of order";
+    case OTA_BAD_MESSAGE:
+        return "bad message";
+    case OTA_BAD_HEADER:
+        return "bad patch header";
+    case OTA_BASE_MISMATCH:
+        return "patch is for another image";
+    case OTA_TOO_LARGE:
+        return "image larger than the slot";
+    case OTA_FLASH_ERROR:
+        return "flash error";
+    case OTA_BAD_PATCH:
+        return "malformed patch";
+    case OTA_BAD_IMAGE:
+        return "image check failed";
+    case OTA_NO_PREVIOUS:
+        return "no previous image";
+    case OTA_NOT_RECEIVING:
+        return "no transfer running";
+    }
+    return "unknown";
+}
+
+// Reports on ota_status
+enum Report : uint8_t
+{
+    REPORT_NONE,
+    REPORT_RECEIVING,  // Progress, "next" is the offset expected next
+    REPORT_RESEND,     // Gap: send again from "next"
+    REPORT_READY,      // Image complete, switching at the next phase boundary
+    REPORT_REJECTED,   // Transfer or rollback refused, see "reason"
+    REPORT_ABORTED,
+    REPORT_APPLYING,   // Restarting into the new (or previous) image now
+    REPORT_RUNNING,    // Booted, on trial if the image is new
+    REPORT_CONFIRMED,  // New image kept
+    REPORT_ROLLED_BACK // The new image did not confirm; the previous one runs again
+};
+
+inline const char *reportName(Report report)
+{
+    static const char *const NAMES[] = {"", "receiving", "resend", "ready", "rejected",
+                                        "aborted", "applying", "running", "confirmed", "rolled_back"};
+    return NAMES[report];
+}
+
+// Rebuilds an image from a stream of operations, in whatever pieces they arrive.
+// Io provides bool readBase(uint32_t offset, uint8_t *out, size_t length) and
+// bool write(const uint8_t *data, size_t length).
+class PatchDecoder
+{
+public:
+    void begin(uint32_t baseSize, uint32_t targetSize)
+    {
+        this->baseSize = baseSize;
+        this->targetSize = targetSize;
+        written = 0;
+        copyEnd = 0;
+        stage = TAG;
+    }
+
+    // Decodes operation bytes until they are used up or `budget` more bytes of the image
+    // are written, and returns how many it took. An operation cut off by the budget goes
+    // on at the next call, with or without new bytes. Nothing is written once failed().
+    template <typename Io>
+    size_t feed(const uint8_t *data, size_t length, Io &io, uint32_t budget = 0xFFFFFFFFu)
+    {
+        bool capped = budget < targetSize - written;
+        uint32_t limit = capped ? written + budget : targetSize;
+        size_t i = 0;
+        while (stage != FAILED && !(capped && written >= limit))
+        {
+            if (stage == RUN)
+            {
+                if (!run(io, limit))
+                {
+                    fail();
+                }
+                continue;
+            }
+            if (i == length)
+            {
+                break;
+            }
+            switch (stage)
+            {
+            case TAG:
+                op = data[i] >> 6;
+                count = data[i] & 0x3F;
+                i++;
+                if (count == 0)
+                {
+                    startVarint(LENGTH);
+                }
+                else if (!afterLength())
+                {
+                    fail();
+                }
+                break;
+            case LENGTH:
+                if (!varintByte(data[i++]))
+                {
+                    fail();
+                }
+                else if (varintDone)
+                {
+                    count = varint;
+                    if (!afterLength())
+                    {
+                        fail();
+                    }
+                }
+                break;
+            case ARGUMENT:
+                if (!varintByte(data[i++]) || (varintDone && !startRun()))
+                {
+                    fail();
+                }
+                break;
+            case LITERAL:
+            {
+                size_t n = length - i < count ? length - i : count;
+                n = n < limit - written ? n : limit - written;
+                if (!emit(data + i, n, io))
+                {
+                    fail();
+                    break;
+                }
+                i += n;
+                count -= n;
+                stage = count == 0 ? TAG : LITERAL;
+                break;
+            }
+            case FILL_BYTE:
+                source = data[i++];
+                startRun();
+                break;
+            default:
+                break;
+            }
+        }
+        return i;
+    }
+
+    // The whole image was written and no operation is left half-read
+    bool complete() const
+    {
+        return stage == TAG && written == targetSize;
+    }
+
+    bool failed() const
+    {
+        return stage == FAILED;
+    }
+
+    // An operation is still writing: feed() has more to do even without new bytes
+    bool pending() const
+    {
+        return stage == RUN;
+    }
+
+    uint32_t bytesWritten() const
+    {
+        return written;
+    }
+
+private:
+    enum Stage : uint8_t
+    {
+        TAG,
+        LENGTH,
+        ARGUMENT,
+        LITERAL,
+        FILL_BYTE,
+        RUN, // COPY, REUSE or FILL with count bytes left
+        FAILED
+    };
+
+    void fail()
+    {
+        stage = FAILED;
+    }
+
+    void startVarint(Stage next)
+    {
+        stage = next;
+        varint = 0;
+        shift = 0;
+        varintDone = false;
+    }
+
+    bool varintByte(uint8_t byte)
+    {
+        if (shift > 28)
+        {
+            return false;
+        }
+        varint |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+        varintDone = (byte & 0x80) == 0;
+        return true;
+    }
+
+    // Length known: read the operation's argument next
+    bool afterLength()
+    {
+        if (count == 0 || count > targetSize - written)
+        {
+            return false;
+        }
+        if (op == OP_COPY || op == OP_REUSE)
+        {
+            startVarint(ARGUMENT);
+        }
+        else
+        {
+            stage = op == OP_ADD ? LITERAL : FILL_BYTE;
+        }
+        return true;
+    }
+
+    // Argument known: check it, `source` becomes the base offset, the distance or the fill byte
+    bool startRun()
+    {
+        if (op == OP_COPY)
+        {
+            int32_t delta = (int32_t)(varint >> 1) ^ -(int32_t)(varint & 1);
+            source = copyEnd + (uint32_t)delta;
+            if (source > baseSize || count > baseSize - source)
+            {
+                return false;
+            }
+            copyEnd = source + count;
+        }
+        else if (op == OP_REUSE)
+        {
+            source = varint;
+            if (source == 0 || source > written || source > WINDOW)
+            {
+                return false;
+            }
+        }
+        stage = RUN;
+        return true;
+    }
+
+    // Write the current run up to limit
+    template <typename Io>
+    bool run(Io &io, uint32_t limit)
+    {
+        uint8_t buffer[256];
+        uint32_t todo = count < limit - written ? count : limit - written;
+        while (todo > 0)
+        {
+            size_t n = todo < sizeof(buffer) ? todo : sizeof(buffer);
+            if (op == OP_COPY)
+            {
+                if (!io.readBase(source, buffer, n) || !emit(buffer, n, io))
+                {
+                    return false;
+                }
+                source += n;
+            }
+            else if (op == OP_REUSE)
+            {
+                // Byte by byte, so a short distance repeats a pattern
+                for (size_t k = 0; k < n; k++)
+                {
+                    buffer[k] = window[(written + k - source) % WINDOW];
+                    window[(written + k) % WINDOW] = buffer[k];
+                }
+                if (!io.write(buffer, n))
+                {
+                    return false;
+                }
+                written += n;
+            }
+            else
+            {
+                memset(buffer, (uint8_t)source, n);
+                if (!emit(buffer, n, io))
+                {
+                    return false;
+                }
+            }
+            todo -= n;
+            count -= n;
+        }
+        if (count == 0)
+        {
+            stage = TAG;
+        }
+        return true;
+    }
+
+    template <typename Io>
+    bool emit(const uint8_t *data, size_t length, Io &io)
+    {
+        for (size_t k = 0; k < length; k++)
+        {
+            window[(written + k) % WINDOW] = data[k];
+        }
+        if (!io.write(data, length))
+        {
+            return false;
+        }
+        written += length;
+        return true;
+    }
+
+    uint8_t window[WINDOW];
+    uint32_t baseSize = 0;
+    uint32_t targetSize = 0;
+    uint32_t written = 0;
+    uint32_t copyEnd = 0;
+    Stage stage = TAG;
+    uint8_t op = 0;
+    uint32_t count = 0;
+    uint32_t source = 0;
+    uint32_t varint = 0;
+    int shift = 0;
+    bool varintDone = false;
+};
+
+// One board's side of the transfer, the slot switch and the trial of a new image.
+// work() runs on the writer task; the sketch holds a mutex around it, handle() and
+// takeReport(). Everything else runs on the signal task.
+class OtaUpdater
+{
+public:
+    enum State : uint8_t
+    {
+        IDLE,
+        RECEIVING,
+        READY,    // New image complete, waiting for switchBoot()
+        ROLLBACK  // Previous image requested, waiting for switchBoot()
+    };
+
+    // At boot: note the running slot and whether its image is new and on trial
+    void begin(uint32_t nowMs)
+    {
+        running = esp_ota_get_running_partition();
+        esp_ota_img_states_t imageState;
+        trial = running != nullptr && esp_ota_get_state_partition(running, &imageState) == ESP_OK &&
+                imageState == ESP_OTA_IMG_PENDING_VERIFY;
+        bootMs = nowMs;
+        state = IDLE;
+        report = REPORT_NONE;
+        loadSlots();
+        int slot = slotOf(running);
+        slots.valid |= 1 << slot;
+        // Switched to a new image, but the bootloader went back to the old one
+        rolledBack = slots.expect <= 1 && slot != slots.expect;
+        if (slots.expect <= 1)
+        {
+            slots.expect = NO_SLOT;
+            saveSlots();
+        }
+        bootReport = rolledBack ? REPORT_ROLLED_BACK : REPORT_RUNNING;
+    }
+
+    // One message from the ota topic
+    Result handle(const uint8_t *payload, unsigned int length)
+    {
+        if (length == 0)
+        {
+            return reject(OTA_BAD_MESSAGE);
+        }
+        switch (payload[0])
+        {
+        case 'B':
+            return start(payload + 1, length - 1);
+        case 'D':
+            return chunk(payload + 1, length - 1);
+        case 'R':
+            return requestRollback();
+        case 'X':
+            if (state == RECEIVING)
+            {
+                esp_ota_abort(handleOta);
+            }
+            state = IDLE;
+            report = REPORT_ABORTED;
+            return OTA_OK;
+        }
+        return reject(OTA_BAD_MESSAGE);
+    }
+
+    // Report the sender should get now, REPORT_NONE if none; clears it
+    Report takeReport()
+    {
+        if (report == REPORT_NONE && state == RECEIVING && decodedBytes - acknowledged >= ACK_BYTES)
+        {
+            report = REPORT_RECEIVING;
+        }
+        Report due = report;
+        report = REPORT_NONE;
+        if (due == REPORT_RESEND)
+        {
+            reportNext = receivedBytes;
+        }
+        else if (due != REPORT_NONE)
+        {
+            acknowledged = decodedBytes;
+            reportNext = decodedBytes;
+        }
+        return due;
+    }
+
+    // Writer task: decode queued operation bytes into the new slot, at most WRITE_STEP bytes
+    // of image per call. True while there is more to do.
+    bool work()
+    {
+        if (state != RECEIVING)
+        {
+            return false;
+        }
+        uint32_t budget = WRITE_STEP;
+        while (budget > 0 && (decodedBytes < receivedBytes || decoder.pending()))
+        {
+            size_t at = decodedBytes % BUFFER;
+            size_t length = receivedBytes - decodedBytes;
+            length = length < BUFFER - at ? length : BUFFER - at;
+            uint32_t before = decoder.bytesWritten();
+            size_t used = decoder.feed(pending + at, length, *this, budget);
+            if (decoder.failed())
+            {
+                esp_ota_abort(handleOta);
+                state = IDLE;
+                reject(OTA_BAD_PATCH);
+                return false;
+            }
+            decodedBytes += used;
+            uint32_t wrote = decoder.bytesWritten() - before;
+            budget -= wrote;
+            if (used == 0 && wrote == 0)
+            {
+                break;
+            }
+        }
+        if (decodedBytes == header.opsSize && !decoder.pending())
+        {
+            finish();
+            return false;
+        }
+        return decodedBytes < receivedBytes || decoder.pending();
+    }
+
+    // Boot report, once MQTT is connected
+    Report takeBootReport()
+    {
+        Report due = bootReport;
+        bootReport = REPORT_NONE;
+        return due;
+    }
+
+    bool switchDue() const
+    {
+        return state == READY || state == ROLLBACK;
+    }
+
+    // At a phase boundary: make the new (or previous) image the boot image. The caller
+    // restarts if that worked.
+    Result switchBoot()
+    {
+        bool update = state == READY;
+        const esp_partition_t *next = update ? target : esp_ota_get_next_update_partition(nullptr);
+        state = IDLE;
+        if (next == nullptr || esp_ota_set_boot_partition(next) != ESP_OK)
+        {
+            return reject(update ? OTA_BAD_IMAGE : OTA_NO_PREVIOUS);
+        }
+        int slot = slotOf(next);
+        if (update)
+        {
+            slots.version[slot] = header.version;
+            slots.valid |= 1 << slot;
+        }
+        slots.expect = slot;
+        saveSlots();
+        return OTA_OK;
+    }
+
+    bool onTrial() const
+    {
+        return trial;
+    }
+
+    // The new image has run long enough; the caller checks that it was healthy meanwhile
+    bool trialPassed(uint32_t nowMs) const
+    {
+        return trial && nowMs - bootMs >= CONFIRM_MS;
+    }
+
+    bool trialExpired(uint32_t nowMs) const
+    {
+        return trial && nowMs - bootMs >= TRIAL_MS;
+    }
+
+    void confirm()
+    {
+        esp_ota_mark_app_valid_cancel_rollback();
+        trial = false;
+    }
+
+    // Trial failed: back to the previous image (restarts)
+    void rollBackNow()
+    {
+        slots.expect = slotOf(running); // The next boot runs the other slot: reported as rolled back
+        saveSlots();
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+
+    State currentState() const
+    {
+        return state;
+    }
+
+    Result lastResult() const
+    {
+        return result;
+    }
+
+    uint32_t runningVersion() const
+    {
+        return slots.version[slotOf(running)];
+    }
+
+    // Version of the transfer, or of the image a switch goes to
+    uint32_t incomingVersion() const
+    {
+        return state == ROLLBACK ? slots.version[1 - slotOf(running)] : header.version;
+    }
+
+    // Offset in the last report: where to resend from after a gap, else how far it was decoded
+    uint32_t nextOffset() const
+    {
+        return reportNext;
+    }
+
+    uint32_t patchSize() const
+    {
+        return header.opsSize;
+    }
+
+    // Io for the decoder: the running slot is the base, writes go to the other slot
+    bool readBase(uint32_t offset, uint8_t *out, size_t length)
+    {
+        return esp_partition_read(running, offset, out, length) == ESP_OK;
+    }
+
+    bool write(const uint8_t *data, size_t length)
+    {
+        targetCrc = crc32Update(targetCrc, data, length);
+        return esp_ota_write(handleOta, data, length) == ESP_OK;
+    }
+
+private:
+    static constexpr uint8_t NO_SLOT = 0xFF;
+
+    // Images in ota_0 and ota_1, kept in NVS
+    struct Slots
+    {
+        uint32_t version[2]; // 0 = unknown, e.g. flashed over USB
+        uint8_t valid;       // Bit per slot holding a complete image
+        uint8_t expect;      // Slot switched to by the last switchBoot(), NO_SLOT once booted
+    };
+
+    static int slotOf(const esp_partition_t *partition)
+    {
+        return partition != nullptr && partition->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_1 ? 1 : 0;
+    }
+
+    void loadSlots()
+    {
+        Preferences prefs;
+        prefs.begin("ota", true);
+        if (prefs.getBytes("slots", &slots, sizeof(slots)) != sizeof(slots))
+        {
+            slots = Slots{{0, 0}, 0, NO_SLOT};
+        }
+        prefs.end();
+    }
+
+    void saveSlots()
+    {
+        Preferences prefs;
+        prefs.begin("ota", false);
+        prefs.putBytes("slots", &slots, sizeof(slots));
+        prefs.end();
+    }
+
+    Result reject(Result why)
+    {
+        result = why;
+        report = REPORT_REJECTED;
+        return why;
+    }
+
+    Result start(const uint8_t *data, size_t length)
+    {
+        if (state == RECEIVING)
+        {
+            esp_ota_abort(handleOta);
+        }
+        state = IDLE;
+        if (length != sizeof(PatchHeader))
+        {
+            return reject(OTA_BAD_MESSAGE);
+        }
+        memcpy(&header, data, sizeof(header));
+        if (header.magic != MAGIC || header.format != FORMAT ||
+            crc32Update(0, data, offsetof(PatchHeader, headerCrc)) != header.headerCrc)
+        {
+            return reject(OTA_BAD_HEADER);
+        }
+
+        target = esp_ota_get_next_update_partition(nullptr);
+        if (target == nullptr || header.targetSize > target->size || header.baseSize > running->size)
+        {
+            return reject(OTA_TOO_LARGE);
+        }
+        if (!baseMatches())
+        {
+            return reject(OTA_BASE_MISMATCH);
+        }
+        // Sequential writes erase sector by sector instead of the whole slot up front
+        if (esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &handleOta) != ESP_OK)
+        {
+            return reject(OTA_FLASH_ERROR);
+        }
+        // The image there is gone: no rollback to it any more
+        slots.version[slotOf(target)] = 0;
+        slots.valid &= ~(1 << slotOf(target));
+        saveSlots();
+        decoder.begin(header.baseSize, header.targetSize);
+        receivedBytes = 0;
+        decodedBytes = 0;
+        acknowledged = 0;
+        resendAsked = false;
+        targetCrc = 0;
+        state = RECEIVING;
+        result = OTA_OK;
+        report = REPORT_RECEIVING;
+        return OTA_OK;
+    }
+
+    bool baseMatches()
+    {
+        uint8_t buffer[512];
+        uint32_t crc = 0;
+        for (uint32_t offset = 0; offset < header.baseSize; offset += sizeof(buffer))
+        {
+            size_t n = header.baseSize - offset < sizeof(buffer) ? header.baseSize - offset : sizeof(buffer);
+            if (esp_partition_read(running, offset, buffer, n) != ESP_OK)
+            {
+                return false;
+            }
+            crc = crc32Update(crc, buffer, n);
+        }
+        return crc == header.baseCrc;
+    }
+
+    Result chunk(const uint8_t *data, size_t length)
+    {
+        if (state != RECEIVING)
+        {
+            // Chunks still in flight after the last one are harmless
+            return state == READY ? OTA_IGNORED : reject(OTA_NOT_RECEIVING);
+        }
+        uint32_t offset;
+        if (length < sizeof(offset) + 1 || length - sizeof(offset) > MAX_CHUNK)
+        {
+            return reject(OTA_BAD_MESSAGE);
+        }
+        memcpy(&offset, data, sizeof(offset));
+        data += sizeof(offset);
+        length -= sizeof(offset);
+        if (offset != receivedBytes || length > header.opsSize - receivedBytes)
+        {
+            // Ask once per gap; older chunks are duplicates or a resend that is already under way
+            if (offset > receivedBytes && !resendAsked)
+            {
+                resendAsked = true;
+                report = REPORT_RESEND;
+            }
+            return OTA_IGNORED;
+        }
+        resendAsked = false;
+
+        // The sender stays within BUFFER of the last acknowledged offset, so this fits
+        if (length > BUFFER - (receivedBytes - decodedBytes))
+        {
+            return OTA_IGNORED;
+        }
+        for (size_t i = 0; i < length; i++)
+        {
+            pending[(receivedBytes + i) % BUFFER] = data[i];
+        }
+        receivedBytes += length;
+        return OTA_OK;
+    }
+
+    // All operations decoded: the image must be complete, match its CRC and pass the
+    // bootloader's check
+    void finish()
+    {
+        bool good = decoder.complete() && targetCrc == header.targetCrc;
+        if (!good)
+        {
+            esp_ota_abort(handleOta);
+        }
+        if (!good || esp_ota_end(handleOta) != ESP_OK)
+        {
+            state = IDLE;
+            reject(OTA_BAD_IMAGE);
+            return;
+        }
+        state = READY;
+        report = REPORT_READY;
+    }
+
+    Result requestRollback()
+    {
+        if (state == RECEIVING)
+        {
+            return reject(OTA_NO_PREVIOUS); // The other slot is half written
+        }
+        const esp_partition_t *previous = esp_ota_get_next_update_partition(nullptr);
+        esp_ota_img_states_t imageState;
+        if (previous == nullptr || !(slots.valid & (1 << slotOf(previous))) ||
+            (esp_ota_get_state_partition(previous, &imageState) == ESP_OK &&
+             (imageState == ESP_OTA_IMG_INVALID || imageState == ESP_OTA_IMG_ABORTED)))
+        {
+            return reject(OTA_NO_PREVIOUS);
+        }
+        state = ROLLBACK;
+        report = REPORT_READY;
+        return OTA_OK;
+    }
+
+    PatchDecoder decoder;
+    uint8_t pending[BUFFER];
+    PatchHeader header = {};
+    Slots slots = {{0, 0}, 0, NO_SLOT};
+    const esp_partition_t *running = nullptr;
+    const esp_partition_t *target = nullptr;
+    esp_ota_handle_t handleOta = 0;
+    State state = IDLE;
+    Result result = OTA_OK;
+    Report report = REPORT_NONE;
+    Report bootReport = REPORT_NONE;
+    uint32_t receivedBytes = 0; // Queued in pending
+    uint32_t decodedBytes = 0;
+    uint32_t acknowledged = 0;  // decodedBytes at the last report
+    uint32_t reportNext = 0;
+    uint32_t targetCrc = 0;
+    bool resendAsked = false;
+    bool trial = false;
+    bool rolledBack = false;
+    uint32_t bootMs = 0;
+};
+} // namespace ota_update
+
+#endif // OTA_UPDATE_H
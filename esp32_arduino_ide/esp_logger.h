@@ -4,13 +4,29 @@
 #include <WiFi.h>
 #include <FS.h>
 #include <SPIFFS.h>
+#include <PubSubClient.h>
 #include <ArduinoJson.h>
 #include <time.h>
 
-// Log file settings
-const char* LOG_FILE = "/log.txt";
-const int MAX_LOG_SIZE = 1024 * 1024; // 1MB max log size
-const int MAX_LOG_LINES = 1000; // Maximum lines to keep
+// Segmented log store.
+// Lines go into a ring of LOG_SEGMENTS fixed-size segment files. A small index
+// (sequence, line and byte counts, first and last timestamp per segment) is kept
+// in RAM as lines are written and saved to flash every LOG_INDEX_SAVE_EVERY lines
+// and at every segment change, so statistics never read the log and a time range
+// only opens the segments that overlap it. When the ring is full the oldest
+// segment is dropped and reused. Ranges are streamed in LOG_CHUNK_SIZE chunks,
+// to Serial or as MQTT messages (handleLogCommand).
+
+// Log store settings
+const char* LOG_DIR = "/log";
+const char* LOG_INDEX_FILE = "/log/index.bin";
+const int LOG_SEGMENTS = 16;
+const size_t LOG_SEGMENT_SIZE = 64 * 1024; // 16 x 64 KB, the 1 MB the single log file had
+const int LOG_INDEX_SAVE_EVERY = 32;       // Lines; at most this many are recounted after a reset
+const size_t LOG_CHUNK_SIZE = 2048;        // Bytes per Serial write or MQTT message when streaming
+const size_t LOG_MAX_LINE = 512;           // Longer lines are cut when a range is filtered
+const uint32_t LOG_INDEX_MAGIC = 0x4C4F4753; // "LOGS"
+const size_t LOG_STAMP_SIZE = 20;          // "YYYY-mm-dd HH:MM:SS" and its terminator
 
 // Log levels
 enum LogLevel {
@@ -22,25 +38,128 @@ enum LogLevel {
     LOG_SYSTEM = 5
 };
 
+// Index entry of one segment file
+struct LogSegmentHeader {
+    uint32_t sequence;          // 0 for an unused slot; one higher for every segment opened
+    uint32_t lines;
+    uint32_t bytes;
+    char first[LOG_STAMP_SIZE]; // Timestamp of the first dated line, "" if none yet
+    char last[LOG_STAMP_SIZE];  // Timestamp of the last dated line
+};
+
+struct LogIndex {
+    uint32_t magic;
+    uint16_t segmentSize;       // In KB, so a changed layout is not mistaken for this one
+    uint16_t current;           // Slot being written
+    LogSegmentHeader segments[LOG_SEGMENTS];
+};
+
+LogIndex logIndex;
+int linesSinceIndexSave = 0;
+
+// Segment file of a slot, e.g. /log/seg07.txt
+String logSegmentPath(int slot) {
+    char path[24];
+    snprintf(path, sizeof(path), "%s/seg%02d.txt", LOG_DIR, slot);
+    return String(path);
+}
+
+void saveLogIndex() {
+    File file = SPIFFS.open(LOG_INDEX_FILE, FILE_WRITE);
+    if (file) {
+        file.write((const uint8_t*)&logIndex, sizeof(logIndex));
+        file.close();
+    }
+    linesSinceIndexSave = 0;
+}
+
+// Whether a line's timestamp is a date (NTP time), not the millis() fallback
+bool isDatedStamp(const char* stamp) {
+    return strlen(stamp) >= LOG_STAMP_SIZE - 1 && stamp[4] == '-' && stamp[13] == ':';
+}
+
+// Count a line written to the current segment in its index entry
+void indexLogLine(const char* stamp, size_t bytes) {
+    LogSegmentHeader &segment = logIndex.segments[logIndex.current];
+    segment.lines++;
+    segment.bytes += bytes;
+    if (isDatedStamp(stamp)) {
+        if (segment.first[0] == '\0') {
+            strncpy(segment.first, stamp, LOG_STAMP_SIZE - 1);
+        }
+        strncpy(segment.last, stamp, LOG_STAMP_SIZE - 1);
+    }
+}
+
+// Start a fresh index with slot 0 as the first segment
+void resetLogIndex() {
+    memset(&logIndex, 0, sizeof(logIndex));
+    logIndex.magic = LOG_INDEX_MAGIC;
+    logIndex.segmentSize = LOG_SEGMENT_SIZE / 1024;
+    logIndex.current = 0;
+    logIndex.segments[0].sequence = 1;
+    SPIFFS.remove(logSegmentPath(0));
+}
+
+// Lines written after the index was last saved are counted again from the end of the segment
+void recoverCurrentSegment() {
+    LogSegmentHeader &segment = logIndex.segments[logIndex.current];
+    File file = SPIFFS.open(logSegmentPath(logIndex.current), FILE_READ);
+    if (!file) {
+        segment.lines = 0;
+        segment.bytes = 0;
+        return;
+    }
+    size_t size = file.size();
+    if (size <= segment.bytes) {
+        segment.bytes = size; // The last index save was after the last line
+        file.close();
+        return;
+    }
+
+    file.seek(segment.bytes);
+    char line[LOG_MAX_LINE];
+    size_t length = 0;
+    while (file.available()) {
+        char c = file.read(); // At most LOG_INDEX_SAVE_EVERY lines
+        if (c == '\n') {
+            line[length] = '\0';
+            char stamp[LOG_STAMP_SIZE] = "";
+            if (length > LOG_STAMP_SIZE && line[0] == '[') {
+                memcpy(stamp, line + 1, LOG_STAMP_SIZE - 1);
+            }
+            indexLogLine(stamp, length + 1);
+            length = 0;
+        } else if (length < LOG_MAX_LINE - 1) {
+            line[length++] = c;
+        }
+    }
+    segment.bytes = size;
+    file.close();
+    saveLogIndex();
+}
+
 // Initialize logging system
 bool initLogger() {
     if (!SPIFFS.begin(true)) {
         Serial.println("Failed to mount SPIFFS");
         return false;
     }
-    
-    // Check if log file exists, create if not
-    if (!SPIFFS.exists(LOG_FILE)) {
-        File file = SPIFFS.open(LOG_FILE, FILE_WRITE);
-        if (file) {
-            file.println("=== ESP Traffic Light System Log Started ===");
-            file.close();
-        } else {
-            Serial.println("Failed to create log file");
-            return false;
-        }
+
+    File file = SPIFFS.open(LOG_INDEX_FILE, FILE_READ);
+    bool loaded = file && file.read((uint8_t*)&logIndex, sizeof(logIndex)) == sizeof(logIndex) &&
+                  logIndex.magic == LOG_INDEX_MAGIC && logIndex.segmentSize == LOG_SEGMENT_SIZE / 1024 &&
+                  logIndex.current < LOG_SEGMENTS;
+    if (file) {
+        file.close();
+    }
+
+    if (loaded) {
+        recoverCurrentSegment();
+    } else {
+        resetLogIndex();
+        saveLogIndex();
     }
-    
     return true;
 }
 
@@ -50,7 +169,7 @@ String getLogTimestamp() {
     if (!getLocalTime(&timeinfo)) {
         return String(millis()) + "ms"; // Fallback to millis if NTP not available
     }
-    
+
     char buffer[64];
     strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
     return String(buffer);
@@ -69,46 +188,46 @@ String getLogLevelString(LogLevel level) {
     }
 }
 
-// Check and rotate log if it's too large
-void rotateLogIfNeeded() {
-    File file = SPIFFS.open(LOG_FILE, FILE_READ);
-    if (!file) return;
-    
-    size_t fileSize = file.size();
-    file.close();
-    
-    if (fileSize > MAX_LOG_SIZE) {
-        // Create backup and truncate
-        SPIFFS.remove("/log_old.txt");
-        SPIFFS.rename(LOG_FILE, "/log_old.txt");
-        
-        File newFile = SPIFFS.open(LOG_FILE, FILE_WRITE);
-        if (newFile) {
-            newFile.println("=== Log rotated - Previous log saved as log_old.txt ===");
-            newFile.println("=== ESP Traffic Light System Log Continued ===");
-            newFile.close();
-        }
+// Move to the next slot when a line of `bytes` would overflow the current segment,
+// dropping the oldest segment once the ring is full
+void rotateLogIfNeeded(size_t bytes) {
+    if (logIndex.segments[logIndex.current].bytes + bytes <= LOG_SEGMENT_SIZE) {
+        return;
     }
+
+    uint32_t sequence = logIndex.segments[logIndex.current].sequence + 1;
+    logIndex.current = (logIndex.current + 1) % LOG_SEGMENTS;
+    SPIFFS.remove(logSegmentPath(logIndex.current));
+    LogSegmentHeader &segment = logIndex.segments[logIndex.current];
+    memset(&segment, 0, sizeof(segment));
+    segment.sequence = sequence;
+    saveLogIndex();
 }
 
 // Core logging function
 void writeToLog(LogLevel level, int laneId, String message) {
-    rotateLogIfNeeded();
-    
-    File file = SPIFFS.open(LOG_FILE, FILE_APPEND);
+    String timestamp = getLogTimestamp();
+    String logLevel = getLogLevelString(level);
+    String logEntry = "[" + timestamp + "] [LANE" + String(laneId) + "] [" + logLevel + "] " + message;
+    size_t bytes = logEntry.length() + 1;
+
+    rotateLogIfNeeded(bytes);
+    File file = SPIFFS.open(logSegmentPath(logIndex.current), FILE_APPEND);
     if (!file) {
         Serial.println("Failed to open log file for writing");
         return;
     }
-    
-    String timestamp = getLogTimestamp();
-    String logLevel = getLogLevelString(level);
-    String logEntry = "[" + timestamp + "] [LANE" + String(laneId) + "] [" + logLevel + "] " + message;
-    
-    // Write to file
-    file.println(logEntry);
+
+    // Write to file, newline only so the index byte counts match the file
+    file.print(logEntry);
+    file.print('\n');
     file.close();
-    
+
+    indexLogLine(timestamp.c_str(), bytes);
+    if (++linesSinceIndexSave >= LOG_INDEX_SAVE_EVERY) {
+        saveLogIndex();
+    }
+
     // Also print to serial for immediate debugging
     Serial.println(logEntry);
 }
@@ -181,8 +300,8 @@ void logMqttStatus(int laneId, String status, String details = "") {
 
 // Log fuzzy logic calculations
 void logFuzzyCalculation(int laneId, float vehicleCount, bool jamSibuk, float duration) {
-    String message = "Fuzzy Logic - Vehicles: " + String(vehicleCount) + 
-                    " | Rush Hour: " + (jamSibuk ? "Yes" : "No") + 
+    String message = "Fuzzy Logic - Vehicles: " + String(vehicleCount) +
+                    " | Rush Hour: " + (jamSibuk ? "Yes" : "No") +
                     " | Calculated Duration: " + String(duration) + "s";
     writeToLog(LOG_DEBUG, laneId, message);
 }
@@ -196,53 +315,266 @@ void logGreenLightRequest(int laneId, String action, String details = "") {
     writeToLog(LOG_INFO, laneId, message);
 }
 
-// Read and display log file content (for debugging)
-void printLogFile() {
-    File file = SPIFFS.open(LOG_FILE, FILE_READ);
-    if (!file) {
-        Serial.println("Failed to open log file for reading");
-        return;
+// Receives the streamed log in chunks of at most LOG_CHUNK_SIZE bytes
+typedef void (*LogChunkSink)(const uint8_t* data, size_t length, void* context);
+
+// Collects output into LOG_CHUNK_SIZE chunks before handing them to the sink
+struct LogChunkWriter {
+    LogChunkSink sink;
+    void* context;
+    uint8_t buffer[LOG_CHUNK_SIZE];
+    size_t length;
+    size_t total;
+
+    void write(const uint8_t* data, size_t size) {
+        while (size > 0) {
+            size_t take = size < LOG_CHUNK_SIZE - length ? size : LOG_CHUNK_SIZE - length;
+            memcpy(buffer + length, data, take);
+            length += take;
+            data += take;
+            size -= take;
+            if (length == LOG_CHUNK_SIZE) {
+                flush();
+            }
+        }
     }
-    
-    Serial.println("=== LOG FILE CONTENT ===");
-    while (file.available()) {
-        Serial.write(file.read());
+
+    void flush() {
+        if (length > 0) {
+            sink(buffer, length, context);
+            total += length;
+            length = 0;
+        }
     }
+};
+
+// Stream the lines logged between two timestamps ("YYYY-mm-dd HH:MM:SS", "" for no bound),
+// oldest first. Segments entirely inside the range are copied in whole chunks; only the
+// segments at its ends are read line by line. Lines without a date (logged before NTP time)
+// go with the dated line before them. Returns the number of bytes streamed.
+size_t streamLogRange(const char* from, const char* to, LogChunkSink sink, void* context) {
+    LogChunkWriter* writer = new LogChunkWriter(); // Too large for the loop task's stack
+    writer->sink = sink;
+    writer->context = context;
+    bool hasFrom = from && from[0] != '\0';
+    bool hasTo = to && to[0] != '\0';
+
+    // Oldest slot first: the ring continues after the one being written
+    for (int i = 1; i <= LOG_SEGMENTS; i++) {
+        int slot = (logIndex.current + i) % LOG_SEGMENTS;
+        const LogSegmentHeader &segment = logIndex.segments[slot];
+        if (segment.sequence == 0 || segment.lines == 0) {
+            continue;
+        }
+        bool dated = segment.first[0] != '\0';
+        if (dated && ((hasFrom && strcmp(segment.last, from) < 0) || (hasTo && strcmp(segment.first, to) > 0))) {
+            continue; // Entirely outside the range
+        }
+        if (!dated && (hasFrom || hasTo)) {
+            continue; // Only lines from before NTP time, which no range can select
+        }
+
+        File file = SPIFFS.open(logSegmentPath(slot), FILE_READ);
+        if (!file) {
+            continue;
+        }
+        bool whole = (!hasFrom || strcmp(segment.first, from) >= 0) && (!hasTo || strcmp(segment.last, to) <= 0);
+        uint8_t chunk[256];
+        if (whole) {
+            size_t read;
+            while ((read = file.read(chunk, sizeof(chunk))) > 0) {
+                writer->write(chunk, read);
+            }
+        } else {
+            char line[LOG_MAX_LINE];
+            size_t length = 0;
+            bool keep = false;
+            size_t read;
+            while ((read = file.read(chunk, sizeof(chunk))) > 0) {
+                for (size_t k = 0; k < read; k++) {
+                    if (chunk[k] != '\n') {
+                        if (length < LOG_MAX_LINE - 1) {
+                            line[length++] = chunk[k];
+                        }
+                        continue;
+                    }
+                    line[length] = '\0';
+                    char stamp[LOG_STAMP_SIZE] = "";
+                    if (length > LOG_STAMP_SIZE && line[0] == '[') {
+                        memcpy(stamp, line + 1, LOG_STAMP_SIZE - 1);
+                    }
+                    if (isDatedStamp(stamp)) {
+                        keep = (!hasFrom || strcmp(stamp, from) >= 0) && (!hasTo || strcmp(stamp, to) <= 0);
+                    }
+                    if (keep) {
+                        line[length] = '\n';
+                        writer->write((const uint8_t*)line, length + 1);
+                    }
+                    length = 0;
+                }
+            }
+        }
+        file.close();
+    }
+
+    writer->flush();
+    size_t total = writer->total;
+    delete writer;
+    return total;
+}
+
+void serialLogSink(const uint8_t* data, size_t length, void*) {
+    Serial.write(data, length);
+}
+
+// Print a time range of the log over Serial in chunks
+void printLogRange(const char* from, const char* to) {
+    Serial.println("=== LOG FILE CONTENT ===");
+    streamLogRange(from, to, serialLogSink, nullptr);
     Serial.println("=== END OF LOG FILE ===");
-    file.close();
+}
+
+// Read and display log file content (for debugging)
+void printLogFile() {
+    printLogRange("", "");
+}
+
+struct MqttLogSink {
+    PubSubClient* client;
+    const char* topic;
+    int chunks;
+};
+
+void mqttLogSink(const uint8_t* data, size_t length, void* context) {
+    MqttLogSink* target = (MqttLogSink*)context;
+    // Streamed, so chunks do not have to fit the client's buffer
+    target->client->beginPublish(target->topic, length, false);
+    target->client->write(data, length);
+    target->client->endPublish();
+    target->chunks++;
+}
+
+// Publish a time range of the log on `topic` as raw text chunks, followed by
+// {"end":true,"bytes":...,"chunks":...}
+void publishLogRange(PubSubClient &client, const char* topic, const char* from, const char* to) {
+    MqttLogSink target = {&client, topic, 0};
+    size_t bytes = streamLogRange(from, to, mqttLogSink, &target);
+
+    char end[96];
+    snprintf(end, sizeof(end), "{\"end\":true,\"bytes\":%u,\"chunks\":%d}", (unsigned)bytes, target.chunks);
+    client.publish(topic, end);
 }
 
 // Clear log file
 void clearLog(int laneId) {
-    SPIFFS.remove(LOG_FILE);
-    File file = SPIFFS.open(LOG_FILE, FILE_WRITE);
-    if (file) {
-        file.println("=== ESP Traffic Light System Log Cleared ===");
-        file.close();
-        logSystem(laneId, "Log file cleared by user request");
+    for (int slot = 0; slot < LOG_SEGMENTS; slot++) {
+        SPIFFS.remove(logSegmentPath(slot));
     }
+    // Files of the single-file logger this store replaced
+    SPIFFS.remove("/log.txt");
+    SPIFFS.remove("/log_old.txt");
+    resetLogIndex();
+    saveLogIndex();
+    logSystem(laneId, "Log file cleared by user request");
+}
+
+// Totals over every segment, from the index alone
+struct LogStats {
+    int segments;
+    uint32_t lines;
+    uint32_t bytes;
+    const char* oldest; // First dated line still stored, "" if none
+    const char* newest;
+};
+
+LogStats getLogStats() {
+    LogStats stats = {0, 0, 0, "", ""};
+    for (int i = 1; i <= LOG_SEGMENTS; i++) {
+        const LogSegmentHeader &segment = logIndex.segments[(logIndex.current + i) % LOG_SEGMENTS];
+        if (segment.sequence == 0) {
+            continue;
+        }
+        stats.segments++;
+        stats.lines += segment.lines;
+        stats.bytes += segment.bytes;
+        if (segment.first[0] != '\0') {
+            if (stats.oldest[0] == '\0') {
+                stats.oldest = segment.first;
+            }
+            stats.newest = segment.last;
+        }
+    }
+    return stats;
 }
 
 // Get log file statistics
 void logFileStats(int laneId) {
-    File file = SPIFFS.open(LOG_FILE, FILE_READ);
-    if (!file) {
-        logError(laneId, "Cannot access log file for statistics");
+    LogStats stats = getLogStats();
+    String message = "Log Statistics - Size: " + String(stats.bytes) + " bytes | Lines: " + String(stats.lines) +
+                     " | Segments: " + String(stats.segments) + "/" + String(LOG_SEGMENTS) +
+                     " | From: " + String(stats.oldest) + " | To: " + String(stats.newest);
+    logSystem(laneId, message);
+}
+
+// Log request received over MQTT, answered on replyTopic:
+//   {"cmd":"stats"}
+//   {"cmd":"range","from":"2025-04-22 08:00:00","to":"2025-04-22 09:00:00"}  (either bound optional)
+//   {"cmd":"clear"}
+void handleLogCommand(PubSubClient &client, const char* replyTopic, int laneId, const uint8_t* payload,
+                      unsigned int length) {
+    DynamicJsonDocument doc(256);
+    if (deserializeJson(doc, payload, length)) {
+        client.publish(replyTopic, "{\"error\":\"invalid json\"}");
         return;
     }
-    
-    size_t fileSize = file.size();
-    int lineCount = 0;
-    
-    while (file.available()) {
-        if (file.read() == '\n') {
-            lineCount++;
-        }
+
+    String command = doc.containsKey("cmd") ? doc["cmd"].as<String>() : "";
+    if (command == "range") {
+        String from = doc.containsKey("from") ? doc["from"].as<String>() : "";
+        String to = doc.containsKey("to") ? doc["to"].as<String>() : "";
+        publishLogRange(client, replyTopic, from.c_str(), to.c_str());
+    } else if (command == "stats") {
+        LogStats stats = getLogStats();
+        DynamicJsonDocument reply(256);
+        reply["segments"] = stats.segments;
+        reply["lines"] = stats.lines;
+        reply["bytes"] = stats.bytes;
+        reply["oldest"] = stats.oldest;
+        reply["newest"] = stats.newest;
+        String message;
+        serializeJson(reply, message);
+        client.publish(replyTopic, message.c_str());
+    } else if (command == "clear") {
+        clearLog(laneId);
+        client.publish(replyTopic, "{\"cleared\":true}");
+    } else {
+        client.publish(replyTopic, "{\"error\":\"unknown cmd\"}");
+    }
+}
+
+// The same commands typed on Serial: "log stats", "log clear",
+// "log range 2025-04-22T08:00:00 2025-04-22T09:00:00" (bounds optional, 'T' or '_' for the space)
+void handleSerialLogCommand(int laneId, String line) {
+    line.trim();
+    if (line == "log stats") {
+        LogStats stats = getLogStats();
+        Serial.println(String(stats.segments) + " segments, " + String(stats.lines) + " lines, " + String(stats.bytes) +
+                       " bytes, " + String(stats.oldest) + " .. " + String(stats.newest));
+    } else if (line == "log clear") {
+        clearLog(laneId);
+    } else if (line.startsWith("log range")) {
+        String args = line.substring(9);
+        args.trim();
+        int space = args.indexOf(' ');
+        String from = space < 0 ? args : args.substring(0, space);
+        String to = space < 0 ? "" : args.substring(space + 1);
+        to.trim();
+        from.replace('T', ' ');
+        from.replace('_', ' ');
+        to.replace('T', ' ');
+        to.replace('_', ' ');
+        printLogRange(from.c_str(), to.c_str());
     }
-    file.close();
-    
-    String stats = "Log Statistics - Size: " + String(fileSize) + " bytes | Lines: " + String(lineCount);
-    logSystem(laneId, stats);
 }
 
-#endif // ESP_LOGGER_H 
\ No newline at end of file
+#endif // ESP_LOGGER_H
@@ -8,6 +8,9 @@
 #include <PubSubClient.h>
 #include <ArduinoJson.h> // Add JSON library for parsing
 #include <time.h>        // Include time library for NTP
+#include "esp32_arduino_ide/esp32_lane4/lane_policy.h" // Green time policy table (generated by Python/compile_policy.py)
+#include "esp32_arduino_ide/esp32_lane4/mqtt_topics.h" // traffic/<intersection>/... topic names
+#include "esp32_arduino_ide/esp32_lane4/plan_schedule.h" // Time-of-day plans replacing the fixed jam sibuk hours
 
 using namespace std;
 
@@ -18,11 +21,12 @@ const char *password = "S3rpong!"; // Replace with your WiFi password
 // MQTT settings
 const char *mqtt_broker = "broker.emqx.io";
 const int mqtt_port = 1883;
-const char *mqtt_topic = "traffic/vehicle_count";
-const char *mqtt_duration_topic = "traffic/duration";           // New topic for publishing duration
+const char *mqtt_topic = MQTT_LANE_TOPIC(4, "vehicle_count"); // Only this lane's counts reach the board
+const char *mqtt_duration_topic = MQTT_LANE_TOPIC(4, "duration");           // New topic for publishing duration
 const char *mqtt_client_id = "esp32_traffic_controller_lane4";  // Unique client ID for Lane 4
-const char *mqtt_green_status_topic = "traffic/green_status";   // New topic for tracking green status
-const char *mqtt_green_request_topic = "traffic/green_request"; // New topic for requesting green light
+const char *mqtt_green_status_topic = MQTT_SITE_TOPIC("green_status");   // New topic for tracking green status
+const char *mqtt_green_request_topic = MQTT_SITE_TOPIC("green_request"); // New topic for requesting green light
+const char *mqtt_green_permission_topic = MQTT_SITE_TOPIC("green_permission");
 
 // NTP Server Settings
 const char *ntpServer = "pool.ntp.org";
@@ -70,38 +74,6 @@ struct TrafficLight
 
 TrafficLight light;
 
-// Membership Functions for Vehicle Count
-float sedikit(float x)
-{
-    if (x <= 3)
-        return 1.0;
-    else if (x > 3 && x < 5)
-        return (5 - x) / 2.0;
-    else
-        return 0.0;
-}
-
-float sedang(float x)
-{
-    if (x <= 3 || x >= 10)
-        return 0.0;
-    else if (x > 3 && x <= 5)
-        return (x - 3) / 2.0;
-    else if (x > 5 && x < 10)
-        return (10 - x) / 5.0;
-    return 0.0;
-}
-
-float padat(float x)
-{
-    if (x <= 5)
-        return 0.0;
-    else if (x > 5 && x < 10)
-        return (x - 5) / 5.0;
-    else
-        return 1.0;
-}
-
 // MQTT message callback
 void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
 {
@@ -227,11 +199,11 @@ void mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
                 
                 String response;
                 serializeJson(responseDoc, response);
-                mqtt_client.publish("traffic/green_permission", response.c_str());
+                mqtt_client.publish(mqtt_green_permission_topic, response.c_str());
             }
         }
     }
-    else if (strcmp(topic, "traffic/green_permission") == 0)
+    else if (strcmp(topic, mqtt_green_permission_topic) == 0)
     {
         // Handle green light permission responses
         DynamicJsonDocument doc(256);
@@ -316,10 +288,10 @@ void connect_mqtt()
                 Serial.println("  ✗ Failed: " + String(mqtt_green_request_topic));
             }
             
-            if (mqtt_client.subscribe("traffic/green_permission")) {
-                Serial.println("  ✓ traffic/green_permission");
+            if (mqtt_client.subscribe(mqtt_green_permission_topic)) {
+                Serial.println("  ✓ " + String(mqtt_green_permission_topic));
             } else {
-                Serial.println("  ✗ Failed: traffic/green_permission");
+                Serial.println("  ✗ Failed: " + String(mqtt_green_permission_topic));
             }
             
             Serial.println("Lane " + String(LANE_ID) + " ready to receive MQTT messages!");
@@ -371,6 +343,11 @@ void setup()
     Serial.begin(115200);
     Serial.println("ESP32 Traffic Light Controller - Lane " + String(LANE_ID));
 
+    // Identify the green time policy that was flashed
+    char policyChecksum[9];
+    snprintf(policyChecksum, sizeof(policyChecksum), "%08lx", (unsigned long)lane_policy::CHECKSUM);
+    Serial.println("Policy: " + String(lane_policy::NAME) + " v" + String(lane_policy::VERSION) + " (crc " + String(policyChecksum) + ")");
+
     // Initialize traffic light pins
     pinMode(RED_PIN, OUTPUT);
     pinMode(YELLOW_PIN, OUTPUT);
@@ -394,9 +371,21 @@ void setup()
     Serial.println("Setup completed for Lane " + String(LANE_ID));
 }
 
-bool isJamSibuk(int jam)
+// Compiled-in plan schedule, the default of the sketches' config blob (lane_config.h):
+// jam sibuk on weekdays 07:00-10:00 and 17:00-20:00, eased in and out over 10 minutes
+const plan_schedule::PlanEntry planSchedule[] = {
+    {plan_schedule::WEEKDAY, 100, 7 * 60, 10 * 60},
+    {plan_schedule::WEEKDAY, 100, 17 * 60, 20 * 60},
+};
+const uint8_t planTransitionMin = 10;
+
+// Rush weight of the plan schedule at `now`: 0 = normal green times, 1 = jam sibuk
+float rushWeightAt(const struct tm &now)
 {
-    return (jam >= 7 && jam <= 9) || (jam >= 17 && jam <= 19);
+    plan_schedule::DayType dayType = plan_schedule::dayTypeOf(now, nullptr, 0);
+    float minute = now.tm_hour * 60 + now.tm_min + now.tm_sec / 60.0f;
+    return plan_schedule::rushWeight(planSchedule, sizeof(planSchedule) / sizeof(planSchedule[0]), planTransitionMin,
+                                     dayType, minute);
 }
 
 void setTrafficLight(bool red, bool yellow, bool green)
@@ -423,38 +412,6 @@ void allRed()
     setTrafficLight(true, false, false);
 }
 
-float defuzzify(float kendaraan, bool jamSibuk)
-{
-    float mu_sedikit = sedikit(kendaraan);
-    float mu_sedang = sedang(kendaraan);
-    float mu_padat = padat(kendaraan);
-
-    float durasi_pendek, durasi_sedang, durasi_lama;
-
-    if (jamSibuk)
-    {
-        durasi_pendek = 15.0;
-        durasi_sedang = 30.0;
-        durasi_lama = 60.0;
-    }
-    else
-    {
-        durasi_pendek = 10.0;
-        durasi_sedang = 20.0;
-        durasi_lama = 40.0;
-    }
-
-    float numerator = (mu_sedikit * durasi_pendek) + (mu_sedang * durasi_sedang) + (mu_padat * durasi_lama);
-    float denominator = mu_sedikit + mu_sedang + mu_padat;
-
-    if (denominator == 0)
-    {
-        return jamSibuk ? 30.0 : 20.0;
-    }
-
-    return numerator / denominator;
-}
-
 void publish_green_status(String status)
 {
     DynamicJsonDocument doc(256);
@@ -552,8 +509,8 @@ void loop()
         return;
     }
 
-    int currentHour = timeinfo.tm_hour;
-    bool jamSibuk = isJamSibuk(currentHour);
+    // Day type and smooth changes between plans come from the schedule
+    float rushWeight = rushWeightAt(timeinfo);
 
     // Check if we have new data for our lane
     if (lastReceivedData.new_data && vehicleCount > 0)
@@ -584,8 +541,9 @@ void loop()
                 }
             }
 
-            // Calculate green light duration using fuzzy logic
-            float duration = defuzzify(vehicleCount, jamSibuk);
+            // Calculate green light duration from the policy table, blending the normal and jam sibuk rows
+            float duration = (1.0f - rushWeight) * lane_policy::greenSeconds(vehicleCount, false) +
+                             rushWeight * lane_policy::greenSeconds(vehicleCount, true);
             
             Serial.print("Lane ");
             Serial.print(LANE_ID);
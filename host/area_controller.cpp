@@ -0,0 +1,199 @@
+// Area controller service (area_controller.h).
+//
+// Default mode reads MQTT messages as "topic payload" lines on stdin, the
+// output of `mosquitto_sub -v`, and writes one "traffic/<id>/area_plan plan"
+// line per updated plan to stdout. The area is a grid of intersections with
+// ids 1..width*height, as the boards' INTERSECTION_ID.
+//
+// --bench feeds synthetic traffic/<id>/state messages in real time, every
+// intersection --rate times a second, with a few hotspots whose queues fill
+// their links, and reports how long updates take to reach a plan.
+//
+// Build:
+//   g++ -std=c++17 -O2 -pthread host/area_controller.cpp -o area_controller
+//
+// Examples:
+//   mosquitto_sub -h broker.emqx.io -v -t 'traffic/+/state' -t 'traffic/+/+/vehicle_count' | ./area_controller --grid 4x3
+//   ./area_controller --bench --grid 40x25 --region 5 --seconds 10 --rate 2
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "area_controller.h"
+
+using namespace std;
+
+struct AreaOptions
+{
+    bool bench = false;
+    int width = 40;
+    int height = 25;
+    int regionSize = 5;
+    float blockMeters = 200.0f;
+    float seconds = 10.0f;
+    float rate = 1.0f;  // state messages per intersection per second in --bench
+    int hotspots = 10;
+    uint32_t seed = 1;
+    AreaConfig area;
+};
+
+bool parseOptions(int argc, char **argv, AreaOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bench")
+            options.bench = true;
+        else if (arg == "--grid" && hasValue)
+        {
+            if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2)
+                return false;
+        }
+        else if (arg == "--region" && hasValue)
+            options.regionSize = atoi(argv[++i]);
+        else if (arg == "--block" && hasValue)
+            options.blockMeters = (float)atof(argv[++i]);
+        else if (arg == "--shards" && hasValue)
+            options.area.shards = atoi(argv[++i]);
+        else if (arg == "--seconds" && hasValue)
+            options.seconds = (float)atof(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+            options.rate = (float)atof(argv[++i]);
+        else if (arg == "--hotspots" && hasValue)
+            options.hotspots = atoi(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            options.seed = (uint32_t)atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.width > 0 && options.height > 0 && options.regionSize > 0 && options.rate > 0 &&
+           options.blockMeters > 0;
+}
+
+double percentile(vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    sort(values.begin(), values.end());
+    return values[min(values.size() - 1, (size_t)(p / 100.0 * values.size()))];
+}
+
+int runService(const AreaOptions &options, const AreaTopology &topology)
+{
+    mutex outputMutex;
+    AreaController controller(topology, options.area, [&](const AreaPlan &plan) {
+        string line = "traffic/" + topology.ids[plan.intersection] + "/area_plan " + AreaController::planJson(plan);
+        lock_guard<mutex> lock(outputMutex);
+        cout << line << '\n';
+    });
+
+    string line;
+    while (getline(cin, line))
+    {
+        size_t space = line.find(' ');
+        if (space == string::npos)
+            continue;
+        line[space] = '\0';
+        controller.onMessage(line.c_str(), line.c_str() + space + 1, line.size() - space - 1);
+    }
+    controller.flush();
+    lock_guard<mutex> lock(outputMutex);
+    cout.flush();
+    return 0;
+}
+
+int runBench(const AreaOptions &options, const AreaTopology &topology)
+{
+    int n = topology.intersections();
+    mutex latencyMutex;
+    vector<double> latencies;
+    latencies.reserve((size_t)(n * options.rate * options.seconds * 1.2f));
+    AreaController controller(topology, options.area, [&](const AreaPlan &plan) {
+        lock_guard<mutex> lock(latencyMutex);
+        latencies.push_back(plan.latencyMs);
+    });
+
+    // Arrivals per minute on each approach; hotspot approaches queue past their link
+    mt19937 rng(options.seed);
+    uniform_real_distribution<float> baseRate(1.0f, 5.0f);
+    vector<float> vpm(n * 4);
+    for (float &rate : vpm)
+        rate = baseRate(rng);
+    vector<int> hotspot(n * 4, 0);
+    for (int h = 0; h < options.hotspots; h++)
+        hotspot[rng() % (n * 4)] = 1;
+    float fullLink = options.blockMeters / options.area.vehicleSpacing;
+
+    printf("%d intersections in %d regions on %d shards, %.1f state messages per intersection per second\n", n,
+           topology.regions(), controller.shardCount(), options.rate);
+
+    auto start = chrono::steady_clock::now();
+    auto period = chrono::duration<double>(1.0 / options.rate);
+    uint64_t messages = 0;
+    char topic[64];
+    char payload[160];
+    normal_distribution<float> noise(0.0f, 1.0f);
+    for (int round = 0; round * period.count() < options.seconds; round++)
+    {
+        // Each round is spread over its period, the way independent boards report
+        auto roundStart = start + chrono::duration_cast<chrono::steady_clock::duration>(period * round);
+        for (int i = 0; i < n; i++)
+        {
+            this_thread::sleep_until(roundStart + chrono::duration_cast<chrono::steady_clock::duration>(period * i / n));
+            float q[4];
+            for (int d = 0; d < 4; d++)
+            {
+                float &rate = vpm[i * 4 + d];
+                rate = min(8.0f, max(0.5f, rate + 0.05f * noise(rng))); // Slow drift of demand
+                q[d] = hotspot[i * 4 + d] ? fullLink * (0.7f + 0.3f * (round % 10) / 9.0f)
+                                          : max(0.0f, rate * 1.5f + noise(rng));
+            }
+            snprintf(topic, sizeof(topic), "traffic/%s/state", topology.ids[i].c_str());
+            int length = snprintf(payload, sizeof(payload), "{\"q\":[%.0f,%.0f,%.0f,%.0f],\"vpm\":[%.1f,%.1f,%.1f,%.1f]}",
+                                  q[0], q[1], q[2], q[3], vpm[i * 4], vpm[i * 4 + 1], vpm[i * 4 + 2], vpm[i * 4 + 3]);
+            controller.onMessage(topic, payload, length);
+            messages++;
+        }
+    }
+    controller.flush();
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    AreaController::Stats stats = controller.stats();
+    float minCycle = 1e9f, maxCycle = 0, meanCycle = 0;
+    for (int r = 0; r < topology.regions(); r++)
+    {
+        float cycle = controller.cycleOfRegion(r);
+        minCycle = min(minCycle, cycle);
+        maxCycle = max(maxCycle, cycle);
+        meanCycle += cycle / topology.regions();
+    }
+    printf("%llu messages in %.2f s (%.0f/s), %llu approach updates, %llu plans\n", (unsigned long long)messages, wall,
+           messages / wall, (unsigned long long)stats.updates, (unsigned long long)stats.plans);
+    printf("Update to plan: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", percentile(latencies, 50),
+           percentile(latencies, 99), percentile(latencies, 100));
+    printf("Region cycle changes: %llu, cycles %.0f-%.0f s (mean %.0f); spillback holds: %llu\n",
+           (unsigned long long)stats.cycleChanges, minCycle, maxCycle, meanCycle, (unsigned long long)stats.holds);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    AreaOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        cerr << "Usage: area_controller [--grid 40x25] [--region 5] [--block 200] [--shards 0]\n"
+             << "                       [--bench [--seconds 10] [--rate 1] [--hotspots 10] [--seed 1]]" << endl;
+        return 1;
+    }
+    AreaTopology topology = AreaTopology::grid(options.width, options.height, options.regionSize, options.blockMeters);
+    return options.bench ? runBench(options, topology) : runService(options, topology);
+}
@@ -0,0 +1,665 @@
+#ifndef AREA_CONTROLLER_H
+#define AREA_CONTROLLER_H
+
+// Area controller: the coordination layer above the intersection controllers.
+//
+// Each intersection keeps running its own cycle; the area controller follows
+// the counts they publish and sends back an advisory plan per intersection:
+// a cycle length shared by its region, an offset within that cycle for
+// progression along the links, green splits per approach and the approaches
+// whose downstream link is full (spillback) and should only get minimum green.
+//
+// State is a structure-of-arrays table of every approach in the area, in
+// region order so each shard's rows are contiguous. Regions are split over
+// shards, one thread each; a shard owns its rows and is the only one writing
+// them. Updates are applied as they arrive and only touch what they change:
+// an approach's demand, its intersection's critical flow ratio and, when that
+// moves the region's cycle by more than the hysteresis, the plans of that
+// region. Spillback crosses regions as a message to the shard owning the
+// upstream intersection, so shards never share mutable state.
+//
+// Inputs (see mqtt_topics.h for the layout):
+//   traffic/<id>/<lane>/vehicle_count  {"total_vehicles": n, "arrival_rate_vpm": r}
+//   traffic/<id>/state                 {"q": [n1..n4], "vpm": [r1..r4]}  (one per phase change)
+// Output, through the PlanSink, meant for traffic/<id>/area_plan.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct AreaTopology
+{
+    static const int kApproaches = 4;
+
+    std::vector<std::string> ids; // Intersection id, the traffic/<id>/ namespace
+    std::vector<int> region;      // Region of each intersection
+    // Per approach (intersection * 4 + approach): the upstream approach feeding this
+    // link (-1 at the edge of the area) and the link length, stop line to stop line
+    std::vector<int> upstreamLane;
+    std::vector<float> linkMeters;
+
+    int intersections() const { return (int)ids.size(); }
+
+    int regions() const
+    {
+        int count = 0;
+        for (int r : region)
+            count = std::max(count, r + 1);
+        return count;
+    }
+
+    // width x height grid, regionSize x regionSize intersections per region. Approaches 1-4
+    // carry traffic from the north, east, south and west, so approach d of an intersection
+    // is fed by approach d of its neighbour on that side.
+    static AreaTopology grid(int width, int height, int regionSize, float blockMeters)
+    {
+        AreaTopology topology;
+        int regionsPerRow = (width + regionSize - 1) / regionSize;
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                topology.ids.push_back(std::to_string(y * width + x + 1));
+                topology.region.push_back((y / regionSize) * regionsPerRow + x / regionSize);
+                const int dx[kApproaches] = {0, 1, 0, -1};
+                const int dy[kApproaches] = {-1, 0, 1, 0};
+                for (int d = 0; d < kApproaches; d++)
+                {
+                    int nx = x + dx[d], ny = y + dy[d];
+                    bool inside = nx >= 0 && nx < width && ny >= 0 && ny < height;
+                    topology.upstreamLane.push_back(inside ? (ny * width + nx) * kApproaches + d : -1);
+                    topology.linkMeters.push_back(blockMeters);
+                }
+            }
+        }
+        return topology;
+    }
+};
+
+struct AreaConfig
+{
+    int shards = 0;                  // 0 = one per hardware thread
+    float saturationFlow = 1800.0f;  // Vehicles per hour of green per approach
+    float lostPerService = 7.0f;     // 1 s all red, 3 s yellow before and after green
+    float minCycle = 60.0f;
+    float maxCycle = 180.0f;
+    float cycleHysteresis = 4.0f;    // A region's cycle only moves by more than this
+    float minGreen = 5.0f;
+    float progressionSpeed = 11.1f;  // m/s for offsets, 40 km/h
+    float vehicleSpacing = 7.0f;     // m of link per queued vehicle
+    float spillbackOn = 0.8f;        // Link occupancy that holds the upstream approach
+    float spillbackOff = 0.6f;       // and releases it again
+    float flowAlpha = 0.3f;          // Smoothing of the demand estimates
+};
+
+struct AreaPlan
+{
+    int intersection = 0;
+    float cycle = 0;    // s, shared by the region
+    float offset = 0;   // s into the region's cycle at which this intersection's cycle starts
+    float green[AreaTopology::kApproaches] = {};
+    uint8_t hold = 0;   // Bit d: approach d feeds a full link and is held at minimum green
+    double latencyMs = 0; // From the oldest update in this plan to the plan
+};
+
+// Number scanning for the compact payloads above; not a general JSON parser
+namespace area_json
+{
+// Position just after "key": in payload, or nullptr
+inline const char *findKey(const char *payload, size_t length, const char *key)
+{
+    size_t keyLength = strlen(key);
+    const char *end = payload + length;
+    for (const char *p = payload; p + keyLength + 2 < end; p++)
+    {
+        if (*p == '"' && p[keyLength + 1] == '"' && memcmp(p + 1, key, keyLength) == 0)
+        {
+            const char *q = p + keyLength + 2;
+            while (q < end && (*q == ' ' || *q == ':'))
+                q++;
+            return q < end ? q : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// Number starting at p, read no further than end: MQTT payloads are not
+// NUL-terminated, so strtof() runs on a bounded copy. Position after it, or nullptr.
+inline const char *parseNumber(const char *p, const char *end, float &out)
+{
+    char text[32];
+    size_t n = 0;
+    while (p + n < end && n + 1 < sizeof(text) && strchr("+-.0123456789eE", p[n]) && p[n] != '\0')
+    {
+        text[n] = p[n];
+        n++;
+    }
+    text[n] = '\0';
+    char *stop;
+    out = strtof(text, &stop);
+    return stop == text ? nullptr : p + (stop - text);
+}
+
+inline bool number(const char *payload, size_t length, const char *key, float &out)
+{
+    const char *p = findKey(payload, length, key);
+    return p && parseNumber(p, payload + length, out);
+}
+
+// Up to `count` numbers of an array; returns how many were read
+inline int numbers(const char *payload, size_t length, const char *key, float *out, int count)
+{
+    const char *p = findKey(payload, length, key);
+    const char *end = payload + length;
+    if (!p || *p != '[')
+        return 0;
+    p++;
+    int read = 0;
+    while (read < count && p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+        const char *next = parseNumber(p, end, out[read]);
+        if (!next)
+            break;
+        read++;
+        p = next;
+        while (p < end && (*p == ' ' || *p == ','))
+            p++;
+    }
+    return read;
+}
+} // namespace area_json
+
+class AreaController
+{
+public:
+    static const int kApproaches = AreaTopology::kApproaches;
+    using Clock = std::chrono::steady_clock;
+    using PlanSink = std::function<void(const AreaPlan &)>; // Called from the shard threads
+
+    struct Stats
+    {
+        uint64_t updates = 0;    // Approach updates applied
+        uint64_t plans = 0;
+        uint64_t cycleChanges = 0;
+        uint64_t holds = 0;      // Spillback holds set
+        uint64_t ignored = 0;    // Messages for unknown intersections or topics
+    };
+
+    AreaController(const AreaTopology &areaTopology, const AreaConfig &areaConfig, PlanSink planSink)
+        : topology(areaTopology), config(areaConfig), sink(std::move(planSink))
+    {
+        int n = topology.intersections();
+        int regions = topology.regions();
+        int shardCount = config.shards > 0 ? config.shards : std::max(1, (int)std::thread::hardware_concurrency());
+        shardCount = std::max(1, std::min(shardCount, regions));
+        lostTime = kApproaches * config.lostPerService;
+        saturation = config.saturationFlow / 3600.0f;
+
+        for (int i = 0; i < n; i++)
+            index[topology.ids[i]] = i;
+
+        // Rows in (shard, region) order so each shard works on a contiguous block
+        std::vector<int> order(n);
+        for (int i = 0; i < n; i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            int sa = topology.region[a] % shardCount, sb = topology.region[b] % shardCount;
+            return sa != sb ? sa < sb : topology.region[a] < topology.region[b];
+        });
+        row.assign(n, 0);
+        for (int r = 0; r < n; r++)
+            row[order[r]] = r;
+
+        int lanes = n * kApproaches;
+        queue.assign(lanes, 0.0f);
+        flow.assign(lanes, 0.0f);
+        green.assign(lanes, 0.0f);
+        spilled.assign(lanes, 0);
+        held.assign(lanes, 0);
+        flowRatio.assign(n, 0.0f);
+        offsetBase.assign(n, 0.0f);
+        oldest.assign(n, Clock::time_point::max());
+        dirty.assign(n, 0);
+        regionCycle.assign(regions, config.minCycle);
+        regionDirty.assign(regions, 0);
+        members.assign(regions, {});
+        for (int r = 0; r < n; r++)
+            members[topology.region[order[r]]].push_back(order[r]);
+        for (int r = 0; r < regions; r++)
+            layOffsets(r);
+        for (int i = 0; i < n; i++)
+            for (int d = 0; d < kApproaches; d++)
+                green[row[i] * kApproaches + d] = (config.minCycle - lostTime) / kApproaches;
+
+        shards.reserve(shardCount);
+        for (int s = 0; s < shardCount; s++)
+            shards.emplace_back(new Shard());
+        for (int s = 0; s < shardCount; s++)
+            shards[s]->thread = std::thread([this, s]() { run(s); });
+    }
+
+    ~AreaController()
+    {
+        for (auto &shard : shards)
+        {
+            {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                shard->stopping = true;
+            }
+            shard->wake.notify_one();
+        }
+        for (auto &shard : shards)
+            shard->thread.join();
+    }
+
+    AreaController(const AreaController &) = delete;
+    AreaController &operator=(const AreaController &) = delete;
+
+    int shardCount() const { return (int)shards.size(); }
+
+    // One MQTT message; returns false if it is not an input of the area controller
+    bool onMessage(const char *topic, const char *payload, size_t length)
+    {
+        Clock::time_point now = Clock::now();
+        // traffic/<id>/<leaf> or traffic/<id>/<lane>/<leaf>
+        if (strncmp(topic, "traffic/", 8) != 0)
+            return ignore();
+        const char *id = topic + 8;
+        const char *slash = strchr(id, '/');
+        if (!slash)
+            return ignore();
+        auto found = index.find(std::string(id, slash - id));
+        if (found == index.end())
+            return ignore();
+        int intersection = found->second;
+        const char *rest = slash + 1;
+
+        Event event;
+        event.intersection = intersection;
+        event.received = now;
+        if (strcmp(rest, "state") == 0)
+        {
+            float rates[kApproaches] = {-1, -1, -1, -1};
+            if (area_json::numbers(payload, length, "q", event.queue, kApproaches) != kApproaches)
+                return ignore();
+            area_json::numbers(payload, length, "vpm", rates, kApproaches);
+            event.kind = Event::STATE;
+            for (int d = 0; d < kApproaches; d++)
+                event.rateVpm[d] = rates[d];
+        }
+        else
+        {
+            int lane = atoi(rest);
+            const char *leaf = strchr(rest, '/');
+            if (lane < 1 || lane > kApproaches || !leaf || strcmp(leaf + 1, "vehicle_count") != 0)
+                return ignore();
+            if (!area_json::number(payload, length, "total_vehicles", event.queue[0]))
+                return ignore();
+            event.rateVpm[0] = -1;
+            area_json::number(payload, length, "arrival_rate_vpm", event.rateVpm[0]);
+            event.kind = Event::COUNT;
+            event.approach = lane - 1;
+        }
+        post(shardOf(intersection), event);
+        return true;
+    }
+
+    // Block until every message passed in so far, and the spillback it caused, is applied
+    void flush()
+    {
+        bool settled = false;
+        while (!settled)
+        {
+            settled = true;
+            for (auto &shard : shards)
+            {
+                std::unique_lock<std::mutex> lock(shard->mutex);
+                if (shard->applied != shard->posted)
+                    settled = false;
+                shard->idle.wait(lock, [&]() { return shard->applied == shard->posted; });
+            }
+        }
+    }
+
+    Stats stats() const
+    {
+        Stats total;
+        total.ignored = ignoredMessages.load();
+        for (auto &shard : shards)
+        {
+            total.updates += shard->updates.load();
+            total.plans += shard->plans.load();
+            total.cycleChanges += shard->cycleChanges.load();
+            total.holds += shard->holds.load();
+        }
+        return total;
+    }
+
+    // Only consistent after flush()
+    float cycleOfRegion(int region) const { return regionCycle[region]; }
+
+    static std::string planJson(const AreaPlan &plan)
+    {
+        char text[192];
+        snprintf(text, sizeof(text), "{\"cycle\":%.0f,\"offset\":%.1f,\"green\":[%.1f,%.1f,%.1f,%.1f],\"hold\":[%d,%d,%d,%d]}",
+                 plan.cycle, plan.offset, plan.green[0], plan.green[1], plan.green[2], plan.green[3],
+                 plan.hold & 1, (plan.hold >> 1) & 1, (plan.hold >> 2) & 1, (plan.hold >> 3) & 1);
+        return text;
+    }
+
+private:
+    struct Event
+    {
+        enum Kind : uint8_t
+        {
+            COUNT, // One approach's count
+            STATE, // All four approaches of one intersection
+            HOLD,  // The link downstream of `approach` is full
+            RELEASE
+        };
+        Kind kind = COUNT;
+        int intersection = 0;
+        int approach = 0;
+        float queue[kApproaches] = {};
+        float rateVpm[kApproaches] = {};
+        Clock::time_point received;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::vector<Event> inbox;
+        uint64_t posted = 0;
+        uint64_t applied = 0;
+        bool stopping = false;
+        std::thread thread;
+        // Owned by the shard thread
+        std::vector<int> dirtyIntersections;
+        std::vector<int> dirtyRegions;
+        std::atomic<uint64_t> updates{0}, plans{0}, cycleChanges{0}, holds{0};
+    };
+
+    bool ignore()
+    {
+        ignoredMessages++;
+        return false;
+    }
+
+    int shardOf(int intersection) const { return topology.region[intersection] % (int)shards.size(); }
+
+    void post(int shardIndex, const Event &event)
+    {
+        Shard &shard = *shards[shardIndex];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.inbox.push_back(event);
+            shard.posted++;
+        }
+        shard.wake.notify_one();
+    }
+
+    // Offsets for progression: walk the region's links breadth first from its first
+    // intersection, adding the travel time along each link in the direction of traffic
+    void layOffsets(int region)
+    {
+        const std::vector<int> &list = members[region];
+        if (list.empty())
+            return;
+        std::vector<uint8_t> seen(topology.intersections(), 0);
+        std::vector<int> frontier = {list[0]};
+        seen[list[0]] = 1;
+        offsetBase[list[0]] = 0;
+        for (size_t k = 0; k < frontier.size(); k++)
+        {
+            int i = frontier[k];
+            for (int d = 0; d < kApproaches; d++)
+            {
+                // Upstream of i along approach d, and downstream: whoever is fed by i
+                int up = topology.upstreamLane[i * kApproaches + d];
+                if (up >= 0)
+                    visit(region, i, up / kApproaches, -travelSeconds(i * kApproaches + d), seen, frontier);
+            }
+            for (int j : list)
+            {
+                for (int d = 0; d < kApproaches; d++)
+                {
+                    int up = topology.upstreamLane[j * kApproaches + d];
+                    if (up >= 0 && up / kApproaches == i)
+                        visit(region, i, j, travelSeconds(j * kApproaches + d), seen, frontier);
+                }
+            }
+        }
+        // Intersections not linked to the first one start at 0
+    }
+
+    void visit(int region, int from, int to, float seconds, std::vector<uint8_t> &seen, std::vector<int> &frontier)
+    {
+        if (topology.region[to] != region || seen[to])
+            return;
+        seen[to] = 1;
+        offsetBase[to] = offsetBase[from] + seconds;
+        frontier.push_back(to);
+    }
+
+    float travelSeconds(int lane) const { return topology.linkMeters[lane] / config.progressionSpeed; }
+
+    void run(int shardIndex)
+    {
+        Shard &shard = *shards[shardIndex];
+        std::vector<Event> batch;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                shard.wake.wait(lock, [&]() { return shard.stopping || !shard.inbox.empty(); });
+                if (shard.inbox.empty())
+                    return;
+                batch.swap(shard.inbox);
+            }
+
+            for (const Event &event : batch)
+                apply(shard, event);
+            for (int region : shard.dirtyRegions)
+                updateCycle(shard, region);
+            shard.dirtyRegions.clear();
+            Clock::time_point now = Clock::now();
+            for (int intersection : shard.dirtyIntersections)
+                emit(shard, intersection, now);
+            shard.dirtyIntersections.clear();
+
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.applied += batch.size();
+            }
+            shard.idle.notify_all();
+            batch.clear();
+        }
+    }
+
+    void apply(Shard &shard, const Event &event)
+    {
+        int i = event.intersection;
+        int base = row[i] * kApproaches;
+        switch (event.kind)
+        {
+        case Event::COUNT:
+            updateApproach(shard, i, event.approach, event.queue[0], event.rateVpm[0]);
+            break;
+        case Event::STATE:
+            for (int d = 0; d < kApproaches; d++)
+                updateApproach(shard, i, d, event.queue[d], event.rateVpm[d]);
+            break;
+        case Event::HOLD:
+        case Event::RELEASE:
+            held[base + event.approach] = event.kind == Event::HOLD;
+            if (event.kind == Event::HOLD)
+                shard.holds++;
+            break;
+        }
+        markDirty(shard, i, event.received);
+    }
+
+    void updateApproach(Shard &shard, int i, int d, float vehicles, float rateVpm)
+    {
+        int lane = row[i] * kApproaches + d;
+        queue[lane] = std::max(0.0f, vehicles);
+        // Demand: the reported arrival rate, or what queued up during the last red
+        float red = std::max(1.0f, regionCycle[topology.region[i]] - green[lane]);
+        float sample = rateVpm >= 0 ? rateVpm / 60.0f : queue[lane] / red;
+        flow[lane] += config.flowAlpha * (sample - flow[lane]);
+        shard.updates++;
+
+        float ratio = 0;
+        for (int k = 0; k < kApproaches; k++)
+            ratio += std::min(0.95f, flow[row[i] * kApproaches + k] / saturation);
+        if (ratio != flowRatio[i])
+        {
+            flowRatio[i] = ratio;
+            int region = topology.region[i];
+            if (!regionDirty[region])
+            {
+                regionDirty[region] = 1;
+                shard.dirtyRegions.push_back(region);
+            }
+        }
+
+        // Spillback: a full link holds the approach feeding it, wherever that is
+        int topoLane = i * kApproaches + d;
+        int up = topology.upstreamLane[topoLane];
+        if (up < 0)
+            return;
+        float occupancy = queue[lane] * config.vehicleSpacing / topology.linkMeters[topoLane];
+        uint8_t &flag = spilled[lane];
+        if (!flag && occupancy >= config.spillbackOn)
+            flag = 1;
+        else if (flag && occupancy <= config.spillbackOff)
+            flag = 0;
+        else
+            return;
+        Event event;
+        event.kind = flag ? Event::HOLD : Event::RELEASE;
+        event.intersection = up / kApproaches;
+        event.approach = up % kApproaches;
+        event.received = Clock::now();
+        post(shardOf(event.intersection), event);
+    }
+
+    void markDirty(Shard &shard, int i, Clock::time_point received)
+    {
+        if (!dirty[i])
+        {
+            dirty[i] = 1;
+            shard.dirtyIntersections.push_back(i);
+        }
+        oldest[i] = std::min(oldest[i], received);
+    }
+
+    // Webster's cycle for the region's most loaded intersection, which all of it shares
+    void updateCycle(Shard &shard, int region)
+    {
+        regionDirty[region] = 0;
+        float critical = 0;
+        for (int i : members[region])
+            critical = std::max(critical, flowRatio[i]);
+        critical = std::min(critical, 0.9f);
+        float cycle = (1.5f * lostTime + 5.0f) / (1.0f - critical);
+        cycle = std::max(config.minCycle, std::min(config.maxCycle, cycle));
+        if (std::fabs(cycle - regionCycle[region]) <= config.cycleHysteresis)
+            return;
+        regionCycle[region] = cycle;
+        shard.cycleChanges++;
+        for (int i : members[region])
+            markDirty(shard, i, Clock::now());
+    }
+
+    void emit(Shard &shard, int i, Clock::time_point now)
+    {
+        dirty[i] = 0;
+        int base = row[i] * kApproaches;
+        AreaPlan plan;
+        plan.intersection = i;
+        plan.cycle = regionCycle[topology.region[i]];
+        plan.offset = std::fmod(offsetBase[i], plan.cycle);
+        if (plan.offset < 0)
+            plan.offset += plan.cycle;
+
+        // Green in proportion to each approach's flow ratio; held approaches get the minimum
+        float available = plan.cycle - lostTime;
+        float weight = 0;
+        int free = 0;
+        for (int d = 0; d < kApproaches; d++)
+        {
+            if (held[base + d])
+            {
+                plan.hold |= 1 << d;
+                available -= config.minGreen;
+            }
+            else
+            {
+                weight += std::max(0.01f, flow[base + d] / saturation);
+                free++;
+            }
+        }
+        float spare = std::max(0.0f, available - free * config.minGreen);
+        for (int d = 0; d < kApproaches; d++)
+        {
+            float share = held[base + d] ? 0 : std::max(0.01f, flow[base + d] / saturation) / weight;
+            plan.green[d] = config.minGreen + spare * share;
+            green[base + d] = plan.green[d];
+        }
+
+        plan.latencyMs = std::chrono::duration<double, std::milli>(now - oldest[i]).count();
+        oldest[i] = Clock::time_point::max();
+        shard.plans++;
+        if (sink)
+            sink(plan);
+    }
+
+    AreaTopology topology;
+    AreaConfig config;
+    PlanSink sink;
+    float lostTime;
+    float saturation; // Vehicles per second of green
+    std::unordered_map<std::string, int> index;
+    std::vector<int> row; // Intersection -> row of the tables below
+
+    // Per approach, indexed row * 4 + approach
+    std::vector<float> queue;
+    std::vector<float> flow;  // Estimated arrivals per second
+    std::vector<float> green; // Last planned green
+    std::vector<uint8_t> spilled; // This approach's link is full
+    std::vector<uint8_t> held;    // Its downstream link is full
+
+    // Per intersection, indexed by intersection
+    std::vector<float> flowRatio; // Sum of the approaches' flow ratios
+    std::vector<float> offsetBase;
+    std::vector<Clock::time_point> oldest;
+    std::vector<uint8_t> dirty;
+
+    // Per region
+    std::vector<float> regionCycle;
+    std::vector<uint8_t> regionDirty;
+    std::vector<std::vector<int>> members;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint64_t> ignoredMessages{0};
+};
+
+#endif // AREA_CONTROLLER_H
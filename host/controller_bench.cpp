@@ -0,0 +1,305 @@
+// Microbenchmarks of the lane controller's hot paths, built against the host shims.
+//
+// Covers mqtt_callback() for every topic a lane board handles, the green time
+// lookup that replaced defuzzify(), getCurrentTimestamp(), the publish_*
+// serializers and writeToLog() on the RAM file system of the SPIFFS shim.
+// Every benchmark reports ns/op and heap allocations per op (allocs/op).
+// Python/bench_compare.py checks a run against host/controller_bench_baseline.json.
+//
+// Lane 1 is compiled into this file like lane_sketches.cpp does, so do not
+// link lane_sketches.cpp as well.
+//
+// Build:
+//   g++ -std=c++17 -O2 -pthread -Ihost/shim host/controller_bench.cpp -lbenchmark -o controller_bench
+//
+// Examples:
+//   ./controller_bench
+//   ./controller_bench --benchmark_filter=mqtt_callback
+//   ./controller_bench --benchmark_out=bench.json --benchmark_out_format=json
+//   python Python/bench_compare.py bench.json                  (fails on regressions)
+//   python Python/bench_compare.py bench.json --save           (new baseline)
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <PubSubClient.h>
+#include <SPIFFS.h>
+#include <WiFi.h>
+#include <esp_ota_ops.h>
+#include <esp_task_wdt.h>
+
+#include "../esp32_arduino_ide/esp32_lane1/lane_policy.h"
+#include "../esp32_arduino_ide/esp32_lane1/plan_schedule.h"
+#include "../esp32_arduino_ide/esp32_lane1/lane_config.h"
+#include "../esp32_arduino_ide/esp32_lane1/phase_engine.h"
+#include "../esp32_arduino_ide/esp32_lane1/cycle_accounting.h"
+#include "../esp32_arduino_ide/esp32_lane1/mqtt_topics.h"
+#include "../esp32_arduino_ide/esp32_lane1/demand_forecast.h"
+#include "../esp32_arduino_ide/esp32_lane1/intersection_snapshot.h"
+#include "../esp32_arduino_ide/esp32_lane1/loop_watchdog.h"
+#include "../esp32_arduino_ide/esp32_lane1/ota_update.h"
+#include "../esp32_arduino_ide/esp_logger.h"
+
+namespace lane1
+{
+#include "../esp32_arduino_ide/esp32_lane1/esp32_lane1.ino"
+}
+
+// Every heap allocation of the process; benchmarks run on the main thread only.
+// All replaceable new/delete forms are defined, so array and nothrow allocations
+// are counted too and every delete matches its new. The free() stays out of line:
+// inlined into a caller, GCC pairs it with the caller's new and warns of a mismatch.
+static std::atomic<uint64_t> heapAllocations{0};
+
+static void *countedAlloc(size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+__attribute__((noinline)) static void release(void *p)
+{
+    std::free(p);
+}
+
+void *operator new(size_t size)
+{
+    if (void *p = countedAlloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    if (void *p = countedAlloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    release(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    release(p);
+}
+
+// Run body once per iteration and report allocations per op next to the time
+template <typename Body>
+void measure(benchmark::State &state, Body body)
+{
+    uint64_t before = heapAllocations.load(std::memory_order_relaxed);
+    for (auto _ : state)
+        body();
+    double allocations = (double)(heapAllocations.load(std::memory_order_relaxed) - before);
+    state.counters["allocs/op"] = benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+}
+
+// One topic the callback handles. Payloads are delivered in turn; reset() puts the
+// board back in the state the message is meant to meet, so every op takes the same path.
+struct CallbackCase
+{
+    const char *name;
+    std::string topic;
+    std::vector<std::string> payloads;
+    void (*reset)();
+};
+
+std::vector<CallbackCase> callbackCases()
+{
+    char duration[mqtt_topics::MAX_TOPIC];
+    mqtt_topics::laneTopic(duration, 2, "duration");
+
+    intersection_snapshot::Snapshot snapshot;
+    snapshot.version = 7;
+    snapshot.publishedMs = (uint64_t)hostScheduler().epoch() * 1000;
+    snapshot.active = 5;
+    snapshot.next = 2;
+    snapshot.stage = intersection_snapshot::GREEN;
+    snapshot.stageEndMs = snapshot.publishedMs + 12000;
+    char encoded[intersection_snapshot::MAX_MESSAGE];
+    intersection_snapshot::encode(snapshot, encoded);
+
+    std::string timestamp = lane1::getCurrentTimestamp().c_str();
+    return {
+        {"vehicle_count",
+         lane1::mqtt_topic,
+         {"{\"road_section_id\": 1, \"total_vehicles\": 7, \"timestamp\": \"" + timestamp + "\"}",
+          "{'road_section_id': 1, 'vehicle_counts': {'car': 5, 'motorcycle': 3, 'bus': 1}, 'timestamp': '" +
+              timestamp + "'}"},
+         []() { lane1::lastReceivedData.new_data = false; }},
+        {"countdown_sync",
+         lane1::mqtt_countdown_sync_topic,
+         {"{'lane_id': 1, 'remaining_seconds': 12, 'phase': 'green', 'source': 'python'}"},
+         []() {}},
+        {"green_status",
+         lane1::mqtt_green_status_topic,
+         {"{\"section\": 2, \"status\": \"green\", \"timestamp\": \"" + timestamp + "\"}",
+          "{\"section\": 2, \"status\": \"red\", \"timestamp\": \"" + timestamp + "\"}"},
+         []() {}},
+        {"green_request",
+         lane1::mqtt_green_request_topic,
+         {"{\"section\": 2, \"timestamp\": \"" + timestamp + "\", \"data_received_time\": 123456}"},
+         []() {
+             lane1::phases.clear();
+             lane1::nextExpectedSection = 2;
+         }},
+        {"green_permission",
+         lane1::mqtt_green_permission_topic,
+         {"{\"section\": 1, \"permission\": \"granted\", \"from_section\": 4}"},
+         []() { lane1::waitingForGreenPermission = true; }},
+        {"next_lane_ready",
+         lane1::mqtt_next_lane_ready_topic,
+         {"{\"next_expected_section\": 2, \"from_lane\": 4}"},
+         []() {}},
+        {"snapshot",
+         lane1::mqtt_snapshot_topic,
+         {encoded},
+         []() {
+             lane1::snapshot.version = 0;
+             lane1::joiningFromSnapshot = false;
+         }},
+        {"duration",
+         duration,
+         {"{\"road_section_id\": 2, \"total_vehicles\": 5, \"duration\": 14.5, \"lost_time_ms\": 4000, "
+          "\"timestamp\": \"" + timestamp + "\"}"},
+         []() {}},
+        {"reset", lane1::mqtt_reset_topic, {"reset"}, []() {}},
+    };
+}
+
+void registerCallbackBenchmarks()
+{
+    for (const CallbackCase &callbackCase : callbackCases())
+    {
+        std::string name = std::string("mqtt_callback/") + callbackCase.name;
+        benchmark::RegisterBenchmark(name.c_str(), [callbackCase](benchmark::State &state) {
+            std::vector<char> topic(callbackCase.topic.begin(), callbackCase.topic.end());
+            topic.push_back('\0');
+            std::vector<std::vector<uint8_t>> payloads;
+            for (const std::string &payload : callbackCase.payloads)
+                payloads.emplace_back(payload.begin(), payload.end());
+            size_t next = 0;
+            measure(state, [&]() {
+                callbackCase.reset();
+                std::vector<uint8_t> &payload = payloads[next];
+                next = next + 1 < payloads.size() ? next + 1 : 0;
+                lane1::mqtt_callback(topic.data(), payload.data(), (unsigned int)payload.size());
+            });
+        });
+    }
+}
+
+static void greenSeconds(benchmark::State &state)
+{
+    int count = 0;
+    measure(state, [&]() {
+        count = count < 40 ? count + 1 : 0;
+        benchmark::DoNotOptimize(lane_policy::greenSeconds((float)count, count & 1));
+    });
+}
+BENCHMARK(greenSeconds)->Name("defuzzify");
+
+static void currentTimestamp(benchmark::State &state)
+{
+    measure(state, []() { benchmark::DoNotOptimize(lane1::getCurrentTimestamp()); });
+}
+BENCHMARK(currentTimestamp)->Name("getCurrentTimestamp");
+
+static void publishGreenStatus(benchmark::State &state)
+{
+    measure(state, []() { lane1::publish_green_status("green"); });
+}
+BENCHMARK(publishGreenStatus)->Name("publish/green_status");
+
+static void publishCountdownSync(benchmark::State &state)
+{
+    measure(state, []() { lane1::publish_countdown_sync(12, "green"); });
+}
+BENCHMARK(publishCountdownSync)->Name("publish/countdown_sync");
+
+static void publishDuration(benchmark::State &state)
+{
+    measure(state, []() { lane1::publish_duration(14.5f); });
+}
+BENCHMARK(publishDuration)->Name("publish/duration");
+
+static void publishCycleStats(benchmark::State &state)
+{
+    measure(state, []() { lane1::publish_cycle_stats(); });
+}
+BENCHMARK(publishCycleStats)->Name("publish/cycle_stats");
+
+static void publishSnapshot(benchmark::State &state)
+{
+    measure(state, []() { lane1::publish_snapshot(1, intersection_snapshot::GREEN, 12000); });
+}
+BENCHMARK(publishSnapshot)->Name("publish/snapshot");
+
+static void logLine(benchmark::State &state)
+{
+    initLogger();
+    String message = "Vehicle Count: 7 | Duration: 14.5s | Jam Sibuk: No";
+    measure(state, [&]() { writeToLog(LOG_INFO, 1, message); });
+}
+BENCHMARK(logLine)->Name("writeToLog");
+
+int main(int argc, char **argv)
+{
+    // Lane 1 as the boards run it: NTP time at 08:00, connected to the broker, nothing subscribed
+    struct tm start = {};
+    start.tm_year = 2025 - 1900;
+    start.tm_mon = 3;
+    start.tm_mday = 22;
+    start.tm_hour = 8;
+    hostScheduler().setEpoch(timegm(&start));
+    lane1::mqtt_client.connect(lane1::mqtt_client_id);
+
+    registerCallbackBenchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,412 @@
+// Network fault benchmark for the host-built controllers.
+//
+// Runs the lane sketches (or the single-board controller) on micro_sim under
+// many randomized fault plans of the in-process broker: latency and jitter,
+// loss, duplication, reordering and broker disconnects with outages. Each run
+// draws its plan from (--seed, run index), so any run can be replayed alone
+// with --run. Runs are independent processes, --jobs at a time, because the
+// broker and the virtual scheduler are per process.
+//
+// Outcomes per run, against a clean run of the same traffic:
+//   stall       every head red for more than 10 s while vehicles are waiting
+//   double green conflicting approaches green or yellow together
+//   cycle       mean cycle length from the boards' cycle_stats records
+//
+// Build:
+//   g++ -std=c++17 -O3 -march=native -pthread -Ihost/shim host/fault_bench.cpp host/lane_sketches.cpp -o fault_bench
+//
+// Examples:
+//   ./fault_bench --runs 1000 --jobs 8
+//   ./fault_bench --runs 200 --max-loss 0.3 --topic 'traffic/+/green_status'
+//   ./fault_bench --run 17 --verbose        (replay run 17 with every board's Serial output)
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include "intersection_harness.h"
+#include "micro_sim.h"
+#include "../esp32_arduino_ide/esp32_lane1/cycle_accounting.h"
+#include "../esp32_arduino_ide/esp32_lane1/mqtt_topics.h"
+
+using namespace std;
+
+// A stall shorter than this is an ordinary clearance interval
+const int STALL_THRESHOLD_SEC = 10;
+
+struct FaultBenchOptions
+{
+    int runs = 200;
+    int jobs = 0;            // concurrent runs, 0 for one per hardware thread
+    int run = -1;            // replay only this run
+    float seconds = 1800.0f;
+    uint32_t seed = 1;
+    bool singleBoard = false;
+    bool verbose = false;
+    string topic = "#";      // topics the fault rule applies to
+    float rates[4] = {600.0f, 300.0f, 600.0f, 300.0f}; // vehicles per hour per approach
+    // Each run draws every parameter uniformly from [0, max]
+    double maxLatencyMs = 500;
+    double maxJitterMs = 1000;
+    double maxLoss = 0.1;
+    double maxDuplicate = 0.1;
+    double maxDisconnectsPerHour = 6;
+    double maxOutageMs = 30000;
+    int top = 5;             // worst runs to list
+};
+
+// Written by a run's process to its pipe, so it must stay trivially copyable
+struct RunResult
+{
+    bool ok = false;
+    double latencyMs = 0, jitterMs = 0, loss = 0, duplicate = 0, disconnectsPerHour = 0, outageMs = 0;
+    int stallSeconds = 0;       // seconds inside stalls longer than STALL_THRESHOLD_SEC
+    int maxStallSeconds = 0;
+    int doubleGreens = 0;       // onsets of conflicting greens
+    int conflictSeconds = 0;
+    double cycleSec = 0;        // mean closed cycle over all lanes
+    double delaySec = 0;        // mean delay per arrival
+    uint64_t discharged = 0;
+    HostFaultStats faults;
+};
+
+bool parseOptions(int argc, char **argv, FaultBenchOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--single-board")
+            options.singleBoard = true;
+        else if (arg == "--verbose")
+            options.verbose = true;
+        else if (arg == "--runs" && hasValue)
+            options.runs = atoi(argv[++i]);
+        else if (arg == "--jobs" && hasValue)
+            options.jobs = atoi(argv[++i]);
+        else if (arg == "--run" && hasValue)
+            options.run = atoi(argv[++i]);
+        else if (arg == "--seconds" && hasValue)
+            options.seconds = (float)atof(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--topic" && hasValue)
+            options.topic = argv[++i];
+        else if (arg == "--max-latency" && hasValue)
+            options.maxLatencyMs = atof(argv[++i]);
+        else if (arg == "--max-jitter" && hasValue)
+            options.maxJitterMs = atof(argv[++i]);
+        else if (arg == "--max-loss" && hasValue)
+            options.maxLoss = atof(argv[++i]);
+        else if (arg == "--max-duplicate" && hasValue)
+            options.maxDuplicate = atof(argv[++i]);
+        else if (arg == "--max-disconnects" && hasValue)
+            options.maxDisconnectsPerHour = atof(argv[++i]);
+        else if (arg == "--max-outage" && hasValue)
+            options.maxOutageMs = atof(argv[++i]);
+        else if (arg == "--top" && hasValue)
+            options.top = atoi(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+        {
+            string value = argv[++i];
+            size_t eq = value.find('=');
+            int lane = atoi(value.substr(0, eq).c_str());
+            if (eq == string::npos || lane < 1 || lane > 4)
+                return false;
+            options.rates[lane - 1] = (float)atof(value.substr(eq + 1).c_str());
+        }
+        else
+            return false;
+    }
+    return options.runs > 0;
+}
+
+// Fault plan of run `index`; index -1 is the clean baseline
+HostFaultPlan planFor(const FaultBenchOptions &options, int index, RunResult &result)
+{
+    HostFaultPlan plan;
+    plan.seed = options.seed * 1000003u + (uint32_t)index;
+    if (index < 0)
+        return plan;
+    mt19937 rng(plan.seed);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    HostFaultRule rule;
+    rule.filter = options.topic;
+    rule.latencyMs = result.latencyMs = unit(rng) * options.maxLatencyMs;
+    rule.jitterMs = result.jitterMs = unit(rng) * options.maxJitterMs;
+    rule.loss = result.loss = unit(rng) * options.maxLoss;
+    rule.duplicate = result.duplicate = unit(rng) * options.maxDuplicate;
+    plan.disconnectsPerHour = result.disconnectsPerHour = unit(rng) * options.maxDisconnectsPerHour;
+    plan.outageMs = result.outageMs = unit(rng) * options.maxOutageMs;
+    plan.rules.push_back(rule);
+    return plan;
+}
+
+// One run in this process; the broker and scheduler are not reusable afterwards
+RunResult runOnce(const FaultBenchOptions &options, int index)
+{
+    RunResult result;
+    hostBroker().setFaults(planFor(options, index, result));
+
+    // Same traffic in every run, so outcomes differ only by the network
+    MicroSim sim(0.1f, options.seed);
+    for (int lane = 0; lane < 4; lane++)
+        sim.addLane(lane, 250.0f, options.rates[lane]);
+
+    IntersectionHarness intersection;
+    intersection.setSerialEcho(options.verbose);
+    uint64_t cycleMs = 0;
+    uint64_t cycles = 0;
+    hostBroker().addTap([&](const string &topic, const string &payload) {
+        if (mqtt_topics::laneOf(topic.c_str(), "cycle_stats") == 0)
+            return;
+        DynamicJsonDocument doc(384);
+        if (deserializeJson(doc, payload))
+            return;
+        cycles++;
+        JsonArray ms = doc["ms"];
+        for (int c = 0; c < cycle_accounting::CATEGORIES; c++)
+            cycleMs += ms[c].as<unsigned long>();
+    });
+    intersection.start(hostLocalTime(2025, 4, 22, 8), options.singleBoard);
+
+    TrafficLight lights[4];
+    int seconds = (int)options.seconds;
+    int stall = 0;
+    bool conflicting = false;
+    for (int t = 0; t < seconds; t++)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if ((t + lane) % 5 == 0)
+                intersection.publishCount(lane + 1, sim.stats(lane).halting);
+        }
+        intersection.advanceTo((uint64_t)t * 1000);
+
+        bool conflict = intersection.conflictCount() > 0;
+        if (conflict)
+            result.conflictSeconds++;
+        if (conflict && !conflicting)
+            result.doubleGreens++;
+        conflicting = conflict;
+
+        bool waiting = false;
+        bool anyMoving = false;
+        for (int lane = 0; lane < 4; lane++)
+        {
+            HostLightState state = intersection.light(lane + 1);
+            lights[lane] = TrafficLight{state.red || (!state.yellow && !state.green), state.yellow, state.green};
+            waiting = waiting || sim.stats(lane).halting > 0;
+            anyMoving = anyMoving || state.green || state.yellow;
+        }
+        if (waiting && !anyMoving)
+            stall++;
+        if ((!waiting || anyMoving || t == seconds - 1) && stall > 0)
+        {
+            if (stall > STALL_THRESHOLD_SEC)
+                result.stallSeconds += stall;
+            result.maxStallSeconds = max(result.maxStallSeconds, stall);
+            stall = 0;
+        }
+
+        for (int s = 0; s < 10; s++)
+            sim.step(lights);
+    }
+
+    uint64_t arrivals = 0;
+    double delay = 0;
+    for (int lane = 0; lane < 4; lane++)
+    {
+        arrivals += sim.stats(lane).arrivals;
+        delay += sim.stats(lane).delaySec;
+        result.discharged += sim.stats(lane).discharged;
+    }
+    result.delaySec = delay / max<uint64_t>(1, arrivals);
+    result.cycleSec = cycleMs / 1000.0 / max<uint64_t>(1, cycles);
+    result.faults = hostBroker().faultStats();
+    result.ok = true;
+    return result;
+}
+
+// Run every index in its own process, at most `jobs` at a time.
+// The parent must not start threads before forking; all of them live in the children.
+vector<RunResult> runAll(const FaultBenchOptions &options, const vector<int> &indices, int jobs)
+{
+    vector<RunResult> results(indices.size());
+    struct Child
+    {
+        pid_t pid;
+        int fd;
+        size_t slot;
+    };
+    vector<Child> running;
+    size_t next = 0;
+    size_t done = 0;
+    while (done < indices.size())
+    {
+        while (next < indices.size() && (int)running.size() < jobs)
+        {
+            int fds[2];
+            if (pipe(fds) != 0)
+            {
+                perror("pipe");
+                exit(1);
+            }
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                close(fds[0]);
+                RunResult result = runOnce(options, indices[next]);
+                ssize_t written = write(fds[1], &result, sizeof(result));
+                _exit(written == (ssize_t)sizeof(result) ? 0 : 1); // Skip the sketch threads' teardown
+            }
+            close(fds[1]);
+            if (pid < 0)
+            {
+                perror("fork");
+                exit(1);
+            }
+            running.push_back({pid, fds[0], next++});
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        for (size_t i = 0; i < running.size(); i++)
+        {
+            if (running[i].pid != pid)
+                continue;
+            RunResult result;
+            if (read(running[i].fd, &result, sizeof(result)) == (ssize_t)sizeof(result))
+                results[running[i].slot] = result;
+            close(running[i].fd);
+            running.erase(running.begin() + i);
+            done++;
+            break;
+        }
+    }
+    return results;
+}
+
+double percentile(vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    sort(values.begin(), values.end());
+    return values[min(values.size() - 1, (size_t)(p / 100.0 * values.size()))];
+}
+
+void printRun(int index, const RunResult &r, double baselineCycle)
+{
+    printf("%5d  %7.0f  %6.0f  %5.1f%%  %5.1f%%  %7.1f  %6.0f  %4d/%-4d  %6d  %+6.1f%%  %6.1f\n", index, r.latencyMs,
+           r.jitterMs, r.loss * 100, r.duplicate * 100, r.disconnectsPerHour, r.outageMs / 1000, r.stallSeconds,
+           r.maxStallSeconds, r.doubleGreens, (r.cycleSec / max(1e-9, baselineCycle) - 1) * 100, r.delaySec);
+}
+
+int main(int argc, char **argv)
+{
+    FaultBenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        cout << "Usage: fault_bench [--runs 200] [--jobs <n>] [--seconds 1800] [--seed 1] [--single-board]\n"
+             << "                   [--topic <filter>] [--max-latency 500] [--max-jitter 1000] [--max-loss 0.1]\n"
+             << "                   [--max-duplicate 0.1] [--max-disconnects 6] [--max-outage 30000]\n"
+             << "                   [--rate <lane>=<veh/h>] [--top 5]\n"
+             << "       fault_bench --run <index> [--verbose]" << endl;
+        return 1;
+    }
+    int jobs = options.jobs > 0 ? options.jobs : max(1, (int)thread::hardware_concurrency());
+
+    vector<int> indices = {-1}; // Clean baseline first
+    if (options.run >= 0)
+        indices.push_back(options.run);
+    else
+        for (int i = 0; i < options.runs; i++)
+            indices.push_back(i);
+
+    auto wallStart = chrono::steady_clock::now();
+    vector<RunResult> results = runAll(options, indices, options.verbose ? 1 : jobs);
+    double wallSec = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+
+    const RunResult &baseline = results[0];
+    if (!baseline.ok)
+    {
+        cerr << "Baseline run failed" << endl;
+        return 1;
+    }
+    printf("%zu runs of %.0f s (%s) in %.1f s wall on %d jobs\n", indices.size() - 1, options.seconds,
+           options.singleBoard ? "single board" : "lane boards", wallSec, jobs);
+    printf("Baseline: cycle %.1f s, delay %.1f s/veh, %llu discharged, stall %d s, double greens %d\n",
+           baseline.cycleSec, baseline.delaySec, (unsigned long long)baseline.discharged, baseline.stallSeconds,
+           baseline.doubleGreens);
+
+    vector<double> stalls, maxStalls, inflation, delays;
+    int failed = 0, withDoubleGreen = 0, withStall = 0;
+    HostFaultStats totals;
+    for (size_t i = 1; i < results.size(); i++)
+    {
+        const RunResult &r = results[i];
+        if (!r.ok)
+        {
+            failed++;
+            continue;
+        }
+        stalls.push_back(r.stallSeconds);
+        maxStalls.push_back(r.maxStallSeconds);
+        inflation.push_back((r.cycleSec / max(1e-9, baseline.cycleSec) - 1) * 100);
+        delays.push_back(r.delaySec);
+        withDoubleGreen += r.doubleGreens > 0 ? 1 : 0;
+        withStall += r.stallSeconds > 0 ? 1 : 0;
+        totals.lost += r.faults.lost;
+        totals.duplicated += r.faults.duplicated;
+        totals.reordered += r.faults.reordered;
+        totals.disconnects += r.faults.disconnects;
+        totals.refusedConnects += r.faults.refusedConnects;
+    }
+    printf("Injected: %llu lost, %llu duplicated, %llu reordered, %llu disconnects, %llu refused connects\n",
+           (unsigned long long)totals.lost, (unsigned long long)totals.duplicated,
+           (unsigned long long)totals.reordered, (unsigned long long)totals.disconnects,
+           (unsigned long long)totals.refusedConnects);
+    printf("Runs with double greens: %d, with stalls over %d s: %d, failed: %d\n", withDoubleGreen,
+           STALL_THRESHOLD_SEC, withStall, failed);
+    printf("Metric                    p50      p90      p99      max\n");
+    auto row = [](const char *name, const vector<double> &values) {
+        printf("%-20s  %7.1f  %7.1f  %7.1f  %7.1f\n", name, percentile(values, 50), percentile(values, 90),
+               percentile(values, 99), percentile(values, 100));
+    };
+    row("Stall (s)", stalls);
+    row("Longest stall (s)", maxStalls);
+    row("Cycle inflation (%)", inflation);
+    row("Delay (s/veh)", delays);
+
+    // Worst runs first: double greens, then stall time, then cycle inflation
+    vector<int> order;
+    for (size_t i = 1; i < results.size(); i++)
+    {
+        if (results[i].ok)
+            order.push_back((int)i);
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        const RunResult &x = results[a], &y = results[b];
+        if (x.doubleGreens != y.doubleGreens)
+            return x.doubleGreens > y.doubleGreens;
+        if (x.stallSeconds != y.stallSeconds)
+            return x.stallSeconds > y.stallSeconds;
+        return x.cycleSec > y.cycleSec;
+    });
+    printf("  Run  Latency  Jitter    Loss     Dup   Disc/h  Outage  Stall/max  Double    Cycle   Delay\n");
+    for (int i = 0; i < min((int)order.size(), options.top); i++)
+        printRun(indices[order[i]], results[order[i]], baseline.cycleSec);
+    return withDoubleGreen > 0 ? 2 : 0;
+}
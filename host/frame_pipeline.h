@@ -0,0 +1,647 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+// Staged pipeline for the camera detectors: decode -> preprocess -> infer ->
+// track -> publish, each stage with its own worker threads and a bounded
+// lock-free queue in front of it.
+//
+// Every stage's input queue has an overflow policy. BLOCK makes the producer
+// wait, which is backpressure: a slow stage stalls the ones before it.
+// DROP_OLDEST is latest-wins: the stalest queued item is discarded so a camera
+// frame never waits behind older ones. DROP_NEWEST discards the new item.
+//
+// Every stage counts its items and drops, samples the depth of its queue on
+// each arrival and keeps histograms of queue wait and service time, so
+// report() shows which stage limits the throughput (the busiest queued one,
+// marked as the bottleneck).
+//
+// Stages are typed: source<Out>() returns a Port<Out> that only a stage
+// taking an Out can be attached to. Underneath, items travel as 64-bit
+// values (heap pointers for the typed stages, opaque tokens for the C
+// interface in frame_pipeline_capi.cpp).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace frame_pipeline
+{
+inline uint64_t nowNs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Multi-producer multi-consumer ring of fixed capacity (Vyukov's bounded
+// queue): one compare-and-swap per push or pop and no locks. The ring needs
+// two cells at least, so a capacity of one (a latest-wins slot) is a limit
+// checked before the push.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity)
+        : limit(std::max<size_t>(capacity, 1)), cap(std::max<size_t>(capacity, 2)), cells(new Cell[cap])
+    {
+        for (size_t i = 0; i < cap; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    bool tryPush(const T &value)
+    {
+        if (limit < cap && size() >= limit)
+            return false;
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos % cap];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // Full
+            }
+            else
+            {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T &value)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos % cap];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = cell.value;
+                    cell.sequence.store(pos + cap, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // Empty
+            }
+            else
+            {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate while other threads push and pop
+    size_t size() const
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_relaxed);
+        return t > h ? std::min(t - h, cap) : 0;
+    }
+
+    size_t capacity() const { return limit; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t limit;
+    const size_t cap;
+    std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<size_t> head{0};
+};
+
+enum class Overflow
+{
+    BLOCK,       // Producer waits for room: backpressure
+    DROP_OLDEST, // Latest wins: the stalest queued item is discarded
+    DROP_NEWEST  // The new item is discarded
+};
+
+// Microsecond latencies in four buckets per power of two (at most 19% wide),
+// recorded with relaxed atomics from any thread.
+class LatencyHistogram
+{
+public:
+    static constexpr int OCTAVES = 40;
+    static constexpr int BUCKETS = 4 * OCTAVES;
+
+    void record(uint64_t ns)
+    {
+        uint64_t us = ns / 1000;
+        counts[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalNs.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    uint64_t samples() const { return count.load(std::memory_order_relaxed); }
+
+    double meanMs() const
+    {
+        uint64_t n = samples();
+        return n ? totalNs.load(std::memory_order_relaxed) / 1e6 / n : 0;
+    }
+
+    // Upper edge of the bucket holding the q-quantile, in milliseconds
+    double quantileMs(double q) const
+    {
+        uint64_t n = samples();
+        if (n == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * (n - 1)) + 1, seen = 0;
+        for (int b = 0; b < BUCKETS; b++)
+        {
+            seen += counts[b].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return upperUs(b) / 1000.0;
+        }
+        return upperUs(BUCKETS - 1) / 1000.0;
+    }
+
+private:
+    static int bucket(uint64_t us)
+    {
+        if (us < 4)
+            return (int)us;
+        int octave = 63 - __builtin_clzll(us); // >= 2
+        int sub = (int)((us >> (octave - 2)) & 3);
+        return std::min(4 * (octave - 1) + sub, BUCKETS - 1);
+    }
+
+    static uint64_t upperUs(int b)
+    {
+        if (b < 4)
+            return (uint64_t)b + 1;
+        int octave = b / 4 + 1, sub = b % 4;
+        return (uint64_t)(4 + sub + 1) << (octave - 2);
+    }
+
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> totalNs{0};
+};
+
+struct StageOptions
+{
+    int workers = 1;
+    size_t capacity = 4;
+    Overflow overflow = Overflow::BLOCK;
+};
+
+struct StageReport
+{
+    std::string name;
+    int workers = 0;
+    size_t capacity = 0;  // 0 for a source
+    size_t queued = 0;
+    uint64_t in = 0;       // Accepted into the queue (produced, for a source)
+    uint64_t out = 0;      // Passed on, or consumed by a sink
+    uint64_t dropped = 0;  // Discarded by the overflow policy
+    uint64_t filtered = 0; // The stage returned nothing
+    uint64_t errors = 0;
+    double meanOccupancy = 0; // Queue depth seen by arriving items
+    double maxOccupancy = 0;
+    double utilization = 0;   // Busy time over workers x running time
+    double blockedS = 0;      // Producers waiting for room (BLOCK)
+    double waitP50Ms = 0, waitP99Ms = 0;
+    double serviceMeanMs = 0, serviceP50Ms = 0, serviceP99Ms = 0;
+    double throughput = 0; // Items passed on per second
+    bool bottleneck = false;
+};
+
+template <typename T>
+struct Port
+{
+    int stage;
+};
+
+class Pipeline
+{
+public:
+    // Returns > 0 with `out` set to pass an item on, 0 for nothing, < 0 for an error.
+    // A source is called with in = 0.
+    using StageFn = std::function<int(uint64_t in, uint64_t &out)>;
+    using Release = std::function<void(uint64_t)>;
+
+    static constexpr int NO_UPSTREAM = -1;
+
+    Pipeline() = default;
+    ~Pipeline() { stop(); }
+
+    Pipeline(const Pipeline &) = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+
+    // Untyped stages. `release` frees an item the pipeline discards: a
+    // dropped or cleared input, or the output of a stage nobody consumes.
+    int addSource(const std::string &name, int workers, StageFn fn, Release release)
+    {
+        auto stage = std::make_unique<Stage>(name, workers, 0, Overflow::BLOCK);
+        stage->source = true;
+        stage->fn = std::move(fn);
+        stage->releaseIn = release;
+        stage->releaseOut = std::move(release);
+        return addStage(std::move(stage), NO_UPSTREAM);
+    }
+
+    // upstream = NO_UPSTREAM for a stage fed only by submit()
+    int addStage(const std::string &name, int upstream, const StageOptions &options, StageFn fn, Release releaseIn,
+                 Release releaseOut)
+    {
+        auto stage = std::make_unique<Stage>(name, options.workers, options.capacity, options.overflow);
+        stage->fn = std::move(fn);
+        stage->releaseIn = std::move(releaseIn);
+        stage->releaseOut = std::move(releaseOut);
+        return addStage(std::move(stage), upstream);
+    }
+
+    // Typed stages: items are heap objects owned by the pipeline
+    template <typename Out>
+    Port<Out> source(const std::string &name, std::function<bool(Out &)> produce, int workers = 1)
+    {
+        auto fn = [produce](uint64_t, uint64_t &out) {
+            auto item = std::make_unique<Out>();
+            if (!produce(*item))
+                return 0;
+            out = (uint64_t)(uintptr_t)item.release();
+            return 1;
+        };
+        return {addSource(name, workers, fn, deleter<Out>())};
+    }
+
+    template <typename In, typename Out>
+    Port<Out> stage(const std::string &name, Port<In> upstream, std::function<bool(In &, Out &)> process,
+                    const StageOptions &options = {})
+    {
+        auto fn = [process](uint64_t in, uint64_t &out) {
+            std::unique_ptr<In> input((In *)(uintptr_t)in);
+            auto item = std::make_unique<Out>();
+            if (!process(*input, *item))
+                return 0;
+            out = (uint64_t)(uintptr_t)item.release();
+            return 1;
+        };
+        return {addStage(name, upstream.stage, options, fn, deleter<In>(), deleter<Out>())};
+    }
+
+    template <typename In>
+    int sink(const std::string &name, Port<In> upstream, std::function<void(In &)> consume,
+             const StageOptions &options = {})
+    {
+        auto fn = [consume](uint64_t in, uint64_t &) {
+            std::unique_ptr<In> input((In *)(uintptr_t)in);
+            consume(*input);
+            return 1;
+        };
+        return addStage(name, upstream.stage, options, fn, deleter<In>(), Release());
+    }
+
+    // Hand an item to a stage's queue under its overflow policy; false if it
+    // was discarded (the item has then been released)
+    bool submit(int stage, uint64_t value)
+    {
+        if (stage < 0 || stage >= (int)stages.size() || stages[stage]->source)
+            return false;
+        return push(*stages[stage], value);
+    }
+
+    void start()
+    {
+        if (running)
+            return;
+        running = true;
+        stopping = false;
+        startNs = nowNs();
+        for (auto &stage : stages)
+            for (int w = 0; w < stage->workers; w++)
+                threads.emplace_back([this, s = stage.get()]() { work(*s); });
+    }
+
+    // Joins the workers and releases whatever is still queued
+    void stop()
+    {
+        if (!running)
+            return;
+        stopping = true;
+        for (auto &thread : threads)
+            thread.join();
+        threads.clear();
+        stopNs = nowNs();
+        running = false;
+        for (size_t s = 0; s < stages.size(); s++)
+            clear((int)s);
+    }
+
+    // Releases the queued items of a stage, e.g. stale frames after a lane switch
+    size_t clear(int stage)
+    {
+        if (stage < 0 || stage >= (int)stages.size() || !stages[stage]->queue)
+            return 0;
+        Stage &s = *stages[stage];
+        size_t cleared = 0;
+        Item item;
+        while (s.queue->tryPop(item))
+        {
+            release(s.releaseIn, item.value);
+            cleared++;
+        }
+        return cleared;
+    }
+
+    int stageCount() const { return (int)stages.size(); }
+    const std::string &stageName(int stage) const { return stages[stage]->name; }
+
+    std::vector<StageReport> report() const
+    {
+        double elapsedNs = (double)((running ? nowNs() : stopNs) - startNs);
+        std::vector<StageReport> reports;
+        for (auto &stage : stages)
+        {
+            const Stage &s = *stage;
+            StageReport r;
+            r.name = s.name;
+            r.workers = s.workers;
+            r.capacity = s.queue ? s.queue->capacity() : 0;
+            r.queued = s.queue ? s.queue->size() : 0;
+            r.in = s.in.load();
+            r.out = s.out.load();
+            r.dropped = s.dropped.load();
+            r.filtered = s.filtered.load();
+            r.errors = s.errors.load();
+            uint64_t samples = s.occupancySamples.load();
+            r.meanOccupancy = samples ? (double)s.occupancySum.load() / samples : 0;
+            r.maxOccupancy = (double)s.occupancyMax.load();
+            r.utilization = elapsedNs > 0 ? s.busyNs.load() / (s.workers * elapsedNs) : 0;
+            r.blockedS = s.blockedNs.load() / 1e9;
+            r.waitP50Ms = s.wait.quantileMs(0.5);
+            r.waitP99Ms = s.wait.quantileMs(0.99);
+            r.serviceMeanMs = s.service.meanMs();
+            r.serviceP50Ms = s.service.quantileMs(0.5);
+            r.serviceP99Ms = s.service.quantileMs(0.99);
+            r.throughput = elapsedNs > 0 ? r.out / (elapsedNs / 1e9) : 0;
+            reports.push_back(r);
+        }
+        // A source is paced by its input (a camera), so only queued stages can be the bottleneck
+        auto busiest = std::max_element(reports.begin(), reports.end(), [](const StageReport &a, const StageReport &b) {
+            return (a.capacity ? a.utilization : -1) < (b.capacity ? b.utilization : -1);
+        });
+        if (busiest != reports.end() && busiest->capacity && busiest->utilization > 0)
+            busiest->bottleneck = true;
+        return reports;
+    }
+
+    void printReport(FILE *out = stdout) const
+    {
+        fprintf(out, "%-12s %3s %7s %8s %8s %7s %6s %6s %7s %9s %9s %9s %8s\n", "stage", "wk", "queue", "in", "out",
+                "drop", "occ", "busy", "fps", "wait p50", "svc p50", "svc p99", "blocked");
+        for (const StageReport &r : report())
+        {
+            char queue[24];
+            if (r.capacity)
+                snprintf(queue, sizeof queue, "%zu/%zu", r.queued, r.capacity);
+            else
+                snprintf(queue, sizeof queue, "-");
+            fprintf(out, "%-12s %3d %7s %8llu %8llu %7llu %6.2f %5.0f%% %7.1f %7.2fms %7.2fms %7.2fms %7.2fs%s\n",
+                    r.name.c_str(), r.workers, queue, (unsigned long long)r.in, (unsigned long long)r.out,
+                    (unsigned long long)r.dropped, r.meanOccupancy, 100 * r.utilization, r.throughput, r.waitP50Ms,
+                    r.serviceP50Ms, r.serviceP99Ms, r.blockedS, r.bottleneck ? "  <- bottleneck" : "");
+        }
+    }
+
+private:
+    struct Item
+    {
+        uint64_t value = 0;
+        uint64_t enqueuedNs = 0;
+    };
+
+    struct Stage
+    {
+        Stage(const std::string &name, int workers, size_t capacity, Overflow overflow)
+            : name(name), workers(std::max(workers, 1)), overflow(overflow)
+        {
+            if (capacity > 0)
+                queue = std::make_unique<BoundedQueue<Item>>(capacity);
+        }
+
+        std::string name;
+        int workers;
+        Overflow overflow;
+        bool source = false;
+        int downstream = -1;
+        StageFn fn;
+        Release releaseIn, releaseOut;
+        std::unique_ptr<BoundedQueue<Item>> queue;
+
+        std::atomic<uint64_t> in{0}, out{0}, dropped{0}, filtered{0}, errors{0};
+        std::atomic<uint64_t> busyNs{0}, blockedNs{0};
+        std::atomic<uint64_t> occupancySum{0}, occupancySamples{0}, occupancyMax{0};
+        LatencyHistogram wait, service;
+    };
+
+    // Spin, then yield, then sleep up to a millisecond while there is nothing to
+    // do: an idle stage costs next to no CPU and adds at most that to the wait
+    class Backoff
+    {
+    public:
+        void idle()
+        {
+            if (rounds < 64)
+            {
+                rounds++;
+            }
+            else if (rounds < 128)
+            {
+                rounds++;
+                std::this_thread::yield();
+            }
+            else
+            {
+                sleepUs = std::min(sleepUs * 2, 1000);
+                std::this_thread::sleep_for(std::chrono::microseconds(sleepUs));
+            }
+        }
+
+        void reset()
+        {
+            rounds = 0;
+            sleepUs = 25;
+        }
+
+    private:
+        int rounds = 0;
+        int sleepUs = 25;
+    };
+
+    template <typename T>
+    static Release deleter()
+    {
+        return [](uint64_t value) { delete (T *)(uintptr_t)value; };
+    }
+
+    static void release(const Release &fn, uint64_t value)
+    {
+        if (fn)
+            fn(value);
+    }
+
+    int addStage(std::unique_ptr<Stage> stage, int upstream)
+    {
+        int index = (int)stages.size();
+        if (upstream >= 0 && upstream < index)
+            stages[upstream]->downstream = index;
+        stages.push_back(std::move(stage));
+        return index;
+    }
+
+    bool push(Stage &stage, uint64_t value)
+    {
+        Item item{value, nowNs()};
+        switch (stage.overflow)
+        {
+        case Overflow::BLOCK:
+            if (!stage.queue->tryPush(item))
+            {
+                Backoff backoff;
+                uint64_t since = nowNs();
+                while (!stage.queue->tryPush(item))
+                {
+                    if (stopping)
+                    {
+                        release(stage.releaseIn, value);
+                        stage.dropped++;
+                        return false;
+                    }
+                    backoff.idle();
+                }
+                stage.blockedNs += nowNs() - since;
+            }
+            break;
+        case Overflow::DROP_OLDEST:
+            while (!stage.queue->tryPush(item))
+            {
+                Item oldest;
+                if (stage.queue->tryPop(oldest))
+                {
+                    release(stage.releaseIn, oldest.value);
+                    stage.dropped++;
+                }
+            }
+            break;
+        case Overflow::DROP_NEWEST:
+            if (!stage.queue->tryPush(item))
+            {
+                release(stage.releaseIn, value);
+                stage.dropped++;
+                return false;
+            }
+            break;
+        }
+        stage.in++;
+        uint64_t depth = stage.queue->size();
+        stage.occupancySum += depth;
+        stage.occupancySamples++;
+        uint64_t seen = stage.occupancyMax.load(std::memory_order_relaxed);
+        while (depth > seen && !stage.occupancyMax.compare_exchange_weak(seen, depth))
+        {
+        }
+        return true;
+    }
+
+    void forward(Stage &stage, uint64_t value)
+    {
+        stage.out++;
+        if (stage.downstream >= 0)
+            push(*stages[stage.downstream], value);
+        else
+            release(stage.releaseOut, value);
+    }
+
+    void work(Stage &stage)
+    {
+        Backoff backoff;
+        while (!stopping)
+        {
+            Item item;
+            if (!stage.source)
+            {
+                if (!stage.queue->tryPop(item))
+                {
+                    backoff.idle();
+                    continue;
+                }
+                backoff.reset();
+            }
+
+            uint64_t begin = nowNs();
+            if (!stage.source)
+                stage.wait.record(begin - item.enqueuedNs);
+            uint64_t out = 0;
+            int result = stage.fn(item.value, out);
+            uint64_t end = nowNs();
+            if (!stage.source || result != 0)
+            {
+                stage.service.record(end - begin);
+                stage.busyNs += end - begin;
+            }
+
+            if (result > 0)
+            {
+                if (stage.source)
+                {
+                    stage.in++;
+                    backoff.reset();
+                }
+                forward(stage, out);
+            }
+            else
+            {
+                if (result < 0)
+                    stage.errors++;
+                else if (!stage.source && stage.downstream < 0)
+                    stage.out++; // A sink consumed it
+                else if (!stage.source)
+                    stage.filtered++;
+                if (stage.source)
+                    backoff.idle(); // Nothing to decode yet
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Stage>> stages;
+    std::vector<std::thread> threads;
+    std::atomic<bool> stopping{false};
+    bool running = false;
+    uint64_t startNs = 0, stopNs = 0;
+};
+} // namespace frame_pipeline
+
+#endif // FRAME_PIPELINE_H
@@ -0,0 +1,119 @@
+// C interface to frame_pipeline::Pipeline (frame_pipeline.h) for the Python
+// bindings in Python/frame_pipeline.py, which load it with ctypes.
+// Items are opaque tokens; the stage callbacks map them to Python objects and
+// the release callback forgets the ones the pipeline discards.
+//
+// Build:
+//   g++ -std=c++17 -O2 -pthread -shared -fPIC host/frame_pipeline_capi.cpp -o Python/libframe_pipeline.so
+
+#include "frame_pipeline.h"
+
+using frame_pipeline::Pipeline;
+
+typedef int (*fp_stage_fn)(void *ctx, uint64_t in, uint64_t *out);
+typedef void (*fp_release_fn)(void *ctx, uint64_t token);
+
+namespace
+{
+struct Handle
+{
+    Pipeline pipeline;
+    Pipeline::Release release;
+};
+
+Pipeline::StageFn stageFn(fp_stage_fn fn, void *ctx)
+{
+    return [fn, ctx](uint64_t in, uint64_t &out) { return fn(ctx, in, &out); };
+}
+
+// Field order of fp_stage_stats(); Python/frame_pipeline.py names them in STAT_FIELDS
+constexpr int STAT_COUNT = 18;
+} // namespace
+
+extern "C"
+{
+    int fp_stats_size()
+    {
+        return STAT_COUNT;
+    }
+
+    void *fp_create(fp_release_fn release, void *ctx)
+    {
+        auto handle = new Handle();
+        handle->release = [release, ctx](uint64_t token) { release(ctx, token); };
+        return handle;
+    }
+
+    void fp_destroy(void *p)
+    {
+        delete static_cast<Handle *>(p);
+    }
+
+    int fp_add_source(void *p, const char *name, int workers, fp_stage_fn fn, void *ctx)
+    {
+        auto handle = static_cast<Handle *>(p);
+        return handle->pipeline.addSource(name, workers, stageFn(fn, ctx), handle->release);
+    }
+
+    // upstream < 0 for a stage fed only by fp_submit(); overflow 0 block, 1 drop oldest, 2 drop newest
+    int fp_add_stage(void *p, const char *name, int upstream, int workers, int capacity, int overflow,
+                     fp_stage_fn fn, void *ctx)
+    {
+        auto handle = static_cast<Handle *>(p);
+        frame_pipeline::StageOptions options;
+        options.workers = workers;
+        options.capacity = capacity > 0 ? (size_t)capacity : 1;
+        options.overflow = static_cast<frame_pipeline::Overflow>(overflow);
+        return handle->pipeline.addStage(name, upstream < 0 ? Pipeline::NO_UPSTREAM : upstream, options,
+                                         stageFn(fn, ctx), handle->release, handle->release);
+    }
+
+    // 1 if queued, 0 if the overflow policy discarded it (it was released)
+    int fp_submit(void *p, int stage, uint64_t token)
+    {
+        return static_cast<Handle *>(p)->pipeline.submit(stage, token) ? 1 : 0;
+    }
+
+    void fp_start(void *p)
+    {
+        static_cast<Handle *>(p)->pipeline.start();
+    }
+
+    void fp_stop(void *p)
+    {
+        static_cast<Handle *>(p)->pipeline.stop();
+    }
+
+    int fp_clear(void *p, int stage)
+    {
+        return (int)static_cast<Handle *>(p)->pipeline.clear(stage);
+    }
+
+    int fp_stage_count(void *p)
+    {
+        return static_cast<Handle *>(p)->pipeline.stageCount();
+    }
+
+    const char *fp_stage_name(void *p, int stage)
+    {
+        return static_cast<Handle *>(p)->pipeline.stageName(stage).c_str();
+    }
+
+    // STAT_COUNT doubles per stage, stage after stage
+    void fp_stats(void *p, double *out)
+    {
+        int i = 0;
+        for (const auto &r : static_cast<Handle *>(p)->pipeline.report())
+        {
+            double fields[STAT_COUNT] = {
+                (double)r.workers,  (double)r.capacity, (double)r.queued,  (double)r.in,
+                (double)r.out,      (double)r.dropped,  (double)r.filtered, (double)r.errors,
+                r.meanOccupancy,    r.maxOccupancy,     r.utilization,      r.blockedS,
+                r.waitP50Ms,        r.waitP99Ms,        r.serviceMeanMs,    r.serviceP50Ms,
+                r.serviceP99Ms,     r.throughput,
+            };
+            for (double field : fields)
+                out[i++] = field;
+        }
+    }
+}
@@ -0,0 +1,299 @@
+#ifndef HOST_BROKER_H
+#define HOST_BROKER_H
+
+// In-process MQTT broker for the host build.
+// Sessions belong to PubSubClient shims (one per sketch) or to host tools that
+// stand in for the Python detector. Messages are queued per session and handed
+// to the sketch one per mqtt_client.loop() call, like the real client does.
+//
+// An optional fault plan (setFaults) makes the network misbehave the way the
+// field does, reproducibly from its seed: per-topic latency and jitter (which
+// also reorders messages), loss and duplication, and the broker dropping
+// sessions and refusing reconnects for a while.
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "host_runtime.h"
+
+struct HostMessage
+{
+    std::string topic;
+    std::string payload;
+    bool retained;
+    uint64_t deliverAt; // Virtual time at which the session may receive it
+};
+
+struct HostSession
+{
+    std::string clientId;
+    std::vector<std::string> filters;
+    std::deque<HostMessage> inbox; // Ordered by deliverAt
+    bool connected = false;
+    uint64_t dropAt = 0;    // Virtual time of the next fault-plan disconnect, 0 before one is drawn
+    uint64_t downUntil = 0; // Reconnects are refused until then
+};
+
+// Faults for deliveries of topics matching `filter`; the first matching rule of a plan applies
+struct HostFaultRule
+{
+    std::string filter = "#";
+    double latencyMs = 0; // Fixed delay of every delivery
+    double jitterMs = 0;  // Mean of an exponential extra delay; later messages can overtake earlier ones
+    double loss = 0;      // Probability that a delivery is dropped
+    double duplicate = 0; // Probability that a delivery arrives twice, each copy with its own delay
+};
+
+struct HostFaultPlan
+{
+    std::vector<HostFaultRule> rules;
+    double disconnectsPerHour = 0; // Mean rate at which the broker drops each session
+    double outageMs = 0;           // How long connect() fails after a drop
+    uint32_t seed = 1;
+};
+
+struct HostFaultStats
+{
+    uint64_t delivered = 0;
+    uint64_t lost = 0;
+    uint64_t duplicated = 0;
+    uint64_t reordered = 0; // Deliveries queued ahead of an earlier message
+    uint64_t disconnects = 0;
+    uint64_t refusedConnects = 0;
+};
+
+class HostBroker
+{
+public:
+    // MQTT topic filter matching with '+' and '#' wildcards
+    static bool topicMatches(const std::string &filter, const std::string &topic)
+    {
+        size_t f = 0;
+        size_t t = 0;
+        while (f < filter.size())
+        {
+            if (filter[f] == '#')
+            {
+                return true;
+            }
+            if (filter[f] == '+')
+            {
+                while (t < topic.size() && topic[t] != '/')
+                    t++;
+                f++;
+                continue;
+            }
+            if (t >= topic.size() || filter[f] != topic[t])
+            {
+                // "a/#" also matches the parent level "a"
+                return t >= topic.size() && filter.compare(f, std::string::npos, "/#") == 0;
+            }
+            f++;
+            t++;
+        }
+        return t == topic.size();
+    }
+
+    // False while a fault-plan outage of this session lasts
+    bool connect(HostSession *session)
+    {
+        if (hostScheduler().now() < session->downUntil)
+        {
+            faultCounts.refusedConnects++;
+            return false;
+        }
+        session->connected = true;
+        session->dropAt = 0;
+        for (auto *s : sessions)
+        {
+            if (s == session)
+                return true;
+        }
+        sessions.push_back(session);
+        return true;
+    }
+
+    void disconnect(HostSession *session)
+    {
+        session->connected = false;
+        session->filters.clear();
+        session->inbox.clear();
+    }
+
+    void subscribe(HostSession *session, const std::string &filter)
+    {
+        session->filters.push_back(filter);
+
+        // Retained messages are delivered right after subscribing
+        for (auto &kv : retainedMessages)
+        {
+            if (topicMatches(filter, kv.first))
+            {
+                deliver(session, {kv.first, kv.second, true, hostScheduler().now()});
+            }
+        }
+    }
+
+    void publish(const std::string &topic, const std::string &payload, bool retained = false)
+    {
+        publishedCount++;
+        if (retained)
+        {
+            if (payload.empty())
+                retainedMessages.erase(topic);
+            else
+                retainedMessages[topic] = payload;
+        }
+
+        for (auto &tap : taps)
+        {
+            tap(topic, payload);
+        }
+
+        for (auto *session : sessions)
+        {
+            if (!session->connected)
+                continue;
+            for (auto &filter : session->filters)
+            {
+                if (topicMatches(filter, topic))
+                {
+                    deliver(session, {topic, payload, false, hostScheduler().now()});
+                    break;
+                }
+            }
+        }
+    }
+
+    // Next message the session may receive at the current virtual time
+    bool poll(HostSession *session, HostMessage &out)
+    {
+        if (dropDue(session))
+        {
+            return false;
+        }
+        if (session->inbox.empty() || session->inbox.front().deliverAt > hostScheduler().now())
+        {
+            return false;
+        }
+        out = session->inbox.front();
+        session->inbox.pop_front();
+        return true;
+    }
+
+    // Observe every published message (used by tools for tracing)
+    void addTap(std::function<void(const std::string &, const std::string &)> tap)
+    {
+        taps.push_back(tap);
+    }
+
+    uint64_t published() const
+    {
+        return publishedCount;
+    }
+
+    // Start injecting faults; an empty plan restores the perfect network
+    void setFaults(const HostFaultPlan &plan)
+    {
+        faults = plan;
+        faultRng.seed(plan.seed);
+        faultsOn = !plan.rules.empty() || plan.disconnectsPerHour > 0;
+    }
+
+    const HostFaultStats &faultStats() const
+    {
+        return faultCounts;
+    }
+
+private:
+    // Queue one delivery, through the fault plan if one is set
+    void deliver(HostSession *session, HostMessage message)
+    {
+        const HostFaultRule *rule = faultsOn ? ruleFor(message.topic) : nullptr;
+        if (rule == nullptr)
+        {
+            session->inbox.push_back(message);
+            faultCounts.delivered++;
+            return;
+        }
+        if (chance(rule->loss))
+        {
+            faultCounts.lost++;
+            return;
+        }
+        int copies = chance(rule->duplicate) ? 2 : 1;
+        faultCounts.duplicated += copies - 1;
+        uint64_t sent = message.deliverAt;
+        for (int c = 0; c < copies; c++)
+        {
+            double delay = rule->latencyMs;
+            if (rule->jitterMs > 0)
+                delay += std::exponential_distribution<double>(1.0 / rule->jitterMs)(faultRng);
+            message.deliverAt = sent + (uint64_t)delay;
+            // Stable insert by delivery time; anything it lands in front of was sent earlier
+            auto at = session->inbox.end();
+            while (at != session->inbox.begin() && std::prev(at)->deliverAt > message.deliverAt)
+                --at;
+            if (at != session->inbox.end())
+                faultCounts.reordered++;
+            session->inbox.insert(at, message);
+            faultCounts.delivered++;
+        }
+    }
+
+    const HostFaultRule *ruleFor(const std::string &topic) const
+    {
+        for (auto &rule : faults.rules)
+        {
+            if (topicMatches(rule.filter, topic))
+                return &rule;
+        }
+        return nullptr;
+    }
+
+    bool chance(double p)
+    {
+        return p > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(faultRng) < p;
+    }
+
+    // Drop the session when its next fault-plan disconnect is due; the queued messages are lost
+    bool dropDue(HostSession *session)
+    {
+        if (!faultsOn || faults.disconnectsPerHour <= 0)
+            return false;
+        uint64_t now = hostScheduler().now();
+        if (session->dropAt == 0)
+        {
+            double meanMs = 3600000.0 / faults.disconnectsPerHour;
+            session->dropAt = now + 1 + (uint64_t)std::exponential_distribution<double>(1.0 / meanMs)(faultRng);
+        }
+        if (now < session->dropAt)
+            return false;
+        disconnect(session);
+        session->downUntil = now + (uint64_t)faults.outageMs;
+        faultCounts.disconnects++;
+        return true;
+    }
+
+    std::vector<HostSession *> sessions;
+    std::map<std::string, std::string> retainedMessages;
+    std::vector<std::function<void(const std::string &, const std::string &)>> taps;
+    uint64_t publishedCount = 0;
+    HostFaultPlan faults;
+    bool faultsOn = false;
+    std::mt19937 faultRng;
+    HostFaultStats faultCounts;
+};
+
+inline HostBroker &hostBroker()
+{
+    static HostBroker broker;
+    return broker;
+}
+
+#endif // HOST_BROKER_H
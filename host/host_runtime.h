@@ -0,0 +1,275 @@
+#ifndef HOST_RUNTIME_H
+#define HOST_RUNTIME_H
+
+// Host runtime for running the ESP32 lane sketches on a PC.
+//
+// Every sketch runs on its own thread, but only one thread is ever allowed to
+// run at a time. delay() hands control back to the scheduler, which advances a
+// virtual clock straight to the next wake-up. This keeps the blocking style of
+// the firmware (delay(1000), countdownTimer(), permission waits) intact while
+// running many times faster than real time.
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Per-board state that the Arduino shims read and write
+struct HostDevice
+{
+    std::string name;
+    int pins[40];
+    int pinModes[40];
+    bool serialEcho = false; // Print Serial output of this board to stdout
+    std::string serialLine;
+    std::map<std::string, std::string> nvs; // Preferences storage, "namespace/key" -> bytes
+    std::map<std::string, std::string> files; // SPIFFS contents, path -> bytes
+
+    // App slots ota_0 and ota_1 for the esp_ota_ops.h shim
+    std::string otaSlots[2];  // Image bytes written so far
+    int otaState[2] = {2, 2}; // esp_ota_img_states_t, ESP_OTA_IMG_VALID
+    int otaRunning = 0;
+    int otaBoot = 0;
+    unsigned boots = 0; // esp_restart() count; tasks started before the last restart end
+
+    explicit HostDevice(const std::string &deviceName = "host") : name(deviceName)
+    {
+        for (int i = 0; i < 40; i++)
+        {
+            pins[i] = 0;
+            pinModes[i] = 0;
+        }
+    }
+};
+
+// Thrown out of delay() when the scheduler shuts down so that sketch threads unwind
+struct HostTaskStop
+{
+};
+
+// Thrown by esp_restart(); startLaneSketches() and startIntersectionSketch() run setup() again
+struct HostRestart
+{
+};
+
+class VirtualScheduler
+{
+public:
+    ~VirtualScheduler()
+    {
+        shutdown();
+    }
+
+    uint64_t now() const
+    {
+        return nowMs;
+    }
+
+    // Local wall-clock time (seconds since 1970, no timezone applied) at virtual time 0
+    void setEpoch(time_t epoch)
+    {
+        epochSec = epoch;
+    }
+
+    time_t epoch() const
+    {
+        return epochSec;
+    }
+
+    // Start a sketch: body normally runs setup() and then loop() forever. Sketches call this
+    // too, for FreeRTOS tasks of their own (xTaskCreatePinnedToCore).
+    void spawn(HostDevice *device, std::function<void()> body)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<Task> task(new Task());
+        task->device = device;
+        task->boot = device->boots;
+        task->wakeAt = nowMs;
+        task->seq = nextSeq++;
+        Task *raw = task.get();
+        tasks.push_back(std::move(task));
+        raw->thread = std::thread([this, raw, body]() { taskMain(raw, body); });
+    }
+
+    // Called from a sketch thread: sleep for ms of virtual time
+    void sleep(uint64_t ms)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        Task *self = current;
+        if (self == nullptr)
+        {
+            // Called from the driver thread, just move the clock
+            nowMs += ms;
+            return;
+        }
+        self->wakeAt = nowMs + ms;
+        self->seq = nextSeq++;
+        current = nullptr;
+        driverCv.notify_one();
+        self->cv.wait(lock, [&]() { return self->go || stopping; });
+        // A task the device started before its last restart is gone
+        if (stopping || self->boot != self->device->boots)
+        {
+            throw HostTaskStop();
+        }
+        self->go = false;
+    }
+
+    // Called from a sketch thread by esp_restart(): the calling task carries on as the
+    // restarted sketch, every other task of its device ends at its next wake-up
+    void restartDevice()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (current != nullptr)
+        {
+            current->boot = ++current->device->boots;
+        }
+    }
+
+    // Run all sketches until virtual time reaches endMs
+    void runUntil(uint64_t endMs)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            Task *next = nullptr;
+            for (auto &task : tasks)
+            {
+                if (task->finished)
+                    continue;
+                if (next == nullptr || task->wakeAt < next->wakeAt ||
+                    (task->wakeAt == next->wakeAt && task->seq < next->seq))
+                {
+                    next = task.get();
+                }
+            }
+
+            if (next == nullptr || next->wakeAt > endMs)
+            {
+                break;
+            }
+
+            if (next->wakeAt > nowMs)
+            {
+                nowMs = next->wakeAt;
+            }
+            current = next;
+            next->go = true;
+            next->cv.notify_one();
+            driverCv.wait(lock, [&]() { return current == nullptr; });
+        }
+
+        if (endMs > nowMs)
+        {
+            nowMs = endMs;
+        }
+    }
+
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            for (auto &task : tasks)
+            {
+                task->cv.notify_one();
+            }
+        }
+        for (auto &task : tasks)
+        {
+            if (task->thread.joinable())
+            {
+                task->thread.join();
+            }
+        }
+        tasks.clear();
+    }
+
+    // Device of the sketch that is currently running (nullptr on the driver thread)
+    static HostDevice *&currentDevice()
+    {
+        static thread_local HostDevice *device = nullptr;
+        return device;
+    }
+
+private:
+    struct Task
+    {
+        HostDevice *device = nullptr;
+        unsigned boot = 0; // device->boots when the task started
+        uint64_t wakeAt = 0;
+        uint64_t seq = 0;
+        bool go = false;
+        bool finished = false;
+        std::condition_variable cv;
+        std::thread thread;
+    };
+
+    void taskMain(Task *self, std::function<void()> body)
+    {
+        currentDevice() = self->device;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            self->cv.wait(lock, [&]() { return self->go || stopping; });
+            if (stopping)
+            {
+                self->finished = true;
+                return;
+            }
+            self->go = false;
+        }
+
+        try
+        {
+            body();
+        }
+        catch (const HostTaskStop &)
+        {
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        self->finished = true;
+        if (current == self)
+        {
+            current = nullptr;
+            driverCv.notify_one();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable driverCv;
+    std::vector<std::unique_ptr<Task>> tasks;
+    Task *current = nullptr;
+    uint64_t nowMs = 0;
+    uint64_t nextSeq = 0;
+    time_t epochSec = 0;
+    bool stopping = false;
+};
+
+inline VirtualScheduler &hostScheduler()
+{
+    static VirtualScheduler scheduler;
+    return scheduler;
+}
+
+// Device used when shims are called from the driver thread
+inline HostDevice &hostDriverDevice()
+{
+    static HostDevice device("driver");
+    return device;
+}
+
+inline HostDevice &hostCurrentDevice()
+{
+    HostDevice *device = VirtualScheduler::currentDevice();
+    return device != nullptr ? *device : hostDriverDevice();
+}
+
+#endif // HOST_RUNTIME_H
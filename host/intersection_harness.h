@@ -0,0 +1,204 @@
+#ifndef INTERSECTION_HARNESS_H
+#define INTERSECTION_HARNESS_H
+
+// One intersection made of the four host-built lane sketches.
+// Traffic models (SUMO, the built-in simulator) feed vehicle counts in the same
+// JSON format the Python detector publishes, advance virtual time and read the
+// resulting signal state of every lane.
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+#include "host_broker.h"
+#include "host_runtime.h"
+#include "lane_sketches.h"
+
+#include "../esp32_arduino_ide/esp32_lane1/lane_policy.h"
+#include "../esp32_arduino_ide/esp32_lane1/lane_config.h"
+#include "../esp32_arduino_ide/esp32_lane1/phase_engine.h"
+#include "../esp32_arduino_ide/esp32_lane1/mqtt_topics.h"
+#include "../esp32_arduino_ide/esp32_lane1/saturation_flow.h"
+
+class IntersectionHarness
+{
+public:
+    IntersectionHarness()
+        : devices{HostDevice("lane1"), HostDevice("lane2"), HostDevice("lane3"), HostDevice("lane4")}
+    {
+        setConflicts(lane_config::defaults().conflicts);
+    }
+
+    ~IntersectionHarness()
+    {
+        hostScheduler().shutdown();
+    }
+
+    void setSerialEcho(bool echo)
+    {
+        for (auto &device : devices)
+            device.serialEcho = echo;
+    }
+
+    // localStart is the local wall-clock time the boards see at virtual time 0.
+    // singleBoard runs esp32_intersection on one device instead of the four lane boards.
+    void start(time_t localStart, bool singleBoard = false)
+    {
+        hostScheduler().setEpoch(localStart);
+        this->singleBoard = singleBoard;
+        if (singleBoard)
+            startIntersectionSketch(devices[0]);
+        else
+            startLaneSketches(devices);
+    }
+
+    // Publish a count for one lane the way the Python detector does
+    void publishCount(int lane, int vehicles)
+    {
+        std::string message = "{\"road_section_id\": " + std::to_string(lane) +
+                              ", \"total_vehicles\": " + std::to_string(vehicles) +
+                              ", \"timestamp\": \"" + timestamp() + "\"}";
+        char topic[mqtt_topics::MAX_TOPIC];
+        hostBroker().publish(mqtt_topics::laneTopic(topic, lane, "vehicle_count"), message, true);
+    }
+
+    // Publish the stop line crossings of one green the way the Python detector does
+    void publishDischarge(int lane, const saturation_flow::GreenDischarge &green, float greenSeconds)
+    {
+        char buffer[192];
+        snprintf(buffer, sizeof(buffer),
+                 "{\"road_section_id\": %d, \"crossings\": %u, \"headways\": %u, \"saturated_s\": %.2f, "
+                 "\"green_s\": %.1f, \"timestamp\": \"%s\"}",
+                 lane, (unsigned)green.crossings, (unsigned)green.headways, green.saturatedS, greenSeconds,
+                 timestamp().c_str());
+        char topic[mqtt_topics::MAX_TOPIC];
+        hostBroker().publish(mqtt_topics::laneTopic(topic, lane, "discharge"), buffer, false);
+    }
+
+    // Run the boards up to virtual time ms and update per-lane statistics
+    void advanceTo(uint64_t ms)
+    {
+        hostScheduler().runUntil(ms);
+        bool anyGreen = false;
+        for (int i = 0; i < 4; i++)
+        {
+            HostLightState state = light(i + 1);
+            if (state.green)
+            {
+                if (!wasGreen[i])
+                    greenStarts[i]++;
+                greenMs[i] += ms - lastSampleMs;
+            }
+            wasGreen[i] = state.green;
+            anyGreen = anyGreen || state.green;
+        }
+        // Lost time: no approach has green (leading all red, pre-yellow, yellow, clearance red)
+        if (!anyGreen)
+        {
+            if (hadGreen)
+                phaseChanges++;
+            lostMs += ms - lastSampleMs;
+        }
+        hadGreen = anyGreen;
+        lastSampleMs = ms;
+    }
+
+    HostLightState light(int lane) const
+    {
+        return singleBoard ? hostIntersectionSketch.light(lane) : hostLaneSketches[lane - 1].light();
+    }
+
+    // SUMO signal character for a lane: G, y or r
+    char signalChar(int lane) const
+    {
+        HostLightState state = light(lane);
+        if (state.green)
+            return 'G';
+        if (state.yellow)
+            return 'y';
+        return 'r';
+    }
+
+    // Save a config blob in every board's NVS before start(), as if it had been
+    // received earlier, and check conflicts against its matrix
+    lane_config::ParseResult storeConfig(const std::string &blob)
+    {
+        lane_config::LaneConfig config;
+        lane_config::ParseResult result = lane_config::parse((const uint8_t *)blob.data(), blob.size(), config);
+        if (result != lane_config::CONFIG_OK)
+            return result;
+        for (auto &device : devices)
+            device.nvs["lane_config/blob"] = blob;
+        setConflicts(config.body.conflicts);
+        return result;
+    }
+
+    // Conflict matrix used by conflictCount(); defaults to the boards' compiled-in one
+    void setConflicts(const uint8_t matrix[4])
+    {
+        phases.setConflicts(matrix);
+    }
+
+    // Pairs of conflicting lanes that are green or yellow at the same time
+    int conflictCount() const
+    {
+        int count = 0;
+        for (int a = 1; a <= 4; a++)
+        {
+            for (int b = a + 1; b <= 4; b++)
+            {
+                HostLightState first = light(a), second = light(b);
+                if (phases.conflicts(a, b) && (first.green || first.yellow) && (second.green || second.yellow))
+                    count++;
+            }
+        }
+        return count;
+    }
+
+    // Number of lanes that are green right now
+    int greenCount() const
+    {
+        int count = 0;
+        for (int lane = 1; lane <= 4; lane++)
+            count += light(lane).green ? 1 : 0;
+        return count;
+    }
+
+    std::string timestamp() const
+    {
+        time_t t = hostScheduler().epoch() + (time_t)(hostScheduler().now() / 1000);
+        struct tm info;
+        gmtime_r(&t, &info);
+        char buffer[20];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &info);
+        return buffer;
+    }
+
+    HostDevice devices[4];
+    uint64_t greenStarts[4] = {0, 0, 0, 0};
+    uint64_t greenMs[4] = {0, 0, 0, 0};
+    uint64_t lostMs = 0;
+    uint64_t phaseChanges = 0; // Green to no-green transitions
+
+private:
+    phase_engine::PhaseEngine phases;
+    bool singleBoard = false;
+    bool wasGreen[4] = {false, false, false, false};
+    bool hadGreen = false;
+    uint64_t lastSampleMs = 0;
+};
+
+// Local time for "YYYY-MM-DD" at the given hour, as seen by the boards
+inline time_t hostLocalTime(int year, int month, int day, int hour, int minute = 0)
+{
+    struct tm info = {};
+    info.tm_year = year - 1900;
+    info.tm_mon = month - 1;
+    info.tm_mday = day;
+    info.tm_hour = hour;
+    info.tm_min = minute;
+    return timegm(&info);
+}
+
+#endif // INTERSECTION_HARNESS_H
@@ -0,0 +1,93 @@
+// Builds the unmodified lane sketches against the shims in host/shim.
+// Headers the sketches include are pulled in here first so that their include
+// guards keep them out of the lane namespaces below.
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <PubSubClient.h>
+#include <WiFi.h>
+#include <esp_ota_ops.h>
+#include <esp_task_wdt.h>
+
+// Generated policy table, runtime config and plan schedule, phase engine, cycle accounting,
+// demand forecast and intersection snapshot, identical in every sketch folder
+#include "../esp32_arduino_ide/esp32_lane1/lane_policy.h"
+#include "../esp32_arduino_ide/esp32_lane1/plan_schedule.h"
+#include "../esp32_arduino_ide/esp32_lane1/lane_config.h"
+#include "../esp32_arduino_ide/esp32_lane1/phase_engine.h"
+#include "../esp32_arduino_ide/esp32_lane1/cycle_accounting.h"
+#include "../esp32_arduino_ide/esp32_lane1/mqtt_topics.h"
+#include "../esp32_arduino_ide/esp32_lane1/demand_forecast.h"
+#include "../esp32_arduino_ide/esp32_lane1/saturation_flow.h"
+#include "../esp32_arduino_ide/esp32_lane1/intersection_snapshot.h"
+#include "../esp32_arduino_ide/esp32_lane1/loop_watchdog.h"
+#include "../esp32_arduino_ide/esp32_lane1/ota_update.h"
+
+#include "lane_sketches.h"
+
+namespace lane1
+{
+#include "../esp32_arduino_ide/esp32_lane1/esp32_lane1.ino"
+}
+
+namespace lane2
+{
+#include "../esp32_arduino_ide/esp32_lane2/esp32_lane2.ino"
+}
+
+namespace lane3
+{
+#include "../esp32_arduino_ide/esp32_lane3/esp32_lane3.ino"
+}
+
+namespace lane4
+{
+#include "../esp32_arduino_ide/esp32_lane4/esp32_lane4.ino"
+}
+
+namespace intersection
+{
+#include "../esp32_arduino_ide/esp32_intersection/esp32_intersection.ino"
+}
+
+// What a board loses in esp_restart(): resetAllData() covers the signal state, and the last
+// snapshot goes too, so the retained one is taken up again after connecting
+#define HOST_RESTART(ns)                                         \
+    []() {                                                       \
+        ns::resetAllData();                                      \
+        ns::snapshot = intersection_snapshot::Snapshot();        \
+    }
+
+#define HOST_LANE_SKETCH(ns)                                                         \
+    {                                                                                \
+        ns::LANE_ID, ns::setup, ns::loop,                                            \
+            []() -> HostLightState {                                                 \
+                return HostLightState{ns::light.red, ns::light.yellow, ns::light.green}; \
+            },                                                                       \
+            HOST_RESTART(ns), lane_policy::greenSeconds, ns::isJamSibuk              \
+    }
+
+const HostLaneSketch hostLaneSketches[4] = {
+    HOST_LANE_SKETCH(lane1),
+    HOST_LANE_SKETCH(lane2),
+    HOST_LANE_SKETCH(lane3),
+    HOST_LANE_SKETCH(lane4),
+};
+
+const HostIntersectionSketch hostIntersectionSketch = {
+    intersection::setup, intersection::loop,
+    [](int section) -> HostLightState {
+        const intersection::TrafficLight &head = intersection::heads[section - 1];
+        return HostLightState{head.red, head.yellow, head.green};
+    },
+    HOST_RESTART(intersection),
+};
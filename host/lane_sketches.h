@@ -0,0 +1,93 @@
+#ifndef LANE_SKETCHES_H
+#define LANE_SKETCHES_H
+
+// The four esp32_laneN.ino sketches and the single-board esp32_intersection.ino
+// sketch compiled for the host. Each sketch lives in its own namespace (lane1..lane4,
+// intersection) so their globals do not clash, and runs as one board on the
+// virtual scheduler.
+
+#include "host_runtime.h"
+
+struct HostLightState
+{
+    bool red;
+    bool yellow;
+    bool green;
+};
+
+struct HostLaneSketch
+{
+    int laneId;
+    void (*setup)();
+    void (*loop)();
+    HostLightState (*light)();
+    void (*reset)(); // Clears what RAM a board loses in esp_restart()
+
+    // Controller logic of the sketch, for tools that model the lane without running it
+    float (*greenSeconds)(float kendaraan, bool jamSibuk);
+    bool (*isJamSibuk)(int jam);
+};
+
+extern const HostLaneSketch hostLaneSketches[4];
+
+struct HostIntersectionSketch
+{
+    void (*setup)();
+    void (*loop)();
+    HostLightState (*light)(int section);
+    void (*reset)();
+};
+
+extern const HostIntersectionSketch hostIntersectionSketch;
+
+// Spawn setup() + loop() of every lane on the scheduler, one device per lane.
+// esp_restart() starts over at setup(). Globals keep their values on the host, so the
+// sketch's reset() clears the state a board loses first.
+inline void startLaneSketches(HostDevice devices[4])
+{
+    for (int i = 0; i < 4; i++)
+    {
+        const HostLaneSketch &sketch = hostLaneSketches[i];
+        hostScheduler().spawn(&devices[i], [sketch]() {
+            while (true)
+            {
+                try
+                {
+                    sketch.setup();
+                    while (true)
+                    {
+                        sketch.loop();
+                    }
+                }
+                catch (const HostRestart &)
+                {
+                    sketch.reset();
+                }
+            }
+        });
+    }
+}
+
+// Spawn the single-board controller, which drives all four heads
+inline void startIntersectionSketch(HostDevice &device)
+{
+    hostScheduler().spawn(&device, []() {
+        while (true)
+        {
+            try
+            {
+                hostIntersectionSketch.setup();
+                while (true)
+                {
+                    hostIntersectionSketch.loop();
+                }
+            }
+            catch (const HostRestart &)
+            {
+                hostIntersectionSketch.reset();
+            }
+        }
+    });
+}
+
+#endif // LANE_SKETCHES_H
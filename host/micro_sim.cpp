@@ -0,0 +1,314 @@
+// Driver for the microscopic simulator (micro_sim.h).
+//
+// Default mode runs one intersection controlled by the four host-built lane
+// sketches: halting vehicles per approach are published as vehicle counts,
+// and the lane lights drive the simulator through a TrafficLight array.
+//
+// --bench runs many intersections on fixed-time plans to measure raw kernel
+// throughput in vehicle-updates per second.
+//
+// Build:
+//   g++ -std=c++17 -O3 -march=native -pthread -Ihost/shim host/micro_sim.cpp host/lane_sketches.cpp -o micro_sim
+//
+// Examples:
+//   ./micro_sim --seconds 3600 --rate 1=600 --rate 2=300 --rate 3=600 --rate 4=300
+//   ./micro_sim --bench --intersections 50 --queue 2000 --seconds 300
+//   ./micro_sim --config sequential.bin   (blob from Python/lane_config.py --out)
+//   ./micro_sim --single-board            (esp32_intersection instead of the lane boards)
+//   ./micro_sim --discharge --config saturation.bin   (stop line crossings to the boards, see saturation_flow.h)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include <ArduinoJson.h>
+
+#include "intersection_harness.h"
+#include "micro_sim.h"
+#include "../esp32_arduino_ide/esp32_lane1/cycle_accounting.h"
+#include "../esp32_arduino_ide/esp32_lane1/mqtt_topics.h"
+
+using namespace std;
+
+struct MicroSimOptions
+{
+    bool bench = false;
+    int intersections = 50;
+    int queue = 2000;        // initial standing queue per approach in --bench
+    float seconds = 3600.0f;
+    float timeStep = 0.1f;
+    float laneLength = 250.0f;
+    float rates[4] = {600.0f, 300.0f, 600.0f, 300.0f}; // vehicles per hour per approach
+    int startHour = 8;
+    int countPeriod = 5;
+    bool verbose = false;
+    bool singleBoard = false;
+    bool discharge = false;  // publish each green's stop line crossings, as the detector's line counter does
+    string configPath;       // config blob published retained on traffic/config before start
+};
+
+bool parseOptions(int argc, char **argv, MicroSimOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bench")
+            options.bench = true;
+        else if (arg == "--verbose")
+            options.verbose = true;
+        else if (arg == "--single-board")
+            options.singleBoard = true;
+        else if (arg == "--discharge")
+            options.discharge = true;
+        else if (arg == "--intersections" && hasValue)
+            options.intersections = atoi(argv[++i]);
+        else if (arg == "--queue" && hasValue)
+            options.queue = atoi(argv[++i]);
+        else if (arg == "--seconds" && hasValue)
+            options.seconds = (float)atof(argv[++i]);
+        else if (arg == "--dt" && hasValue)
+            options.timeStep = (float)atof(argv[++i]);
+        else if (arg == "--length" && hasValue)
+            options.laneLength = (float)atof(argv[++i]);
+        else if (arg == "--start-hour" && hasValue)
+            options.startHour = atoi(argv[++i]);
+        else if (arg == "--config" && hasValue)
+            options.configPath = argv[++i];
+        else if (arg == "--count-period" && hasValue)
+            options.countPeriod = atoi(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+        {
+            string value = argv[++i];
+            size_t eq = value.find('=');
+            int lane = atoi(value.substr(0, eq).c_str());
+            if (eq == string::npos || lane < 1 || lane > 4)
+                return false;
+            options.rates[lane - 1] = (float)atof(value.substr(eq + 1).c_str());
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+// Fixed-time plan: each approach gets 30 s green, 3 s yellow, in turn
+void fixedTimeLights(TrafficLight *lights, int intersections, double t)
+{
+    const double green = 30.0;
+    const double yellow = 3.0;
+    const double phase = green + yellow;
+    for (int k = 0; k < intersections; k++)
+    {
+        double local = fmod(t + k * 7.0, 4 * phase); // small offsets between intersections
+        int active = (int)(local / phase);
+        bool isYellow = local - active * phase >= green;
+        for (int lane = 0; lane < 4; lane++)
+        {
+            TrafficLight &light = lights[k * 4 + lane];
+            light.green = lane == active && !isYellow;
+            light.yellow = lane == active && isYellow;
+            light.red = lane != active;
+        }
+    }
+}
+
+int runBench(const MicroSimOptions &options)
+{
+    MicroSim sim(options.timeStep);
+    IdmParams params;
+    float spacing = params.vehicleLength + params.minGap;
+    float length = options.queue * spacing + options.laneLength;
+    for (int k = 0; k < options.intersections; k++)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            int index = sim.addLane(k * 4 + lane, length, options.rates[lane]);
+            sim.seedQueue(index, options.queue);
+        }
+    }
+
+    vector<TrafficLight> lights(options.intersections * 4);
+    int steps = (int)(options.seconds / options.timeStep + 0.5f);
+    int stepsPerSecond = max(1, (int)(1.0f / options.timeStep + 0.5f));
+    cout << "Bench: " << sim.laneCount() << " approaches, " << sim.totalVehicles() << " vehicles, "
+         << steps << " steps of " << options.timeStep << " s" << endl;
+
+    auto wallStart = chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++)
+    {
+        if (s % stepsPerSecond == 0)
+            fixedTimeLights(lights.data(), options.intersections, sim.simTime());
+        sim.step(lights.data());
+    }
+    double wallSec = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+
+    uint64_t discharged = 0;
+    for (int i = 0; i < sim.laneCount(); i++)
+        discharged += sim.stats(i).discharged;
+
+    printf("Vehicle updates: %llu in %.3f s wall\n", (unsigned long long)sim.vehicleUpdates(), wallSec);
+    printf("Throughput: %.1f M vehicle-updates/s (single core), %.0fx real time\n",
+           sim.vehicleUpdates() / wallSec / 1e6, options.seconds / wallSec);
+    printf("Discharged: %llu vehicles, %d still on the network\n", (unsigned long long)discharged, sim.totalVehicles());
+    return 0;
+}
+
+int runWithSketches(const MicroSimOptions &options)
+{
+    MicroSim sim(options.timeStep);
+    for (int lane = 0; lane < 4; lane++)
+        sim.addLane(lane, options.laneLength, options.rates[lane]);
+
+    IntersectionHarness intersection;
+    intersection.setSerialEcho(options.verbose);
+    if (!options.configPath.empty())
+    {
+        ifstream file(options.configPath, ios::binary);
+        string blob((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        lane_config::ParseResult result = intersection.storeConfig(blob);
+        if (result != lane_config::CONFIG_OK)
+        {
+            cerr << options.configPath << ": " << lane_config::describe(result) << endl;
+            return 1;
+        }
+    }
+    // Sum the boards' cycle_stats records: [lane][effective green, clearance, wait, idle]
+    uint64_t cycleMs[4][cycle_accounting::CATEGORIES] = {};
+    uint64_t cycles[4] = {};
+    hostBroker().addTap([&](const string &topic, const string &payload) {
+        if (mqtt_topics::laneOf(topic.c_str(), "cycle_stats") == 0)
+            return;
+        DynamicJsonDocument doc(384);
+        if (deserializeJson(doc, payload))
+            return;
+        int lane = doc["lane_id"];
+        if (lane < 1 || lane > 4)
+            return;
+        cycles[lane - 1]++;
+        JsonArray ms = doc["ms"];
+        for (int c = 0; c < cycle_accounting::CATEGORIES; c++)
+            cycleMs[lane - 1][c] += ms[c].as<unsigned long>();
+    });
+    // Saturation flow each board learnt from the discharge reports, from its duration messages
+    int saturationVph[4] = {};
+    hostBroker().addTap([&](const string &topic, const string &payload) {
+        int lane = mqtt_topics::laneOf(topic.c_str(), "duration");
+        if (lane < 1 || lane > 4)
+            return;
+        DynamicJsonDocument doc(384);
+        if (!deserializeJson(doc, payload) && doc.containsKey("saturation_flow_vph"))
+            saturationVph[lane - 1] = doc["saturation_flow_vph"];
+    });
+    intersection.start(hostLocalTime(2025, 4, 22, options.startHour), options.singleBoard);
+
+    // Same layout as the lights[] array in backup_main.cpp: index = lane - 1
+    TrafficLight lights[4];
+    int stepsPerSecond = max(1, (int)(1.0f / options.timeStep + 0.5f));
+    int seconds = (int)options.seconds;
+    int conflictSeconds = 0;
+
+    // --discharge: vehicles leaving on green are the detector's stop line crossings
+    saturation_flow::GreenDischarge greens[4];
+    double greenStart[4] = {};
+    bool wasGreen[4] = {};
+    uint64_t counted[4] = {};
+
+    auto wallStart = chrono::steady_clock::now();
+    for (int t = 0; t < seconds; t++)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if ((t + lane) % options.countPeriod == 0)
+                intersection.publishCount(lane + 1, sim.stats(lane).halting);
+        }
+
+        intersection.advanceTo((uint64_t)t * 1000);
+        if (intersection.conflictCount() > 0)
+            conflictSeconds++;
+        for (int lane = 0; lane < 4; lane++)
+        {
+            HostLightState state = intersection.light(lane + 1);
+            lights[lane] = TrafficLight{state.red || (!state.yellow && !state.green), state.yellow, state.green};
+            if (options.discharge && state.green != wasGreen[lane])
+            {
+                if (state.green)
+                {
+                    greens[lane].reset();
+                    greenStart[lane] = t;
+                }
+                else
+                {
+                    intersection.publishDischarge(lane + 1, greens[lane], (float)(t - greenStart[lane]));
+                }
+                wasGreen[lane] = state.green;
+            }
+        }
+
+        for (int s = 0; s < stepsPerSecond; s++)
+        {
+            sim.step(lights);
+            for (int lane = 0; lane < 4 && options.discharge; lane++)
+            {
+                for (; counted[lane] < sim.stats(lane).discharged; counted[lane]++)
+                {
+                    if (lights[lane].green)
+                        greens[lane].cross((float)(sim.simTime() - greenStart[lane]));
+                }
+            }
+        }
+    }
+    double wallSec = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+
+    printf("Simulated %d s in %.3f s wall (%.0fx real time), seconds with conflicting greens: %d\n",
+           seconds, wallSec, seconds / wallSec, conflictSeconds);
+    printf("Lane  Arrivals  Discharged  Green starts  Green (s)  Mean delay (s/veh)\n");
+    for (int lane = 0; lane < 4; lane++)
+    {
+        const MicroSim::LaneStats &stats = sim.stats(lane);
+        printf("%4d  %8llu  %10llu  %12llu  %9.0f  %18.1f\n", lane + 1, (unsigned long long)stats.arrivals,
+               (unsigned long long)stats.discharged, (unsigned long long)intersection.greenStarts[lane],
+               intersection.greenMs[lane] / 1000.0, stats.delaySec / max<uint64_t>(1, stats.arrivals));
+    }
+    printf("Lane  Cycles  Effective green  Clearance  Coordination wait  Idle   (%% of closed cycles)\n");
+    for (int lane = 0; lane < 4; lane++)
+    {
+        uint64_t total = 0;
+        for (int c = 0; c < cycle_accounting::CATEGORIES; c++)
+            total += cycleMs[lane][c];
+        double scale = 100.0 / max<uint64_t>(1, total);
+        printf("%4d  %6llu  %14.1f%%  %8.1f%%  %16.1f%%  %4.1f%%\n", lane + 1, (unsigned long long)cycles[lane],
+               cycleMs[lane][cycle_accounting::EFFECTIVE_GREEN] * scale, cycleMs[lane][cycle_accounting::CLEARANCE] * scale,
+               cycleMs[lane][cycle_accounting::COORDINATION_WAIT] * scale, cycleMs[lane][cycle_accounting::IDLE] * scale);
+    }
+    if (options.discharge)
+    {
+        printf("Saturation flow learnt by the boards (veh/h):");
+        for (int lane = 0; lane < 4; lane++)
+            printf(" %d", saturationVph[lane]);
+        printf("\n");
+    }
+    // A cycle is counted each time section 1 gets green
+    printf("Lost time (no approach green): %.0f s, %.1f s per phase change, %.1f s per cycle\n",
+           intersection.lostMs / 1000.0, intersection.lostMs / 1000.0 / max<uint64_t>(1, intersection.phaseChanges),
+           intersection.lostMs / 1000.0 / max<uint64_t>(1, intersection.greenStarts[0]));
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    MicroSimOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        cout << "Usage: micro_sim [--seconds 3600] [--dt 0.1] [--rate <lane>=<veh/h>] [--length 250]\n"
+             << "                 [--start-hour 8] [--count-period 5] [--config <blob>] [--single-board] [--discharge]\n"
+             << "                 [--verbose]\n"
+             << "       micro_sim --bench [--intersections 50] [--queue 2000] [--seconds 300]" << endl;
+        return 1;
+    }
+    return options.bench ? runBench(options) : runWithSketches(options);
+}
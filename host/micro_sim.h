@@ -0,0 +1,288 @@
+#ifndef MICRO_SIM_H
+#define MICRO_SIM_H
+
+// Vehicle-level traffic simulator for the host build.
+//
+// Vehicles follow the Intelligent Driver Model (IDM) and stop at the stop line
+// of their approach while its signal is red (or yellow and they can still stop).
+// State is kept as structure-of-arrays per approach lane, ordered from the
+// front of the queue to the back, so the leader of vehicle i is i-1. The update
+// loops are branch-free over those arrays and vectorize with plain -O3. The
+// integration loop's delay sum is kept in eight independent lanes, so its
+// reductions need no -ffast-math or -fopenmp-simd either.
+//
+// Signals use the same TrafficLight struct as backup_main.cpp: each lane obeys
+// one entry of the lights array passed to step().
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+struct TrafficLight
+{
+    bool red;
+    bool yellow;
+    bool green;
+};
+
+struct IdmParams
+{
+    float desiredSpeed = 13.9f;   // v0, m/s (50 km/h)
+    float timeHeadway = 1.5f;     // T, s
+    float maxAccel = 1.5f;        // a, m/s^2
+    float comfortDecel = 2.0f;    // b, m/s^2
+    float minGap = 2.0f;          // s0, m
+    float vehicleLength = 5.0f;   // m
+};
+
+class MicroSim
+{
+public:
+    struct LaneStats
+    {
+        uint64_t arrivals = 0;
+        uint64_t discharged = 0;
+        uint64_t blockedArrivals = 0; // Vehicles that had to wait outside the lane
+        double delaySec = 0;          // Time lost against driving at desired speed
+        int halting = 0;              // Vehicles below 2 m/s after the last step
+    };
+
+    explicit MicroSim(float timeStep = 0.1f, uint32_t seed = 1) : dt(timeStep), rng(seed) {}
+
+    // Add an approach lane of the given length that obeys lights[signal]
+    int addLane(int signal, float length, float arrivalsPerHour, const IdmParams &params = IdmParams())
+    {
+        Lane lane;
+        lane.signal = signal;
+        lane.length = length;
+        lane.arrivalRate = arrivalsPerHour / 3600.0f;
+        lane.params = params;
+        lane.nextArrival = sampleHeadway(lane.arrivalRate);
+        lanes.push_back(lane);
+        return (int)lanes.size() - 1;
+    }
+
+    // Place a standing queue of n vehicles at the stop line (initial condition)
+    void seedQueue(int laneIndex, int n)
+    {
+        Lane &lane = lanes[laneIndex];
+        float spacing = lane.params.vehicleLength + lane.params.minGap;
+        for (int i = 0; i < n; i++)
+        {
+            float pos = lane.length - 0.5f - i * spacing;
+            if (pos < 0)
+                break;
+            lane.pos.push_back(pos);
+            lane.vel.push_back(0.0f);
+            lane.stats.halting++;
+        }
+        lane.acc.resize(lane.pos.size());
+    }
+
+    void setArrivalRate(int laneIndex, float arrivalsPerHour)
+    {
+        lanes[laneIndex].arrivalRate = arrivalsPerHour / 3600.0f;
+    }
+
+    // Advance one fixed time step
+    void step(const TrafficLight *lights)
+    {
+        for (auto &lane : lanes)
+        {
+            arrive(lane);
+            updateLane(lane, lights[lane.signal]);
+            discharge(lane);
+        }
+        time += dt;
+    }
+
+    // Advance `seconds` with the lights held constant
+    void run(const TrafficLight *lights, float seconds)
+    {
+        int steps = (int)(seconds / dt + 0.5f);
+        for (int i = 0; i < steps; i++)
+            step(lights);
+    }
+
+    int laneCount() const { return (int)lanes.size(); }
+    int vehicleCount(int laneIndex) const { return (int)(lanes[laneIndex].pos.size() - lanes[laneIndex].head); }
+    const LaneStats &stats(int laneIndex) const { return lanes[laneIndex].stats; }
+    uint64_t vehicleUpdates() const { return updates; }
+    double simTime() const { return time; }
+
+    int totalVehicles() const
+    {
+        int n = 0;
+        for (int i = 0; i < laneCount(); i++)
+            n += vehicleCount(i);
+        return n;
+    }
+
+private:
+    struct Lane
+    {
+        int signal = 0;
+        float length = 200.0f;
+        float arrivalRate = 0.0f; // vehicles per second
+        double nextArrival = 0;   // seconds until the next arrival
+        int waiting = 0;          // arrivals that could not enter yet
+        IdmParams params;
+
+        // Structure of arrays, index head is the vehicle closest to the stop line
+        std::vector<float> pos;
+        std::vector<float> vel;
+        std::vector<float> acc;
+        size_t head = 0;
+
+        LaneStats stats;
+    };
+
+    double sampleHeadway(float rate)
+    {
+        if (rate <= 0)
+            return 1e30;
+        std::exponential_distribution<double> headway(rate);
+        return headway(rng);
+    }
+
+    void arrive(Lane &lane)
+    {
+        lane.nextArrival -= dt;
+        while (lane.nextArrival <= 0)
+        {
+            lane.waiting++;
+            lane.stats.arrivals++;
+            lane.nextArrival += sampleHeadway(lane.arrivalRate);
+        }
+
+        // Enter at the upstream end when there is room behind the last vehicle
+        while (lane.waiting > 0)
+        {
+            float entrySpeed = lane.params.desiredSpeed;
+            if (lane.pos.size() > lane.head)
+            {
+                float gap = lane.pos.back() - lane.params.vehicleLength;
+                if (gap < lane.params.minGap + lane.params.vehicleLength)
+                {
+                    lane.stats.blockedArrivals++;
+                    break;
+                }
+                entrySpeed = std::min(entrySpeed, lane.vel.back());
+            }
+            lane.pos.push_back(0.0f);
+            lane.vel.push_back(entrySpeed);
+            lane.acc.push_back(0.0f);
+            lane.waiting--;
+        }
+    }
+
+    void updateLane(Lane &lane, const TrafficLight &light)
+    {
+        const size_t n = lane.pos.size();
+        const size_t h = lane.head;
+        if (n == h)
+        {
+            lane.stats.halting = 0;
+            return;
+        }
+
+        const IdmParams &p = lane.params;
+        float *__restrict pos = lane.pos.data();
+        float *__restrict vel = lane.vel.data();
+        float *__restrict acc = lane.acc.data();
+
+        const float a = p.maxAccel;
+        const float invV0 = 1.0f / p.desiredSpeed;
+        const float T = p.timeHeadway;
+        const float s0 = p.minGap;
+        const float len = p.vehicleLength;
+        const float invTwoSqrtAb = 1.0f / (2.0f * std::sqrt(p.maxAccel * p.comfortDecel));
+
+        // Head vehicle: the stop line acts as a standing leader while the signal
+        // says stop. On yellow only vehicles that can still stop comfortably do so.
+        {
+            float v = vel[h];
+            float toLine = lane.length - pos[h];
+            bool mustStop = light.red || (light.yellow && toLine > v * v / (2.0f * p.comfortDecel));
+            float gap = mustStop ? std::max(toLine, 0.1f) : 1e6f;
+            float dv = mustStop ? v : 0.0f;
+            float sStar = s0 + std::max(0.0f, v * T + v * dv * invTwoSqrtAb);
+            float x = v * invV0;
+            float x2 = x * x;
+            float r = sStar / gap;
+            acc[h] = a * (1.0f - x2 * x2 - r * r);
+        }
+
+        // Followers: leader is the vehicle in front (i - 1)
+        for (size_t i = h + 1; i < n; i++)
+        {
+            float v = vel[i];
+            float gap = std::max(pos[i - 1] - pos[i] - len, 0.1f);
+            float dv = v - vel[i - 1];
+            float sStar = s0 + std::max(0.0f, v * T + v * dv * invTwoSqrtAb);
+            float x = v * invV0;
+            float x2 = x * x;
+            float r = sStar / gap;
+            acc[i] = a * (1.0f - x2 * x2 - r * r);
+        }
+
+        // Ballistic update, no reversing. acc[] is reused for each vehicle's
+        // lost fraction so the loop vectorizes without a float reduction; the
+        // fractions are then summed in eight independent lanes.
+        const float step = dt;
+        const float v0 = p.desiredSpeed;
+        int halting = 0;
+        for (size_t i = h; i < n; i++)
+        {
+            float v = vel[i];
+            float vNew = std::max(v + acc[i] * step, 0.0f);
+            pos[i] += 0.5f * (v + vNew) * step;
+            vel[i] = vNew;
+            acc[i] = (v0 - std::min(vNew, v0)) * invV0;
+            halting += vNew < 2.0f ? 1 : 0;
+        }
+        float partial[8] = {};
+        size_t i = h;
+        for (; i + 8 <= n; i += 8)
+            for (int k = 0; k < 8; k++)
+                partial[k] += acc[i + k];
+        float lost = 0.0f;
+        for (; i < n; i++)
+            lost += acc[i];
+        for (float sum : partial)
+            lost += sum;
+
+        lane.stats.delaySec += lost * step;
+        lane.stats.halting = halting;
+        updates += n - h;
+    }
+
+    // Vehicles past the stop line leave the approach
+    void discharge(Lane &lane)
+    {
+        while (lane.head < lane.pos.size() && lane.pos[lane.head] > lane.length)
+        {
+            lane.head++;
+            lane.stats.discharged++;
+        }
+
+        // Compact once the discharged prefix dominates
+        if (lane.head > 256 && lane.head * 2 > lane.pos.size())
+        {
+            lane.pos.erase(lane.pos.begin(), lane.pos.begin() + lane.head);
+            lane.vel.erase(lane.vel.begin(), lane.vel.begin() + lane.head);
+            lane.acc.erase(lane.acc.begin(), lane.acc.begin() + lane.head);
+            lane.head = 0;
+        }
+    }
+
+    std::vector<Lane> lanes;
+    float dt;
+    double time = 0;
+    uint64_t updates = 0;
+    std::mt19937 rng;
+};
+
+#endif // MICRO_SIM_H
@@ -0,0 +1,278 @@
+// Benchmark of the rolling-horizon MPC controller (mpc_controller.h) against
+// the green times of defuzzify(), on identical demand traces.
+//
+// Both controllers run the cycle of backup_main.cpp on the same simulator:
+// lanes in 1 -> 2 -> 3 -> 4 order, each service 1 s all red, 3 s yellow,
+// green, 3 s yellow. The baseline takes the green from the policy table the
+// boards run (policies/fuzzy_default.csv is defuzzify() sampled per count)
+// for the served lane's halting vehicles. MPC plans at every phase change from
+// the halting vehicles on all four lanes and arrival rates learnt with
+// demand_forecast.h, and may skip a lane. A trace is a seed plus per-lane
+// demand that is drawn again every --period seconds, so both controllers see
+// the same arrivals.
+//
+// Build:
+//   g++ -std=c++17 -O3 -march=native -pthread -Ihost/shim host/mpc_bench.cpp host/lane_sketches.cpp -o mpc_bench
+//
+// Examples:
+//   ./mpc_bench --traces 20 --seconds 3600
+//   ./mpc_bench --traces 5 --micro --budget-ms 10 --cycles 3
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lane_sketches.h"
+#include "micro_sim.h"
+#include "mpc_controller.h"
+#include "queue_model.h"
+#include "../esp32_arduino_ide/esp32_lane1/demand_forecast.h"
+
+using namespace std;
+
+struct MpcBenchOptions
+{
+    int traces = 20;
+    uint32_t seed = 1;
+    float seconds = 3600.0f;
+    float period = 900.0f;      // s between demand changes within a trace
+    float minRate = 100.0f;     // vehicles per hour per approach
+    float maxRate = 600.0f;
+    int hour = 8;
+    bool micro = false;
+    MpcConfig mpc;
+};
+
+bool parseOptions(int argc, char **argv, MpcBenchOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--micro")
+            options.micro = true;
+        else if (arg == "--traces" && hasValue)
+            options.traces = atoi(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            options.seed = (uint32_t)atoi(argv[++i]);
+        else if (arg == "--seconds" && hasValue)
+            options.seconds = (float)atof(argv[++i]);
+        else if (arg == "--period" && hasValue)
+            options.period = (float)atof(argv[++i]);
+        else if (arg == "--min-rate" && hasValue)
+            options.minRate = (float)atof(argv[++i]);
+        else if (arg == "--max-rate" && hasValue)
+            options.maxRate = (float)atof(argv[++i]);
+        else if (arg == "--hour" && hasValue)
+            options.hour = atoi(argv[++i]);
+        else if (arg == "--cycles" && hasValue)
+            options.mpc.cycles = atoi(argv[++i]);
+        else if (arg == "--horizon" && hasValue)
+            options.mpc.horizonSeconds = (float)atof(argv[++i]);
+        else if (arg == "--budget-ms" && hasValue)
+            options.mpc.budgetMs = (float)atof(argv[++i]);
+        else if (arg == "--threads" && hasValue)
+            options.mpc.threads = atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.traces > 0 && options.period > 0 && options.minRate <= options.maxRate;
+}
+
+// Per-lane demand of one trace, one row per period
+struct Trace
+{
+    uint32_t simSeed;
+    vector<array<float, 4>> rates;
+};
+
+struct TraceResult
+{
+    uint64_t arrivals = 0;
+    uint64_t discharged = 0;
+    double delaySec = 0;
+    int decisions = 0;
+    int skips = 0;
+    int outOfBudget = 0;
+    vector<double> decideMs;
+};
+
+// One service of `lane` as the sketches run it
+template <typename Sim>
+void runService(Sim &sim, int lane, float green)
+{
+    TrafficLight lights[4];
+    for (auto &light : lights)
+        light = TrafficLight{true, false, false};
+    sim.run(lights, 1.0f);
+
+    lights[lane] = TrafficLight{false, true, false};
+    sim.run(lights, 3.0f);
+    lights[lane] = TrafficLight{false, false, true};
+    sim.run(lights, green);
+    lights[lane] = TrafficLight{false, true, false};
+    sim.run(lights, 3.0f);
+}
+
+unique_ptr<QueueModel> makeSim(const Trace &trace, QueueModel *)
+{
+    unique_ptr<QueueModel> sim(new QueueModel(1.0f, trace.simSeed));
+    for (int lane = 0; lane < 4; lane++)
+        sim->addLane(lane, trace.rates[0][lane]);
+    return sim;
+}
+
+unique_ptr<MicroSim> makeSim(const Trace &trace, MicroSim *)
+{
+    unique_ptr<MicroSim> sim(new MicroSim(0.1f, trace.simSeed));
+    for (int lane = 0; lane < 4; lane++)
+        sim->addLane(lane, 250.0f, trace.rates[0][lane]);
+    return sim;
+}
+
+template <typename Sim>
+TraceResult runTrace(const MpcBenchOptions &options, const Trace &trace, MpcController *mpc)
+{
+    unique_ptr<Sim> sim = makeSim(trace, (Sim *)nullptr);
+    bool rush = hostLaneSketches[0].isJamSibuk(options.hour);
+    demand_forecast::DemandForecast forecast[4];
+    const float priorRate = (options.minRate + options.maxRate) / 2 / 3600.0f;
+
+    TraceResult result;
+    int lane = 0;
+    double t = 0;
+    while (t < options.seconds)
+    {
+        size_t period = min(trace.rates.size() - 1, (size_t)(t / options.period));
+        for (int l = 0; l < 4; l++)
+            sim->setArrivalRate(l, trace.rates[period][l]);
+
+        float count[4];
+        for (int l = 0; l < 4; l++)
+            count[l] = (float)sim->stats(l).halting;
+
+        float green;
+        if (mpc)
+        {
+            int slot = demand_forecast::slotOf(options.hour + (int)(t / 3600) % 24, (int)(t / 60) % 60);
+            float rate[4];
+            float baseline[4];
+            for (int l = 0; l < 4; l++)
+            {
+                // Every head is red at a phase change
+                forecast[l].observeRed(count[l], (uint32_t)(t * 1000), slot);
+                rate[l] = forecast[l].ready() ? forecast[l].ratePerSecond(slot) : priorRate;
+                baseline[l] = (float)(int)hostLaneSketches[l].greenSeconds(count[l], rush);
+            }
+            MpcController::Decision decision = mpc->decide(count, rate, lane, baseline);
+            result.decideMs.push_back(decision.elapsedMs);
+            result.skips += decision.skipped;
+            result.outOfBudget += decision.outOfBudget ? 1 : 0;
+            lane = decision.lane;
+            green = decision.green;
+            forecast[lane].breakInterval();
+        }
+        else
+        {
+            green = (float)(int)hostLaneSketches[lane].greenSeconds(count[lane], rush); // countdownTimer((int)duration)
+        }
+
+        runService(*sim, lane, green);
+        t += 7.0 + green;
+        lane = (lane + 1) % 4;
+        result.decisions++;
+    }
+
+    for (int l = 0; l < 4; l++)
+    {
+        result.arrivals += sim->stats(l).arrivals;
+        result.discharged += sim->stats(l).discharged;
+        result.delaySec += sim->stats(l).delaySec;
+    }
+    return result;
+}
+
+double percentile(vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    sort(values.begin(), values.end());
+    return values[min(values.size() - 1, (size_t)(p / 100.0 * values.size()))];
+}
+
+int main(int argc, char **argv)
+{
+    MpcBenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        cout << "Usage: mpc_bench [--traces 20] [--seed 1] [--seconds 3600] [--period 900] [--min-rate 100]\n"
+             << "                 [--max-rate 600] [--hour 8] [--micro] [--cycles 2] [--horizon 240]\n"
+             << "                 [--budget-ms 10] [--threads 0]" << endl;
+        return 1;
+    }
+
+    mt19937 rng(options.seed);
+    uniform_real_distribution<float> rateDist(options.minRate, options.maxRate);
+    int periods = max(1, (int)(options.seconds / options.period + 0.999f));
+    vector<Trace> traces(options.traces);
+    for (Trace &trace : traces)
+    {
+        trace.simSeed = rng();
+        trace.rates.resize(periods);
+        for (auto &row : trace.rates)
+            for (float &rate : row)
+                rate = rateDist(rng);
+    }
+
+    MpcController probe(options.mpc);
+    printf("%d traces of %.0f s, %s, MPC over %d cycles / %.0f s horizon, %.1f ms budget on %d threads\n",
+           options.traces, options.seconds, options.micro ? "micro_sim" : "queue model", options.mpc.cycles,
+           options.mpc.horizonSeconds, options.mpc.budgetMs, probe.threads());
+    printf("Trace  Arrivals  defuzzify delay (s/veh)  MPC delay (s/veh)  Change\n");
+
+    double baseDelay = 0, mpcDelay = 0;
+    uint64_t baseArrivals = 0, mpcArrivals = 0, baseDischarged = 0, mpcDischarged = 0;
+    int decisions = 0, skips = 0, outOfBudget = 0;
+    vector<double> decideMs;
+    for (int i = 0; i < options.traces; i++)
+    {
+        MpcController mpc(options.mpc);
+        TraceResult base = options.micro ? runTrace<MicroSim>(options, traces[i], nullptr)
+                                         : runTrace<QueueModel>(options, traces[i], nullptr);
+        TraceResult planned = options.micro ? runTrace<MicroSim>(options, traces[i], &mpc)
+                                            : runTrace<QueueModel>(options, traces[i], &mpc);
+        double basePerVeh = base.delaySec / max<uint64_t>(1, base.arrivals);
+        double mpcPerVeh = planned.delaySec / max<uint64_t>(1, planned.arrivals);
+        printf("%5d  %8llu  %23.1f  %17.1f  %+5.1f%%\n", i + 1, (unsigned long long)base.arrivals, basePerVeh,
+               mpcPerVeh, 100.0 * (mpcPerVeh - basePerVeh) / max(1e-9, basePerVeh));
+
+        baseDelay += base.delaySec;
+        mpcDelay += planned.delaySec;
+        baseArrivals += base.arrivals;
+        mpcArrivals += planned.arrivals;
+        baseDischarged += base.discharged;
+        mpcDischarged += planned.discharged;
+        decisions += planned.decisions;
+        skips += planned.skips;
+        outOfBudget += planned.outOfBudget;
+        decideMs.insert(decideMs.end(), planned.decideMs.begin(), planned.decideMs.end());
+    }
+
+    double mean = 0;
+    for (double ms : decideMs)
+        mean += ms;
+    mean /= max<size_t>(1, decideMs.size());
+    printf("Mean delay: defuzzify %.1f s/veh, MPC %.1f s/veh; discharged %llu vs %llu\n",
+           baseDelay / max<uint64_t>(1, baseArrivals), mpcDelay / max<uint64_t>(1, mpcArrivals),
+           (unsigned long long)baseDischarged, (unsigned long long)mpcDischarged);
+    printf("MPC decisions: %d, lanes skipped: %d, decide time mean %.2f ms, p99 %.2f ms, max %.2f ms, "
+           "out of budget: %d\n",
+           decisions, skips, mean, percentile(decideMs, 99), percentile(decideMs, 100), outOfBudget);
+    return 0;
+}
@@ -0,0 +1,319 @@
+#ifndef MPC_CONTROLLER_H
+#define MPC_CONTROLLER_H
+
+// Rolling-horizon model predictive controller for one intersection.
+//
+// At every phase change it plans the next `cycles` passes through the
+// 1 -> 2 -> 3 -> 4 order of backup_main.cpp: for each service it picks a
+// green time from greenOptions(), or 0 to skip the lane. A service is the
+// lane sketches' sequence (1 s all red, 3 s yellow, green, 3 s yellow). Each
+// plan is scored with a deterministic fluid version of QueueModel
+// (queue_model.h) over horizonSeconds: vehicle-seconds of delay, plus the
+// delay still owed by the queues left at the end. Only the first service of
+// the best plan is carried out; the next phase change plans again from the
+// counts measured then.
+//
+// Search: every combination of the first two services is a prefix. The
+// prefixes are split over a ThreadPool, and each one completes the rest of
+// its plan by coordinate descent from the policy table's green times. The
+// search stops at budgetMs and keeps the best plan found so far.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#include "thread_pool.h"
+
+struct MpcConfig
+{
+    int cycles = 2;               // Passes through all four lanes per plan
+    float horizonSeconds = 240.0f;
+    float budgetMs = 10.0f;       // Wall time of one decision
+    int threads = 0;              // 0 = one per hardware thread
+    int maxSkips = 1;             // Times in a row a lane may be skipped
+    float saturationFlow = 1800.0f; // QueueParams defaults
+    float startupLostTime = 2.0f;
+    float yellowDischarge = 2.0f;
+};
+
+class MpcController
+{
+public:
+    static const int kLanes = 4;
+    static const int kOptions = 10;
+    static const int kMaxServices = 4 * 4;
+
+    // Green seconds of every option, 0 = skip the lane
+    static const float *greenOptions()
+    {
+        static const float options[kOptions] = {0, 5, 10, 15, 20, 25, 30, 40, 50, 60};
+        return options;
+    }
+
+    struct Decision
+    {
+        int lane = 0;           // 0-based lane to serve now
+        float green = 0;        // Seconds
+        int skipped = 0;        // Lanes skipped before it in the cycle order
+        double cost = 0;        // Predicted vehicle-seconds of the chosen plan
+        int plansEvaluated = 0;
+        double elapsedMs = 0;
+        bool outOfBudget = false;
+    };
+
+    explicit MpcController(const MpcConfig &mpcConfig = MpcConfig())
+        : config(mpcConfig), pool(mpcConfig.threads)
+    {
+        config.cycles = std::max(1, std::min(config.cycles, kMaxServices / kLanes));
+        services = config.cycles * kLanes;
+        mu = config.saturationFlow / 3600.0f;
+        for (int lane = 0; lane < kLanes; lane++)
+            skips[lane] = 0;
+    }
+
+    int threads() const { return pool.size(); }
+
+    // Plan from the queues now on each lane and their arrival rates (vehicles per second).
+    // nextLane is the lane whose turn it is; baselineGreen[lane] seeds the search.
+    Decision decide(const float queue[kLanes], const float arrivalRate[kLanes], int nextLane,
+                    const float baselineGreen[kLanes])
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::microseconds((long long)(config.budgetMs * 1000.0f));
+
+        Plan seed;
+        for (int k = 0; k < services; k++)
+            seed.option[k] = nearestOption(baselineGreen[(nextLane + k) % kLanes]);
+
+        Problem problem;
+        for (int lane = 0; lane < kLanes; lane++)
+        {
+            problem.queue[lane] = std::max(0.0f, queue[lane]);
+            problem.rate[lane] = std::max(0.0f, arrivalRate[lane]);
+        }
+        problem.nextLane = nextLane;
+
+        Plan best = seed;
+        double bestCost = evaluate(problem, seed);
+        int evaluated = 1;
+        bool outOfBudget = false;
+        std::mutex bestMutex;
+
+        const int prefixes = kOptions * kOptions;
+        pool.parallelFor(prefixes, [&](int begin, int end) {
+            Plan localBest = seed;
+            double localCost = 1e300;
+            int localEvaluated = 0;
+            bool localOut = false;
+            for (int p = begin; p < end; p++)
+            {
+                if (std::chrono::steady_clock::now() >= deadline)
+                {
+                    localOut = true;
+                    break;
+                }
+                Plan plan = seed;
+                plan.option[0] = p / kOptions;
+                plan.option[1] = p % kOptions;
+                if (!allowed(problem, plan))
+                    continue;
+                double cost = descend(problem, plan, 2, deadline, localEvaluated, localOut);
+                if (cost < localCost)
+                {
+                    localCost = cost;
+                    localBest = plan;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(bestMutex);
+            evaluated += localEvaluated;
+            outOfBudget = outOfBudget || localOut;
+            if (localCost < bestCost)
+            {
+                bestCost = localCost;
+                best = localBest;
+            }
+        });
+
+        Decision decision;
+        int k = 0;
+        while (k < services - 1 && greenOptions()[best.option[k]] == 0)
+            k++;
+        decision.lane = (nextLane + k) % kLanes;
+        decision.green = greenOptions()[best.option[k]];
+        if (decision.green == 0)
+            decision.green = greenOptions()[1]; // Every service in the plan skipped: serve briefly
+        decision.skipped = k;
+        decision.cost = bestCost;
+        decision.plansEvaluated = evaluated;
+        decision.outOfBudget = outOfBudget;
+        decision.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        for (int i = 0; i < k; i++)
+            skips[(nextLane + i) % kLanes]++;
+        skips[decision.lane] = 0;
+        return decision;
+    }
+
+    static int nearestOption(float greenSeconds)
+    {
+        int best = 1;
+        for (int o = 2; o < kOptions; o++)
+        {
+            if (std::fabs(greenOptions()[o] - greenSeconds) < std::fabs(greenOptions()[best] - greenSeconds))
+                best = o;
+        }
+        return best;
+    }
+
+private:
+    struct Plan
+    {
+        int option[kMaxServices] = {};
+    };
+
+    struct Problem
+    {
+        float queue[kLanes];
+        float rate[kLanes];
+        int nextLane;
+    };
+
+    // Fluid queue state while a plan is played out
+    struct State
+    {
+        double queue[kLanes];
+        double delay;
+        double time;
+    };
+
+    // Skipping is only allowed while none of a lane's consecutive skips run over maxSkips
+    bool allowed(const Problem &problem, const Plan &plan) const
+    {
+        int run[kLanes];
+        for (int lane = 0; lane < kLanes; lane++)
+            run[lane] = skips[lane];
+        for (int k = 0; k < services; k++)
+        {
+            int lane = (problem.nextLane + k) % kLanes;
+            if (greenOptions()[plan.option[k]] == 0)
+            {
+                if (++run[lane] > config.maxSkips)
+                    return false;
+            }
+            else
+            {
+                run[lane] = 0;
+            }
+        }
+        return true;
+    }
+
+    // Coordinate descent over services [from, services): try every option at each position
+    // and keep the best, two passes. Returns the cost of the final plan.
+    double descend(const Problem &problem, Plan &plan, int from,
+                   std::chrono::steady_clock::time_point deadline, int &evaluated, bool &outOfBudget) const
+    {
+        double cost = evaluate(problem, plan);
+        evaluated++;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            bool improved = false;
+            for (int k = from; k < services; k++)
+            {
+                if (std::chrono::steady_clock::now() >= deadline)
+                {
+                    outOfBudget = true;
+                    return cost;
+                }
+                int keep = plan.option[k];
+                for (int o = 0; o < kOptions; o++)
+                {
+                    if (o == keep)
+                        continue;
+                    plan.option[k] = o;
+                    if (!allowed(problem, plan))
+                        continue;
+                    double candidate = evaluate(problem, plan);
+                    evaluated++;
+                    if (candidate < cost - 1e-9)
+                    {
+                        cost = candidate;
+                        keep = o;
+                        improved = true;
+                    }
+                }
+                plan.option[k] = keep;
+            }
+            if (!improved)
+                break;
+        }
+        return cost;
+    }
+
+    double evaluate(const Problem &problem, const Plan &plan) const
+    {
+        State state;
+        for (int lane = 0; lane < kLanes; lane++)
+            state.queue[lane] = problem.queue[lane];
+        state.delay = 0;
+        state.time = 0;
+
+        for (int k = 0; k < services && state.time < config.horizonSeconds; k++)
+        {
+            float green = greenOptions()[plan.option[k]];
+            if (green == 0)
+                continue;
+            int lane = (problem.nextLane + k) % kLanes;
+            float startup = std::min(green, config.startupLostTime);
+            advance(problem, state, -1, 4.0);             // 1 s all red, 3 s yellow
+            advance(problem, state, -1, startup);
+            advance(problem, state, lane, green - startup);
+            advance(problem, state, lane, config.yellowDischarge);
+            advance(problem, state, -1, 3.0 - config.yellowDischarge);
+        }
+        // Nothing served for the rest of the horizon
+        advance(problem, state, -1, config.horizonSeconds - state.time);
+
+        // Delay the remaining queues still owe: each discharges in q / mu
+        double terminal = 0;
+        for (int lane = 0; lane < kLanes; lane++)
+            terminal += state.queue[lane] * state.queue[lane] / (2.0 * mu);
+        return state.delay + terminal;
+    }
+
+    // Advance every lane by `seconds` (clipped to the horizon); `served` discharges at the saturation flow
+    void advance(const Problem &problem, State &state, int served, double seconds) const
+    {
+        seconds = std::min(seconds, (double)config.horizonSeconds - state.time);
+        if (seconds <= 0)
+            return;
+        for (int lane = 0; lane < kLanes; lane++)
+        {
+            double q = state.queue[lane];
+            double net = problem.rate[lane] - (lane == served ? mu : 0.0);
+            double empty = net < 0 ? q / -net : 1e30;
+            if (empty >= seconds)
+            {
+                state.delay += q * seconds + 0.5 * net * seconds * seconds;
+                state.queue[lane] = q + net * seconds;
+            }
+            else
+            {
+                state.delay += 0.5 * q * empty;
+                state.queue[lane] = 0;
+            }
+        }
+        state.time += seconds;
+    }
+
+    MpcConfig config;
+    ThreadPool pool;
+    int services;
+    double mu;
+    int skips[kLanes];
+};
+
+#endif // MPC_CONTROLLER_H
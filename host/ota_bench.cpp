@@ -0,0 +1,779 @@
+// Firmware update benchmark for the host-built controllers.
+//
+// Runs the lane sketches (or the single-board controller) on micro_sim and, at
+// --at seconds, sends every board a firmware patch over the in-process broker the
+// way Python/ota_update.py does: 1 KB chunks paced to --link bytes per second per
+// board, a window of ota_update::BUFFER bytes past the last acknowledged offset,
+// and a resend from the offset a board asks for. The boards decode the patch into
+// their spare app slot while the lights keep running, switch at a phase boundary,
+// restart (HOST_BOOT_MS dark) and confirm the new image after a minute. With
+// --rollback the sender then asks each board to go back to the old image.
+//
+// The patch is built here with the same encoder as ota_update.py, from --base and
+// --target .bin files or from a synthetic ~1 MB image and a new version of it with
+// a function inserted (which moves every address after it) and a few edits.
+// --full sends the whole image instead, to compare. A run without the update on
+// the same traffic is the baseline for delay, stalls and double greens.
+//
+// Build:
+//   g++ -std=c++17 -O3 -march=native -pthread -Ihost/shim host/ota_bench.cpp host/lane_sketches.cpp -o ota_bench
+//
+// Examples:
+//   ./ota_bench
+//   ./ota_bench --full --link 8192
+//   ./ota_bench --single-board --rollback
+//   ./ota_bench --base v6/esp32_lane1.ino.bin --target v7/esp32_lane1.ino.bin
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ArduinoJson.h>
+#include <esp_ota_ops.h>
+
+#include "intersection_harness.h"
+#include "micro_sim.h"
+#include "../esp32_arduino_ide/esp32_lane1/mqtt_topics.h"
+#include "../esp32_arduino_ide/esp32_lane1/ota_update.h"
+
+using namespace std;
+
+const int STALL_THRESHOLD_SEC = 10;  // As in fault_bench
+const uint64_t SENDER_TIMEOUT_MS = 30000; // No report for this long: go back to the last acknowledged offset
+const uint64_t ROLLBACK_AFTER_MS = 30000; // --rollback: after the last board confirmed
+
+struct OtaBenchOptions
+{
+    float seconds = 900.0f;
+    float atSec = 300.0f;       // Update sent at this time
+    double linkBytesPerSec = 16384; // Per board
+    uint32_t seed = 1;
+    bool singleBoard = false;
+    bool full = false;
+    bool rollback = false;
+    bool verbose = false;
+    string base, target;        // .bin files, synthetic images without them
+    int imageKb = 960;
+    int changeKb = 2;           // Size of the function the synthetic update inserts
+    float rates[4] = {600.0f, 300.0f, 600.0f, 300.0f};
+};
+
+bool parseOptions(int argc, char **argv, OtaBenchOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--single-board")
+            options.singleBoard = true;
+        else if (arg == "--full")
+            options.full = true;
+        else if (arg == "--rollback")
+            options.rollback = true;
+        else if (arg == "--verbose")
+            options.verbose = true;
+        else if (arg == "--seconds" && hasValue)
+            options.seconds = (float)atof(argv[++i]);
+        else if (arg == "--at" && hasValue)
+            options.atSec = (float)atof(argv[++i]);
+        else if (arg == "--link" && hasValue)
+            options.linkBytesPerSec = atof(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--base" && hasValue)
+            options.base = argv[++i];
+        else if (arg == "--target" && hasValue)
+            options.target = argv[++i];
+        else if (arg == "--image-kb" && hasValue)
+            options.imageKb = atoi(argv[++i]);
+        else if (arg == "--change-kb" && hasValue)
+            options.changeKb = atoi(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+        {
+            string value = argv[++i];
+            size_t eq = value.find('=');
+            int lane = atoi(value.substr(0, eq).c_str());
+            if (eq == string::npos || lane < 1 || lane > 4)
+                return false;
+            options.rates[lane - 1] = (float)atof(value.substr(eq + 1).c_str());
+        }
+        else
+            return false;
+    }
+    return options.seconds > options.atSec && options.linkBytesPerSec > 0 &&
+           options.base.empty() == options.target.empty();
+}
+
+// Patch encoder, the same greedy choice as build_operations() in Python/ota_update.py
+
+const size_t KEY = 8;
+const size_t MIN_RUN = 8;
+const size_t MIN_NEXT = 4;
+const size_t MIN_FILL = 16;
+
+void putLeb128(string &out, uint64_t value)
+{
+    do
+    {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out.push_back((char)(value ? byte | 0x80 : byte));
+    } while (value);
+}
+
+void putTag(string &out, int op, size_t length)
+{
+    if (length < 64)
+    {
+        out.push_back((char)(op << 6 | (int)length));
+        return;
+    }
+    out.push_back((char)(op << 6));
+    putLeb128(out, length);
+}
+
+uint64_t keyAt(const string &data, size_t position)
+{
+    uint64_t key;
+    memcpy(&key, data.data() + position, KEY);
+    return key;
+}
+
+size_t matchLength(const string &source, size_t start, const string &target, size_t position)
+{
+    size_t limit = min(source.size() - start, target.size() - position);
+    size_t length = 0;
+    while (length < limit && source[start + length] == target[position + length])
+        length++;
+    return length;
+}
+
+string buildOperations(const string &base, const string &target)
+{
+    unordered_map<uint64_t, uint32_t> index;
+    for (size_t i = 0; i + KEY <= base.size(); i++)
+        index.emplace(keyAt(base, i), (uint32_t)i);
+
+    string ops, literal;
+    unordered_map<uint64_t, uint32_t> recent; // KEY bytes of the new image -> last position
+    int64_t copyEnd = 0;
+    bool haveShift = false;
+    int64_t shift = 0; // Base offset minus target position of the last COPY
+    size_t position = 0;
+    auto flushLiteral = [&]() {
+        if (literal.empty())
+            return;
+        putTag(ops, ota_update::OP_ADD, literal.size());
+        ops += literal;
+        literal.clear();
+    };
+
+    while (position < target.size())
+    {
+        bool keyed = position + KEY <= target.size();
+        uint64_t key = keyed ? keyAt(target, position) : 0;
+        int bestOp = -1;
+        size_t bestLength = 0;
+        int64_t bestArg = 0;
+
+        if (haveShift && (int64_t)position + shift >= 0 && (int64_t)position + shift < (int64_t)base.size())
+        {
+            size_t length = matchLength(base, position + shift, target, position);
+            if (length >= MIN_NEXT)
+                bestOp = ota_update::OP_COPY, bestLength = length, bestArg = (int64_t)position + shift;
+        }
+        auto offset = keyed ? index.find(key) : index.end();
+        if (offset != index.end())
+        {
+            size_t length = matchLength(base, offset->second, target, position);
+            if (length >= MIN_RUN && length > bestLength)
+                bestOp = ota_update::OP_COPY, bestLength = length, bestArg = offset->second;
+        }
+        auto previous = keyed ? recent.find(key) : recent.end();
+        if (previous != recent.end() && position - previous->second <= ota_update::WINDOW)
+        {
+            size_t length = matchLength(target, previous->second, target, position);
+            if (length >= MIN_RUN && length > bestLength)
+                bestOp = ota_update::OP_REUSE, bestLength = length, bestArg = position - previous->second;
+        }
+        size_t run = 1;
+        while (position + run < target.size() && target[position + run] == target[position] && run < (1u << 20))
+            run++;
+        if (run >= MIN_FILL && run > bestLength)
+            bestOp = ota_update::OP_FILL, bestLength = run, bestArg = (uint8_t)target[position];
+
+        if (bestOp < 0)
+        {
+            literal.push_back(target[position]);
+            if (keyed)
+                recent[key] = (uint32_t)position;
+            position++;
+            continue;
+        }
+
+        flushLiteral();
+        putTag(ops, bestOp, bestLength);
+        if (bestOp == ota_update::OP_COPY)
+        {
+            int64_t delta = bestArg - copyEnd;
+            putLeb128(ops, delta >= 0 ? (uint64_t)delta * 2 : (uint64_t)(-delta) * 2 - 1);
+            copyEnd = bestArg + (int64_t)bestLength;
+            shift = bestArg - (int64_t)position;
+            haveShift = true;
+        }
+        else if (bestOp == ota_update::OP_REUSE)
+            putLeb128(ops, (uint64_t)bestArg);
+        else
+            ops.push_back((char)bestArg);
+        for (size_t p = position; p < position + bestLength && p + KEY <= target.size(); p++)
+            recent[keyAt(target, p)] = (uint32_t)p;
+        position += bestLength;
+    }
+    flushLiteral();
+    return ops;
+}
+
+// PatchHeader + operations; an empty base gives a full image
+string buildPatch(const string &base, const string &target, uint32_t version)
+{
+    string ops = buildOperations(base, target);
+    ota_update::PatchHeader header = {};
+    header.magic = ota_update::MAGIC;
+    header.format = ota_update::FORMAT;
+    header.version = version;
+    header.baseSize = (uint32_t)base.size();
+    header.baseCrc = ota_update::crc32Update(0, (const uint8_t *)base.data(), base.size());
+    header.targetSize = (uint32_t)target.size();
+    header.targetCrc = ota_update::crc32Update(0, (const uint8_t *)target.data(), target.size());
+    header.opsSize = (uint32_t)ops.size();
+    header.headerCrc = ota_update::crc32Update(0, (const uint8_t *)&header, offsetof(ota_update::PatchHeader, headerCrc));
+    return string((const char *)&header, sizeof(header)) + ops;
+}
+
+// Synthetic firmware: functions of 3-byte instructions drawn from a skewed vocabulary, each
+// followed by a literal pool that holds absolute addresses of other functions, then string
+// constants and a digest. The update inserts a function a third of the way in, so every
+// address after it moves, edits a few instructions and adds a string.
+struct SyntheticFirmware
+{
+    struct Function
+    {
+        string code;
+        vector<int> calls;        // Literal pool entries: index of the function whose address it holds
+        vector<uint32_t> constants;
+    };
+
+    static const uint32_t TEXT_BASE = 0x400D0020;
+
+    vector<Function> functions;
+    vector<string> strings;
+
+    SyntheticFirmware(uint32_t seed, size_t imageBytes) : rng(seed)
+    {
+        for (int i = 0; i < 512; i++)
+            vocabulary.push_back({(char)rng(), (char)rng(), (char)rng()});
+        for (int i = 0; i < 400; i++)
+        {
+            string word;
+            for (int n = 3 + rng() % 7; n > 0; n--)
+                word.push_back((char)('a' + rng() % 26));
+            words.push_back(word);
+        }
+        size_t text = 0;
+        while (text < imageBytes * 72 / 100)
+        {
+            functions.push_back(makeFunction(40 + rng() % 560));
+            text += functions.back().code.size() + 4 * (functions.back().calls.size() + functions.back().constants.size());
+        }
+        for (auto &function : functions)
+        {
+            for (auto &call : function.calls)
+                call = (int)(rng() % functions.size());
+        }
+        size_t rodata = 0;
+        while (rodata < imageBytes * 22 / 100)
+        {
+            strings.push_back(makeString());
+            rodata += strings.back().size() + 1;
+        }
+    }
+
+    // The next version: a new function of about changeBytes, three edited functions and a string
+    void update(size_t changeBytes)
+    {
+        int at = (int)functions.size() / 3;
+        Function added = makeFunction(changeBytes);
+        for (auto &call : added.calls)
+            call = (int)(rng() % functions.size());
+        for (auto &function : functions)
+        {
+            for (auto &call : function.calls)
+                call += call >= at ? 1 : 0;
+        }
+        functions.insert(functions.begin() + at, added);
+        functions[at - 1].calls.push_back(at);
+        for (int i = 0; i < 3; i++)
+        {
+            Function &function = functions[rng() % functions.size()];
+            size_t position = (rng() % (function.code.size() / 3)) * 3;
+            function.code.replace(position, 3, vocabulary[rng() % vocabulary.size()]);
+        }
+        strings.insert(strings.begin() + rng() % strings.size(), makeString());
+    }
+
+    string image()
+    {
+        vector<uint32_t> address;
+        uint32_t offset = 0;
+        for (auto &function : functions)
+        {
+            address.push_back(TEXT_BASE + offset);
+            offset += (uint32_t)(function.code.size() + 4 * (function.calls.size() + function.constants.size()));
+            offset = (offset + 3) & ~3u;
+        }
+        string out = string("\xE9\x06\x02\x20", 4) + string(20, '\0'); // Image header
+        for (auto &function : functions)
+        {
+            out += function.code;
+            for (int call : function.calls)
+                out.append((const char *)&address[call], 4);
+            for (uint32_t constant : function.constants)
+                out.append((const char *)&constant, 4);
+            out.append((4 - out.size() % 4) % 4, '\0');
+        }
+        out.append((16 - out.size() % 16) % 16, '\0');
+        for (auto &text : strings)
+            out.append(text.c_str(), text.size() + 1);
+        out.append((16 - out.size() % 16) % 16, '\0');
+        uint32_t digest = ota_update::crc32Update(0, (const uint8_t *)out.data(), out.size());
+        for (int i = 0; i < 8; i++)
+        {
+            digest = digest * 1664525u + 1013904223u;
+            out.append((const char *)&digest, 4); // Stands in for the SHA-256 the build appends
+        }
+        return out;
+    }
+
+private:
+    Function makeFunction(size_t bytes)
+    {
+        Function function;
+        size_t literals = max<size_t>(1, bytes / 64);
+        size_t instructions = max<size_t>(4, (bytes - 4 * literals) / 3);
+        for (size_t i = 0; i < instructions; i++)
+        {
+            double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+            function.code += vocabulary[(size_t)(vocabulary.size() * u * u * u)];
+        }
+        for (size_t i = 0; i < literals; i++)
+        {
+            if (rng() % 5 < 3)
+                function.calls.push_back(0);
+            else
+                function.constants.push_back(rng() % 8 == 0 ? rng() : rng() % 256);
+        }
+        return function;
+    }
+
+    string makeString()
+    {
+        string text;
+        for (int n = 2 + rng() % 8; n > 0; n--)
+        {
+            double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+            text += (text.empty() ? "" : " ") + words[(size_t)(words.size() * u * u)];
+        }
+        return text;
+    }
+
+    mt19937 rng;
+    vector<string> vocabulary;
+    vector<string> words;
+};
+
+// Timings of one board, ms after the update was sent; -1 if it did not happen
+struct BoardResult
+{
+    int64_t readyMs = -1;     // Image decoded and checked
+    int64_t switchMs = -1;    // Restarted into it
+    int64_t runningMs = -1;   // Back with MQTT after the restart
+    int64_t confirmedMs = -1;
+    int64_t rollbackMs = -1;  // --rollback: from the request to running the old image again
+    uint64_t darkMs = 0;      // Heads dark (restarting)
+    uint64_t sentBytes = 0;   // Chunk payloads, resends included
+    uint32_t resends = 0;     // Asked for after a gap, or after SENDER_TIMEOUT_MS without a report
+    uint32_t runningVersion = 0;
+    bool rejected = false;
+};
+
+// Written by a run's process to its pipe, so it must stay trivially copyable
+struct RunResult
+{
+    bool ok = false;
+    BoardResult boards[4];
+    int stallSeconds = 0;
+    int maxStallSeconds = 0;
+    int doubleGreens = 0;
+    double delaySec = 0;
+    uint64_t discharged = 0;
+};
+
+// The driver's side of one board's transfer, fed by the board's ota_status reports
+struct Sender
+{
+    string topic;
+    string statusTopic;
+    string patch;
+    uint32_t opsSize = 0;
+    bool started = false;
+    bool done = false;
+    uint32_t sent = 0;
+    uint32_t acked = 0;
+    double credit = 0;
+    uint64_t heardMs = 0;
+    uint64_t rollbackAtMs = 0;
+};
+
+struct StatusReport
+{
+    int board;
+    uint64_t atMs;
+    string state;
+    uint32_t next;
+    uint32_t running;
+};
+
+RunResult runOnce(const OtaBenchOptions &options, const string &base, const string &patch, bool update)
+{
+    RunResult result;
+    MicroSim sim(0.1f, options.seed);
+    for (int lane = 0; lane < 4; lane++)
+        sim.addLane(lane, 250.0f, options.rates[lane]);
+
+    IntersectionHarness intersection;
+    intersection.setSerialEcho(options.verbose);
+    int boards = options.singleBoard ? 1 : 4;
+    Sender senders[4];
+    vector<StatusReport> reports;
+    for (int b = 0; b < boards; b++)
+    {
+        intersection.devices[b].otaSlots[0] = base; // Flashed over USB, version unknown
+        char topic[mqtt_topics::MAX_TOPIC];
+        senders[b].topic = options.singleBoard ? MQTT_SITE_TOPIC("ota") : mqtt_topics::laneTopic(topic, b + 1, "ota");
+        senders[b].statusTopic = options.singleBoard ? MQTT_SITE_TOPIC("ota_status")
+                                                     : mqtt_topics::laneTopic(topic, b + 1, "ota_status");
+        senders[b].patch = patch;
+        senders[b].opsSize = (uint32_t)(patch.size() - sizeof(ota_update::PatchHeader));
+    }
+    hostBroker().addTap([&](const string &topic, const string &payload) {
+        for (int b = 0; b < boards; b++)
+        {
+            if (topic != senders[b].statusTopic)
+                continue;
+            DynamicJsonDocument doc(384);
+            if (!deserializeJson(doc, payload))
+                reports.push_back({b, hostScheduler().now(), doc["state"].as<string>(), doc["next"].as<uint32_t>(),
+                                   doc["running"].as<uint32_t>()});
+        }
+    });
+    intersection.start(hostLocalTime(2025, 4, 22, 8), options.singleBoard);
+
+    uint64_t updateMs = (uint64_t)(options.atSec * 1000);
+    auto since = [&](uint64_t ms) { return (int64_t)(ms - updateMs); };
+    TrafficLight lights[4];
+    int ticks = (int)(options.seconds * 10);
+    int stall = 0;
+    bool conflicting = false;
+    for (int tick = 0; tick < ticks; tick++)
+    {
+        uint64_t now = (uint64_t)tick * 100;
+        if (tick % 10 == 0)
+        {
+            int t = tick / 10;
+            for (int lane = 0; lane < 4; lane++)
+            {
+                if ((t + lane) % 5 == 0)
+                    intersection.publishCount(lane + 1, sim.stats(lane).halting);
+            }
+        }
+        intersection.advanceTo(now);
+
+        bool conflict = intersection.conflictCount() > 0;
+        if (conflict && !conflicting)
+            result.doubleGreens++;
+        conflicting = conflict;
+
+        bool waiting = false;
+        bool anyMoving = false;
+        for (int lane = 0; lane < 4; lane++)
+        {
+            HostLightState state = intersection.light(lane + 1);
+            lights[lane] = TrafficLight{state.red || (!state.yellow && !state.green), state.yellow, state.green};
+            waiting = waiting || sim.stats(lane).halting > 0;
+            anyMoving = anyMoving || state.green || state.yellow;
+        }
+        // Restarting: every output low, whatever the sketch's globals (kept on the host) say
+        for (int b = 0; b < boards; b++)
+        {
+            const HostDevice &device = intersection.devices[b];
+            bool lit = false;
+            for (int pin = 0; pin < 40; pin++)
+                lit = lit || (device.pinModes[pin] == OUTPUT && device.pins[pin] == HIGH);
+            result.boards[b].darkMs += lit ? 0 : 100;
+        }
+        if (tick % 10 == 0)
+        {
+            if (waiting && !anyMoving)
+                stall++;
+            if ((!waiting || anyMoving || tick + 10 >= ticks) && stall > 0)
+            {
+                if (stall > STALL_THRESHOLD_SEC)
+                    result.stallSeconds += stall;
+                result.maxStallSeconds = max(result.maxStallSeconds, stall);
+                stall = 0;
+            }
+        }
+
+        if (update)
+        {
+            for (auto &report : reports)
+            {
+                Sender &sender = senders[report.board];
+                BoardResult &board = result.boards[report.board];
+                sender.heardMs = report.atMs;
+                if (report.state == "receiving")
+                    sender.acked = max(sender.acked, report.next);
+                else if (report.state == "resend")
+                {
+                    sender.sent = report.next;
+                    board.resends++;
+                }
+                else if (report.state == "ready" && board.readyMs < 0)
+                {
+                    board.readyMs = since(report.atMs);
+                    sender.done = true;
+                }
+                else if (report.state == "applying" && board.switchMs < 0)
+                    board.switchMs = since(report.atMs);
+                else if ((report.state == "running" || report.state == "rolled_back") && board.switchMs >= 0)
+                {
+                    if (board.runningMs < 0)
+                        board.runningMs = since(report.atMs);
+                    else if (sender.rollbackAtMs > 0 && board.rollbackMs < 0)
+                        board.rollbackMs = (int64_t)(report.atMs - sender.rollbackAtMs);
+                }
+                else if (report.state == "confirmed" && board.confirmedMs < 0)
+                    board.confirmedMs = since(report.atMs);
+                else if (report.state == "rejected")
+                {
+                    board.rejected = true;
+                    sender.done = true;
+                }
+                board.runningVersion = report.running;
+            }
+            reports.clear();
+
+            bool allConfirmed = true;
+            uint64_t lastConfirmMs = 0;
+            for (int b = 0; b < boards; b++)
+            {
+                allConfirmed = allConfirmed && result.boards[b].confirmedMs >= 0;
+                lastConfirmMs = max(lastConfirmMs, (uint64_t)max<int64_t>(0, result.boards[b].confirmedMs) + updateMs);
+            }
+            for (int b = 0; b < boards && now >= updateMs; b++)
+            {
+                Sender &sender = senders[b];
+                BoardResult &board = result.boards[b];
+                if (!sender.started)
+                {
+                    hostBroker().publish(sender.topic, "B" + sender.patch.substr(0, sizeof(ota_update::PatchHeader)));
+                    sender.started = true;
+                    sender.heardMs = now;
+                    continue;
+                }
+                if (options.rollback && allConfirmed && sender.rollbackAtMs == 0 && now >= lastConfirmMs + ROLLBACK_AFTER_MS)
+                {
+                    hostBroker().publish(sender.topic, "R");
+                    sender.rollbackAtMs = now;
+                }
+                if (sender.done)
+                    continue;
+                if (now - sender.heardMs > SENDER_TIMEOUT_MS)
+                {
+                    sender.sent = sender.acked;
+                    sender.heardMs = now;
+                    board.resends++;
+                }
+                sender.credit = min(sender.credit + options.linkBytesPerSec / 10, (double)ota_update::BUFFER);
+                const char *ops = sender.patch.data() + sizeof(ota_update::PatchHeader);
+                while (sender.sent < sender.opsSize)
+                {
+                    uint32_t length = min<uint32_t>(ota_update::MAX_CHUNK, sender.opsSize - sender.sent);
+                    if (sender.sent + length - sender.acked > ota_update::BUFFER || sender.credit < length)
+                        break;
+                    string message = "D" + string((const char *)&sender.sent, 4) + string(ops + sender.sent, length);
+                    hostBroker().publish(sender.topic, message);
+                    sender.credit -= length;
+                    sender.sent += length;
+                    board.sentBytes += length;
+                }
+            }
+        }
+
+        sim.step(lights);
+    }
+
+    uint64_t arrivals = 0;
+    double delay = 0;
+    for (int lane = 0; lane < 4; lane++)
+    {
+        arrivals += sim.stats(lane).arrivals;
+        delay += sim.stats(lane).delaySec;
+        result.discharged += sim.stats(lane).discharged;
+    }
+    result.delaySec = delay / max<uint64_t>(1, arrivals);
+    result.ok = true;
+    return result;
+}
+
+// Run both in child processes at the same time; the broker and scheduler are per process
+vector<RunResult> runBoth(const OtaBenchOptions &options, const string &base, const string &patch)
+{
+    vector<RunResult> results(2);
+    pid_t pids[2];
+    int fds[2][2];
+    for (int run = 0; run < 2; run++)
+    {
+        if (pipe(fds[run]) != 0)
+        {
+            perror("pipe");
+            exit(1);
+        }
+        fflush(stdout);
+        pids[run] = fork();
+        if (pids[run] == 0)
+        {
+            close(fds[run][0]);
+            RunResult result = runOnce(options, base, patch, run == 1);
+            ssize_t written = write(fds[run][1], &result, sizeof(result));
+            _exit(written == (ssize_t)sizeof(result) ? 0 : 1); // Skip the sketch threads' teardown
+        }
+        close(fds[run][1]);
+        if (pids[run] < 0)
+        {
+            perror("fork");
+            exit(1);
+        }
+    }
+    for (int run = 0; run < 2; run++)
+    {
+        if (read(fds[run][0], &results[run], sizeof(RunResult)) != (ssize_t)sizeof(RunResult))
+            results[run].ok = false;
+        close(fds[run][0]);
+        waitpid(pids[run], nullptr, 0);
+    }
+    return results;
+}
+
+string readFile(const string &path)
+{
+    ifstream in(path, ios::binary);
+    stringstream buffer;
+    buffer << in.rdbuf();
+    return buffer.str();
+}
+
+string seconds(int64_t ms)
+{
+    char text[16];
+    if (ms < 0)
+        return "-";
+    snprintf(text, sizeof(text), "%.1f", ms / 1000.0);
+    return text;
+}
+
+int main(int argc, char **argv)
+{
+    OtaBenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        cout << "Usage: ota_bench [--seconds 900] [--at 300] [--link <bytes/s>] [--seed 1] [--single-board]\n"
+             << "                 [--full] [--rollback] [--verbose] [--rate <lane>=<veh/h>]\n"
+             << "                 [--base <old.bin> --target <new.bin> | --image-kb 960 --change-kb 2]" << endl;
+        return 1;
+    }
+
+    string base, target;
+    if (!options.base.empty())
+    {
+        base = readFile(options.base);
+        target = readFile(options.target);
+    }
+    else
+    {
+        SyntheticFirmware firmware(options.seed, (size_t)options.imageKb * 1024);
+        base = firmware.image();
+        firmware.update((size_t)options.changeKb * 1024);
+        target = firmware.image();
+    }
+    if (base.empty() || target.empty() || base.size() > HOST_APP_SLOT_SIZE || target.size() > HOST_APP_SLOT_SIZE)
+    {
+        cerr << "Images must be 1 to " << HOST_APP_SLOT_SIZE << " bytes" << endl;
+        return 1;
+    }
+
+    auto buildStart = chrono::steady_clock::now();
+    string patch = buildPatch(options.full ? string() : base, target, 2);
+    double buildSec = chrono::duration<double>(chrono::steady_clock::now() - buildStart).count();
+    size_t opsSize = patch.size() - sizeof(ota_update::PatchHeader);
+    printf("Image %zu -> %zu bytes; %s patch %zu bytes (%.1f %%), built in %.2f s\n", base.size(), target.size(),
+           options.full ? "full" : "delta", opsSize, 100.0 * opsSize / target.size(), buildSec);
+    printf("At %.0f KB/s per board the transfer takes %.1f s, the full image %.1f s\n",
+           options.linkBytesPerSec / 1024, opsSize / options.linkBytesPerSec, target.size() / options.linkBytesPerSec);
+
+    auto wallStart = chrono::steady_clock::now();
+    vector<RunResult> results = runBoth(options, base, patch);
+    double wallSec = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+    const RunResult &baseline = results[0], &run = results[1];
+    if (!baseline.ok || !run.ok)
+    {
+        cerr << "Run failed" << endl;
+        return 1;
+    }
+    printf("%.0f s (%s), update at %.0f s, in %.1f s wall\n", options.seconds,
+           options.singleBoard ? "single board" : "lane boards", options.atSec, wallSec);
+
+    int boards = options.singleBoard ? 1 : 4;
+    bool allConfirmed = true;
+    printf("Board  Sent (KB)  Resends  Ready (s)  Switch (s)  Back (s)  Dark (s)  Confirmed (s)  Rollback (s)  Running\n");
+    for (int b = 0; b < boards; b++)
+    {
+        const BoardResult &r = run.boards[b];
+        printf("%5s  %9.1f  %7u  %9s  %10s  %8s  %8.1f  %13s  %12s  %7s\n",
+               options.singleBoard ? "inter" : ("lane" + to_string(b + 1)).c_str(), r.sentBytes / 1024.0, r.resends,
+               seconds(r.readyMs).c_str(), seconds(r.switchMs).c_str(), seconds(r.runningMs).c_str(),
+               r.darkMs / 1000.0, seconds(r.confirmedMs).c_str(), seconds(r.rollbackMs).c_str(),
+               r.rejected ? "rejected" : ("v" + to_string(r.runningVersion)).c_str());
+        allConfirmed = allConfirmed && r.confirmedMs >= 0;
+    }
+    printf("                 Baseline   Update\n");
+    printf("Delay (s/veh)   %9.1f  %7.1f\n", baseline.delaySec, run.delaySec);
+    printf("Discharged      %9llu  %7llu\n", (unsigned long long)baseline.discharged, (unsigned long long)run.discharged);
+    printf("Stall (s)       %9d  %7d\n", baseline.stallSeconds, run.stallSeconds);
+    printf("Longest stall   %9d  %7d\n", baseline.maxStallSeconds, run.maxStallSeconds);
+    printf("Double greens   %9d  %7d\n", baseline.doubleGreens, run.doubleGreens);
+    if (run.doubleGreens > 0)
+        return 2;
+    return allConfirmed ? 0 : 3;
+}
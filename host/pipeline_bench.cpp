@@ -0,0 +1,289 @@
+// Benchmark of the staged detector pipeline (frame_pipeline.h).
+//
+// Runs decode -> preprocess -> infer -> track -> publish as typed stages on
+// synthetic frames: decode is paced to the camera's --fps, preprocess downsizes
+// the frame for real, and infer, track and publish wait their --*-ms the way a
+// GPU or a broker would. Frames go through latest-wins queues unless --block,
+// so a slow infer stage drops stale frames instead of delaying every later one.
+// The report shows each stage's occupancy, waits and service times, marks the
+// bottleneck and ends with the decode-to-publish latency.
+//
+// --queue-bench instead measures pushes and pops per second of BoundedQueue
+// against a mutex-guarded deque with the same capacity.
+//
+// Build:
+//   g++ -std=c++17 -O2 -pthread host/pipeline_bench.cpp -o pipeline_bench
+//
+// Examples:
+//   ./pipeline_bench
+//   ./pipeline_bench --infer-ms 80 --infer-workers 2
+//   ./pipeline_bench --block
+//   ./pipeline_bench --queue-bench --threads 4
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_pipeline.h"
+
+using namespace frame_pipeline;
+
+namespace
+{
+struct Options
+{
+    double seconds = 5;
+    double fps = 25;
+    double inferMs = 60;
+    int inferWorkers = 1;
+    double trackMs = 3;
+    double publishMs = 1;
+    bool block = false;
+    bool queueBench = false;
+    int threads = 2;
+};
+
+struct Frame
+{
+    uint64_t seq = 0;
+    uint64_t decodedNs = 0;
+    int width = 0, height = 0;
+    std::vector<uint8_t> pixels; // Grey, one byte per pixel
+};
+
+struct Detections
+{
+    uint64_t seq = 0;
+    uint64_t decodedNs = 0;
+    int boxes = 0;
+};
+
+void waitMs(double ms)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(ms * 1000)));
+}
+
+void runPipeline(const Options &options)
+{
+    Pipeline pipeline;
+    uint64_t frameNs = (uint64_t)(1e9 / options.fps);
+    uint64_t nextFrameNs = nowNs();
+    uint64_t sequence = 0;
+    uint64_t lastTracked = 0;
+    LatencyHistogram latency;
+    StageOptions frames;
+    frames.capacity = 1;
+    frames.overflow = options.block ? Overflow::BLOCK : Overflow::DROP_OLDEST;
+
+    auto decode = pipeline.source<Frame>("decode", [&](Frame &frame) {
+        uint64_t now = nowNs();
+        if (nextFrameNs > now)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(nextFrameNs - now));
+        nextFrameNs = std::max(nextFrameNs + frameNs, nowNs() - frameNs);
+        frame.seq = ++sequence;
+        frame.decodedNs = nowNs();
+        frame.width = 1920;
+        frame.height = 1080;
+        frame.pixels.assign((size_t)frame.width * frame.height, (uint8_t)frame.seq);
+        return true;
+    });
+
+    // 2x2 box filter to 960x540, standing in for the resize to the model's input
+    auto preprocess = pipeline.stage<Frame, Frame>(
+        "preprocess", decode,
+        [](Frame &in, Frame &out) {
+            out.seq = in.seq;
+            out.decodedNs = in.decodedNs;
+            out.width = in.width / 2;
+            out.height = in.height / 2;
+            out.pixels.resize((size_t)out.width * out.height);
+            for (int y = 0; y < out.height; y++)
+            {
+                const uint8_t *row = &in.pixels[(size_t)2 * y * in.width];
+                for (int x = 0; x < out.width; x++)
+                    out.pixels[(size_t)y * out.width + x] =
+                        (uint8_t)((row[2 * x] + row[2 * x + 1] + row[in.width + 2 * x] + row[in.width + 2 * x + 1]) / 4);
+            }
+            return true;
+        },
+        frames);
+
+    StageOptions infer = frames;
+    infer.workers = options.inferWorkers;
+    auto detect = pipeline.stage<Frame, Detections>(
+        "infer", preprocess,
+        [&](Frame &in, Detections &out) {
+            waitMs(options.inferMs);
+            out.seq = in.seq;
+            out.decodedNs = in.decodedNs;
+            out.boxes = in.pixels[0] % 8;
+            return true;
+        },
+        infer);
+
+    // One worker and a blocking queue: the tracker sees every inferred frame in
+    // order, except one overtaken by a later frame from another infer worker
+    auto track = pipeline.stage<Detections, Detections>("track", detect, [&](Detections &in, Detections &out) {
+        if (in.seq < lastTracked)
+            return false;
+        lastTracked = in.seq;
+        waitMs(options.trackMs);
+        out = in;
+        return true;
+    });
+
+    StageOptions publish;
+    publish.capacity = 16;
+    pipeline.sink<Detections>(
+        "publish", track,
+        [&](Detections &in) {
+            waitMs(options.publishMs);
+            latency.record(nowNs() - in.decodedNs);
+        },
+        publish);
+
+    pipeline.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds((int64_t)(options.seconds * 1000)));
+    pipeline.stop();
+
+    printf("%g fps camera, %s frame queues, %d infer worker%s, %g s\n", options.fps,
+           options.block ? "blocking" : "latest-wins", options.inferWorkers, options.inferWorkers == 1 ? "" : "s",
+           options.seconds);
+    pipeline.printReport();
+    printf("decode to publish: p50 %.1f ms, p99 %.1f ms, %llu frames published\n", latency.quantileMs(0.5),
+           latency.quantileMs(0.99), (unsigned long long)latency.samples());
+}
+
+// Mutex-guarded deque with the BoundedQueue interface, for comparison
+class LockedQueue
+{
+public:
+    explicit LockedQueue(size_t capacity) : cap(capacity) {}
+
+    bool tryPush(uint64_t value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.size() >= cap)
+            return false;
+        items.push_back(value);
+        return true;
+    }
+
+    bool tryPop(uint64_t &value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty())
+            return false;
+        value = items.front();
+        items.pop_front();
+        return true;
+    }
+
+private:
+    size_t cap;
+    std::mutex mutex;
+    std::deque<uint64_t> items;
+};
+
+// Items per second through the queue with `threads` producers and as many
+// consumers, each yielding when the queue is full or empty
+template <typename Queue>
+double queueThroughput(Queue &queue, int threads, double seconds)
+{
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> popped{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]() {
+            uint64_t value = 1;
+            while (!stopping.load(std::memory_order_relaxed))
+            {
+                if (queue.tryPush(value))
+                    value++;
+                else
+                    std::this_thread::yield();
+            }
+        });
+        workers.emplace_back([&]() {
+            uint64_t value, count = 0;
+            while (!stopping.load(std::memory_order_relaxed))
+            {
+                if (queue.tryPop(value))
+                    count++;
+                else
+                    std::this_thread::yield();
+            }
+            popped += count;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds((int64_t)(seconds * 1000)));
+    stopping = true;
+    for (auto &worker : workers)
+        worker.join();
+    return popped / seconds;
+}
+
+void runQueueBench(const Options &options)
+{
+    for (size_t capacity : {4, 64})
+    {
+        BoundedQueue<uint64_t> lockFree(capacity);
+        LockedQueue locked(capacity);
+        double a = queueThroughput(lockFree, options.threads, options.seconds / 4);
+        double b = queueThroughput(locked, options.threads, options.seconds / 4);
+        printf("capacity %3zu, %d producers + %d consumers: BoundedQueue %.1f M/s, mutex deque %.1f M/s\n", capacity,
+               options.threads, options.threads, a / 1e6, b / 1e6);
+    }
+}
+
+void usage()
+{
+    printf("Usage: pipeline_bench [--seconds S] [--fps F] [--infer-ms MS] [--infer-workers N] [--track-ms MS]\n"
+           "                      [--publish-ms MS] [--block] [--queue-bench] [--threads N]\n");
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() { return i + 1 < argc ? atof(argv[++i]) : 0.0; };
+        if (arg == "--seconds")
+            options.seconds = value();
+        else if (arg == "--fps")
+            options.fps = value();
+        else if (arg == "--infer-ms")
+            options.inferMs = value();
+        else if (arg == "--infer-workers")
+            options.inferWorkers = std::max(1, (int)value());
+        else if (arg == "--track-ms")
+            options.trackMs = value();
+        else if (arg == "--publish-ms")
+            options.publishMs = value();
+        else if (arg == "--block")
+            options.block = true;
+        else if (arg == "--queue-bench")
+            options.queueBench = true;
+        else if (arg == "--threads")
+            options.threads = std::max(1, (int)value());
+        else
+        {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    if (options.queueBench)
+        runQueueBench(options);
+    else
+        runPipeline(options);
+    return 0;
+}
@@ -0,0 +1,182 @@
+#ifndef QUEUE_MODEL_H
+#define QUEUE_MODEL_H
+
+// Point-queue traffic model for the host build.
+//
+// Each approach lane is a single queue at the stop line: vehicles join it on
+// arrival (Poisson) and leave at the saturation flow while the signal serves
+// the lane, after a start-up lost time. Delay is the time spent in the queue.
+// It has the same interface as MicroSim (micro_sim.h) for the parts the tools
+// use, and is orders of magnitude cheaper, which is what training and
+// planning loops need.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "micro_sim.h"
+
+struct QueueParams
+{
+    float saturationFlow = 1800.0f; // vehicles per hour of effective green
+    float startupLostTime = 2.0f;   // s of each green before discharge starts
+    float yellowDischarge = 2.0f;   // s of the yellow after green that is still used
+};
+
+class QueueModel
+{
+public:
+    struct LaneStats
+    {
+        uint64_t arrivals = 0;
+        uint64_t discharged = 0;
+        double delaySec = 0; // Vehicle-seconds spent in the queue
+        int halting = 0;     // Queue length after the last step
+    };
+
+    explicit QueueModel(float timeStep = 1.0f, uint32_t seed = 1) : dt(timeStep), rng(seed) {}
+
+    // Add an approach lane that obeys lights[signal]
+    int addLane(int signal, float arrivalsPerHour, const QueueParams &params = QueueParams())
+    {
+        Lane lane;
+        lane.signal = signal;
+        lane.arrivalRate = arrivalsPerHour / 3600.0f;
+        lane.dischargePerStep = params.saturationFlow / 3600.0f * dt;
+        lane.params = params;
+        lane.nextArrival = sampleHeadway(lane.arrivalRate);
+        lanes.push_back(lane);
+        return (int)lanes.size() - 1;
+    }
+
+    void seedQueue(int laneIndex, int n)
+    {
+        lanes[laneIndex].queue += n;
+        lanes[laneIndex].stats.halting = lanes[laneIndex].queue;
+    }
+
+    void setArrivalRate(int laneIndex, float arrivalsPerHour)
+    {
+        lanes[laneIndex].arrivalRate = arrivalsPerHour / 3600.0f;
+    }
+
+    // Advance one fixed time step
+    void step(const TrafficLight *lights)
+    {
+        for (auto &lane : lanes)
+        {
+            arrive(lane);
+            serve(lane, lights[lane.signal]);
+            lane.stats.delaySec += lane.queue * dt;
+            lane.stats.halting = lane.queue;
+        }
+        time += dt;
+    }
+
+    // Advance `seconds` with the lights held constant
+    void run(const TrafficLight *lights, float seconds)
+    {
+        int steps = (int)(seconds / dt + 0.5f);
+        for (int i = 0; i < steps; i++)
+            step(lights);
+    }
+
+    int laneCount() const { return (int)lanes.size(); }
+    int vehicleCount(int laneIndex) const { return lanes[laneIndex].queue; }
+    const LaneStats &stats(int laneIndex) const { return lanes[laneIndex].stats; }
+    double simTime() const { return time; }
+
+    int totalVehicles() const
+    {
+        int n = 0;
+        for (const auto &lane : lanes)
+            n += lane.queue;
+        return n;
+    }
+
+private:
+    enum ServeState
+    {
+        STOPPED,
+        GREEN,
+        CLEARING // yellow right after green
+    };
+
+    struct Lane
+    {
+        int signal = 0;
+        float arrivalRate = 0.0f; // vehicles per second
+        double nextArrival = 0;   // seconds until the next arrival
+        float dischargePerStep = 0.0f;
+        QueueParams params;
+
+        int queue = 0;
+        ServeState state = STOPPED;
+        float stateTime = 0.0f; // s since the state started
+        float credit = 0.0f;    // discharge capacity not used yet, in vehicles
+
+        LaneStats stats;
+    };
+
+    double sampleHeadway(float rate)
+    {
+        if (rate <= 0)
+            return 1e30;
+        std::exponential_distribution<double> headway(rate);
+        return headway(rng);
+    }
+
+    void arrive(Lane &lane)
+    {
+        lane.nextArrival -= dt;
+        while (lane.nextArrival <= 0)
+        {
+            lane.queue++;
+            lane.stats.arrivals++;
+            lane.nextArrival += sampleHeadway(lane.arrivalRate);
+        }
+    }
+
+    void serve(Lane &lane, const TrafficLight &light)
+    {
+        ServeState next = STOPPED;
+        if (light.green)
+            next = GREEN;
+        else if (light.yellow && lane.state != STOPPED)
+            next = CLEARING;
+
+        if (next != lane.state)
+        {
+            lane.state = next;
+            lane.stateTime = 0.0f;
+        }
+        lane.stateTime += dt;
+
+        bool discharging = (lane.state == GREEN && lane.stateTime > lane.params.startupLostTime) ||
+                           (lane.state == CLEARING && lane.stateTime <= lane.params.yellowDischarge);
+        if (!discharging)
+        {
+            lane.credit = 0.0f;
+            return;
+        }
+
+        lane.credit += lane.dischargePerStep;
+        int n = std::min(lane.queue, (int)lane.credit);
+        lane.queue -= n;
+        lane.credit -= n;
+        lane.stats.discharged += n;
+
+        // Capacity cannot be saved up while nobody is waiting
+        if (lane.queue == 0)
+            lane.credit = std::min(lane.credit, 1.0f);
+    }
+
+    std::vector<Lane> lanes;
+    float dt;
+    double time = 0;
+    std::mt19937 rng;
+};
+
+#endif // QUEUE_MODEL_H
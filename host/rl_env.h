@@ -0,0 +1,302 @@
+#ifndef RL_ENV_H
+#define RL_ENV_H
+
+// Batched intersection environment for learning signal policies.
+//
+// Each of the N intersections runs the lane controllers' cycle under the same
+// config the boards load (lane_config.h, the compiled-in defaults unless one is
+// given): the conflict matrix forms barrier groups (phase_engine.h), {1, 3} and
+// {2, 4} by default, served in turn, and every section of a group runs its own
+// green between the config's clearance intervals (leading all red, pre-yellow,
+// then its yellow and, with kinematic clearance, its all red). The next group
+// starts once every section of this one has cleared. The only decision is the
+// one each board makes with its policy table (lane_policy.h): how long its
+// section stays green. One env step is one such decision, taken section by
+// section in serving order; a group's sections all decide on the counts at the
+// start of its turn, so the traffic only moves, and the step only has a reward,
+// on the last decision of a group. With that config, a policy learned here is
+// what the boards would run.
+//
+// Observation (kObsDim floats, section order starts at the one deciding now):
+//   [0..3] halting vehicles on each approach (obs[0] is what that section's
+//          board would receive as its vehicle count)
+//   [4]    1 if the config's plan schedule is jam sibuk at the current hour
+//   [5]    hour of day / 23
+// Reward: minus the vehicle-minutes of delay on all approaches during the step.
+// Episodes end after episodeSeconds of simulated time and reset automatically.
+//
+// Traffic comes from QueueModel (queue_model.h) by default, or from the
+// vehicle-level MicroSim (micro_sim.h) when microscopic is set.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../esp32_arduino_ide/esp32_lane1/lane_policy.h"
+#include "../esp32_arduino_ide/esp32_lane1/plan_schedule.h"
+#include "../esp32_arduino_ide/esp32_lane1/lane_config.h"
+#include "../esp32_arduino_ide/esp32_lane1/phase_engine.h"
+#include "micro_sim.h"
+#include "queue_model.h"
+#include "thread_pool.h"
+
+struct RlEnvConfig
+{
+    int numEnvs = 64;
+    uint32_t seed = 1;
+    bool microscopic = false;
+    int threads = 0;                // 0 = one per hardware thread
+    float episodeSeconds = 3600.0f;
+    float minRate = 50.0f;          // arrivals per approach, vehicles per hour,
+    float maxRate = 350.0f;         // sampled per approach at every reset
+    float rushFactor = 1.3f;        // demand multiplier during the schedule's jam sibuk
+    int hour = -1;                  // fixed hour of day, or -1 to sample per episode
+    // Conflict groups, clearance, green limits and rush hours of the boards
+    lane_config::LaneConfig signal = {0, 0, lane_config::defaults()};
+};
+
+class VecIntersectionEnv
+{
+public:
+    static const int kObsDim = 6;
+    static const int kActions = 9;
+
+    // Green time in seconds for each action
+    static const float *greenOptions()
+    {
+        static const float options[kActions] = {5, 10, 15, 20, 25, 30, 40, 50, 60};
+        return options;
+    }
+
+    explicit VecIntersectionEnv(const RlEnvConfig &envConfig)
+        : config(envConfig), pool(envConfig.threads), envs(envConfig.numEnvs)
+    {
+        for (int i = 0; i < size(); i++)
+            envs[i].rng.seed(config.seed * 1000003u + (uint32_t)i);
+
+        // Serving order: the barrier groups in turn, each in section order
+        phases.setConflicts(config.signal.body.conflicts);
+        int n = 0;
+        for (int lead = 1; lead <= 4; lead++)
+        {
+            for (int s = lead; s <= 4; s++)
+            {
+                if (phases.leadOf(s) == lead)
+                    order[n++] = s - 1;
+            }
+        }
+    }
+
+    int size() const { return (int)envs.size(); }
+    int threads() const { return pool.size(); }
+
+    // Reset every intersection and write the first observations (size() x kObsDim)
+    void reset(float *obs)
+    {
+        pool.parallelFor(size(), [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                resetEnv(envs[i]);
+                observe(envs[i], obs + i * kObsDim);
+            }
+        });
+    }
+
+    // Apply one action per intersection. Finished episodes are reset and obs
+    // holds the first observation of the new episode. seconds, if given,
+    // receives the simulated time each step took (0 until a group's last decision).
+    void step(const int32_t *actions, float *obs, float *rewards, uint8_t *dones, float *seconds = nullptr)
+    {
+        pool.parallelFor(size(), [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                Env &env = envs[i];
+                int action = actions[i] < 0 ? 0 : (actions[i] >= kActions ? kActions - 1 : actions[i]);
+                int lane = order[env.decision];
+                env.greens[lane] = config.signal.clampGreen(greenOptions()[action]);
+                env.decision = (env.decision + 1) % 4;
+                env.steps++;
+
+                float took = 0;
+                rewards[i] = 0;
+                if (env.decision == 0 || phases.leadOf(order[env.decision] + 1) != phases.leadOf(lane + 1))
+                {
+                    double delayBefore = totalDelay(env);
+                    int lead = phases.leadOf(lane + 1);
+                    took = config.microscopic ? runGroup(*env.micro, lead, env.greens)
+                                              : runGroup(*env.queue, lead, env.greens);
+                    env.elapsed += took;
+                    rewards[i] = -(float)((totalDelay(env) - delayBefore) / 60.0);
+                }
+                if (seconds)
+                    seconds[i] = took;
+
+                dones[i] = env.decision == 0 && env.elapsed >= config.episodeSeconds;
+                if (dones[i])
+                    resetEnv(env);
+                observe(env, obs + i * kObsDim);
+            }
+        });
+    }
+
+    // What the lane sketches would do: the config's green for the deciding
+    // section's count, rounded to the nearest green option
+    void baselineActions(const float *obs, int32_t *actions) const
+    {
+        for (int i = 0; i < size(); i++)
+        {
+            const float *o = obs + i * kObsDim;
+            float duration = config.signal.greenSeconds(o[0], o[4] > 0.5f);
+            actions[i] = nearestAction((float)(int)duration); // countdownTimer((int)duration)
+        }
+    }
+
+    static int nearestAction(float greenSeconds)
+    {
+        int best = 0;
+        for (int a = 1; a < kActions; a++)
+        {
+            if (std::fabs(greenOptions()[a] - greenSeconds) < std::fabs(greenOptions()[best] - greenSeconds))
+                best = a;
+        }
+        return best;
+    }
+
+    uint64_t totalSteps() const
+    {
+        uint64_t n = 0;
+        for (const auto &env : envs)
+            n += env.steps;
+        return n;
+    }
+
+private:
+    struct Env
+    {
+        std::mt19937 rng;
+        std::unique_ptr<QueueModel> queue;
+        std::unique_ptr<MicroSim> micro;
+        int decision = 0;  // Index into order of the section deciding next
+        float greens[4] = {};
+        double elapsed = 0;
+        int hour = 8;
+        bool rush = false;
+        uint64_t steps = 0;
+    };
+
+    void resetEnv(Env &env)
+    {
+        std::uniform_int_distribution<int> hourDist(0, 23);
+        std::uniform_real_distribution<float> rateDist(config.minRate, config.maxRate);
+        std::uniform_int_distribution<int> queueDist(0, 8);
+
+        env.hour = config.hour >= 0 ? config.hour : hourDist(env.rng);
+        env.rush = config.signal.isRushHour(env.hour);
+        env.decision = 0;
+        env.elapsed = 0;
+
+        uint32_t simSeed = env.rng();
+        if (config.microscopic)
+            env.micro.reset(new MicroSim(0.1f, simSeed));
+        else
+            env.queue.reset(new QueueModel(1.0f, simSeed));
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+            float rate = rateDist(env.rng) * (env.rush ? config.rushFactor : 1.0f);
+            int initialQueue = queueDist(env.rng);
+            if (config.microscopic)
+            {
+                env.micro->addLane(lane, 250.0f, rate);
+                env.micro->seedQueue(lane, initialQueue);
+            }
+            else
+            {
+                env.queue->addLane(lane, rate);
+                env.queue->seedQueue(lane, initialQueue);
+            }
+        }
+    }
+
+    // One turn of the group led by `lead` as the boards run it: every section
+    // of the group goes through its clearance and green at the same time, and
+    // the turn ends when the last one has cleared. Returns its length in seconds.
+    template <typename Sim>
+    float runGroup(Sim &sim, int lead, const float greens[4]) const
+    {
+        const lane_config::LaneConfig &signal = config.signal;
+        const float start = signal.leadRedMs() / 1000.0f;
+        float greenAt[4], yellowAt[4], redAt[4], clearAt[4];
+        float end = start;
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if (phases.leadOf(lane + 1) != lead)
+            {
+                greenAt[lane] = yellowAt[lane] = redAt[lane] = clearAt[lane] = 0;
+                continue;
+            }
+            greenAt[lane] = start + signal.body.preYellowMs / 1000.0f;
+            yellowAt[lane] = greenAt[lane] + greens[lane];
+            redAt[lane] = yellowAt[lane] + signal.yellowMsFor(lane + 1) / 1000.0f;
+            clearAt[lane] = redAt[lane] + signal.allRedMsFor(lane + 1) / 1000.0f;
+            end = std::max(end, clearAt[lane]);
+        }
+
+        // Run the simulator between consecutive signal changes
+        float t = 0;
+        while (t < end)
+        {
+            float next = end;
+            TrafficLight lights[4];
+            for (int lane = 0; lane < 4; lane++)
+            {
+                bool member = phases.leadOf(lane + 1) == lead;
+                bool preYellow = member && t >= start && t < greenAt[lane];
+                bool green = member && t >= greenAt[lane] && t < yellowAt[lane];
+                bool yellow = member && t >= yellowAt[lane] && t < redAt[lane];
+                lights[lane] = TrafficLight{!(preYellow || green || yellow), preYellow || yellow, green};
+                if (member)
+                {
+                    for (float change : {start, greenAt[lane], yellowAt[lane], redAt[lane]})
+                    {
+                        if (change > t && change < next)
+                            next = change;
+                    }
+                }
+            }
+            sim.run(lights, next - t);
+            t = next;
+        }
+        return end;
+    }
+
+    double totalDelay(const Env &env) const
+    {
+        double delay = 0;
+        for (int lane = 0; lane < 4; lane++)
+            delay += config.microscopic ? env.micro->stats(lane).delaySec : env.queue->stats(lane).delaySec;
+        return delay;
+    }
+
+    void observe(const Env &env, float *obs) const
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            int lane = order[(env.decision + k) % 4];
+            obs[k] = (float)(config.microscopic ? env.micro->stats(lane).halting : env.queue->stats(lane).halting);
+        }
+        obs[4] = env.rush ? 1.0f : 0.0f;
+        obs[5] = env.hour / 23.0f;
+    }
+
+    RlEnvConfig config;
+    ThreadPool pool;
+    std::vector<Env> envs;
+    phase_engine::PhaseEngine phases; // Barrier groups of the config's conflict matrix
+    int order[4];                     // Sections (0-based) in serving order
+};
+
+#endif // RL_ENV_H
@@ -0,0 +1,71 @@
+// C interface to VecIntersectionEnv (rl_env.h) for the Python bindings in
+// Python/traffic_rl_env.py, which load it with ctypes.
+//
+// Build:
+//   g++ -std=c++17 -O3 -march=native -pthread -shared -fPIC -Ihost/shim host/rl_env_capi.cpp -o Python/librl_env.so
+
+#include "rl_env.h"
+
+extern "C"
+{
+    int rl_env_obs_dim()
+    {
+        return VecIntersectionEnv::kObsDim;
+    }
+
+    int rl_env_num_actions()
+    {
+        return VecIntersectionEnv::kActions;
+    }
+
+    // Green seconds of every action, kActions floats
+    void rl_env_green_options(float *out)
+    {
+        for (int a = 0; a < VecIntersectionEnv::kActions; a++)
+            out[a] = VecIntersectionEnv::greenOptions()[a];
+    }
+
+    // config/configLength: a lane_config.h blob (Python/lane_config.py --out) for the
+    // signal settings, or NULL for the compiled-in defaults. Returns NULL if it does not parse.
+    void *rl_env_create(int numEnvs, uint32_t seed, int microscopic, int threads, float episodeSeconds,
+                        float minRate, float maxRate, int hour, const uint8_t *config, size_t configLength)
+    {
+        RlEnvConfig envConfig;
+        if (config && lane_config::parse(config, configLength, envConfig.signal) != lane_config::CONFIG_OK)
+            return nullptr;
+        envConfig.numEnvs = numEnvs;
+        envConfig.seed = seed;
+        envConfig.microscopic = microscopic != 0;
+        envConfig.threads = threads;
+        envConfig.episodeSeconds = episodeSeconds;
+        envConfig.minRate = minRate;
+        envConfig.maxRate = maxRate;
+        envConfig.hour = hour;
+        return new VecIntersectionEnv(envConfig);
+    }
+
+    void rl_env_destroy(void *env)
+    {
+        delete static_cast<VecIntersectionEnv *>(env);
+    }
+
+    int rl_env_threads(void *env)
+    {
+        return static_cast<VecIntersectionEnv *>(env)->threads();
+    }
+
+    void rl_env_reset(void *env, float *obs)
+    {
+        static_cast<VecIntersectionEnv *>(env)->reset(obs);
+    }
+
+    void rl_env_step(void *env, const int32_t *actions, float *obs, float *rewards, uint8_t *dones, float *seconds)
+    {
+        static_cast<VecIntersectionEnv *>(env)->step(actions, obs, rewards, dones, seconds);
+    }
+
+    void rl_env_baseline_actions(void *env, const float *obs, int32_t *actions)
+    {
+        static_cast<VecIntersectionEnv *>(env)->baselineActions(obs, actions);
+    }
+}
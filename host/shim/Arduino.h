@@ -0,0 +1,391 @@
+#ifndef HOST_SHIM_ARDUINO_H
+#define HOST_SHIM_ARDUINO_H
+
+// Minimal Arduino/ESP32 core API for building the lane sketches on the host.
+// Only what the sketches use is provided. Time comes from the virtual clock in
+// host_runtime.h, pins and Serial output belong to the board that is running.
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include "../host_runtime.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+const int LOW = 0;
+const int HIGH = 1;
+const int INPUT = 0;
+const int OUTPUT = 1;
+const int BIN = 2;
+const int OCT = 8;
+const int DEC = 10;
+const int HEX = 16;
+
+class String
+{
+public:
+    String() {}
+    String(const char *s) : value(s != nullptr ? s : "") {}
+    String(const std::string &s) : value(s) {}
+    explicit String(char c) : value(1, c) {}
+    String(int v) : value(std::to_string(v)) {}
+    String(unsigned int v) : value(std::to_string(v)) {}
+    String(long v) : value(std::to_string(v)) {}
+    String(unsigned long v) : value(std::to_string(v)) {}
+    String(long long v) : value(std::to_string(v)) {}
+    String(unsigned long long v) : value(std::to_string(v)) {}
+    String(float v, unsigned int decimals = 2) : value(formatFloat(v, decimals)) {}
+    String(double v, unsigned int decimals = 2) : value(formatFloat(v, decimals)) {}
+
+    const char *c_str() const { return value.c_str(); }
+    unsigned int length() const { return (unsigned int)value.size(); }
+    bool isEmpty() const { return value.empty(); }
+    const std::string &str() const { return value; }
+
+    char charAt(unsigned int i) const { return i < value.size() ? value[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+
+    String &operator+=(const String &other)
+    {
+        value += other.value;
+        return *this;
+    }
+    String &operator+=(const char *other)
+    {
+        value += other;
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        value += c;
+        return *this;
+    }
+
+    bool operator==(const String &other) const { return value == other.value; }
+    bool operator==(const char *other) const { return value == other; }
+    bool operator!=(const String &other) const { return value != other.value; }
+    bool operator!=(const char *other) const { return value != other; }
+    bool operator<(const String &other) const { return value < other.value; }
+
+    int indexOf(char c, unsigned int from = 0) const
+    {
+        size_t pos = value.find(c, from);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    int indexOf(const String &s, unsigned int from = 0) const
+    {
+        size_t pos = value.find(s.value, from);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    bool startsWith(const String &s) const { return value.compare(0, s.value.size(), s.value) == 0; }
+    bool endsWith(const String &s) const
+    {
+        return value.size() >= s.value.size() &&
+               value.compare(value.size() - s.value.size(), s.value.size(), s.value) == 0;
+    }
+
+    String substring(unsigned int from) const
+    {
+        return from >= value.size() ? String() : String(value.substr(from));
+    }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if (from > to)
+            std::swap(from, to);
+        if (from >= value.size())
+            return String();
+        return String(value.substr(from, to - from));
+    }
+
+    void replace(const String &find, const String &with)
+    {
+        if (find.value.empty())
+            return;
+        size_t pos = 0;
+        while ((pos = value.find(find.value, pos)) != std::string::npos)
+        {
+            value.replace(pos, find.value.size(), with.value);
+            pos += with.value.size();
+        }
+    }
+
+    void trim()
+    {
+        size_t start = 0;
+        while (start < value.size() && isspace((unsigned char)value[start]))
+            start++;
+        size_t end = value.size();
+        while (end > start && isspace((unsigned char)value[end - 1]))
+            end--;
+        value = value.substr(start, end - start);
+    }
+
+    void toLowerCase()
+    {
+        for (auto &c : value)
+            c = (char)tolower((unsigned char)c);
+    }
+    void toUpperCase()
+    {
+        for (auto &c : value)
+            c = (char)toupper((unsigned char)c);
+    }
+
+    long toInt() const { return atol(value.c_str()); }
+    float toFloat() const { return (float)atof(value.c_str()); }
+
+private:
+    static std::string formatFloat(double v, unsigned int decimals)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, v);
+        return buffer;
+    }
+
+    std::string value;
+};
+
+inline String operator+(const String &a, const String &b)
+{
+    String result(a);
+    result += b;
+    return result;
+}
+inline String operator+(const String &a, const char *b)
+{
+    String result(a);
+    result += b;
+    return result;
+}
+inline String operator+(const char *a, const String &b)
+{
+    String result(a);
+    result += b;
+    return result;
+}
+
+// Serial port of the board that is currently running
+class HostSerial
+{
+public:
+    void begin(unsigned long) {}
+    operator bool() const { return true; }
+
+    void print(const String &s) { emit(s.str()); }
+    void print(const char *s) { emit(s); }
+    void print(char c) { emit(std::string(1, c)); }
+    void print(int v) { emit(std::to_string(v)); }
+    void print(unsigned int v) { emit(std::to_string(v)); }
+    void print(long v) { emit(std::to_string(v)); }
+    void print(unsigned long v) { emit(std::to_string(v)); }
+    void print(long long v) { emit(std::to_string(v)); }
+    void print(unsigned long long v) { emit(std::to_string(v)); }
+    void print(double v, int decimals = 2) { emit(String(v, decimals).str()); }
+    void print(int v, int base) { print((unsigned long)(unsigned int)v, base); }
+    void print(unsigned int v, int base) { print((unsigned long)v, base); }
+    void print(long v, int base) { print((unsigned long)v, base); }
+    void print(unsigned long v, int base)
+    {
+        if (base == DEC)
+        {
+            print(v);
+            return;
+        }
+        std::string digits;
+        do
+        {
+            digits.insert(digits.begin(), "0123456789ABCDEF"[v % base]);
+            v /= base;
+        } while (v != 0);
+        emit(digits);
+    }
+
+    template <typename T>
+    void println(const T &v)
+    {
+        print(v);
+        println();
+    }
+    template <typename T>
+    void println(const T &v, int format)
+    {
+        print(v, format);
+        println();
+    }
+    void println() { emit("\n"); }
+
+    size_t write(uint8_t c)
+    {
+        emit(std::string(1, (char)c));
+        return 1;
+    }
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        emit(std::string((const char *)buffer, size));
+        return size;
+    }
+
+private:
+    void emit(const std::string &text)
+    {
+        HostDevice &device = hostCurrentDevice();
+        if (!device.serialEcho)
+            return;
+        for (char c : text)
+        {
+            if (c == '\n')
+            {
+                std::cout << "[" << device.name << " " << hostScheduler().now() << "ms] " << device.serialLine << "\n";
+                device.serialLine.clear();
+            }
+            else
+            {
+                device.serialLine += c;
+            }
+        }
+    }
+};
+
+inline HostSerial Serial;
+
+inline unsigned long millis()
+{
+    return (unsigned long)(uint32_t)hostScheduler().now();
+}
+
+inline unsigned long micros()
+{
+    return (unsigned long)(uint32_t)(hostScheduler().now() * 1000);
+}
+
+inline void delay(unsigned long ms)
+{
+    hostScheduler().sleep(ms);
+}
+
+inline void yield()
+{
+    hostScheduler().sleep(0);
+}
+
+// esp_err.h
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+// esp_system.h: esp_restart() is in esp_ota_ops.h, next to the bootloader's slot choice
+typedef enum
+{
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT
+} esp_reset_reason_t;
+
+inline esp_reset_reason_t esp_reset_reason()
+{
+    return hostCurrentDevice().boots == 0 ? ESP_RST_POWERON : ESP_RST_SW;
+}
+
+// FreeRTOS as the sketches use it. Tasks run on the virtual scheduler, one at a time, so a
+// critical section has nothing to exclude.
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define pdMS_TO_TICKS(ms) ((uint32_t)(ms))
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+inline void vTaskDelay(uint32_t ticks)
+{
+    hostScheduler().sleep(ticks);
+}
+
+// The task runs on the device of the sketch that starts it; the core is ignored
+inline int xTaskCreatePinnedToCore(TaskFunction_t task, const char *, uint32_t, void *parameter, int,
+                                   TaskHandle_t *handle, int)
+{
+    if (handle != nullptr)
+        *handle = nullptr;
+    hostScheduler().spawn(&hostCurrentDevice(), [task, parameter]() { task(parameter); });
+    return 1; // pdPASS
+}
+
+// A task can hold a mutex across a delay (a flash write), so here one does have to wait
+struct HostMutex
+{
+    bool taken = false;
+};
+typedef HostMutex *SemaphoreHandle_t;
+#define portMAX_DELAY 0xffffffffu
+#define pdTRUE 1
+#define pdFALSE 0
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new HostMutex(); // Never freed, like the board's until the next restart
+}
+
+inline int xSemaphoreTake(SemaphoreHandle_t mutex, uint32_t ticks)
+{
+    for (uint32_t waited = 0; mutex->taken; waited++)
+    {
+        if (waited >= ticks)
+            return pdFALSE;
+        hostScheduler().sleep(1);
+    }
+    mutex->taken = true;
+    return pdTRUE;
+}
+
+inline int xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    mutex->taken = false;
+    return pdTRUE;
+}
+
+inline void pinMode(int pin, int mode)
+{
+    if (pin >= 0 && pin < 40)
+        hostCurrentDevice().pinModes[pin] = mode;
+}
+
+inline void digitalWrite(int pin, int value)
+{
+    if (pin >= 0 && pin < 40)
+        hostCurrentDevice().pins[pin] = value;
+}
+
+inline int digitalRead(int pin)
+{
+    return (pin >= 0 && pin < 40) ? hostCurrentDevice().pins[pin] : LOW;
+}
+
+// ESP32 time API (esp32-hal-time) on top of the virtual clock.
+// The scheduler epoch is already local wall-clock time, so the timezone passed
+// to configTime() is not applied again.
+inline void configTime(long, int, const char *, const char * = nullptr, const char * = nullptr)
+{
+}
+
+inline bool getLocalTime(struct tm *info, uint32_t = 5000)
+{
+    time_t t = hostScheduler().epoch() + (time_t)(hostScheduler().now() / 1000);
+    gmtime_r(&t, info);
+    return true;
+}
+
+#endif // HOST_SHIM_ARDUINO_H
@@ -0,0 +1,825 @@
+#ifndef HOST_SHIM_ARDUINOJSON_H
+#define HOST_SHIM_ARDUINOJSON_H
+
+// Subset of the ArduinoJson 6 API used by the lane sketches, for the host build.
+// Documents are a small tree of JsonNode values; capacities are accepted but
+// not enforced.
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Arduino.h"
+
+struct JsonNode
+{
+    enum Kind
+    {
+        Null,
+        Bool,
+        Int,
+        Float,
+        Str,
+        Obj,
+        Arr
+    };
+
+    Kind kind = Null;
+    bool b = false;
+    long long i = 0;
+    double f = 0;
+    std::string s;
+    // Deques, so JsonObject/JsonArray handles to a child stay valid when siblings are added
+    std::deque<std::pair<std::string, JsonNode>> members;
+    std::deque<JsonNode> items;
+
+    JsonNode *find(const std::string &key)
+    {
+        if (kind != Obj)
+            return nullptr;
+        for (auto &member : members)
+        {
+            if (member.first == key)
+                return &member.second;
+        }
+        return nullptr;
+    }
+
+    JsonNode &getOrAdd(const std::string &key)
+    {
+        if (kind != Obj)
+        {
+            *this = JsonNode();
+            kind = Obj;
+        }
+        JsonNode *existing = find(key);
+        if (existing != nullptr)
+            return *existing;
+        members.push_back(std::make_pair(key, JsonNode()));
+        return members.back().second;
+    }
+};
+
+class JsonVariant;
+class JsonObject;
+class JsonArray;
+
+template <typename T, typename Enable = void>
+struct JsonConvert;
+
+class JsonVariant
+{
+public:
+    JsonVariant() {}
+    explicit JsonVariant(JsonNode *node) : direct(node) {}
+    JsonVariant(JsonNode *parentNode, const std::string &memberKey) : parent(parentNode), key(memberKey) {}
+
+    JsonNode *node() const
+    {
+        if (direct != nullptr)
+            return direct;
+        return parent != nullptr ? parent->find(key) : nullptr;
+    }
+
+    JsonNode &nodeForWrite() const
+    {
+        if (direct != nullptr)
+            return *direct;
+        return parent->getOrAdd(key);
+    }
+
+    bool isNull() const
+    {
+        JsonNode *n = node();
+        return n == nullptr || n->kind == JsonNode::Null;
+    }
+
+    template <typename T>
+    T as() const
+    {
+        return JsonConvert<T>::get(node());
+    }
+
+    template <typename T>
+    bool is() const
+    {
+        return JsonConvert<T>::is(node());
+    }
+
+    template <typename T>
+    operator T() const
+    {
+        return as<T>();
+    }
+
+    template <typename T>
+    JsonVariant &operator=(const T &value)
+    {
+        JsonConvert<T>::set(nodeForWrite(), value);
+        return *this;
+    }
+
+    JsonVariant &operator=(const char *value)
+    {
+        JsonNode &n = nodeForWrite();
+        n = JsonNode();
+        n.kind = JsonNode::Str;
+        n.s = value != nullptr ? value : "";
+        return *this;
+    }
+
+    JsonVariant &operator=(const JsonVariant &other)
+    {
+        JsonNode *src = other.node();
+        nodeForWrite() = src != nullptr ? *src : JsonNode();
+        return *this;
+    }
+
+    JsonVariant operator[](const char *memberKey) const
+    {
+        return JsonVariant(&nodeForWrite(), memberKey);
+    }
+
+    JsonVariant operator[](const String &memberKey) const
+    {
+        return JsonVariant(&nodeForWrite(), memberKey.str());
+    }
+
+    JsonVariant operator[](int index) const
+    {
+        JsonNode *n = node();
+        if (n == nullptr || n->kind != JsonNode::Arr || index < 0 || (size_t)index >= n->items.size())
+            return JsonVariant();
+        return JsonVariant(&n->items[index]);
+    }
+
+    bool containsKey(const char *memberKey) const
+    {
+        JsonNode *n = node();
+        return n != nullptr && n->find(memberKey) != nullptr;
+    }
+
+    bool containsKey(const String &memberKey) const
+    {
+        return containsKey(memberKey.c_str());
+    }
+
+    size_t size() const
+    {
+        JsonNode *n = node();
+        if (n == nullptr)
+            return 0;
+        return n->kind == JsonNode::Obj ? n->members.size() : (n->kind == JsonNode::Arr ? n->items.size() : 0);
+    }
+
+    JsonArray createNestedArray(const char *memberKey) const;
+    JsonObject createNestedObject(const char *memberKey) const;
+
+private:
+    JsonNode *direct = nullptr;
+    JsonNode *parent = nullptr;
+    std::string key;
+};
+
+class JsonString
+{
+public:
+    explicit JsonString(const std::string &s) : value(&s) {}
+    const char *c_str() const { return value->c_str(); }
+    operator String() const { return String(*value); }
+
+private:
+    const std::string *value;
+};
+
+class JsonPair
+{
+public:
+    explicit JsonPair(std::pair<std::string, JsonNode> *member) : pair(member) {}
+    JsonString key() const { return JsonString(pair->first); }
+    JsonVariant value() const { return JsonVariant(&pair->second); }
+
+private:
+    std::pair<std::string, JsonNode> *pair;
+};
+
+class JsonObject
+{
+public:
+    class iterator
+    {
+    public:
+        using Members = std::deque<std::pair<std::string, JsonNode>>;
+        iterator() {}
+        explicit iterator(Members::iterator member) : current(member) {}
+        JsonPair operator*() const { return JsonPair(&*current); }
+        iterator &operator++()
+        {
+            current++;
+            return *this;
+        }
+        bool operator!=(const iterator &other) const { return current != other.current; }
+
+    private:
+        Members::iterator current;
+    };
+
+    JsonObject() {}
+    explicit JsonObject(JsonNode *objectNode) : n(objectNode) {}
+
+    iterator begin() const { return valid() ? iterator(n->members.begin()) : iterator(); }
+    iterator end() const { return valid() ? iterator(n->members.end()) : iterator(); }
+
+    bool isNull() const { return !valid(); }
+    size_t size() const { return valid() ? n->members.size() : 0; }
+    bool containsKey(const char *key) const { return valid() && n->find(key) != nullptr; }
+    JsonVariant operator[](const char *key) const { return JsonVariant(n, key); }
+
+private:
+    bool valid() const { return n != nullptr && n->kind == JsonNode::Obj; }
+    JsonNode *n = nullptr;
+};
+
+class JsonArray
+{
+public:
+    JsonArray() {}
+    explicit JsonArray(JsonNode *arrayNode) : n(arrayNode) {}
+
+    template <typename T>
+    bool add(const T &value)
+    {
+        if (n == nullptr)
+            return false;
+        n->items.push_back(JsonNode());
+        JsonVariant(&n->items.back()) = value;
+        return true;
+    }
+
+    bool add(const char *value)
+    {
+        if (n == nullptr)
+            return false;
+        n->items.push_back(JsonNode());
+        JsonVariant(&n->items.back()) = value;
+        return true;
+    }
+
+    size_t size() const { return n != nullptr ? n->items.size() : 0; }
+    bool isNull() const { return n == nullptr || n->kind != JsonNode::Arr; }
+    JsonVariant operator[](size_t index) const
+    {
+        return (n != nullptr && index < n->items.size()) ? JsonVariant(&n->items[index]) : JsonVariant();
+    }
+
+private:
+    JsonNode *n = nullptr;
+};
+
+inline JsonArray JsonVariant::createNestedArray(const char *memberKey) const
+{
+    JsonNode &child = nodeForWrite().getOrAdd(memberKey);
+    child = JsonNode();
+    child.kind = JsonNode::Arr;
+    return JsonArray(&child);
+}
+
+inline JsonObject JsonVariant::createNestedObject(const char *memberKey) const
+{
+    JsonNode &child = nodeForWrite().getOrAdd(memberKey);
+    child = JsonNode();
+    child.kind = JsonNode::Obj;
+    return JsonObject(&child);
+}
+
+// Value conversions
+
+inline std::string jsonSerializeNode(const JsonNode &n);
+
+template <typename T>
+struct JsonConvert<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static T get(const JsonNode *n)
+    {
+        if (n == nullptr)
+            return 0;
+        switch (n->kind)
+        {
+        case JsonNode::Int:
+            return (T)n->i;
+        case JsonNode::Float:
+            return (T)n->f;
+        case JsonNode::Bool:
+            return (T)n->b;
+        case JsonNode::Str:
+            return (T)atoll(n->s.c_str());
+        default:
+            return 0;
+        }
+    }
+    static bool is(const JsonNode *n) { return n != nullptr && n->kind == JsonNode::Int; }
+    static void set(JsonNode &n, T value)
+    {
+        n = JsonNode();
+        n.kind = JsonNode::Int;
+        n.i = (long long)value;
+    }
+};
+
+template <typename T>
+struct JsonConvert<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static T get(const JsonNode *n)
+    {
+        if (n == nullptr)
+            return 0;
+        switch (n->kind)
+        {
+        case JsonNode::Int:
+            return (T)n->i;
+        case JsonNode::Float:
+            return (T)n->f;
+        case JsonNode::Str:
+            return (T)atof(n->s.c_str());
+        default:
+            return 0;
+        }
+    }
+    static bool is(const JsonNode *n) { return n != nullptr && (n->kind == JsonNode::Int || n->kind == JsonNode::Float); }
+    static void set(JsonNode &n, T value)
+    {
+        n = JsonNode();
+        n.kind = JsonNode::Float;
+        n.f = value;
+    }
+};
+
+template <>
+struct JsonConvert<bool>
+{
+    static bool get(const JsonNode *n)
+    {
+        if (n == nullptr)
+            return false;
+        if (n->kind == JsonNode::Bool)
+            return n->b;
+        if (n->kind == JsonNode::Int)
+            return n->i != 0;
+        return false;
+    }
+    static bool is(const JsonNode *n) { return n != nullptr && n->kind == JsonNode::Bool; }
+    static void set(JsonNode &n, bool value)
+    {
+        n = JsonNode();
+        n.kind = JsonNode::Bool;
+        n.b = value;
+    }
+};
+
+template <>
+struct JsonConvert<String>
+{
+    static String get(const JsonNode *n)
+    {
+        if (n == nullptr)
+            return String("null");
+        if (n->kind == JsonNode::Str)
+            return String(n->s);
+        return String(jsonSerializeNode(*n));
+    }
+    static bool is(const JsonNode *n) { return n != nullptr && n->kind == JsonNode::Str; }
+    static void set(JsonNode &n, const String &value)
+    {
+        n = JsonNode();
+        n.kind = JsonNode::Str;
+        n.s = value.str();
+    }
+};
+
+template <>
+struct JsonConvert<std::string>
+{
+    static std::string get(const JsonNode *n) { return JsonConvert<String>::get(n).str(); }
+    static bool is(const JsonNode *n) { return JsonConvert<String>::is(n); }
+    static void set(JsonNode &n, const std::string &value) { JsonConvert<String>::set(n, String(value)); }
+};
+
+template <>
+struct JsonConvert<const char *>
+{
+    static const char *get(const JsonNode *n) { return (n != nullptr && n->kind == JsonNode::Str) ? n->s.c_str() : nullptr; }
+    static bool is(const JsonNode *n) { return JsonConvert<String>::is(n); }
+};
+
+template <>
+struct JsonConvert<JsonObject>
+{
+    static JsonObject get(const JsonNode *n) { return JsonObject(const_cast<JsonNode *>(n)); }
+    static bool is(const JsonNode *n) { return n != nullptr && n->kind == JsonNode::Obj; }
+};
+
+template <>
+struct JsonConvert<JsonArray>
+{
+    static JsonArray get(const JsonNode *n)
+    {
+        return (n != nullptr && n->kind == JsonNode::Arr) ? JsonArray(const_cast<JsonNode *>(n)) : JsonArray();
+    }
+    static bool is(const JsonNode *n) { return n != nullptr && n->kind == JsonNode::Arr; }
+};
+
+class JsonDocument
+{
+public:
+    explicit JsonDocument(size_t = 0) {}
+
+    JsonVariant operator[](const char *key) { return JsonVariant(&root, key); }
+    JsonVariant operator[](const String &key) { return JsonVariant(&root, key.str()); }
+    bool containsKey(const char *key) const { return const_cast<JsonNode &>(root).find(key) != nullptr; }
+    bool containsKey(const String &key) const { return containsKey(key.c_str()); }
+
+    template <typename T>
+    T as() const
+    {
+        return JsonConvert<T>::get(&root);
+    }
+
+    template <typename T>
+    T to()
+    {
+        root = JsonNode();
+        root.kind = std::is_same<T, JsonArray>::value ? JsonNode::Arr : JsonNode::Obj;
+        return JsonConvert<T>::get(&root);
+    }
+
+    JsonArray createNestedArray(const char *key) { return JsonVariant(&root).createNestedArray(key); }
+    JsonObject createNestedObject(const char *key) { return JsonVariant(&root).createNestedObject(key); }
+
+    size_t size() const { return root.kind == JsonNode::Obj ? root.members.size() : root.items.size(); }
+    void clear() { root = JsonNode(); }
+    bool overflowed() const { return false; }
+
+    JsonNode root;
+};
+
+class DynamicJsonDocument : public JsonDocument
+{
+public:
+    explicit DynamicJsonDocument(size_t capacity) : JsonDocument(capacity) {}
+};
+
+template <size_t N>
+class StaticJsonDocument : public JsonDocument
+{
+public:
+    StaticJsonDocument() : JsonDocument(N) {}
+};
+
+class DeserializationError
+{
+public:
+    enum Code
+    {
+        Ok,
+        EmptyInput,
+        IncompleteInput,
+        InvalidInput,
+        NoMemory
+    };
+
+    DeserializationError(Code c = Ok) : errorCode(c) {}
+    explicit operator bool() const { return errorCode != Ok; }
+    Code code() const { return errorCode; }
+    const char *c_str() const
+    {
+        static const char *names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory"};
+        return names[errorCode];
+    }
+
+private:
+    Code errorCode;
+};
+
+// Recursive descent parser
+class JsonParser
+{
+public:
+    JsonParser(const char *input, size_t length) : p(input), end(input + length) {}
+
+    DeserializationError parse(JsonNode &out)
+    {
+        skipSpace();
+        if (p >= end)
+            return DeserializationError::EmptyInput;
+        DeserializationError::Code code = value(out, 0);
+        return code;
+    }
+
+private:
+    void skipSpace()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+    }
+
+    DeserializationError::Code value(JsonNode &out, int depth)
+    {
+        if (depth > 10)
+            return DeserializationError::NoMemory;
+        skipSpace();
+        if (p >= end)
+            return DeserializationError::IncompleteInput;
+
+        out = JsonNode();
+        char c = *p;
+        if (c == '{')
+        {
+            p++;
+            out.kind = JsonNode::Obj;
+            skipSpace();
+            if (p < end && *p == '}')
+            {
+                p++;
+                return DeserializationError::Ok;
+            }
+            while (true)
+            {
+                skipSpace();
+                std::string key;
+                DeserializationError::Code code = string(key);
+                if (code != DeserializationError::Ok)
+                    return code;
+                skipSpace();
+                if (p >= end)
+                    return DeserializationError::IncompleteInput;
+                if (*p != ':')
+                    return DeserializationError::InvalidInput;
+                p++;
+                out.members.push_back(std::make_pair(key, JsonNode()));
+                code = value(out.members.back().second, depth + 1);
+                if (code != DeserializationError::Ok)
+                    return code;
+                skipSpace();
+                if (p >= end)
+                    return DeserializationError::IncompleteInput;
+                if (*p == ',')
+                {
+                    p++;
+                    continue;
+                }
+                if (*p == '}')
+                {
+                    p++;
+                    return DeserializationError::Ok;
+                }
+                return DeserializationError::InvalidInput;
+            }
+        }
+        if (c == '[')
+        {
+            p++;
+            out.kind = JsonNode::Arr;
+            skipSpace();
+            if (p < end && *p == ']')
+            {
+                p++;
+                return DeserializationError::Ok;
+            }
+            while (true)
+            {
+                out.items.push_back(JsonNode());
+                DeserializationError::Code code = value(out.items.back(), depth + 1);
+                if (code != DeserializationError::Ok)
+                    return code;
+                skipSpace();
+                if (p >= end)
+                    return DeserializationError::IncompleteInput;
+                if (*p == ',')
+                {
+                    p++;
+                    continue;
+                }
+                if (*p == ']')
+                {
+                    p++;
+                    return DeserializationError::Ok;
+                }
+                return DeserializationError::InvalidInput;
+            }
+        }
+        if (c == '"' || c == '\'')
+        {
+            out.kind = JsonNode::Str;
+            return string(out.s);
+        }
+        if (literal("true"))
+        {
+            out.kind = JsonNode::Bool;
+            out.b = true;
+            return DeserializationError::Ok;
+        }
+        if (literal("false"))
+        {
+            out.kind = JsonNode::Bool;
+            return DeserializationError::Ok;
+        }
+        if (literal("null"))
+        {
+            return DeserializationError::Ok;
+        }
+        return number(out);
+    }
+
+    bool literal(const char *word)
+    {
+        size_t n = strlen(word);
+        if ((size_t)(end - p) >= n && strncmp(p, word, n) == 0)
+        {
+            p += n;
+            return true;
+        }
+        return false;
+    }
+
+    DeserializationError::Code string(std::string &out)
+    {
+        if (p >= end)
+            return DeserializationError::IncompleteInput;
+        char quote = *p;
+        if (quote != '"' && quote != '\'')
+            return DeserializationError::InvalidInput;
+        p++;
+        while (p < end && *p != quote)
+        {
+            if (*p == '\\' && p + 1 < end)
+            {
+                p++;
+                switch (*p)
+                {
+                case 'n':
+                    out += '\n';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                default:
+                    out += *p;
+                    break;
+                }
+                p++;
+                continue;
+            }
+            out += *p++;
+        }
+        if (p >= end)
+            return DeserializationError::IncompleteInput;
+        p++;
+        return DeserializationError::Ok;
+    }
+
+    DeserializationError::Code number(JsonNode &out)
+    {
+        const char *start = p;
+        bool isFloat = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            p++;
+        while (p < end && (isdigit((unsigned char)*p) || *p == '.' || *p == 'e' || *p == 'E' || *p == '-' || *p == '+'))
+        {
+            if (*p == '.' || *p == 'e' || *p == 'E')
+                isFloat = true;
+            p++;
+        }
+        if (p == start)
+            return DeserializationError::InvalidInput;
+        std::string text(start, p - start);
+        if (isFloat)
+        {
+            out.kind = JsonNode::Float;
+            out.f = atof(text.c_str());
+        }
+        else
+        {
+            out.kind = JsonNode::Int;
+            out.i = atoll(text.c_str());
+        }
+        return DeserializationError::Ok;
+    }
+
+    const char *p;
+    const char *end;
+};
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input, size_t length)
+{
+    doc.clear();
+    if (input == nullptr)
+        return DeserializationError::EmptyInput;
+    return JsonParser(input, length).parse(doc.root);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input)
+{
+    return deserializeJson(doc, input, input != nullptr ? strlen(input) : 0);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const String &input)
+{
+    return deserializeJson(doc, input.c_str(), input.length());
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const uint8_t *input, size_t length)
+{
+    return deserializeJson(doc, (const char *)input, length);
+}
+
+inline void jsonSerializeTo(const JsonNode &n, std::string &out)
+{
+    char buffer[48];
+    switch (n.kind)
+    {
+    case JsonNode::Null:
+        out += "null";
+        break;
+    case JsonNode::Bool:
+        out += n.b ? "true" : "false";
+        break;
+    case JsonNode::Int:
+        out += std::to_string(n.i);
+        break;
+    case JsonNode::Float:
+        snprintf(buffer, sizeof(buffer), "%.9g", n.f);
+        out += buffer;
+        break;
+    case JsonNode::Str:
+        out += '"';
+        for (char c : n.s)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+        out += '"';
+        break;
+    case JsonNode::Obj:
+        out += '{';
+        for (size_t i = 0; i < n.members.size(); i++)
+        {
+            if (i > 0)
+                out += ',';
+            out += '"';
+            out += n.members[i].first;
+            out += "\":";
+            jsonSerializeTo(n.members[i].second, out);
+        }
+        out += '}';
+        break;
+    case JsonNode::Arr:
+        out += '[';
+        for (size_t i = 0; i < n.items.size(); i++)
+        {
+            if (i > 0)
+                out += ',';
+            jsonSerializeTo(n.items[i], out);
+        }
+        out += ']';
+        break;
+    }
+}
+
+inline std::string jsonSerializeNode(const JsonNode &n)
+{
+    std::string out;
+    jsonSerializeTo(n, out);
+    return out;
+}
+
+inline size_t serializeJson(const JsonDocument &doc, String &output)
+{
+    output = String(jsonSerializeNode(doc.root));
+    return output.length();
+}
+
+inline size_t serializeJson(const JsonDocument &doc, char *buffer, size_t size)
+{
+    std::string text = jsonSerializeNode(doc.root);
+    if (size == 0)
+        return 0;
+    size_t n = text.size() < size - 1 ? text.size() : size - 1;
+    memcpy(buffer, text.data(), n);
+    buffer[n] = '\0';
+    return n;
+}
+
+inline size_t measureJson(const JsonDocument &doc)
+{
+    return jsonSerializeNode(doc.root).size();
+}
+
+#endif // HOST_SHIM_ARDUINOJSON_H
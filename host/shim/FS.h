@@ -0,0 +1,103 @@
+#ifndef HOST_SHIM_FS_H
+#define HOST_SHIM_FS_H
+
+// File system stand-in for the host build. Files live in RAM in the running
+// board's HostDevice, like its NVS, so the flash is as fast as memory and
+// vanishes with the process.
+
+#include <algorithm>
+
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+class File
+{
+public:
+    File() {}
+    File(std::string *contents, bool append) : data(contents), pos(append ? contents->size() : 0) {}
+
+    explicit operator bool() const { return data != nullptr; }
+
+    size_t size() const { return data ? data->size() : 0; }
+    size_t position() const { return pos; }
+    int available() const { return data && pos < data->size() ? (int)(data->size() - pos) : 0; }
+
+    bool seek(size_t offset)
+    {
+        if (!data || offset > data->size())
+            return false;
+        pos = offset;
+        return true;
+    }
+
+    int read()
+    {
+        return available() > 0 ? (uint8_t)(*data)[pos++] : -1;
+    }
+
+    size_t read(uint8_t *buffer, size_t size)
+    {
+        size_t count = std::min(size, (size_t)available());
+        if (count > 0)
+            memcpy(buffer, data->data() + pos, count);
+        pos += count;
+        return count;
+    }
+
+    // Writes go to the current position, which is the end for FILE_WRITE and FILE_APPEND
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        if (!data)
+            return 0;
+        data->replace(pos, std::min(size, data->size() - pos), (const char *)buffer, size);
+        pos += size;
+        return size;
+    }
+
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t print(const String &text) { return write((const uint8_t *)text.c_str(), text.length()); }
+    size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t println(const String &text) { return print(text) + print('\n'); }
+
+    void close() { data = nullptr; }
+
+private:
+    std::string *data = nullptr;
+    size_t pos = 0;
+};
+
+class HostFS
+{
+public:
+    bool begin(bool = false) { return true; }
+
+    bool exists(const String &path) const
+    {
+        return hostCurrentDevice().files.count(path.c_str()) > 0;
+    }
+
+    bool remove(const String &path)
+    {
+        return hostCurrentDevice().files.erase(path.c_str()) > 0;
+    }
+
+    File open(const String &path, const char *mode = FILE_READ)
+    {
+        auto &files = hostCurrentDevice().files;
+        if (mode[0] == 'r')
+        {
+            auto it = files.find(path.c_str());
+            return it != files.end() ? File(&it->second, false) : File();
+        }
+        std::string &contents = files[path.c_str()];
+        if (mode[0] == 'w')
+            contents.clear();
+        return File(&contents, true);
+    }
+};
+
+#endif // HOST_SHIM_FS_H
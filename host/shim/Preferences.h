@@ -0,0 +1,81 @@
+#ifndef HOST_SHIM_PREFERENCES_H
+#define HOST_SHIM_PREFERENCES_H
+
+// NVS Preferences stand-in for the host build. Values live in the running
+// board's HostDevice, so they survive a sketch restart but not the process.
+
+#include "Arduino.h"
+
+class Preferences
+{
+public:
+    bool begin(const char *name, bool readOnly = false)
+    {
+        space = name;
+        writable = !readOnly;
+        opened = true;
+        return true;
+    }
+
+    void end()
+    {
+        opened = false;
+    }
+
+    size_t getBytesLength(const char *key)
+    {
+        const std::string *value = find(key);
+        return value != nullptr ? value->size() : 0;
+    }
+
+    size_t getBytes(const char *key, void *buf, size_t maxLen)
+    {
+        const std::string *value = find(key);
+        if (value == nullptr || value->size() > maxLen)
+            return 0;
+        memcpy(buf, value->data(), value->size());
+        return value->size();
+    }
+
+    size_t putBytes(const char *key, const void *value, size_t len)
+    {
+        if (!opened || !writable)
+            return 0;
+        hostCurrentDevice().nvs[space + "/" + key] = std::string((const char *)value, len);
+        return len;
+    }
+
+    bool remove(const char *key)
+    {
+        if (!opened || !writable)
+            return false;
+        return hostCurrentDevice().nvs.erase(space + "/" + key) > 0;
+    }
+
+    bool clear()
+    {
+        if (!opened || !writable)
+            return false;
+        auto &nvs = hostCurrentDevice().nvs;
+        std::string prefix = space + "/";
+        for (auto it = nvs.begin(); it != nvs.end();)
+            it = it->first.compare(0, prefix.size(), prefix) == 0 ? nvs.erase(it) : std::next(it);
+        return true;
+    }
+
+private:
+    const std::string *find(const char *key) const
+    {
+        if (!opened)
+            return nullptr;
+        const auto &nvs = hostCurrentDevice().nvs;
+        auto it = nvs.find(space + "/" + key);
+        return it != nvs.end() ? &it->second : nullptr;
+    }
+
+    std::string space;
+    bool writable = false;
+    bool opened = false;
+};
+
+#endif // HOST_SHIM_PREFERENCES_H
@@ -0,0 +1,148 @@
+#ifndef HOST_SHIM_PUBSUBCLIENT_H
+#define HOST_SHIM_PUBSUBCLIENT_H
+
+// PubSubClient stand-in backed by the in-process HostBroker
+
+#include <functional>
+#include <vector>
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "../host_broker.h"
+
+#define MQTT_CONNECTED 0
+#define MQTT_DISCONNECTED -1
+
+class PubSubClient
+{
+public:
+    typedef std::function<void(char *, uint8_t *, unsigned int)> Callback;
+
+    PubSubClient() {}
+    explicit PubSubClient(WiFiClient &) {}
+
+    PubSubClient &setServer(const char *host, int port)
+    {
+        serverHost = host;
+        serverPort = port;
+        return *this;
+    }
+
+    PubSubClient &setCallback(Callback cb)
+    {
+        callback = cb;
+        return *this;
+    }
+
+    PubSubClient &setBufferSize(uint16_t) { return *this; }
+    PubSubClient &setKeepAlive(uint16_t) { return *this; }
+
+    bool connect(const char *id)
+    {
+        session.clientId = id;
+        return hostBroker().connect(&session); // Refused during a fault-plan outage
+    }
+
+    bool connect(const char *id, const char *, const char *)
+    {
+        return connect(id);
+    }
+
+    void disconnect()
+    {
+        hostBroker().disconnect(&session);
+    }
+
+    bool connected() const { return session.connected; }
+    int state() const { return session.connected ? MQTT_CONNECTED : MQTT_DISCONNECTED; }
+
+    bool subscribe(const char *topic)
+    {
+        if (!session.connected)
+            return false;
+        hostBroker().subscribe(&session, topic);
+        return true;
+    }
+
+    bool publish(const char *topic, const char *payload)
+    {
+        return publish(topic, payload, false);
+    }
+
+    bool publish(const char *topic, const char *payload, bool retained)
+    {
+        if (!session.connected)
+            return false;
+        hostBroker().publish(topic, payload, retained);
+        return true;
+    }
+
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained = false)
+    {
+        if (!session.connected)
+            return false;
+        hostBroker().publish(topic, std::string((const char *)payload, length), retained);
+        return true;
+    }
+
+    // Streamed publish: the payload is collected and sent as one message by endPublish()
+    bool beginPublish(const char *topic, unsigned int length, bool retained)
+    {
+        if (!session.connected)
+            return false;
+        streamTopic = topic;
+        streamPayload.clear();
+        streamPayload.reserve(length);
+        streamRetained = retained;
+        return true;
+    }
+
+    size_t write(uint8_t c)
+    {
+        streamPayload.push_back((char)c);
+        return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        streamPayload.append((const char *)buffer, size);
+        return size;
+    }
+
+    int endPublish()
+    {
+        if (!session.connected)
+            return 0;
+        hostBroker().publish(streamTopic, streamPayload, streamRetained);
+        return 1;
+    }
+
+    // Handles at most one incoming message per call, like the real client
+    bool loop()
+    {
+        if (!session.connected)
+            return false;
+
+        HostMessage message;
+        if (hostBroker().poll(&session, message) && callback)
+        {
+            std::vector<char> topic(message.topic.begin(), message.topic.end());
+            topic.push_back('\0');
+            std::vector<uint8_t> payload(message.payload.begin(), message.payload.end());
+            payload.push_back(0);
+            callback(topic.data(), payload.data(), (unsigned int)message.payload.size());
+        }
+        return true;
+    }
+
+private:
+    HostSession session;
+    Callback callback;
+    const char *serverHost = nullptr;
+    int serverPort = 0;
+    std::string streamTopic;
+    std::string streamPayload;
+    bool streamRetained = false;
+};
+
+#endif // HOST_SHIM_PUBSUBCLIENT_H
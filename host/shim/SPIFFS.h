@@ -0,0 +1,10 @@
+#ifndef HOST_SHIM_SPIFFS_H
+#define HOST_SHIM_SPIFFS_H
+
+// SPIFFS stand-in for the host build, see FS.h
+
+#include "FS.h"
+
+inline HostFS SPIFFS;
+
+#endif // HOST_SHIM_SPIFFS_H
@@ -0,0 +1,46 @@
+#ifndef HOST_SHIM_WIFI_H
+#define HOST_SHIM_WIFI_H
+
+// WiFi stand-in for the host build: the network is always up
+
+#include "Arduino.h"
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_CONNECTED = 3,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+class IPAddress
+{
+public:
+    IPAddress(uint8_t a = 127, uint8_t b = 0, uint8_t c = 0, uint8_t d = 1) : octets{a, b, c, d} {}
+
+    String toString() const
+    {
+        return String((int)octets[0]) + "." + String((int)octets[1]) + "." + String((int)octets[2]) + "." + String((int)octets[3]);
+    }
+
+    operator String() const { return toString(); }
+
+private:
+    uint8_t octets[4];
+};
+
+class HostWiFi
+{
+public:
+    void begin(const char *, const char *) {}
+    wl_status_t status() const { return WL_CONNECTED; }
+    String localIP() const { return IPAddress().toString(); }
+    void disconnect() {}
+};
+
+inline HostWiFi WiFi;
+
+class WiFiClient
+{
+};
+
+#endif // HOST_SHIM_WIFI_H
@@ -0,0 +1,200 @@
+#ifndef HOST_SHIM_ESP_OTA_OPS_H
+#define HOST_SHIM_ESP_OTA_OPS_H
+
+// ESP-IDF app OTA and partition API over two RAM app slots per device
+// (HostDevice::otaSlots). esp_restart() is here as well, because a restart is
+// where the bootloader picks the slot to run and applies its rollback rules.
+// Erasing a flash sector costs HOST_SECTOR_ERASE_MS of virtual time, so long
+// writes hold up the sketch like they do on the board.
+
+#include <cstring>
+#include <string>
+
+#include "Arduino.h"
+
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_OTA_VALIDATE_FAILED 0x1503
+#define OTA_SIZE_UNKNOWN 0xffffffff
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+
+const uint32_t HOST_APP_SLOT_SIZE = 0x140000; // Default partition table: two 1.25 MB app slots
+const uint32_t HOST_SECTOR_SIZE = 4096;
+const unsigned long HOST_SECTOR_ERASE_MS = 45;
+const unsigned long HOST_BOOT_MS = 1200; // Reset to the end of setup()'s first lines, heads dark
+
+typedef enum
+{
+    ESP_PARTITION_SUBTYPE_APP_OTA_0 = 0x10,
+    ESP_PARTITION_SUBTYPE_APP_OTA_1 = 0x11
+} esp_partition_subtype_t;
+
+typedef struct
+{
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    const char *label;
+} esp_partition_t;
+
+typedef enum
+{
+    ESP_OTA_IMG_NEW = 0,
+    ESP_OTA_IMG_PENDING_VERIFY = 1,
+    ESP_OTA_IMG_VALID = 2,
+    ESP_OTA_IMG_INVALID = 3,
+    ESP_OTA_IMG_ABORTED = 4,
+    ESP_OTA_IMG_UNDEFINED = -1
+} esp_ota_img_states_t;
+
+typedef uint32_t esp_ota_handle_t;
+
+inline const esp_partition_t *hostAppSlot(int slot)
+{
+    static const esp_partition_t SLOTS[2] = {
+        {ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, HOST_APP_SLOT_SIZE, "app0"},
+        {ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x150000, HOST_APP_SLOT_SIZE, "app1"},
+    };
+    return &SLOTS[slot];
+}
+
+inline int hostSlotOf(const esp_partition_t *partition)
+{
+    return partition->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_1 ? 1 : 0;
+}
+
+inline const esp_partition_t *esp_ota_get_running_partition()
+{
+    return hostAppSlot(hostCurrentDevice().otaRunning);
+}
+
+inline const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *)
+{
+    return hostAppSlot(1 - hostCurrentDevice().otaRunning);
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+    // Erased flash beyond the image reads as 0xFF
+    const std::string &image = hostCurrentDevice().otaSlots[hostSlotOf(partition)];
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_ARG;
+    for (size_t i = 0; i < size; i++)
+        ((uint8_t *)dst)[i] = offset + i < image.size() ? (uint8_t)image[offset + i] : 0xFF;
+    return ESP_OK;
+}
+
+// One transfer at a time per device; the handle is the slot number + 1
+inline esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t imageSize, esp_ota_handle_t *handle)
+{
+    HostDevice &device = hostCurrentDevice();
+    int slot = hostSlotOf(partition);
+    if (slot == device.otaRunning)
+        return ESP_ERR_INVALID_ARG;
+    device.otaSlots[slot].clear();
+    device.otaState[slot] = ESP_OTA_IMG_UNDEFINED;
+    if (imageSize != OTA_WITH_SEQUENTIAL_WRITES)
+        delay((partition->size / HOST_SECTOR_SIZE) * HOST_SECTOR_ERASE_MS); // Whole slot up front
+    *handle = (esp_ota_handle_t)slot + 1;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    if (handle == 0)
+        return ESP_ERR_INVALID_ARG;
+    std::string &image = hostCurrentDevice().otaSlots[handle - 1];
+    if (image.size() + size > HOST_APP_SLOT_SIZE)
+        return ESP_ERR_INVALID_ARG;
+    size_t sectorsBefore = (image.size() + HOST_SECTOR_SIZE - 1) / HOST_SECTOR_SIZE;
+    image.append((const char *)data, size);
+    size_t sectorsAfter = (image.size() + HOST_SECTOR_SIZE - 1) / HOST_SECTOR_SIZE;
+    if (sectorsAfter > sectorsBefore)
+        delay((sectorsAfter - sectorsBefore) * HOST_SECTOR_ERASE_MS);
+    return ESP_OK;
+}
+
+// The image format is not checked on the host; anything written counts as an app
+inline esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    if (handle == 0)
+        return ESP_ERR_INVALID_ARG;
+    HostDevice &device = hostCurrentDevice();
+    if (device.otaSlots[handle - 1].empty())
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    device.otaState[handle - 1] = ESP_OTA_IMG_NEW;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    if (handle == 0)
+        return ESP_ERR_INVALID_ARG;
+    hostCurrentDevice().otaState[handle - 1] = ESP_OTA_IMG_INVALID;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    HostDevice &device = hostCurrentDevice();
+    int slot = hostSlotOf(partition);
+    if (device.otaSlots[slot].empty() || device.otaState[slot] == ESP_OTA_IMG_INVALID ||
+        device.otaState[slot] == ESP_OTA_IMG_UNDEFINED)
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    device.otaBoot = slot;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_ota_get_state_partition(const esp_partition_t *partition, esp_ota_img_states_t *state)
+{
+    *state = (esp_ota_img_states_t)hostCurrentDevice().otaState[hostSlotOf(partition)];
+    return ESP_OK;
+}
+
+inline esp_err_t esp_ota_mark_app_valid_cancel_rollback()
+{
+    HostDevice &device = hostCurrentDevice();
+    device.otaState[device.otaRunning] = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+// Restart the board: outputs go low for HOST_BOOT_MS, then the bootloader runs the boot
+// slot. A new image runs on trial (PENDING_VERIFY); one still on trial at the next restart
+// is marked ABORTED and the other slot runs instead.
+[[noreturn]] inline void esp_restart()
+{
+    HostDevice &device = hostCurrentDevice();
+    for (int pin = 0; pin < 40; pin++)
+    {
+        if (device.pinModes[pin] == OUTPUT)
+            device.pins[pin] = LOW;
+    }
+    hostScheduler().restartDevice();
+    delay(HOST_BOOT_MS);
+
+    int slot = device.otaBoot;
+    if (device.otaState[slot] == ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        device.otaState[slot] = ESP_OTA_IMG_ABORTED;
+        slot = 1 - slot;
+        device.otaBoot = slot;
+    }
+    else if (device.otaState[slot] == ESP_OTA_IMG_NEW)
+    {
+        device.otaState[slot] = ESP_OTA_IMG_PENDING_VERIFY;
+    }
+    device.otaRunning = slot;
+    Serial.print("rst: SW_CPU_RESET, boot app");
+    Serial.println(slot);
+    throw HostRestart();
+}
+
+inline esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot()
+{
+    HostDevice &device = hostCurrentDevice();
+    device.otaState[device.otaRunning] = ESP_OTA_IMG_INVALID;
+    device.otaBoot = 1 - device.otaRunning;
+    esp_restart();
+}
+
+#endif // HOST_SHIM_ESP_OTA_OPS_H
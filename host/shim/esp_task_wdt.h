@@ -0,0 +1,24 @@
+#ifndef HOST_SHIM_ESP_TASK_WDT_H
+#define HOST_SHIM_ESP_TASK_WDT_H
+
+// ESP-IDF task watchdog stand-in. The host has no task watchdog: a sketch that hangs
+// here stops the virtual clock instead of resetting.
+
+#include "Arduino.h"
+
+inline esp_err_t esp_task_wdt_init(uint32_t, bool)
+{
+    return ESP_OK;
+}
+
+inline esp_err_t esp_task_wdt_add(void *)
+{
+    return ESP_OK;
+}
+
+inline esp_err_t esp_task_wdt_reset()
+{
+    return ESP_OK;
+}
+
+#endif // HOST_SHIM_ESP_TASK_WDT_H
@@ -0,0 +1,279 @@
+// SUMO/TraCI co-simulation bridge for the lane controllers.
+//
+// Runs the four esp32_laneN.ino sketches on the host, feeds them vehicle counts
+// read from SUMO detectors each step, and writes their signal heads back to a
+// SUMO traffic light. Time on the boards is virtual and follows SUMO time, so
+// a run goes as fast as SUMO can step.
+//
+// Build:
+//   g++ -std=c++17 -O2 -pthread -Ihost/shim host/sumo_bridge.cpp host/lane_sketches.cpp -o sumo_bridge
+//
+// Example (4-arm junction "J0", one E2 detector per approach, 3 links per approach):
+//   sumo -c junction.sumocfg --remote-port 8813 &
+//   ./sumo_bridge --tls J0 --steps 3600
+//       --approach 1=e2:det_n --approach 2=e2:det_e --approach 3=e2:det_s --approach 4=e2:det_w
+//       --links 1=0-2 --links 2=3-5 --links 3=6-8 --links 4=9-11
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "intersection_harness.h"
+#include "traci_client.h"
+
+using namespace std;
+
+struct Source
+{
+    uint8_t domain; // CMD_GET_LANEAREA_VARIABLE or CMD_GET_LANE_VARIABLE
+    string id;
+};
+
+struct BridgeOptions
+{
+    string host = "127.0.0.1";
+    int port = 8813;
+    string tlsId;
+    vector<Source> approaches[4];
+    int linkFirst[4] = {-1, -1, -1, -1};
+    int linkLast[4] = {-1, -1, -1, -1};
+    int steps = 3600;
+    double stepLength = 1.0;
+    int startHour = 8;
+    int countPeriod = 5; // seconds between detector publications per lane
+    uint8_t metric = traci::LAST_STEP_VEHICLE_NUMBER;
+    string csvPath;
+    bool verbose = false;
+    bool singleBoard = false; // esp32_intersection drives all heads instead of the lane boards
+};
+
+void printUsage()
+{
+    cout << "Usage: sumo_bridge --tls <id> --approach <lane>=<e2|lane>:<id>[,...] --links <lane>=<first>-<last>\n"
+         << "                   [--host 127.0.0.1] [--port 8813] [--steps 3600] [--step-length 1.0]\n"
+         << "                   [--start-hour 8] [--count-period 5] [--metric vehicles|halting]\n"
+         << "                   [--csv out.csv] [--single-board] [--verbose]" << endl;
+}
+
+bool parseLaneKey(const string &arg, int &lane, string &value)
+{
+    size_t eq = arg.find('=');
+    if (eq == string::npos)
+        return false;
+    lane = atoi(arg.substr(0, eq).c_str());
+    value = arg.substr(eq + 1);
+    return lane >= 1 && lane <= 4;
+}
+
+bool parseOptions(int argc, char **argv, BridgeOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        string next = (i + 1 < argc) ? argv[i + 1] : "";
+        int lane = 0;
+        string value;
+
+        bool takesValue = arg == "--host" || arg == "--port" || arg == "--tls" || arg == "--steps" ||
+                          arg == "--step-length" || arg == "--start-hour" || arg == "--count-period" ||
+                          arg == "--csv" || arg == "--metric" || arg == "--approach" || arg == "--links";
+        if (takesValue)
+        {
+            if (i + 1 >= argc)
+            {
+                cerr << "Missing value for " << arg << endl;
+                return false;
+            }
+            i++;
+        }
+
+        if (arg == "--host")
+            options.host = next;
+        else if (arg == "--port")
+            options.port = atoi(next.c_str());
+        else if (arg == "--tls")
+            options.tlsId = next;
+        else if (arg == "--steps")
+            options.steps = atoi(next.c_str());
+        else if (arg == "--step-length")
+        {
+            options.stepLength = atof(next.c_str());
+            if (!(options.stepLength > 0))
+            {
+                cerr << "--step-length must be a positive number of seconds" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--start-hour")
+            options.startHour = atoi(next.c_str());
+        else if (arg == "--count-period")
+            options.countPeriod = atoi(next.c_str());
+        else if (arg == "--csv")
+            options.csvPath = next;
+        else if (arg == "--verbose")
+            options.verbose = true;
+        else if (arg == "--single-board")
+            options.singleBoard = true;
+        else if (arg == "--metric")
+            options.metric = next == "halting" ? traci::LAST_STEP_VEHICLE_HALTING_NUMBER : traci::LAST_STEP_VEHICLE_NUMBER;
+        else if (arg == "--approach" && parseLaneKey(next, lane, value))
+        {
+            stringstream list(value);
+            string item;
+            while (getline(list, item, ','))
+            {
+                size_t colon = item.find(':');
+                if (colon == string::npos)
+                    return false;
+                string kind = item.substr(0, colon);
+                uint8_t domain = kind == "lane" ? traci::CMD_GET_LANE_VARIABLE : traci::CMD_GET_LANEAREA_VARIABLE;
+                options.approaches[lane - 1].push_back({domain, item.substr(colon + 1)});
+            }
+        }
+        else if (arg == "--links" && parseLaneKey(next, lane, value))
+        {
+            size_t dash = value.find('-');
+            options.linkFirst[lane - 1] = atoi(value.substr(0, dash).c_str());
+            options.linkLast[lane - 1] = dash == string::npos ? options.linkFirst[lane - 1] : atoi(value.substr(dash + 1).c_str());
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return !options.tlsId.empty();
+}
+
+int main(int argc, char **argv)
+{
+    BridgeOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    int linkCount = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (options.linkLast[i] + 1 > linkCount)
+            linkCount = options.linkLast[i] + 1;
+    }
+
+    // Detector reads are batched per domain: one round trip each
+    vector<string> ids[2];
+    vector<int> laneOf[2];
+    for (int lane = 0; lane < 4; lane++)
+    {
+        for (const auto &source : options.approaches[lane])
+        {
+            int d = source.domain == traci::CMD_GET_LANE_VARIABLE ? 1 : 0;
+            ids[d].push_back(source.id);
+            laneOf[d].push_back(lane);
+        }
+    }
+
+    traci::Client sumo;
+    try
+    {
+        sumo.connect(options.host, options.port);
+        string description;
+        int api = sumo.getVersion(description);
+        cout << "Connected to " << description << " (TraCI API " << api << ")" << endl;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    IntersectionHarness intersection;
+    intersection.setSerialEcho(options.verbose);
+    intersection.start(hostLocalTime(2025, 4, 22, options.startHour), options.singleBoard);
+
+    ofstream csv;
+    if (!options.csvPath.empty())
+    {
+        csv.open(options.csvPath);
+        csv << "time,state,count1,count2,count3,count4\n";
+    }
+
+    double queueSum[4] = {0, 0, 0, 0};
+    double arrived = 0;
+    int conflictSteps = 0;
+    uint64_t stepMs = (uint64_t)(options.stepLength * 1000.0 + 0.5);
+    int countPeriodSteps = max(1, (int)(options.countPeriod / options.stepLength + 0.5));
+    auto wallStart = chrono::steady_clock::now();
+
+    try
+    {
+        for (int step = 0; step < options.steps; step++)
+        {
+            double counts[4] = {0, 0, 0, 0};
+            for (int d = 0; d < 2; d++)
+            {
+                if (ids[d].empty())
+                    continue;
+                uint8_t domain = d == 1 ? traci::CMD_GET_LANE_VARIABLE : traci::CMD_GET_LANEAREA_VARIABLE;
+                vector<double> values = sumo.getNumbers(domain, options.metric, ids[d]);
+                for (size_t k = 0; k < values.size(); k++)
+                    counts[laneOf[d][k]] += values[k];
+            }
+
+            // Stagger publications so lanes do not all report in the same step
+            for (int lane = 0; lane < 4; lane++)
+            {
+                queueSum[lane] += counts[lane];
+                if ((step + lane) % countPeriodSteps == 0)
+                    intersection.publishCount(lane + 1, (int)counts[lane]);
+            }
+
+            uint64_t now = (uint64_t)step * stepMs;
+            intersection.advanceTo(now);
+            if (intersection.conflictCount() > 0)
+                conflictSteps++;
+
+            string state(linkCount, 'r');
+            for (int lane = 0; lane < 4; lane++)
+            {
+                for (int link = options.linkFirst[lane]; link >= 0 && link <= options.linkLast[lane]; link++)
+                    state[link] = intersection.signalChar(lane + 1);
+            }
+
+            if (csv.is_open())
+            {
+                csv << now / 1000.0 << "," << state;
+                for (int lane = 0; lane < 4; lane++)
+                    csv << "," << counts[lane];
+                csv << "\n";
+            }
+
+            sumo.setStateAndStep(options.tlsId, state, (step + 1) * options.stepLength);
+            arrived += sumo.getSimNumber(traci::VAR_ARRIVED_VEHICLES_NUMBER);
+        }
+        sumo.close();
+    }
+    catch (const exception &e)
+    {
+        cerr << "Co-simulation stopped: " << e.what() << endl;
+    }
+
+    double wallSec = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+    double simSec = options.steps * options.stepLength;
+
+    cout << "\nSimulated " << simSec << " s in " << wallSec << " s wall ("
+         << (wallSec > 0 ? simSec / wallSec : 0) << "x real time)" << endl;
+    cout << "Vehicles arrived: " << arrived << ", steps with conflicting greens: " << conflictSteps << endl;
+    cout << "Lane  Green starts  Green time (s)  Mean detector value" << endl;
+    for (int lane = 0; lane < 4; lane++)
+    {
+        printf("%4d  %12llu  %14.0f  %19.2f\n", lane + 1, (unsigned long long)intersection.greenStarts[lane],
+               intersection.greenMs[lane] / 1000.0, queueSum[lane] / max(1, options.steps));
+    }
+    return 0;
+}
@@ -0,0 +1,379 @@
+// Telemetry ingestion service (telemetry_ingest.h).
+//
+// Default mode reads MQTT messages as "topic payload" lines on stdin, the
+// output of `mosquitto_sub -v -t 'traffic/#'`, and prints a line of totals
+// every --report seconds and a table of the busiest intersections at the end.
+//
+// --check runs the ingest's self-checks and exits non-zero if one fails.
+//
+// --bench builds a corpus of messages in every format the boards and the
+// detector publish (a tenth of them single-quoted), checks that the ingest
+// reads the same values as ArduinoJson, and measures messages per second for
+// ArduinoJson (one document per message, as the sketches parse) and for the
+// ingest on 1..--threads workers.
+//
+// Build:
+//   g++ -std=c++17 -O3 -march=native -pthread -Ihost/shim host/telemetry_ingest.cpp -o telemetry_ingest
+//
+// Examples:
+//   mosquitto_sub -h broker.emqx.io -v -t 'traffic/#' | ./telemetry_ingest --intersections 1000
+//   ./telemetry_ingest --bench --intersections 1000 --seconds 2 --threads 4
+//   ./telemetry_ingest --check
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include "telemetry_ingest.h"
+
+using namespace std;
+using namespace telemetry;
+
+struct IngestOptions
+{
+    bool bench = false;
+    bool check = false;
+    int intersections = 1000;
+    int threads = 0;
+    float seconds = 2.0f;
+    float report = 1.0f;
+    size_t batch = 8192;
+    uint32_t seed = 1;
+};
+
+bool parseOptions(int argc, char **argv, IngestOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bench")
+            options.bench = true;
+        else if (arg == "--check")
+            options.check = true;
+        else if (arg == "--intersections" && hasValue)
+            options.intersections = atoi(argv[++i]);
+        else if (arg == "--threads" && hasValue)
+            options.threads = atoi(argv[++i]);
+        else if (arg == "--seconds" && hasValue)
+            options.seconds = (float)atof(argv[++i]);
+        else if (arg == "--report" && hasValue)
+            options.report = (float)atof(argv[++i]);
+        else if (arg == "--batch" && hasValue)
+            options.batch = (size_t)atoi(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            options.seed = (uint32_t)atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.intersections > 0 && options.batch > 0;
+}
+
+struct Message
+{
+    string topic;
+    string payload;
+};
+
+// One message of every kind per lane of every intersection, payloads as the publishers format them
+vector<Message> buildCorpus(int intersections, uint32_t seed)
+{
+    mt19937 rng(seed);
+    uniform_int_distribution<int> count(0, 30);
+    uniform_real_distribution<float> real(0.0f, 60.0f);
+    vector<Message> corpus;
+    char payload[512];
+    for (int i = 1; i <= intersections; i++)
+    {
+        string site = "traffic/" + to_string(i) + "/";
+        for (int lane = 1; lane <= 4; lane++)
+        {
+            string prefix = site + to_string(lane) + "/";
+            int cars = count(rng), motorcycles = count(rng);
+            // Detector, with per-class counts only, or totals and the optional fields
+            if (rng() % 2)
+                snprintf(payload, sizeof(payload),
+                         "{\"road_section_id\": %d, \"vehicle_counts\": {\"car\": %d, \"motorcycle\": %d, \"truck\": 1}, "
+                         "\"timestamp\": \"2025-03-31 08:15:02\"}",
+                         lane, cars, motorcycles);
+            else
+                snprintf(payload, sizeof(payload),
+                         "{\"road_section_id\": %d, \"total_vehicles\": %d, \"approach_speed_kph\": %.1f, "
+                         "\"arrival_rate_vpm\": %.2f, \"timestamp\": \"2025-03-31 08:15:02\"}",
+                         lane, cars + motorcycles, real(rng), real(rng) / 6);
+            corpus.push_back({prefix + "vehicle_count", payload});
+            snprintf(payload, sizeof(payload),
+                     "{\"road_section_id\":%d,\"total_vehicles\":%d,\"duration\":%d,\"lost_time_ms\":%d,"
+                     "\"timestamp\":\"2025-03-31 08:15:02\"}",
+                     lane, cars, 10 + count(rng), 4000 + count(rng) * 10);
+            corpus.push_back({prefix + "duration", payload});
+            snprintf(payload, sizeof(payload),
+                     "{\"lane_id\":%d,\"remaining_seconds\":%d,\"phase\":\"green\",\"timestamp\":%d,\"source\":\"%s\"}",
+                     lane, count(rng), (int)rng() % 100000, rng() % 2 ? "esp" : "python");
+            corpus.push_back({prefix + "countdown_sync", payload});
+            snprintf(payload, sizeof(payload),
+                     "{\"lane_id\":%d,\"cycle\":%d,\"cycle_ms\":%d,\"ms\":[%d,%d,%d,%d],\"total_s\":[%d,%d,%d,%d]}",
+                     lane, count(rng), 60000 + count(rng) * 1000, count(rng) * 1000, 14000, count(rng) * 1000, 500,
+                     count(rng) * 60, 1400, count(rng) * 60, 50);
+            corpus.push_back({prefix + "cycle_stats", payload});
+            snprintf(payload, sizeof(payload), "{\"section\":%d,\"status\":\"%s\",\"timestamp\":\"2025-03-31 08:15:02\"}",
+                     lane, rng() % 2 ? "green" : "red");
+            corpus.push_back({site + "green_status", payload});
+        }
+        snprintf(payload, sizeof(payload), "{\"lead\":%d,\"q\":[%d,%d,%d,%d],\"vpm\":[%.1f,%.1f,%.1f,%.1f]}",
+                 1 + (int)(rng() % 4), count(rng), count(rng), count(rng), count(rng), real(rng) / 6, real(rng) / 6,
+                 real(rng) / 6, real(rng) / 6);
+        corpus.push_back({site + "state", payload});
+    }
+    // A tenth single-quoted, the way some publishers send them
+    for (Message &message : corpus)
+    {
+        if (rng() % 10 == 0)
+            replace(message.payload.begin(), message.payload.end(), '"', '\'');
+    }
+    shuffle(corpus.begin(), corpus.end(), rng);
+    return corpus;
+}
+
+// The value of each ingested field as ArduinoJson reads it, for --bench's check
+bool sameAsArduinoJson(const Message &message)
+{
+    Leaf leaf = leafOf(message.topic.c_str() + message.topic.rfind('/') + 1,
+                       message.topic.size() - message.topic.rfind('/') - 1);
+    Record record;
+    if (!schemaOf(leaf).parse(message.payload.data(), message.payload.size(), record))
+        return false;
+
+    String text(message.payload.c_str());
+    text.replace("'", "\"");
+    DynamicJsonDocument doc(1024);
+    if (deserializeJson(doc, text))
+        return false;
+    auto near = [](float a, float b) { return fabs(a - b) <= 1e-3f * max(1.0f, fabs(b)); };
+    auto number = [&](const char *key, int slotIndex) {
+        return !doc.containsKey(key) || (record.has(slotIndex) && near(record.value[slotIndex], doc[key].as<float>()));
+    };
+    switch (leaf)
+    {
+    case VEHICLE_COUNT:
+    {
+        float sum = 0;
+        if (doc.containsKey("vehicle_counts"))
+        {
+            JsonObject counts = doc["vehicle_counts"];
+            for (JsonPair kv : counts)
+                sum += kv.value().as<float>();
+            if (!near(record.get(slot::VC_BY_CLASS, -1), sum))
+                return false;
+        }
+        return number("road_section_id", slot::VC_SECTION) && number("total_vehicles", slot::VC_TOTAL) &&
+               number("approach_speed_kph", slot::VC_SPEED) && number("arrival_rate_vpm", slot::VC_RATE);
+    }
+    case DURATION:
+        return number("road_section_id", slot::DU_SECTION) && number("duration", slot::DU_DURATION) &&
+               number("lost_time_ms", slot::DU_LOST_MS);
+    case COUNTDOWN_SYNC:
+        return number("lane_id", slot::CD_LANE) && number("remaining_seconds", slot::CD_REMAINING) &&
+               record.get(slot::CD_SOURCE, -1) == (doc["source"].as<String>() == "python" ? 1 : 0);
+    case CYCLE_STATS:
+        return number("lane_id", slot::CS_LANE) && number("cycle", slot::CS_CYCLE) && number("cycle_ms", slot::CS_CYCLE_MS);
+    case GREEN_STATUS:
+        return number("section", slot::GS_SECTION) &&
+               record.get(slot::GS_STATUS, -1) == (doc["status"].as<String>() == "green" ? 0 : 1);
+    case STATE:
+    {
+        JsonArray q = doc["q"];
+        JsonArray vpm = doc["vpm"];
+        for (int l = 0; l < 4; l++)
+        {
+            if (!near(record.get(slot::ST_QUEUE + l, -1), q[l].as<float>()) ||
+                !near(record.get(slot::ST_RATE + l, -1), vpm[l].as<float>()))
+                return false;
+        }
+        return number("lead", slot::ST_LEAD);
+    }
+    case LEAF_COUNT:
+        break;
+    }
+    return false;
+}
+
+int runBench(const IngestOptions &options)
+{
+    vector<Message> corpus = buildCorpus(options.intersections, options.seed);
+    size_t bytes = 0;
+    for (const Message &message : corpus)
+        bytes += message.topic.size() + message.payload.size();
+    printf("Corpus: %zu messages, %.0f bytes each on average\n", corpus.size(), (double)bytes / corpus.size());
+
+    size_t mismatches = 0;
+    for (const Message &message : corpus)
+        mismatches += sameAsArduinoJson(message) ? 0 : 1;
+    printf("Values differing from ArduinoJson: %zu\n", mismatches);
+
+    // Baseline: a document per message, as the sketches and micro_sim's taps parse
+    auto start = chrono::steady_clock::now();
+    uint64_t parsed = 0;
+    double sink = 0;
+    while (chrono::duration<double>(chrono::steady_clock::now() - start).count() < options.seconds)
+    {
+        for (const Message &message : corpus)
+        {
+            String text(message.payload.c_str());
+            text.replace("'", "\"");
+            DynamicJsonDocument doc(1024);
+            if (!deserializeJson(doc, text))
+                sink += doc["lane_id"].as<float>();
+        }
+        parsed += corpus.size();
+    }
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("ArduinoJson, 1 thread: %10.0f messages/s\n", parsed / wall);
+
+    int maxThreads = options.threads > 0 ? options.threads : max(1, (int)thread::hardware_concurrency());
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        TelemetryIngest ingest(options.intersections, threads, options.batch);
+        start = chrono::steady_clock::now();
+        do
+        {
+            for (const Message &message : corpus)
+                ingest.submit(message.topic.data(), message.topic.size(), message.payload.data(),
+                              message.payload.size());
+            ingest.flush();
+        } while (chrono::duration<double>(chrono::steady_clock::now() - start).count() < options.seconds);
+        wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        const TelemetryIngest::Stats &stats = ingest.totals();
+        printf("Ingest, %d thread%s:     %10.0f messages/s, %.0f MB/s of payload, %llu not applied\n", threads,
+               threads == 1 ? " " : "s", stats.messages / wall, stats.bytes / wall / 1e6,
+               (unsigned long long)(stats.messages - stats.applied));
+        if (threads < maxThreads && threads * 2 > maxThreads)
+            threads = maxThreads / 2; // Always finish with maxThreads
+    }
+    return sink < 0 ? 1 : 0;
+}
+
+// Self-checks of --check; prints each and returns how many failed
+int runChecks()
+{
+    int failed = 0;
+    auto check = [&](bool ok, const char *what) {
+        printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+        failed += ok ? 0 : 1;
+    };
+    auto send = [](TelemetryIngest &ingest, const string &id, int vehicles) {
+        string topic = "traffic/" + id + "/1/vehicle_count";
+        string payload = "{\"road_section_id\": 1, \"total_vehicles\": " + to_string(vehicles) + "}";
+        ingest.submit(topic.data(), topic.size(), payload.data(), payload.size());
+    };
+
+    // Named and numeric ids side by side: names get their own rows and never land on a numbered one
+    {
+        TelemetryIngest ingest(4, 1, 8192, 2);
+        for (int i = 1; i <= 4; i++)
+            send(ingest, to_string(i), 10 * i);
+        send(ingest, "north", 99);
+        send(ingest, "south", 77);
+        send(ingest, "east", 55);  // Beyond the named rows
+        send(ingest, "5", 55);     // Beyond the numbered rows
+        send(ingest, "north", 98); // Same row as before
+        ingest.flush();
+        bool numbered = true;
+        for (int i = 1; i <= 4; i++)
+            numbered = numbered && ingest.intersection(i - 1).lanes[0].vehicles == 10 * i &&
+                       ingest.idOf(i - 1) == to_string(i);
+        check(numbered, "numeric ids keep their rows next to named ones");
+        check(ingest.idOf(4) == "north" && ingest.intersection(4).lanes[0].vehicles == 98 &&
+                  ingest.idOf(5) == "south" && ingest.intersection(5).lanes[0].vehicles == 77,
+              "named ids get rows after the numbered ones");
+        check(ingest.totals().ignored == 2 && ingest.intersections() == 6,
+              "ids beyond either range are ignored");
+    }
+
+    // Payloads end where the length says, not at a NUL: nothing after it may be read
+    {
+        const char text[] = "{\"total_vehicles\": 1e25}";
+        size_t length = strstr(text, "1e2") + 3 - text; // The "5}" after it belongs to the next message
+        Record record;
+        schemaOf(VEHICLE_COUNT).parse(text, length, record);
+        check(record.get(slot::VC_TOTAL, -1) == 100.0f, "an exponent at the end of a payload stops there");
+    }
+    {
+        // Exact-size copy, so a build with -fsanitize=address reports any read past it
+        const char text[] = "{\"status\": \"gre\\";
+        vector<char> payload(text, text + strlen(text));
+        Record record;
+        schemaOf(GREEN_STATUS).parse(payload.data(), payload.size(), record);
+        check(record.get(slot::GS_STATUS, -1) != 0, "an escape cut off by the end of a payload stops there");
+    }
+    return failed;
+}
+
+int runService(const IngestOptions &options)
+{
+    TelemetryIngest ingest(options.intersections, options.threads, options.batch);
+    auto start = chrono::steady_clock::now();
+    auto lastReport = start;
+    string line;
+    while (getline(cin, line))
+    {
+        size_t space = line.find(' ');
+        if (space == string::npos)
+            continue;
+        ingest.submit(line.data(), space, line.data() + space + 1, line.size() - space - 1);
+
+        auto now = chrono::steady_clock::now();
+        if (chrono::duration<double>(now - lastReport).count() >= options.report)
+        {
+            ingest.flush();
+            const TelemetryIngest::Stats &stats = ingest.totals();
+            printf("%.0f s: %llu messages, %llu applied, %llu ignored\n",
+                   chrono::duration<double>(now - start).count(), (unsigned long long)stats.messages,
+                   (unsigned long long)stats.applied, (unsigned long long)stats.ignored);
+            fflush(stdout);
+            lastReport = now;
+        }
+    }
+    ingest.flush();
+
+    vector<int> rows;
+    for (int row = 0; row < ingest.intersections(); row++)
+    {
+        if (ingest.intersection(row).messages)
+            rows.push_back(row);
+    }
+    sort(rows.begin(), rows.end(),
+         [&](int a, int b) { return ingest.intersection(a).messages > ingest.intersection(b).messages; });
+    printf("Id        Messages  Vehicles per lane         Green (s) per lane\n");
+    for (size_t k = 0; k < min<size_t>(rows.size(), 20); k++)
+    {
+        const IntersectionTelemetry &site = ingest.intersection(rows[k]);
+        printf("%-8s  %8llu  %5.0f %5.0f %5.0f %5.0f   %5.1f %5.1f %5.1f %5.1f\n", ingest.idOf(rows[k]).c_str(),
+               (unsigned long long)site.messages, site.lanes[0].vehicles, site.lanes[1].vehicles, site.lanes[2].vehicles,
+               site.lanes[3].vehicles, site.lanes[0].green, site.lanes[1].green, site.lanes[2].green,
+               site.lanes[3].green);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    IngestOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        cerr << "Usage: telemetry_ingest [--intersections 1000] [--threads 0] [--batch 8192] [--report 1]\n"
+             << "                        [--bench [--seconds 2] [--seed 1]] [--check]" << endl;
+        return 1;
+    }
+    if (options.check)
+        return runChecks() ? 1 : 0;
+    return options.bench ? runBench(options) : runService(options);
+}
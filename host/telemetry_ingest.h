@@ -0,0 +1,683 @@
+#ifndef TELEMETRY_INGEST_H
+#define TELEMETRY_INGEST_H
+
+// City-wide telemetry ingestion for the aggregation side.
+//
+// Consumes traffic/# (layout in mqtt_topics.h) and keeps the latest state of
+// every lane of every intersection. Payloads have a handful of fixed schemas,
+// so instead of building a document per message each topic leaf has a schema
+// compiled once into a key table. A scan of the payload looks up each
+// top-level key there and converts only the values that are wanted, in place;
+// everything else is skipped without being decoded. Single-quoted payloads
+// (what the boards turn into JSON with message.replace("'", "\"")) are read
+// as they are.
+//
+// Scanning for quotes and delimiters runs 16 bytes at a time with SSE2 where
+// the compiler targets it, and byte by byte otherwise.
+//
+// submit() is called from the MQTT client's thread. It parses the topic,
+// copies the payload into a batch and assigns it to the worker owning its
+// intersection. Full batches are parsed on a ThreadPool, each worker applying
+// only its own intersections, so the state table needs no locks.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "thread_pool.h"
+
+namespace telemetry
+{
+enum Leaf : uint8_t
+{
+    VEHICLE_COUNT,
+    DURATION,
+    COUNTDOWN_SYNC,
+    CYCLE_STATS,
+    GREEN_STATUS,
+    STATE,
+    LEAF_COUNT
+};
+
+// ---- Scanning --------------------------------------------------------------
+
+// First position in [p, end) holding a or b, or end
+inline const char *findEither(const char *p, const char *end, char a, char b)
+{
+#if defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    while (p + 16 <= end)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != a && *p != b)
+        p++;
+    return p;
+}
+
+// First candidate structural character: , } ] { [ or a quote
+inline const char *findStructural(const char *p, const char *end, char quote)
+{
+#if defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quoteChar = _mm_set1_epi8(quote);
+    // { } [ ] are 0x7B 0x7D 0x5B 0x5D, all 0x59 with bits 0x26 cleared. So are Y _ y and DEL;
+    // callers look at the character they get and step over those
+    const __m128i bracketMask = _mm_set1_epi8((char)~0x26);
+    const __m128i bracket = _mm_set1_epi8(0x59);
+    while (p + 16 <= end)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, comma), _mm_cmpeq_epi8(block, quoteChar));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(_mm_and_si128(block, bracketMask), bracket));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ',' && *p != quote && *p != '{' && *p != '}' && *p != '[' && *p != ']')
+        p++;
+    return p;
+}
+
+// Closing quote of a string whose body starts at p, honouring backslash escapes
+inline const char *stringEnd(const char *p, const char *end, char quote)
+{
+    while (true)
+    {
+        p = findEither(p, end, quote, '\\');
+        if (p >= end || *p == quote)
+            return p;
+        if (end - p < 2)
+            return end; // Escape cut off by the end of the payload
+        p += 2;         // Escaped character
+    }
+}
+
+inline const char *skipSpace(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+// Decimal number; exponents, which no publisher here sends, go through strtod on a bounded copy
+inline const char *parseNumber(const char *p, const char *end, float &out)
+{
+    bool negative = p < end && *p == '-';
+    if (negative)
+        p++;
+    const char *start = p;
+    uint64_t mantissa = 0;
+    while (p < end && (unsigned)(*p - '0') < 10)
+        mantissa = mantissa * 10 + (*p++ - '0');
+    double value = (double)mantissa;
+    if (p < end && *p == '.')
+    {
+        p++;
+        double scale = 0.1;
+        while (p < end && (unsigned)(*p - '0') < 10)
+        {
+            value += (*p++ - '0') * scale;
+            scale *= 0.1;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        // Rare: let the library handle exponents, on a copy bounded by end since
+        // payloads are not NUL-terminated
+        char text[40];
+        size_t n = 0;
+        while (start + n < end && n + 1 < sizeof(text) && strchr("0123456789.eE+-", start[n]) && start[n] != '\0')
+        {
+            text[n] = start[n];
+            n++;
+        }
+        text[n] = '\0';
+        char *after;
+        value = strtod(text, &after);
+        p = start + (after - text);
+    }
+    if (p == start)
+        return nullptr;
+    out = (float)(negative ? -value : value);
+    return p;
+}
+
+// End of the value starting at p (object, array, string or scalar)
+inline const char *skipValue(const char *p, const char *end, char quote)
+{
+    if (p >= end)
+        return end;
+    if (*p == quote)
+        return std::min(end, stringEnd(p + 1, end, quote) + 1);
+    if (*p != '{' && *p != '[')
+    {
+        while (p < end && *p != ',' && *p != '}' && *p != ']')
+            p++;
+        return p;
+    }
+    int depth = 0;
+    while (p < end)
+    {
+        p = findStructural(p, end, quote);
+        if (p >= end)
+            return end;
+        char c = *p;
+        if (c == quote)
+            p = stringEnd(p + 1, end, quote);
+        else if (c == '{' || c == '[')
+            depth++;
+        else if ((c == '}' || c == ']') && --depth == 0)
+            return p + 1;
+        p++;
+    }
+    return end;
+}
+
+// ---- Schemas ---------------------------------------------------------------
+
+enum FieldKind : uint8_t
+{
+    NUMBER,     // Number or boolean (true = 1)
+    WORD,       // String, stored as its index in the field's word list, -1 if not listed
+    SUM_OBJECT, // Object of numbers, stored as their sum ("vehicle_counts")
+    ARRAY       // Up to `width` numbers in consecutive slots
+};
+
+struct Field
+{
+    const char *key;
+    FieldKind kind;
+    uint8_t slot;
+    uint8_t width;            // Slots used by an ARRAY
+    const char *const *words; // WORD values, nullptr terminated
+};
+
+constexpr int MAX_SLOTS = 16;
+
+// Values of one message, by slot
+struct Record
+{
+    uint32_t present = 0; // Bit per slot
+    float value[MAX_SLOTS];
+
+    bool has(int slot) const { return present >> slot & 1; }
+    float get(int slot, float fallback = 0) const { return has(slot) ? value[slot] : fallback; }
+};
+
+// A leaf's fields compiled into a lookup by key length and first eight bytes
+class Schema
+{
+public:
+    Schema() = default;
+
+    Schema(std::initializer_list<Field> list) : fields(list)
+    {
+        for (const Field &field : fields)
+        {
+            Key key;
+            key.length = (uint16_t)strlen(field.key);
+            key.prefix = prefixOf(field.key, key.length);
+            keys.push_back(key);
+        }
+    }
+
+    // Parse a top-level object into record; false if the payload is not an object
+    bool parse(const char *p, size_t length, Record &record) const
+    {
+        const char *end = p + length;
+        p = skipSpace(p, end);
+        if (p >= end || *p != '{')
+            return false;
+        p++;
+        record.present = 0;
+        while (true)
+        {
+            p = findEither(p, end, '"', '\'');
+            if (p >= end)
+                return true;
+            char quote = *p;
+            const char *key = p + 1;
+            const char *keyEnd = stringEnd(key, end, quote);
+            if (keyEnd >= end)
+                return true;
+            p = skipSpace(keyEnd + 1, end);
+            if (p >= end || *p != ':')
+                return true;
+            p = skipSpace(p + 1, end);
+
+            int index = lookup(key, keyEnd - key);
+            p = index >= 0 ? readValue(fields[index], p, end, quote, record) : skipValue(p, end, quote);
+            if (!p)
+                return true;
+            p = skipSpace(p, end);
+            if (p >= end || *p == '}')
+                return true;
+            p++; // ','
+        }
+    }
+
+private:
+    struct Key
+    {
+        uint16_t length;
+        uint64_t prefix;
+    };
+
+    static uint64_t prefixOf(const char *key, size_t length)
+    {
+        uint64_t prefix = 0;
+        memcpy(&prefix, key, std::min<size_t>(length, 8));
+        return prefix;
+    }
+
+    int lookup(const char *key, size_t length) const
+    {
+        uint64_t prefix = prefixOf(key, length);
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (keys[i].length == length && keys[i].prefix == prefix &&
+                (length <= 8 || memcmp(key + 8, fields[i].key + 8, length - 8) == 0))
+                return (int)i;
+        }
+        return -1;
+    }
+
+    static const char *readValue(const Field &field, const char *p, const char *end, char quote, Record &record)
+    {
+        float value = 0;
+        switch (field.kind)
+        {
+        case NUMBER:
+            if (p < end && (*p == 't' || *p == 'f'))
+            {
+                value = *p == 't';
+                p = skipValue(p, end, quote);
+            }
+            else if (!(p = parseNumber(p, end, value)))
+            {
+                return nullptr;
+            }
+            break;
+        case WORD:
+        {
+            if (p >= end || (*p != '"' && *p != '\''))
+                return skipValue(p, end, quote);
+            const char *word = p + 1;
+            const char *wordEnd = stringEnd(word, end, *p);
+            value = -1;
+            for (int w = 0; field.words[w]; w++)
+            {
+                size_t n = strlen(field.words[w]);
+                if ((size_t)(wordEnd - word) == n && memcmp(word, field.words[w], n) == 0)
+                {
+                    value = (float)w;
+                    break;
+                }
+            }
+            p = std::min(end, wordEnd + 1);
+            break;
+        }
+        case SUM_OBJECT:
+        {
+            if (p >= end || *p != '{')
+                return skipValue(p, end, quote);
+            const char *objectEnd = skipValue(p, end, quote);
+            value = 0;
+            // Every number after a colon inside the object
+            for (const char *q = findEither(p, objectEnd, ':', ':'); q < objectEnd; q = findEither(q, objectEnd, ':', ':'))
+            {
+                float item;
+                const char *next = parseNumber(skipSpace(q + 1, objectEnd), objectEnd, item);
+                if (next)
+                    value += item;
+                q = next ? next : q + 1;
+            }
+            p = objectEnd;
+            break;
+        }
+        case ARRAY:
+        {
+            if (p >= end || *p != '[')
+                return skipValue(p, end, quote);
+            p++;
+            for (int k = 0; k < field.width; k++)
+            {
+                p = skipSpace(p, end);
+                float item;
+                const char *next = parseNumber(p, end, item);
+                if (!next)
+                    break;
+                record.value[field.slot + k] = item;
+                record.present |= 1u << (field.slot + k);
+                p = skipSpace(next, end);
+                if (p < end && *p == ',')
+                    p++;
+            }
+            p = findEither(p, end, ']', ']');
+            return std::min(end, p + 1);
+        }
+        }
+        record.value[field.slot] = value;
+        record.present |= 1u << field.slot;
+        return p;
+    }
+
+    std::vector<Field> fields;
+    std::vector<Key> keys;
+};
+
+// Slots of each leaf's record
+namespace slot
+{
+enum VehicleCount { VC_SECTION, VC_TOTAL, VC_BY_CLASS, VC_SPEED, VC_RATE };
+enum Duration { DU_SECTION, DU_TOTAL, DU_DURATION, DU_LOST_MS };
+enum Countdown { CD_LANE, CD_REMAINING, CD_SOURCE, CD_PHASE };
+enum CycleStats { CS_LANE, CS_CYCLE, CS_CYCLE_MS };
+enum GreenStatus { GS_SECTION, GS_STATUS };
+enum State { ST_LEAD, ST_QUEUE, ST_RATE = ST_QUEUE + 4 };
+} // namespace slot
+
+inline const Schema &schemaOf(Leaf leaf)
+{
+    static const char *const sources[] = {"esp", "python", nullptr};
+    static const char *const phases[] = {"green", "red", "yellow", nullptr};
+    static const char *const statuses[] = {"green", "red", "yellow", nullptr};
+    static const Schema schemas[LEAF_COUNT] = {
+        {{"road_section_id", NUMBER, slot::VC_SECTION, 1, nullptr},
+         {"total_vehicles", NUMBER, slot::VC_TOTAL, 1, nullptr},
+         {"vehicle_counts", SUM_OBJECT, slot::VC_BY_CLASS, 1, nullptr},
+         {"approach_speed_kph", NUMBER, slot::VC_SPEED, 1, nullptr},
+         {"arrival_rate_vpm", NUMBER, slot::VC_RATE, 1, nullptr}},
+        {{"road_section_id", NUMBER, slot::DU_SECTION, 1, nullptr},
+         {"total_vehicles", NUMBER, slot::DU_TOTAL, 1, nullptr},
+         {"duration", NUMBER, slot::DU_DURATION, 1, nullptr},
+         {"lost_time_ms", NUMBER, slot::DU_LOST_MS, 1, nullptr}},
+        {{"lane_id", NUMBER, slot::CD_LANE, 1, nullptr},
+         {"remaining_seconds", NUMBER, slot::CD_REMAINING, 1, nullptr},
+         {"source", WORD, slot::CD_SOURCE, 1, sources},
+         {"phase", WORD, slot::CD_PHASE, 1, phases}},
+        {{"lane_id", NUMBER, slot::CS_LANE, 1, nullptr},
+         {"cycle", NUMBER, slot::CS_CYCLE, 1, nullptr},
+         {"cycle_ms", NUMBER, slot::CS_CYCLE_MS, 1, nullptr}},
+        {{"section", NUMBER, slot::GS_SECTION, 1, nullptr},
+         {"status", WORD, slot::GS_STATUS, 1, statuses}},
+        {{"lead", NUMBER, slot::ST_LEAD, 1, nullptr},
+         {"q", ARRAY, slot::ST_QUEUE, 4, nullptr},
+         {"vpm", ARRAY, slot::ST_RATE, 4, nullptr}},
+    };
+    return schemas[leaf];
+}
+
+// Leaf of a topic name's last level, LEAF_COUNT if not ingested
+inline Leaf leafOf(const char *leaf, size_t length)
+{
+    static const char *const names[LEAF_COUNT] = {"vehicle_count", "duration", "countdown_sync",
+                                                  "cycle_stats", "green_status", "state"};
+    for (int l = 0; l < LEAF_COUNT; l++)
+    {
+        if (strlen(names[l]) == length && memcmp(names[l], leaf, length) == 0)
+            return (Leaf)l;
+    }
+    return LEAF_COUNT;
+}
+
+// ---- State -----------------------------------------------------------------
+
+struct LaneTelemetry
+{
+    float vehicles = 0;
+    float speedKph = 0;
+    float arrivalVpm = -1;
+    float green = 0;        // Last green duration, s
+    float lostMs = 0;
+    float remaining = 0;    // Last countdown from the board, s
+    float cycleMs = 0;
+    uint32_t cycles = 0;
+    bool isGreen = false;
+    uint64_t updates = 0;
+};
+
+struct IntersectionTelemetry
+{
+    LaneTelemetry lanes[4];
+    uint64_t messages = 0;
+};
+
+// ---- Ingestion -------------------------------------------------------------
+
+class TelemetryIngest
+{
+public:
+    static const int kLanes = 4;
+
+    struct Stats
+    {
+        uint64_t messages = 0; // Submitted
+        uint64_t applied = 0;
+        uint64_t ignored = 0;  // Unknown topic, intersection or payload
+        uint64_t bytes = 0;
+    };
+
+    // intersections: numeric ids 1..intersections map straight to rows 0..intersections-1.
+    // namedIntersections: rows after those for any other id, one per id on first sight;
+    // further named ids are ignored. Numeric ids can never reach these rows.
+    explicit TelemetryIngest(int intersections, int threads = 0, size_t batchMessages = 8192,
+                             int namedIntersections = 64)
+        : pool(threads), table(intersections + namedIntersections), batchLimit(batchMessages),
+          numbered(intersections)
+    {
+        work.resize(pool.size());
+        named.reserve(namedIntersections);
+    }
+
+    int threads() const { return pool.size(); }
+
+    // One MQTT message, from the client thread
+    void submit(const char *topic, size_t topicLength, const char *payload, size_t payloadLength)
+    {
+        stats.messages++;
+        stats.bytes += payloadLength;
+        // traffic/<id>/<leaf> or traffic/<id>/<lane>/<leaf>
+        const char *end = topic + topicLength;
+        if (topicLength < 8 || memcmp(topic, "traffic/", 8) != 0)
+        {
+            stats.ignored++;
+            return;
+        }
+        const char *id = topic + 8;
+        const char *idEnd = (const char *)memchr(id, '/', end - id);
+        if (!idEnd)
+        {
+            stats.ignored++;
+            return;
+        }
+        int row = rowOf(id, idEnd - id);
+        const char *rest = idEnd + 1;
+        int lane = 0;
+        while (rest < end && (unsigned)(*rest - '0') < 10)
+            lane = lane * 10 + (*rest++ - '0');
+        if (lane > 0)
+        {
+            if (rest >= end || *rest != '/')
+                lane = -1;
+            rest++;
+        }
+        else
+        {
+            rest = idEnd + 1;
+        }
+        Leaf leaf = rest < end ? leafOf(rest, end - rest) : LEAF_COUNT;
+        if (row < 0 || lane < 0 || lane > kLanes || leaf == LEAF_COUNT)
+        {
+            stats.ignored++;
+            return;
+        }
+
+        Pending pending;
+        pending.offset = (uint32_t)arena.size();
+        pending.length = (uint32_t)payloadLength;
+        pending.row = row;
+        pending.lane = (uint8_t)lane;
+        pending.leaf = leaf;
+        arena.insert(arena.end(), payload, payload + payloadLength);
+        work[row % work.size()].push_back(pending);
+        if (++batched >= batchLimit)
+            flush();
+    }
+
+    // Parse and apply everything submitted so far
+    void flush()
+    {
+        if (batched == 0)
+            return;
+        std::vector<uint64_t> applied(work.size(), 0);
+        pool.parallelFor((int)work.size(), [&](int begin, int end) {
+            for (int w = begin; w < end; w++)
+            {
+                for (const Pending &pending : work[w])
+                    applied[w] += apply(pending) ? 1 : 0;
+                work[w].clear();
+            }
+        });
+        for (uint64_t count : applied)
+            stats.applied += count;
+        stats.ignored += batched - std::accumulate(applied.begin(), applied.end(), (uint64_t)0);
+        arena.clear();
+        batched = 0;
+    }
+
+    const IntersectionTelemetry &intersection(int row) const { return table[row]; }
+    int intersections() const { return (int)table.size(); }
+    // The id a row belongs to, as it appears in topics
+    std::string idOf(int row) const { return row < numbered ? std::to_string(row + 1) : names[row - numbered]; }
+    const Stats &totals() const { return stats; }
+
+private:
+    struct Pending
+    {
+        uint32_t offset;
+        uint32_t length;
+        int32_t row;
+        uint8_t lane; // From the topic, 0 for site-wide topics
+        Leaf leaf;
+    };
+
+    int rowOf(const char *id, size_t length)
+    {
+        int number = 0;
+        size_t i = 0;
+        while (i < length && i < 9 && (unsigned)(id[i] - '0') < 10)
+            number = number * 10 + (id[i++] - '0');
+        if (i == length)
+            return number >= 1 && number <= numbered ? number - 1 : -1;
+        // Named ids take the rows after the numbered ones
+        std::string name(id, length);
+        auto found = named.find(name);
+        if (found != named.end())
+            return found->second;
+        int row = numbered + (int)names.size();
+        if (row >= (int)table.size())
+            return -1;
+        named[name] = row;
+        names.push_back(name);
+        return row;
+    }
+
+    // Runs on the worker owning pending.row
+    bool apply(const Pending &pending)
+    {
+        Record record;
+        if (!schemaOf(pending.leaf).parse(arena.data() + pending.offset, pending.length, record))
+            return false;
+        IntersectionTelemetry &site = table[pending.row];
+        // The lane from the topic, else the one the payload names
+        auto laneOf = [&](int payloadSlot) {
+            int lane = pending.lane ? pending.lane : (int)record.get(payloadSlot, 0);
+            return lane >= 1 && lane <= kLanes ? &site.lanes[lane - 1] : nullptr;
+        };
+
+        LaneTelemetry *lane = nullptr;
+        switch (pending.leaf)
+        {
+        case VEHICLE_COUNT:
+            if ((lane = laneOf(slot::VC_SECTION)))
+            {
+                lane->vehicles = record.has(slot::VC_TOTAL) ? record.value[slot::VC_TOTAL]
+                                                            : record.get(slot::VC_BY_CLASS, lane->vehicles);
+                lane->speedKph = record.get(slot::VC_SPEED, lane->speedKph);
+                lane->arrivalVpm = record.get(slot::VC_RATE, lane->arrivalVpm);
+            }
+            break;
+        case DURATION:
+            if ((lane = laneOf(slot::DU_SECTION)))
+            {
+                lane->green = record.get(slot::DU_DURATION, lane->green);
+                lane->lostMs = record.get(slot::DU_LOST_MS, lane->lostMs);
+            }
+            break;
+        case COUNTDOWN_SYNC:
+            if ((lane = laneOf(slot::CD_LANE)))
+                lane->remaining = record.get(slot::CD_REMAINING, lane->remaining);
+            break;
+        case CYCLE_STATS:
+            if ((lane = laneOf(slot::CS_LANE)))
+            {
+                lane->cycles = (uint32_t)record.get(slot::CS_CYCLE, (float)lane->cycles);
+                lane->cycleMs = record.get(slot::CS_CYCLE_MS, lane->cycleMs);
+            }
+            break;
+        case GREEN_STATUS:
+            if ((lane = laneOf(slot::GS_SECTION)) && record.has(slot::GS_STATUS))
+                lane->isGreen = record.value[slot::GS_STATUS] == 0;
+            break;
+        case STATE:
+            for (int l = 0; l < kLanes; l++)
+            {
+                site.lanes[l].vehicles = record.get(slot::ST_QUEUE + l, site.lanes[l].vehicles);
+                site.lanes[l].arrivalVpm = record.get(slot::ST_RATE + l, site.lanes[l].arrivalVpm);
+                site.lanes[l].updates++;
+            }
+            site.messages++;
+            return true;
+        case LEAF_COUNT:
+            break;
+        }
+        if (!lane)
+            return false;
+        lane->updates++;
+        site.messages++;
+        return true;
+    }
+
+    ThreadPool pool;
+    std::vector<IntersectionTelemetry> table;
+    size_t batchLimit;
+    size_t batched = 0;
+    std::vector<char> arena;                   // Payloads of the current batch
+    std::vector<std::vector<Pending>> work;    // Per worker
+    int numbered;                              // Rows of numeric ids, the named ones follow
+    std::unordered_map<std::string, int> named;
+    std::vector<std::string> names;            // Id of each named row
+    Stats stats;
+};
+} // namespace telemetry
+
+#endif // TELEMETRY_INGEST_H
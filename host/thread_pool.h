@@ -0,0 +1,122 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Fixed set of worker threads for batch work in the host tools.
+// parallelFor() splits an index range into one chunk per thread and blocks
+// until every chunk is done; the calling thread runs the first chunk itself,
+// so a pool of one thread has no synchronization cost at all.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // threads = 0 uses one thread per hardware thread
+    explicit ThreadPool(int threads = 0)
+    {
+        if (threads <= 0)
+            threads = std::max(1, (int)std::thread::hardware_concurrency());
+        threadCount = threads;
+        for (int i = 1; i < threads; i++)
+            workers.emplace_back([this, i]() { work(i); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const { return threadCount; }
+
+    // Call fn(begin, end) on disjoint chunks covering [0, n)
+    void parallelFor(int n, const std::function<void(int, int)> &fn)
+    {
+        if (n <= 0)
+            return;
+        if (workers.empty() || n == 1)
+        {
+            fn(0, n);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &fn;
+            taskSize = n;
+            pending = (int)workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        int begin, end;
+        chunk(0, n, begin, end);
+        fn(begin, end);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending == 0; });
+        task = nullptr;
+    }
+
+private:
+    void chunk(int index, int n, int &begin, int &end) const
+    {
+        begin = (int)((long long)n * index / threadCount);
+        end = (int)((long long)n * (index + 1) / threadCount);
+    }
+
+    void work(int index)
+    {
+        uint64_t seen = 0;
+        while (true)
+        {
+            const std::function<void(int, int)> *fn;
+            int n;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                fn = task;
+                n = taskSize;
+            }
+
+            int begin, end;
+            chunk(index, n, begin, end);
+            if (begin < end)
+                (*fn)(begin, end);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                done.notify_one();
+        }
+    }
+
+    int threadCount = 1;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)> *task = nullptr;
+    int taskSize = 0;
+    int pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,363 @@
+#ifndef TRACI_CLIENT_H
+#define TRACI_CLIENT_H
+
+// Minimal TraCI client for a locally running SUMO (sumo --remote-port <port>).
+// Only the commands the co-simulation bridge needs are implemented. Several
+// commands are packed into one TCP message where possible so that a simulation
+// step costs a fixed number of round trips regardless of the number of detectors.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace traci
+{
+// Command ids
+const uint8_t CMD_GETVERSION = 0x00;
+const uint8_t CMD_SIMSTEP = 0x02;
+const uint8_t CMD_CLOSE = 0x7F;
+const uint8_t CMD_GET_LANE_VARIABLE = 0xa3;
+const uint8_t CMD_GET_LANEAREA_VARIABLE = 0xad;
+const uint8_t CMD_GET_SIM_VARIABLE = 0xab;
+const uint8_t CMD_SET_TL_VARIABLE = 0xc2;
+
+// Variable ids
+const uint8_t LAST_STEP_VEHICLE_NUMBER = 0x10;
+const uint8_t LAST_STEP_MEAN_SPEED = 0x11;
+const uint8_t LAST_STEP_VEHICLE_HALTING_NUMBER = 0x14;
+const uint8_t TL_RED_YELLOW_GREEN_STATE = 0x20;
+const uint8_t VAR_TIME = 0x66;
+const uint8_t VAR_ARRIVED_VEHICLES_NUMBER = 0x79;
+const uint8_t VAR_MIN_EXPECTED_VEHICLES = 0x7d;
+
+// Data types
+const uint8_t TYPE_UBYTE = 0x07;
+const uint8_t TYPE_BYTE = 0x08;
+const uint8_t TYPE_INTEGER = 0x09;
+const uint8_t TYPE_DOUBLE = 0x0B;
+const uint8_t TYPE_STRING = 0x0C;
+
+const uint8_t RTYPE_OK = 0x00;
+
+class Buffer
+{
+public:
+    void writeUByte(uint8_t v) { data.push_back(v); }
+
+    void writeInt(int32_t v)
+    {
+        uint32_t u = (uint32_t)v;
+        for (int shift = 24; shift >= 0; shift -= 8)
+            data.push_back((uint8_t)(u >> shift));
+    }
+
+    void writeDouble(double v)
+    {
+        uint64_t u;
+        memcpy(&u, &v, sizeof(u));
+        for (int shift = 56; shift >= 0; shift -= 8)
+            data.push_back((uint8_t)(u >> shift));
+    }
+
+    void writeString(const std::string &s)
+    {
+        writeInt((int32_t)s.size());
+        data.insert(data.end(), s.begin(), s.end());
+    }
+
+    uint8_t readUByte()
+    {
+        need(1);
+        return data[pos++];
+    }
+
+    int32_t readInt()
+    {
+        need(4);
+        uint32_t u = 0;
+        for (int i = 0; i < 4; i++)
+            u = (u << 8) | data[pos++];
+        return (int32_t)u;
+    }
+
+    double readDouble()
+    {
+        need(8);
+        uint64_t u = 0;
+        for (int i = 0; i < 8; i++)
+            u = (u << 8) | data[pos++];
+        double v;
+        memcpy(&v, &u, sizeof(v));
+        return v;
+    }
+
+    std::string readString()
+    {
+        int32_t n = readInt();
+        need((size_t)n);
+        std::string s((const char *)&data[pos], (size_t)n);
+        pos += (size_t)n;
+        return s;
+    }
+
+    // Reads a typed value and returns it as double (int and double types)
+    double readTypedNumber()
+    {
+        uint8_t type = readUByte();
+        switch (type)
+        {
+        case TYPE_INTEGER:
+            return readInt();
+        case TYPE_DOUBLE:
+            return readDouble();
+        case TYPE_UBYTE:
+        case TYPE_BYTE:
+            return readUByte();
+        default:
+            throw std::runtime_error("TraCI: unexpected value type " + std::to_string(type));
+        }
+    }
+
+    void skip(size_t n)
+    {
+        need(n);
+        pos += n;
+    }
+
+    size_t position() const { return pos; }
+    bool atEnd() const { return pos >= data.size(); }
+
+    std::vector<uint8_t> data;
+
+private:
+    void need(size_t n)
+    {
+        if (pos + n > data.size())
+            throw std::runtime_error("TraCI: truncated message");
+    }
+
+    size_t pos = 0;
+};
+
+class Client
+{
+public:
+    ~Client()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    // SUMO may still be starting up, so retry for a while
+    void connect(const std::string &host, int port, int retries = 20)
+    {
+        for (int attempt = 0; attempt <= retries; attempt++)
+        {
+            addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo *result = nullptr;
+            if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) == 0)
+            {
+                fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+                if (fd >= 0 && ::connect(fd, result->ai_addr, result->ai_addrlen) == 0)
+                {
+                    freeaddrinfo(result);
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    return;
+                }
+                if (fd >= 0)
+                    ::close(fd);
+                fd = -1;
+                freeaddrinfo(result);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+        throw std::runtime_error("TraCI: could not connect to " + host + ":" + std::to_string(port));
+    }
+
+    int getVersion(std::string &description)
+    {
+        Buffer request;
+        appendCommand(request, CMD_GETVERSION, Buffer());
+        Buffer response = roundTrip(request);
+        checkStatus(response, CMD_GETVERSION);
+        readCommandHeader(response);
+        int api = response.readInt();
+        description = response.readString();
+        return api;
+    }
+
+    // One get command per object; values come back in the same order
+    std::vector<double> getNumbers(uint8_t domain, uint8_t variable, const std::vector<std::string> &ids)
+    {
+        Buffer request;
+        for (const auto &id : ids)
+        {
+            Buffer content;
+            content.writeUByte(variable);
+            content.writeString(id);
+            appendCommand(request, domain, content);
+        }
+
+        Buffer response = roundTrip(request);
+        std::vector<double> values;
+        values.reserve(ids.size());
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            checkStatus(response, domain);
+            readCommandHeader(response);
+            response.readUByte();  // variable
+            response.readString(); // object id
+            values.push_back(response.readTypedNumber());
+        }
+        return values;
+    }
+
+    double getSimNumber(uint8_t variable)
+    {
+        return getNumbers(CMD_GET_SIM_VARIABLE, variable, {""})[0];
+    }
+
+    // Set the signal state string and advance the simulation in one message
+    void setStateAndStep(const std::string &tlsId, const std::string &state, double targetTime)
+    {
+        Buffer request;
+        Buffer set;
+        set.writeUByte(TL_RED_YELLOW_GREEN_STATE);
+        set.writeString(tlsId);
+        set.writeUByte(TYPE_STRING);
+        set.writeString(state);
+        appendCommand(request, CMD_SET_TL_VARIABLE, set);
+
+        Buffer step;
+        step.writeDouble(targetTime);
+        appendCommand(request, CMD_SIMSTEP, step);
+
+        Buffer response = roundTrip(request);
+        checkStatus(response, CMD_SET_TL_VARIABLE);
+        checkStatus(response, CMD_SIMSTEP);
+        int subscriptions = response.readInt();
+        if (subscriptions != 0)
+            throw std::runtime_error("TraCI: unexpected subscription results");
+    }
+
+    void close()
+    {
+        if (fd < 0)
+            return;
+        Buffer request;
+        appendCommand(request, CMD_CLOSE, Buffer());
+        try
+        {
+            Buffer response = roundTrip(request);
+            checkStatus(response, CMD_CLOSE);
+        }
+        catch (const std::exception &)
+        {
+        }
+        ::close(fd);
+        fd = -1;
+    }
+
+private:
+    static void appendCommand(Buffer &out, uint8_t command, const Buffer &content)
+    {
+        size_t length = content.data.size() + 2;
+        if (length <= 255)
+        {
+            out.writeUByte((uint8_t)length);
+        }
+        else
+        {
+            out.writeUByte(0);
+            out.writeInt((int32_t)(length + 4));
+        }
+        out.writeUByte(command);
+        out.data.insert(out.data.end(), content.data.begin(), content.data.end());
+    }
+
+    static void readCommandHeader(Buffer &in)
+    {
+        if (in.readUByte() == 0)
+            in.readInt();
+        in.readUByte(); // response command id
+    }
+
+    static void checkStatus(Buffer &in, uint8_t command)
+    {
+        readCommandHeader(in);
+        uint8_t result = in.readUByte();
+        std::string description = in.readString();
+        if (result != RTYPE_OK)
+        {
+            throw std::runtime_error("TraCI command 0x" + toHex(command) + " failed: " + description);
+        }
+    }
+
+    static std::string toHex(uint8_t v)
+    {
+        const char *digits = "0123456789abcdef";
+        return std::string{digits[v >> 4], digits[v & 15]};
+    }
+
+    Buffer roundTrip(const Buffer &request)
+    {
+        Buffer framed;
+        framed.writeInt((int32_t)(request.data.size() + 4));
+        framed.data.insert(framed.data.end(), request.data.begin(), request.data.end());
+        sendAll(framed.data.data(), framed.data.size());
+
+        uint8_t header[4];
+        recvAll(header, 4);
+        uint32_t total = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | header[3];
+        if (total < 4)
+            throw std::runtime_error("TraCI: bad message length");
+        Buffer response;
+        response.data.resize(total - 4);
+        recvAll(response.data.data(), response.data.size());
+        return response;
+    }
+
+    void sendAll(const uint8_t *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = ::send(fd, data, size, 0);
+            if (n <= 0)
+                throw std::runtime_error("TraCI: connection lost while sending");
+            data += n;
+            size -= (size_t)n;
+        }
+    }
+
+    void recvAll(uint8_t *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = ::recv(fd, data, size, 0);
+            if (n <= 0)
+                throw std::runtime_error("TraCI: connection lost while receiving");
+            data += n;
+            size -= (size_t)n;
+        }
+    }
+
+    int fd = -1;
+};
+} // namespace traci
+
+#endif // TRACI_CLIENT_H